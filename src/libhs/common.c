@@ -14,6 +14,9 @@
 static hs_log_handler_func *log_handler = hs_log_default_handler;
 static void *log_handler_udata;
 
+hs_trace_handler_func *_hs_trace_handler;
+void *_hs_trace_handler_udata;
+
 static _HS_THREAD_LOCAL hs_error_code error_masks[32];
 static _HS_THREAD_LOCAL unsigned int error_masks_count;
 
@@ -55,6 +58,12 @@ void hs_log_set_handler(hs_log_handler_func *f, void *udata)
     log_handler_udata = udata;
 }
 
+void hs_trace_set_handler(hs_trace_handler_func *f, void *udata)
+{
+    _hs_trace_handler = f;
+    _hs_trace_handler_udata = udata;
+}
+
 void hs_log_default_handler(hs_log_level level, int err, const char *msg, void *udata)
 {
     _HS_UNUSED(err);
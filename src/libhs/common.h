@@ -138,6 +138,7 @@ typedef enum hs_error_code {
 } hs_error_code;
 
 typedef void hs_log_handler_func(hs_log_level level, int err, const char *msg, void *udata);
+typedef void hs_trace_handler_func(const char *name, bool begin, void *udata);
 
 /**
  * @{
@@ -212,6 +213,28 @@ void hs_log(hs_log_level level, const char *fmt, ...) HS_PRINTF_FORMAT(2, 3);
 
 /** @} */
 
+/**
+ * @{
+ * @name Trace Functions
+ */
+
+/**
+ * @ingroup misc
+ * @brief Change the trace handler function.
+ *
+ * The trace handler is called when libhs starts (begin is true) and finishes (begin is
+ * false) a potentially slow operation, such as device enumeration. Use it to measure where
+ * time goes, for example by writing profiling spans. Tracing is disabled by default.
+ *
+ * The handler can be called from any thread that uses libhs.
+ *
+ * @param f     New trace handler, or NULL to disable tracing.
+ * @param udata Pointer to user-defined data for the handler.
+ */
+void hs_trace_set_handler(hs_trace_handler_func *f, void *udata);
+
+/** @} */
+
 /**
  * @{
  * @name Error Functions
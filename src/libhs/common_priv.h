@@ -36,6 +36,20 @@
 
 #define _HS_UNUSED(arg) ((void)(arg))
 
+extern hs_trace_handler_func *_hs_trace_handler;
+extern void *_hs_trace_handler_udata;
+
+#define _HS_TRACE_BEGIN(name) \
+    do { \
+        if (_hs_trace_handler) \
+            (*_hs_trace_handler)((name), true, _hs_trace_handler_udata); \
+    } while (false)
+#define _HS_TRACE_END(name) \
+    do { \
+        if (_hs_trace_handler) \
+            (*_hs_trace_handler)((name), false, _hs_trace_handler_udata); \
+    } while (false)
+
 #define _HS_COUNTOF(a) (sizeof(a) / sizeof(*(a)))
 
 #define _HS_ALIGN_SIZE(size, align) (((size) + (align) - 1) / (align) * (align))
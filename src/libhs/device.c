@@ -105,6 +105,36 @@ int hs_port_open(hs_device *dev, hs_port_mode mode, hs_port **rport)
     return 0;
 }
 
+int hs_port_open_serial_path(const char *path, hs_port_mode mode, hs_port **rport)
+{
+    hs_device *dev;
+    int r;
+
+    assert(path);
+    assert(rport);
+
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    dev->refcount = 1;
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->key = strdup(path);
+    dev->location = strdup("");
+    dev->path = strdup(path);
+    if (!dev->key || !dev->location || !dev->path) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    // The port keeps its own reference to the device
+    r = hs_port_open(dev, mode, rport);
+
+cleanup:
+    hs_device_unref(dev);
+    return r;
+}
+
 void hs_port_close(hs_port *port)
 {
     if (!port)
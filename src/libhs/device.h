@@ -202,6 +202,19 @@ void hs_device_unref(hs_device *dev);
  * @return This function returns 0 on success, or a negative @ref hs_error_code value.
  */
 int hs_port_open(hs_device *dev, hs_port_mode mode, hs_port **rport);
+/**
+ * @ingroup device
+ * @brief Open a serial device from its path, without going through a monitor.
+ *
+ * This is useful for devices that cannot be enumerated, such as pseudo-terminals. The
+ * device object attached to the handle has no USB information and an empty location.
+ *
+ * @param      path  Serial device node path.
+ * @param      mode  Open device for read / write or both.
+ * @param[out] rport Device handle, the value is changed only if the function succeeds.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+int hs_port_open_serial_path(const char *path, hs_port_mode mode, hs_port **rport);
 /**
  * @ingroup device
  * @brief Close a device, and free all used resources.
@@ -111,7 +111,8 @@ restart:
             goto error;
         }
         r = ioctl(port->u.file.fd, TIOCMBIS, &modem_bits);
-        if (r < 0) {
+        // Pseudo-terminals (and some drivers) don't support modem control lines
+        if (r < 0 && errno != ENOTTY && errno != EINVAL) {
             r = hs_error(HS_ERROR_SYSTEM, "ioctl(TIOCMBIS, TIOCM_DTR) failed on '%s': %s",
                          dev->path, strerror(errno));
             goto error;
@@ -48,6 +48,19 @@ struct hs_monitor;
  */
 typedef int hs_enumerate_func(struct hs_device *dev, void *udata);
 
+/**
+ * @ingroup monitor
+ * @brief Device monitor statistics.
+ *
+ * @sa hs_monitor_get_stats()
+ */
+typedef struct hs_monitor_stats {
+    /** Number of times the OS dropped device notifications (Linux netlink overflow). */
+    uint64_t overflows;
+    /** Number of device events synthesized by the resynchronizations following overflows. */
+    uint64_t resync_events;
+} hs_monitor_stats;
+
 /**
  * @{
  * @name Enumeration Functions
@@ -150,6 +163,10 @@ hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor);
  * on Windows). This descriptors becomes ready (POLLIN) when there are notifications, you can then
  * call hs_monitor_refresh() to process them.
  *
+ * On Linux, the netlink socket receive buffer is enlarged to 4 MiB so that bursts of events
+ * (e.g. many boards resetting at once) do not overflow it. Set the LIBHS_UDEV_BUFFER_SIZE
+ * environment variable to a size in bytes to change it.
+ *
  * @param monitor Device monitor.
  * @return This function returns 0 on success, or a negative @ref hs_error_code value.
  */
@@ -171,6 +188,10 @@ void hs_monitor_stop(hs_monitor *monitor);
  *
  * This function is non-blocking.
  *
+ * If the OS reports that notifications were dropped, the monitor enumerates devices again
+ * once the pending events are processed, and calls the callback for each device that
+ * appeared or disappeared in the meantime.
+ *
  * @param monitor Device monitor.
  * @param f       Callback to process each device event, or NULL.
  * @param udata   Pointer to user-defined arbitrary data for the callback.
@@ -199,6 +220,17 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata);
  */
 int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata);
 
+/**
+ * @ingroup monitor
+ * @brief Get device monitor statistics.
+ *
+ * Counters are cumulative and are not reset when the monitor is stopped.
+ *
+ * @param monitor Device monitor.
+ * @param[out] rstats Statistics structure to fill.
+ */
+void hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats);
+
 HS_END_C
 
 #endif
@@ -449,6 +449,8 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
     kern_return_t kret;
     int r;
 
+    _HS_TRACE_BEGIN("hs_enumerate");
+
     r = _hs_match_helper_init(&match_helper, matches, count);
     if (r < 0)
         goto cleanup;
@@ -477,6 +479,7 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
 
     r = 0;
 cleanup:
+    _HS_TRACE_END("hs_enumerate");
     if (it) {
         clear_iterator(it);
         IOObjectRelease(it);
@@ -676,6 +679,8 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
         return 0;
     assert(kev.filter == EVFILT_MACHPORT);
 
+    _HS_TRACE_BEGIN("hs_monitor_refresh");
+
     monitor->callback = f;
     monitor->callback_udata = udata;
 
@@ -707,6 +712,7 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
         }
     }
 
+    _HS_TRACE_END("hs_monitor_refresh");
     return r;
 }
 
@@ -714,3 +720,12 @@ int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     return _hs_monitor_list(&monitor->devices, f, udata);
 }
+
+void hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    // Notifications are not dropped here, or at least we cannot tell
+    memset(rstats, 0, sizeof(*rstats));
+}
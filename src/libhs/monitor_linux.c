@@ -27,6 +27,8 @@ struct hs_monitor {
 
     struct udev_monitor *udev_mon;
     int wait_fd;
+
+    hs_monitor_stats stats;
 };
 
 struct device_subsystem {
@@ -46,6 +48,9 @@ static struct device_subsystem device_subsystems[] = {
     {NULL}
 };
 
+// Big enough for a few hundred boards resetting at once, the kernel default is much smaller
+#define DEFAULT_UDEV_BUFFER_SIZE (4 * 1024 * 1024)
+
 static pthread_mutex_t udev_init_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct udev *udev;
 static int common_eventfd = -1;
@@ -498,7 +503,9 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
     ctx.f = f;
     ctx.udata = udata;
 
+    _HS_TRACE_BEGIN("hs_enumerate");
     r = enumerate(&match_helper, enumerate_enumerate_callback, &ctx);
+    _HS_TRACE_END("hs_enumerate");
 
     _hs_match_helper_release(&match_helper);
     return r;
@@ -595,7 +602,21 @@ int hs_monitor_start(hs_monitor *monitor)
         goto error;
     }
 
+    {
+        int buffer_size = DEFAULT_UDEV_BUFFER_SIZE;
+
+        if (getenv("LIBHS_UDEV_BUFFER_SIZE"))
+            buffer_size = (int)strtol(getenv("LIBHS_UDEV_BUFFER_SIZE"), NULL, 10);
+
+        /* This may fail without CAP_NET_ADMIN if the size exceeds net.core.rmem_max, in
+           which case the kernel caps it. Overflows are dealt with anyway. */
+        if (buffer_size > 0 && udev_monitor_set_receive_buffer_size(monitor->udev_mon, buffer_size) < 0)
+            hs_log(HS_LOG_DEBUG, "Failed to set udev monitor receive buffer to %d bytes", buffer_size);
+    }
+
+    _HS_TRACE_BEGIN("hs_enumerate");
     r = enumerate(&monitor->match_helper, monitor_enumerate_callback, monitor);
+    _HS_TRACE_END("hs_enumerate");
     if (r < 0)
         goto error;
 
@@ -630,18 +651,133 @@ hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
     return monitor->wait_fd;
 }
 
+static bool is_same_device(const hs_device *dev1, const hs_device *dev2)
+{
+    /* The device node can be reused by another device (e.g. a board that rebooted to its
+       bootloader), so don't trust the key alone. */
+    return strcmp(dev1->key, dev2->key) == 0 && dev1->iface_number == dev2->iface_number &&
+           dev1->type == dev2->type && dev1->vid == dev2->vid && dev1->pid == dev2->pid &&
+           strcmp(dev1->path, dev2->path) == 0 &&
+           !!dev1->serial_number_string == !!dev2->serial_number_string &&
+           (!dev1->serial_number_string ||
+            strcmp(dev1->serial_number_string, dev2->serial_number_string) == 0);
+}
+
+static hs_device *find_same_device(_hs_htable *devices, const hs_device *dev)
+{
+    _hs_htable_foreach_hash(cur, devices, _hs_htable_hash_str(dev->key)) {
+        hs_device *dev2 = _hs_container_of(cur, hs_device, hnode);
+
+        if (is_same_device(dev, dev2))
+            return dev2;
+    }
+
+    return NULL;
+}
+
+static int resync_enumerate_callback(hs_device *dev, void *udata)
+{
+    _hs_htable *devices = (_hs_htable *)udata;
+
+    if (!find_same_device(devices, dev)) {
+        hs_device_ref(dev);
+        _hs_htable_add(devices, _hs_htable_hash_str(dev->key), &dev->hnode);
+    }
+
+    return 0;
+}
+
+/* Events were dropped, diff a fresh enumeration against the device list and fire the
+   missing events. This is much cheaper than restarting the monitor, and unchanged devices
+   keep their hs_device objects (and everything attached to them upstream). */
+static int resync_devices(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    _hs_htable devices = {0};
+    int r;
+
+    hs_log(HS_LOG_WARNING, "Device notifications were dropped, resynchronizing device list");
+
+    _HS_TRACE_BEGIN("hs_monitor_resync");
+
+    r = _hs_htable_init(&devices, 64);
+    if (r < 0)
+        goto cleanup;
+
+    r = enumerate(&monitor->match_helper, resync_enumerate_callback, &devices);
+    if (r < 0)
+        goto cleanup;
+
+    // Only the current node is removed, so this is safe to do inside the loop
+    _hs_htable_foreach(cur, &monitor->devices) {
+        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+
+        if (find_same_device(&devices, dev))
+            continue;
+
+        dev->status = HS_DEVICE_STATUS_DISCONNECTED;
+        hs_log(HS_LOG_DEBUG, "Remove device '%s' (resync)", dev->key);
+        monitor->stats.resync_events++;
+
+        if (f)
+            (*f)(dev, udata);
+
+        _hs_htable_remove(&dev->hnode);
+        hs_device_unref(dev);
+    }
+
+    _hs_htable_foreach(cur, &devices) {
+        hs_device *dev = _hs_container_of(cur, hs_device, hnode);
+
+        _hs_htable_remove(&dev->hnode);
+        if (find_same_device(&monitor->devices, dev)) {
+            hs_device_unref(dev);
+            continue;
+        }
+
+        monitor->stats.resync_events++;
+        r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+        hs_device_unref(dev);
+        if (r)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    if (devices.heads) {
+        _hs_monitor_clear_devices(&devices);
+        _hs_htable_release(&devices);
+    }
+    _HS_TRACE_END("hs_monitor_resync");
+    return r;
+}
+
 int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     assert(monitor);
 
     struct udev_device *udev_dev;
+    bool overflow = false;
     int r;
 
     if (!monitor->udev_mon)
         return 0;
 
-    errno = 0;
-    while ((udev_dev = udev_monitor_receive_device(monitor->udev_mon))) {
+    _HS_TRACE_BEGIN("hs_monitor_refresh");
+
+    for (;;) {
+        errno = 0;
+        udev_dev = udev_monitor_receive_device(monitor->udev_mon);
+        if (!udev_dev) {
+            /* The kernel reports ENOBUFS once when the socket buffer overflows, the queued
+               events are still valid so process them before we resynchronize. */
+            if (errno == ENOBUFS) {
+                monitor->stats.overflows++;
+                overflow = true;
+                continue;
+            }
+            break;
+        }
+
         const char *action = udev_device_get_action(udev_dev);
 
         r = 0;
@@ -661,17 +797,34 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
         }
         udev_device_unref(udev_dev);
         if (r)
-            return r;
+            goto cleanup;
+    }
+    if (errno == ENOMEM) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
 
-        errno = 0;
+    if (overflow) {
+        r = resync_devices(monitor, f, udata);
+        if (r)
+            goto cleanup;
     }
-    if (errno == ENOMEM)
-        return hs_error(HS_ERROR_MEMORY, NULL);
 
-    return 0;
+    r = 0;
+cleanup:
+    _HS_TRACE_END("hs_monitor_refresh");
+    return r;
 }
 
 int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     return _hs_monitor_list(&monitor->devices, f, udata);
 }
+
+void hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    *rstats = monitor->stats;
+}
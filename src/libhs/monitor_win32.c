@@ -1116,7 +1116,9 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
     ctx.f = f;
     ctx.udata = udata;
 
+    _HS_TRACE_BEGIN("hs_enumerate");
     r = enumerate(&match_helper, enumerate_enumerate_callback, &ctx);
+    _HS_TRACE_END("hs_enumerate");
 
     _hs_match_helper_release(&match_helper);
     return r;
@@ -1409,7 +1411,9 @@ int hs_monitor_start(hs_monitor *monitor)
     }
     ResetEvent(monitor->thread_event);
 
+    _HS_TRACE_BEGIN("hs_enumerate");
     r = enumerate(&monitor->match_helper, monitor_enumerate_callback, monitor);
+    _HS_TRACE_END("hs_enumerate");
     if (r < 0)
         goto error;
 
@@ -1477,6 +1481,8 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
     if (!monitor->thread)
         return 0;
 
+    _HS_TRACE_BEGIN("hs_monitor_refresh");
+
     if (!monitor->refresh_events.count) {
         /* We don't want to keep the lock for too long, so move all device events to our
            own array and let the background thread work and process Win32 events. */
@@ -1520,6 +1526,7 @@ cleanup:
     if (!monitor->refresh_events.count && !monitor->events.count)
         ResetEvent(monitor->thread_event);
     LeaveCriticalSection(&monitor->events_lock);
+    _HS_TRACE_END("hs_monitor_refresh");
     return r;
 }
 
@@ -1527,3 +1534,12 @@ int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     return _hs_monitor_list(&monitor->devices, f, udata);
 }
+
+void hs_monitor_get_stats(const hs_monitor *monitor, hs_monitor_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    // Notifications are not dropped here, or at least we cannot tell
+    memset(rstats, 0, sizeof(*rstats));
+}
@@ -9,17 +9,29 @@
    See the LICENSE file for more details. */
 
 #include "common_priv.h"
-#ifndef _WIN32
+#include <ctype.h>
+#ifdef _WIN32
+    #include <windows.h>
+    #include <direct.h>
+    #include <fcntl.h>
+    #include <io.h>
+    #include <sys/stat.h>
+#else
+    #include <fcntl.h>
     #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 #include "../libhs/device.h"
 #include "board_priv.h"
 #include "class_priv.h"
 #include "firmware.h"
+#include "ini.h"
+#include "metrics.h"
 #include "monitor.h"
 #include "system.h"
 #include "task.h"
 #include "timer.h"
+#include "trace.h"
 
 static const char *capability_names[] = {
     "unique",
@@ -32,10 +44,71 @@ static const char *capability_names[] = {
 
 #ifdef _WIN32
     #define MANUAL_REBOOT_DELAY 15000
+    // Removal notifications can take several seconds to come through on Windows
+    #define REBOOT_DISCONNECT_DELAY 5000
 #else
     #define MANUAL_REBOOT_DELAY 8000
+    // Boards that accept a reboot request drop off the bus well within this delay
+    #define REBOOT_DISCONNECT_DELAY 1000
 #endif
 #define FINAL_TASK_TIMEOUT 8000
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+#define CAPTURE_POLL_TIMEOUT 100
+#define CAPTURE_READ_SIZE 4096
+// Bytes read per board and per poll, other boards and users of ifaces_lock get a turn
+#define CAPTURE_READ_BUDGET (64 * 1024)
+
+struct model_cache_entry {
+    char *serial_number;
+    ty_model model;
+    // Set when this process learns the model, it wins over the file until saved
+    bool changed;
+    // Bumped on each change, the save only clears changed if nothing happened meanwhile
+    unsigned int generation;
+    unsigned int written_generation;
+};
+typedef _HS_ARRAY(struct model_cache_entry) model_cache_entry_array;
+
+// Disabled until ty_board_load_model_cache() is called
+static struct {
+    char *filename;
+    ty_mutex mutex;
+    model_cache_entry_array entries;
+
+    // Saves happen in this thread, away from the monitor callbacks
+    ty_cond cond;
+    ty_thread thread;
+    bool thread_running;
+    bool dirty;
+    bool stop;
+} model_cache;
+
+// Boards with capture enabled, see ty_board_set_capture()
+static struct {
+    unsigned int init;
+    ty_mutex mutex;
+    bool running;
+    _HS_ARRAY(ty_board *) boards;
+} capture_reader;
+
+struct usb_slot {
+    char *key;
+    unsigned int count;
+};
+typedef _HS_ARRAY(struct usb_slot) usb_slot_array;
+
+// Disabled until ty_board_set_usb_limits() is called
+static struct {
+    bool init;
+    ty_mutex mutex;
+    ty_cond cond;
+
+    unsigned int root_port_limit;
+    unsigned int hub_limit;
+
+    usb_slot_array root_ports;
+    usb_slot_array hubs;
+} usb_slots;
 
 const char *ty_board_capability_get_name(ty_board_capability cap)
 {
@@ -57,6 +130,8 @@ void ty_board_unref(ty_board *board)
         if (_ty_refcount_decrease(&board->refcount))
             return;
 
+        ty_board_snapshot_unref(board->snapshot);
+
         if (board->tag != board->id)
             free(board->tag);
         free(board->id);
@@ -65,7 +140,10 @@ void ty_board_unref(ty_board *board)
         free(board->description);
 
         ty_mutex_release(&board->ifaces_lock);
+        ty_mutex_release(&board->snapshot_lock);
 
+        ty_board_interface_close(board->capture_iface);
+        free(board->capture_buf);
         for (size_t i = 0; i < board->ifaces.count; i++) {
             ty_board_interface *iface = board->ifaces.values[i];
             ty_board_interface_unref(iface);
@@ -76,35 +154,251 @@ void ty_board_unref(ty_board *board)
     free(board);
 }
 
-struct board_id_part {
-    const char *ptr;
-    size_t len;
+struct selector_term {
+    bool negate;
+    // Whole term, custom tags are compared to this
+    const char *tag;
+    // The term is not valid selector syntax, only a custom tag can match it
+    bool tag_only;
+
+    const char *serial;
+    bool serial_range;
+    uint64_t serial_min;
+    uint64_t serial_max;
+
+    const char *family;
+    // Bit i is set if ty_models[i] matches the family part
+    uint64_t family_models;
+
+    const char *location;
+    bool location_glob;
 };
 
-static void parse_board_id(const char *id, const char *delimiters, struct board_id_part parts[])
+struct ty_board_selector {
+    char *expr;
+
+    // Both are copies of expr, cut at commas (tags) or at every delimiter (parts)
+    char *tags;
+    char *parts;
+
+    struct selector_term *terms;
+    unsigned int terms_count;
+    bool has_positive;
+};
+
+static bool match_glob(const char *pattern, const char *str, size_t len)
 {
-    size_t part_offset = 0;
-    size_t delim_offset = 0;
+    const char *star = NULL;
+    size_t star_offset = 0;
     size_t i = 0;
-    do {
-        const char *d = strchr(delimiters + delim_offset, id[i]);
-        if (d || !id[i]) {
-            if (i - part_offset) {
-                parts[delim_offset].ptr = id + part_offset;
-                parts[delim_offset].len = i - part_offset;
-            }
-            part_offset = i + 1;
-            delim_offset = (size_t)(d - delimiters + 1);
+
+    while (i < len) {
+        if (*pattern == '*') {
+            star = ++pattern;
+            star_offset = i;
+        } else if (*pattern && (*pattern == '?' || *pattern == str[i])) {
+            pattern++;
+            i++;
+        } else if (star) {
+            pattern = star;
+            i = ++star_offset;
+        } else {
+            return false;
         }
-    } while (id[i++]);
+    }
+    while (*pattern == '*')
+        pattern++;
+
+    return !*pattern;
 }
 
-static bool compare_board_id_parts(const struct board_id_part *part1,
-                                   const struct board_id_part *part2)
+static bool match_model_family(const char *family, const char *name)
 {
-    if (!part1->ptr || !part2->ptr)
+    if (match_glob(family, name, strlen(name)))
         return true;
-    return part1->len == part2->len && memcmp(part1->ptr, part2->ptr, part1->len) == 0;
+
+    /* Model names are like 'Teensy 3.6', so 'Teensy 3' matches all Teensy 3.x boards
+       and 'Teensy' matches every Teensy. */
+    size_t len = strlen(family);
+    return !strncmp(name, family, len) && !isalnum((unsigned char)name[len]);
+}
+
+static int parse_serial_range(const char *str, struct selector_term *term)
+{
+    const char *dots = strstr(str, "..");
+    char *end;
+
+    term->serial_min = 0;
+    term->serial_max = UINT64_MAX;
+
+    if (dots != str) {
+        errno = 0;
+        term->serial_min = strtoull(str, &end, 10);
+        if (errno || end != dots)
+            goto error;
+    }
+    if (dots[2]) {
+        errno = 0;
+        term->serial_max = strtoull(dots + 2, &end, 10);
+        if (errno || *end)
+            goto error;
+    }
+    if (term->serial_min > term->serial_max)
+        goto error;
+
+    term->serial_range = true;
+    return 0;
+
+error:
+    return ty_error(TY_ERROR_PARSE, "Invalid serial number range '%s'", str);
+}
+
+/* Terms use the usual tag syntax ([serial][-model][@location]), the parts are cut in
+   place. Only the first '-' before '@' is a delimiter, locations often contain '-'. */
+static int parse_selector_term(char *str, struct selector_term *term)
+{
+    char *ptr;
+    int r;
+
+    if (*str == '!') {
+        term->negate = true;
+        str++;
+    }
+    if (!*str)
+        return ty_error(TY_ERROR_PARSE, "Empty board selector term");
+
+    ptr = strchr(str, '@');
+    if (ptr) {
+        *ptr = 0;
+        term->location = ptr[1] ? ptr + 1 : NULL;
+    }
+    ptr = strchr(str, '-');
+    if (ptr) {
+        *ptr = 0;
+        term->family = ptr[1] ? ptr + 1 : NULL;
+    }
+    term->serial = str[0] ? str : NULL;
+
+    if (term->serial && strstr(term->serial, "..")) {
+        r = parse_serial_range(term->serial, term);
+        if (r < 0)
+            return r;
+    }
+    if (term->family) {
+        for (unsigned int i = 0; i < ty_models_count && i < 64; i++) {
+            if (match_model_family(term->family, ty_models[i].name))
+                term->family_models |= (uint64_t)1 << i;
+        }
+    }
+    if (term->location)
+        term->location_glob = strpbrk(term->location, "*?") != NULL;
+
+    return 0;
+}
+
+/* Custom tags can be anything (e.g. 'rig..1'), so terms that don't parse are kept as
+   literal tags instead of failing the whole selector. Empty terms are still errors. */
+static int parse_selector_term_or_tag(char *str, const char *tag, struct selector_term *term)
+{
+    bool negate = (*str == '!');
+    int r;
+
+    if (!str[negate])
+        return ty_error(TY_ERROR_PARSE, "Empty board selector term");
+
+    ty_error_mask(TY_ERROR_PARSE);
+    r = parse_selector_term(str, term);
+    ty_error_unmask();
+    if (r == TY_ERROR_PARSE) {
+        memset(term, 0, sizeof(*term));
+        term->negate = negate;
+        term->tag_only = true;
+        r = 0;
+    }
+    term->tag = tag;
+
+    return r;
+}
+
+int ty_board_selector_new(const char *expr, ty_board_selector **rsel)
+{
+    assert(expr);
+    assert(rsel);
+
+    ty_board_selector *sel;
+    unsigned int terms_count;
+    char *term_ptr;
+    int r;
+
+    sel = calloc(1, sizeof(*sel));
+    if (!sel) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    sel->expr = strdup(expr);
+    sel->tags = strdup(expr);
+    sel->parts = strdup(expr);
+    if (!sel->expr || !sel->tags || !sel->parts) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    terms_count = 1;
+    for (const char *ptr = expr; *ptr; ptr++)
+        terms_count += (*ptr == ',');
+    sel->terms = calloc(terms_count, sizeof(*sel->terms));
+    if (!sel->terms) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    term_ptr = sel->parts;
+    for (unsigned int i = 0; i < terms_count; i++) {
+        struct selector_term *term = &sel->terms[i];
+        char *next = strchr(term_ptr, ',');
+
+        if (next) {
+            *next = 0;
+            sel->tags[next - sel->parts] = 0;
+        }
+
+        r = parse_selector_term_or_tag(term_ptr,
+                                       sel->tags + (term_ptr - sel->parts) + (*term_ptr == '!'),
+                                       term);
+        if (r < 0)
+            goto error;
+        sel->has_positive |= !term->negate;
+
+        if (next)
+            term_ptr = next + 1;
+    }
+    sel->terms_count = terms_count;
+
+    *rsel = sel;
+    return 0;
+
+error:
+    ty_board_selector_free(sel);
+    return r;
+}
+
+void ty_board_selector_free(ty_board_selector *sel)
+{
+    if (sel) {
+        free(sel->terms);
+        free(sel->parts);
+        free(sel->tags);
+        free(sel->expr);
+    }
+
+    free(sel);
+}
+
+const char *ty_board_selector_get_string(const ty_board_selector *sel)
+{
+    assert(sel);
+    return sel->expr;
 }
 
 static int match_board_interface(ty_board_interface *iface, void *udata)
@@ -112,32 +406,125 @@ static int match_board_interface(ty_board_interface *iface, void *udata)
     return ty_compare_paths(ty_board_interface_get_path(iface), udata);
 }
 
+static bool match_selector_term(const struct selector_term *term, ty_board *board)
+{
+    if (board->tag != board->id && strcmp(term->tag, board->tag) == 0)
+        return true;
+    if (term->tag_only)
+        return false;
+
+    if (term->serial_range) {
+        if (!board->serial_numeric || board->serial_value < term->serial_min ||
+                board->serial_value > term->serial_max)
+            return false;
+    } else if (term->serial && !match_glob(term->serial, board->id, board->id_serial_len)) {
+        return false;
+    }
+    if (term->family && !(board->model < 64 && (term->family_models & ((uint64_t)1 << board->model))) &&
+            !match_glob(term->family, board->id_family, strlen(board->id_family)))
+        return false;
+    if (term->location) {
+        if (term->location_glob) {
+            if (!match_glob(term->location, board->location, strlen(board->location)))
+                return false;
+        } else if (strcmp(term->location, board->location) != 0 &&
+                   !ty_board_list_interfaces(board, match_board_interface, (void *)term->location)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool ty_board_selector_matches(const ty_board_selector *sel, ty_board *board)
+{
+    assert(board);
+
+    if (!sel)
+        return true;
+    // Custom tags may contain commas or anything else
+    if (board->tag != board->id && strcmp(sel->expr, board->tag) == 0)
+        return true;
+
+    bool match = !sel->has_positive;
+    for (unsigned int i = 0; i < sel->terms_count; i++) {
+        const struct selector_term *term = &sel->terms[i];
+
+        if (term->negate) {
+            if (match_selector_term(term, board))
+                return false;
+        } else if (!match) {
+            match = match_selector_term(term, board);
+        }
+    }
+
+    return match;
+}
+
 bool ty_board_matches_tag(ty_board *board, const char *id)
 {
     assert(board);
 
+    ty_board_selector *sel;
+    bool match;
+    int r;
+
     if (!id)
         return true;
+    // Custom tags may contain anything, including selector syntax such as '..'
     if (board->tag != board->id && strcmp(id, board->tag) == 0)
         return true;
 
-    struct board_id_part parts1[3] = {0};
-    struct board_id_part parts2[2] = {0};
+    /* Single terms are parsed on the stack, compile a selector with ty_board_selector_new()
+       to match many boards against the same expression. */
+    if (!strchr(id, ',')) {
+        struct selector_term term = {0};
+        char buf[256];
 
-    parse_board_id(id, "-@", parts1);
-    parse_board_id(board->id, "-", parts2);
+        if (strlen(id) >= sizeof(buf))
+            return false;
+        strcpy(buf, id);
 
-    if (!compare_board_id_parts(&parts1[0], &parts2[0]))
-        return false;
-    if (!compare_board_id_parts(&parts1[1], &parts2[1]))
-        return false;
-    /* The last part is necessarily NUL-terminated so we can just use regular
-       C string functions. */
-    if (parts1[2].ptr && strcmp(parts1[2].ptr, board->location) != 0 &&
-            !ty_board_list_interfaces(board, match_board_interface, (void *)parts1[2].ptr))
+        ty_error_mask(TY_ERROR_PARSE);
+        r = parse_selector_term_or_tag(buf, id + (*id == '!'), &term);
+        ty_error_unmask();
+        if (r < 0)
+            return false;
+
+        return match_selector_term(&term, board) != term.negate;
+    }
+
+    ty_error_mask(TY_ERROR_PARSE);
+    r = ty_board_selector_new(id, &sel);
+    ty_error_unmask();
+    if (r < 0)
         return false;
 
-    return true;
+    match = ty_board_selector_matches(sel, board);
+    ty_board_selector_free(sel);
+
+    return match;
+}
+
+void _ty_board_update_selector_fields(ty_board *board)
+{
+    const char *dash = strchr(board->id, '-');
+    char *end;
+
+    if (dash) {
+        board->id_serial_len = (size_t)(dash - board->id);
+        board->id_family = dash + 1;
+    } else {
+        board->id_serial_len = strlen(board->id);
+        board->id_family = board->id + board->id_serial_len;
+    }
+
+    board->serial_numeric = false;
+    if (board->serial_number && isdigit((unsigned char)board->serial_number[0])) {
+        errno = 0;
+        board->serial_value = strtoull(board->serial_number, &end, 10);
+        board->serial_numeric = !errno && !*end;
+    }
 }
 
 ty_monitor *ty_board_get_monitor(const ty_board *board)
@@ -146,6 +533,113 @@ ty_monitor *ty_board_get_monitor(const ty_board *board)
     return board->monitor;
 }
 
+static char *copy_snapshot_string(char **rptr, const char *str)
+{
+    char *copy;
+    size_t len;
+
+    if (!str)
+        return NULL;
+
+    copy = *rptr;
+    len = strlen(str) + 1;
+    memcpy(copy, str, len);
+    *rptr += len;
+
+    return copy;
+}
+
+static ty_board_snapshot *make_snapshot(const ty_board *board)
+{
+    const char *strings[] = {board->id, board->tag != board->id ? board->tag : NULL,
+                             board->location, board->serial_number, board->description};
+    ty_board_snapshot *snap;
+    size_t size;
+    char *ptr;
+
+    // One allocation for everything, strings follow the struct
+    size = sizeof(*snap);
+    for (unsigned int i = 0; i < TY_COUNTOF(strings); i++)
+        size += strings[i] ? strlen(strings[i]) + 1 : 0;
+    snap = malloc(size);
+    if (!snap) {
+        ty_error(TY_ERROR_MEMORY, NULL);
+        return NULL;
+    }
+    ptr = (char *)(snap + 1);
+
+    snap->refcount = 1;
+    snap->generation = board->snapshot ? board->snapshot->generation + 1 : 1;
+    snap->status = board->status;
+    snap->model = board->model;
+    snap->capabilities = board->capabilities;
+    snap->vid = board->vid;
+    snap->pid = board->pid;
+    snap->id = copy_snapshot_string(&ptr, board->id);
+    snap->tag = board->tag != board->id ? copy_snapshot_string(&ptr, board->tag) : snap->id;
+    snap->location = copy_snapshot_string(&ptr, board->location);
+    snap->serial_number = copy_snapshot_string(&ptr, board->serial_number);
+    snap->description = copy_snapshot_string(&ptr, board->description);
+
+    return snap;
+}
+
+/* Called by whoever changes the board, after the change. If we run out of memory the old
+   snapshot stays in place, readers get stale but coherent data. */
+void _ty_board_publish_snapshot(ty_board *board)
+{
+    ty_board_snapshot *snap, *old;
+
+    // Publishers are serialized by ifaces_lock, which also protects the fields we copy
+    ty_mutex_lock(&board->ifaces_lock);
+    snap = make_snapshot(board);
+    if (!snap) {
+        ty_mutex_unlock(&board->ifaces_lock);
+        return;
+    }
+    ty_mutex_lock(&board->snapshot_lock);
+    old = board->snapshot;
+    board->snapshot = snap;
+    ty_mutex_unlock(&board->snapshot_lock);
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    // Readers that got the old snapshot hold their own reference
+    ty_board_snapshot_unref(old);
+}
+
+/* Readers only hold snapshot_lock to take a reference, everything else happens on the
+   immutable snapshot without it. */
+ty_board_snapshot *ty_board_get_snapshot(ty_board *board)
+{
+    assert(board);
+
+    ty_board_snapshot *snap;
+
+    ty_mutex_lock(&board->snapshot_lock);
+    snap = board->snapshot;
+    assert(snap);
+    _ty_refcount_increase(&snap->refcount);
+    ty_mutex_unlock(&board->snapshot_lock);
+
+    return snap;
+}
+
+ty_board_snapshot *ty_board_snapshot_ref(ty_board_snapshot *snap)
+{
+    assert(snap);
+
+    _ty_refcount_increase(&snap->refcount);
+    return snap;
+}
+
+void ty_board_snapshot_unref(ty_board_snapshot *snap)
+{
+    if (snap && _ty_refcount_decrease(&snap->refcount))
+        return;
+
+    free(snap);
+}
+
 ty_board_status ty_board_get_status(const ty_board *board)
 {
     assert(board);
@@ -175,6 +669,8 @@ int ty_board_set_tag(ty_board *board, const char *tag)
     if (board->tag != board->id)
         free(board->tag);
     board->tag = new_tag;
+    if (board->snapshot)
+        _ty_board_publish_snapshot(board);
 
     return 0;
 }
@@ -206,15 +702,656 @@ const char *ty_board_get_description(const ty_board *board)
 void ty_board_set_model(ty_board *board, ty_model model)
 {
     assert(board);
-    assert(board->model);
+    assert(board->model);
+
+    board->model = model;
+    if (board->snapshot)
+        _ty_board_publish_snapshot(board);
+}
+
+ty_model ty_board_get_model(const ty_board *board)
+{
+    assert(board);
+    return board->model;
+}
+
+static void free_model_cache_entries(model_cache_entry_array *entries)
+{
+    for (size_t i = 0; i < entries->count; i++)
+        free(entries->values[i].serial_number);
+    _hs_array_release(entries);
+}
+
+static void free_model_cache(void)
+{
+    // Write pending changes before we go away
+    if (model_cache.thread_running) {
+        ty_mutex_lock(&model_cache.mutex);
+        model_cache.stop = true;
+        ty_cond_signal(&model_cache.cond);
+        ty_mutex_unlock(&model_cache.mutex);
+
+        ty_thread_join(&model_cache.thread);
+        model_cache.thread_running = false;
+    }
+
+    free_model_cache_entries(&model_cache.entries);
+    ty_cond_release(&model_cache.cond);
+    ty_mutex_release(&model_cache.mutex);
+    free(model_cache.filename);
+    model_cache.filename = NULL;
+}
+
+static struct model_cache_entry *find_model_cache_entry(model_cache_entry_array *entries,
+                                                        const char *serial_number)
+{
+    for (size_t i = 0; i < entries->count; i++) {
+        struct model_cache_entry *entry = &entries->values[i];
+
+        if (!strcmp(entry->serial_number, serial_number))
+            return entry;
+    }
+
+    return NULL;
+}
+
+static int set_model_cache_entry(model_cache_entry_array *entries, const char *serial_number,
+                                 ty_model model, bool changed)
+{
+    struct model_cache_entry *entry;
+    int r;
+
+    entry = find_model_cache_entry(entries, serial_number);
+    if (!entry) {
+        char *serial_copy = strdup(serial_number);
+        if (!serial_copy)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+
+        r = _hs_array_grow(entries, 1);
+        if (r < 0) {
+            free(serial_copy);
+            return ty_libhs_translate_error(r);
+        }
+        entry = &entries->values[entries->count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->serial_number = serial_copy;
+    } else if (entry->changed && !changed) {
+        // Don't let the file overwrite what we've just learnt
+        return 0;
+    }
+    entry->model = model;
+    entry->changed = changed;
+    if (changed)
+        entry->generation++;
+
+    return 0;
+}
+
+static int load_model_cache_callback(const char *section, char *key, char *value, void *udata)
+{
+    model_cache_entry_array *entries = udata;
+
+    if (!strcmp(section, "Models")) {
+        ty_model model = ty_models_find(value);
+        if (model && ty_models[model].mcu)
+            return set_model_cache_entry(entries, key, model, false);
+    }
+
+    return 0;
+}
+
+int ty_board_load_model_cache(const char *filename)
+{
+    char path[TY_PATH_MAX_SIZE];
+    int r;
+
+    if (model_cache.filename)
+        return 0;
+
+    if (!filename) {
+        if (!ty_standard_get_paths(TY_PATH_CONFIG_DIRECTORY, "TyTools/board_models.ini", &path, 1))
+            return ty_error(TY_ERROR_NOT_FOUND, "Cannot find directory for board model cache");
+        filename = path;
+    }
+
+    r = ty_mutex_init(&model_cache.mutex);
+    if (r < 0)
+        return r;
+    r = ty_cond_init(&model_cache.cond);
+    if (r < 0) {
+        ty_mutex_release(&model_cache.mutex);
+        return r;
+    }
+    model_cache.filename = strdup(filename);
+    if (!model_cache.filename) {
+        ty_cond_release(&model_cache.cond);
+        ty_mutex_release(&model_cache.mutex);
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    atexit(free_model_cache);
+
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+    r = ty_ini_walk(model_cache.filename, load_model_cache_callback, &model_cache.entries);
+    ty_error_unmask();
+    if (r < 0 && r != TY_ERROR_NOT_FOUND)
+        return r;
+
+    return 0;
+}
+
+#ifdef _WIN32
+typedef HANDLE model_cache_lock;
+#else
+typedef int model_cache_lock;
+#endif
+
+/* Other processes (e.g. parallel tycmd runs) may update the cache at the same time, hold
+   this lock (on a separate file, the cache itself gets replaced) while we merge. */
+static int lock_model_cache(const char *lock_filename, model_cache_lock *rlock)
+{
+#ifdef _WIN32
+    OVERLAPPED ov = {0};
+    HANDLE h;
+
+    h = CreateFileA(lock_filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                    NULL, OPEN_ALWAYS, 0, NULL);
+    if (h == INVALID_HANDLE_VALUE)
+        return ty_error(TY_ERROR_ACCESS, "Cannot open '%s': %s", lock_filename,
+                        ty_win32_strerror(0));
+    if (!LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov)) {
+        CloseHandle(h);
+        return ty_error(TY_ERROR_SYSTEM, "Cannot lock '%s': %s", lock_filename,
+                        ty_win32_strerror(0));
+    }
+
+    *rlock = h;
+    return 0;
+#else
+    struct flock fl = {0};
+    int fd;
+
+    fd = open(lock_filename, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return ty_error(TY_ERROR_ACCESS, "Cannot open '%s': %s", lock_filename, strerror(errno));
+
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+restart:
+    if (fcntl(fd, F_SETLKW, &fl) < 0) {
+        if (errno == EINTR)
+            goto restart;
+
+        close(fd);
+        return ty_error(TY_ERROR_SYSTEM, "Cannot lock '%s': %s", lock_filename, strerror(errno));
+    }
+
+    *rlock = fd;
+    return 0;
+#endif
+}
+
+static void unlock_model_cache(model_cache_lock lock)
+{
+#ifdef _WIN32
+    CloseHandle(lock);
+#else
+    close(lock);
+#endif
+}
+
+static FILE *create_temporary_file(char *filename)
+{
+#ifdef _WIN32
+    int fd;
+
+    if (_mktemp_s(filename, strlen(filename) + 1))
+        return NULL;
+    fd = _open(filename, _O_CREAT | _O_EXCL | _O_WRONLY | _O_TEXT, _S_IREAD | _S_IWRITE);
+    return fd >= 0 ? _fdopen(fd, "w") : NULL;
+#else
+    int fd;
+
+    fd = mkstemp(filename);
+    if (fd < 0)
+        return NULL;
+    fchmod(fd, 0644);
+    return fdopen(fd, "w");
+#endif
+}
+
+static int save_model_cache(void)
+{
+    char lock_filename[TY_PATH_MAX_SIZE + 8];
+    char tmp_filename[TY_PATH_MAX_SIZE + 8];
+    model_cache_entry_array file_entries = {0};
+    model_cache_lock lock;
+    FILE *fp = NULL;
+    bool tmp_created = false;
+    int r;
+
+    // Create the parent directory (usually the TyTools configuration directory) if needed
+    {
+        char dir[TY_PATH_MAX_SIZE];
+        size_t len = strlen(model_cache.filename);
+
+        while (len && !strchr(TY_PATH_SEPARATORS, model_cache.filename[len - 1]))
+            len--;
+        if (len > 1 && len < sizeof(dir)) {
+            memcpy(dir, model_cache.filename, len - 1);
+            dir[len - 1] = 0;
+#ifdef _WIN32
+            _mkdir(dir);
+#else
+            mkdir(dir, 0755);
+#endif
+        }
+    }
+
+    snprintf(lock_filename, sizeof(lock_filename), "%s.lock", model_cache.filename);
+    r = lock_model_cache(lock_filename, &lock);
+    if (r < 0)
+        return r;
+
+    // Pick up the entries saved by other processes since we loaded the file
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+    r = ty_ini_walk(model_cache.filename, load_model_cache_callback, &file_entries);
+    ty_error_unmask();
+    if (r < 0 && r != TY_ERROR_NOT_FOUND)
+        goto cleanup;
+    r = 0;
+
+    snprintf(tmp_filename, sizeof(tmp_filename), "%s.XXXXXX", model_cache.filename);
+    fp = create_temporary_file(tmp_filename);
+    if (!fp) {
+        r = ty_error(TY_ERROR_ACCESS, "Cannot write board model cache '%s': %s",
+                     model_cache.filename, strerror(errno));
+        goto cleanup;
+    }
+    tmp_created = true;
+
+    ty_mutex_lock(&model_cache.mutex);
+    for (size_t i = 0; i < file_entries.count && r >= 0; i++) {
+        struct model_cache_entry *entry = &file_entries.values[i];
+        r = set_model_cache_entry(&model_cache.entries, entry->serial_number, entry->model, false);
+    }
+    fprintf(fp, "[Models]\n");
+    for (size_t i = 0; i < model_cache.entries.count; i++) {
+        struct model_cache_entry *entry = &model_cache.entries.values[i];
+        fprintf(fp, "%s = %s\n", entry->serial_number, ty_models[entry->model].name);
+        entry->written_generation = entry->generation;
+    }
+    ty_mutex_unlock(&model_cache.mutex);
+    if (r < 0)
+        goto cleanup;
+
+    r = ferror(fp) ? ty_error(TY_ERROR_IO, "Failed to write board model cache '%s'",
+                              tmp_filename) : 0;
+    if (fclose(fp) && r >= 0)
+        r = ty_error(TY_ERROR_IO, "Failed to write board model cache '%s': %s", tmp_filename,
+                     strerror(errno));
+    fp = NULL;
+    if (r < 0)
+        goto cleanup;
+
+#ifdef _WIN32
+    remove(model_cache.filename);
+#endif
+    if (rename(tmp_filename, model_cache.filename) < 0) {
+        r = ty_error(TY_ERROR_ACCESS, "Cannot move board model cache to '%s': %s",
+                     model_cache.filename, strerror(errno));
+        goto cleanup;
+    }
+    tmp_created = false;
+
+    /* Models learnt while we were writing the file are not in it, these entries stay
+       changed and the next save takes care of them. */
+    ty_mutex_lock(&model_cache.mutex);
+    for (size_t i = 0; i < model_cache.entries.count; i++) {
+        struct model_cache_entry *entry = &model_cache.entries.values[i];
+        if (entry->generation == entry->written_generation)
+            entry->changed = false;
+    }
+    ty_mutex_unlock(&model_cache.mutex);
+
+    r = 0;
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (tmp_created)
+        remove(tmp_filename);
+    unlock_model_cache(lock);
+    free_model_cache_entries(&file_entries);
+    return r;
+}
+
+static int model_cache_thread(void *udata)
+{
+    TY_UNUSED(udata);
+
+    ty_mutex_lock(&model_cache.mutex);
+    while (true) {
+        while (!model_cache.dirty && !model_cache.stop)
+            ty_cond_wait(&model_cache.cond, &model_cache.mutex, -1);
+        if (!model_cache.dirty)
+            break;
+        model_cache.dirty = false;
+
+        // Errors are reported, we'll try again on the next change
+        ty_mutex_unlock(&model_cache.mutex);
+        save_model_cache();
+        ty_mutex_lock(&model_cache.mutex);
+    }
+    ty_mutex_unlock(&model_cache.mutex);
+
+    return 0;
+}
+
+/* Boards running a firmware only tell us they are a Teensy, the exact model is known
+   once we've seen them in bootloader mode. Remember it per serial number, so that we
+   can pick a compatible firmware before the reboot on the next run. */
+void _ty_board_update_model_cache(ty_board *board)
+{
+    if (!model_cache.filename || !board->serial_number ||
+            !(board->capabilities & (1 << TY_BOARD_CAPABILITY_UNIQUE)))
+        return;
+
+    ty_mutex_lock(&model_cache.mutex);
+
+    if (ty_models[board->model].mcu) {
+        struct model_cache_entry *entry = find_model_cache_entry(&model_cache.entries,
+                                                                 board->serial_number);
+
+        if ((!entry || entry->model != board->model) &&
+                set_model_cache_entry(&model_cache.entries, board->serial_number,
+                                      board->model, true) >= 0) {
+            model_cache.dirty = true;
+            if (model_cache.thread_running) {
+                ty_cond_signal(&model_cache.cond);
+            } else if (ty_thread_create(&model_cache.thread, model_cache_thread, NULL) >= 0) {
+                model_cache.thread_running = true;
+            }
+        }
+    } else if (board->model == TY_MODEL_TEENSY) {
+        struct model_cache_entry *entry = find_model_cache_entry(&model_cache.entries,
+                                                                 board->serial_number);
+
+        if (entry)
+            board->model = entry->model;
+    }
+
+    ty_mutex_unlock(&model_cache.mutex);
+}
+
+static int capture_thread(void *udata);
+
+static void start_capture(ty_board *board)
+{
+    unsigned int state = 0;
+    int r;
+
+    if (_ty_atomic_load(&capture_reader.init) != 2) {
+        if (_ty_atomic_compare_exchange(&capture_reader.init, &state, 1)) {
+            ty_mutex_init(&capture_reader.mutex);
+            _ty_atomic_store(&capture_reader.init, 2);
+        } else {
+            while (_ty_atomic_load(&capture_reader.init) != 2)
+                ty_delay(1);
+        }
+    }
+
+    ty_mutex_lock(&capture_reader.mutex);
+
+    for (size_t i = 0; i < capture_reader.boards.count; i++) {
+        if (capture_reader.boards.values[i] == board) {
+            board = NULL;
+            break;
+        }
+    }
+    if (board) {
+        r = _hs_array_push(&capture_reader.boards, board);
+        if (r < 0) {
+            ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+        ty_board_ref(board);
+    }
+
+    if (!capture_reader.running) {
+        ty_thread thread;
+
+        r = ty_thread_create(&thread, capture_thread, NULL);
+        if (r < 0)
+            goto cleanup;
+        ty_thread_detach(&thread);
+
+        capture_reader.running = true;
+    }
+
+cleanup:
+    ty_mutex_unlock(&capture_reader.mutex);
+}
+
+static void stop_capture(ty_board *board)
+{
+    if (_ty_atomic_load(&capture_reader.init) != 2)
+        return;
+
+    ty_mutex_lock(&capture_reader.mutex);
+    for (size_t i = 0; i < capture_reader.boards.count; i++) {
+        if (capture_reader.boards.values[i] == board) {
+            _hs_array_remove(&capture_reader.boards, i, 1);
+            ty_board_unref(board);
+            break;
+        }
+    }
+    ty_mutex_unlock(&capture_reader.mutex);
+}
+
+/* Call with ifaces_lock held, returns the amount of data read. This does a single read so
+   that the caller can release the lock between reads, even for chatty boards. */
+static size_t fill_capture_buffer(ty_board *board)
+{
+    char buf[CAPTURE_READ_SIZE];
+    size_t len, end, part;
+    ssize_t r;
+
+    if (!board->capture_buf || !board->capture_iface || board->capture_attached)
+        return 0;
+
+    r = (*board->capture_iface->class_vtable->serial_read)(board->capture_iface, buf,
+                                                           sizeof(buf), 0);
+    if (r < 0) {
+        // Stop polling a broken interface, the consumer will get the error
+        board->capture_attached = true;
+        return 0;
+    }
+    if (!r)
+        return 0;
+    len = (size_t)r;
+
+    // Keep the most recent output
+    if (len > CAPTURE_BUFFER_SIZE - board->capture_len) {
+        size_t drop = len - (CAPTURE_BUFFER_SIZE - board->capture_len);
+
+        board->capture_start = (board->capture_start + drop) % CAPTURE_BUFFER_SIZE;
+        board->capture_len -= drop;
+        board->capture_dropped += drop;
+    }
+
+    end = (board->capture_start + board->capture_len) % CAPTURE_BUFFER_SIZE;
+    part = TY_MIN(len, CAPTURE_BUFFER_SIZE - end);
+    memcpy(board->capture_buf + end, buf, part);
+    memcpy(board->capture_buf, buf + part, len - part);
+    board->capture_len += len;
+
+    return len;
+}
+
+// Call with ifaces_lock held
+static size_t read_capture_buffer(ty_board *board, char *buf, size_t size)
+{
+    size_t len, part;
+
+    len = TY_MIN(size, board->capture_len);
+    part = TY_MIN(len, CAPTURE_BUFFER_SIZE - board->capture_start);
+    memcpy(buf, board->capture_buf + board->capture_start, part);
+    memcpy(buf + part, board->capture_buf, len - part);
+
+    board->capture_start = (board->capture_start + len) % CAPTURE_BUFFER_SIZE;
+    board->capture_len -= len;
+
+    if (board->capture_dropped) {
+        ty_log(TY_LOG_WARNING, "Lost %" PRIu64 " bytes from board '%s' before they were read",
+               board->capture_dropped, board->tag);
+        board->capture_dropped = 0;
+    }
+
+    return len;
+}
+
+/* Boards with no consumer attached are polled from this thread, it runs as long as at
+   least one board has capture enabled. Reads are non-blocking and happen with ifaces_lock
+   held, so they cannot interleave with a consumer read. */
+static int capture_thread(void *udata)
+{
+    _HS_ARRAY(ty_board *) boards = {0};
+    // Same size as ty_descriptor_set
+    ty_board_interface *ifaces[64];
+
+    TY_UNUSED(udata);
+
+    ty_error_mask(TY_ERROR_IO);
+    ty_error_mask(TY_ERROR_MODE);
+
+    while (true) {
+        ty_descriptor_set set = {0};
+
+        ty_mutex_lock(&capture_reader.mutex);
+        if (!capture_reader.boards.count || _hs_array_grow(&boards, capture_reader.boards.count) < 0) {
+            capture_reader.running = false;
+            ty_mutex_unlock(&capture_reader.mutex);
+            break;
+        }
+        for (size_t i = 0; i < capture_reader.boards.count; i++)
+            boards.values[boards.count++] = ty_board_ref(capture_reader.boards.values[i]);
+        ty_mutex_unlock(&capture_reader.mutex);
+
+        // Our own reference keeps the descriptors valid if the board drops the interface
+        for (size_t i = 0; i < boards.count && set.count < TY_COUNTOF(ifaces); i++) {
+            ty_board *board = boards.values[i];
+
+            ty_mutex_lock(&board->ifaces_lock);
+            if (board->capture_buf && board->capture_iface && !board->capture_attached &&
+                    ty_board_interface_open(board->capture_iface) >= 0) {
+                ifaces[set.count] = board->capture_iface;
+                ty_board_interface_get_descriptors(board->capture_iface, &set, (int)i + 1);
+            }
+            ty_mutex_unlock(&board->ifaces_lock);
+        }
+
+        if (set.count && ty_poll(&set, CAPTURE_POLL_TIMEOUT) > 0) {
+            size_t total = 0;
+
+            // One read at a time per board, with ifaces_lock released in between
+            for (unsigned int j = 0; j < CAPTURE_READ_BUDGET / CAPTURE_READ_SIZE; j++) {
+                size_t len = 0;
+
+                for (size_t i = 0; i < boards.count; i++) {
+                    ty_board *board = boards.values[i];
+
+                    ty_mutex_lock(&board->ifaces_lock);
+                    len += fill_capture_buffer(board);
+                    ty_mutex_unlock(&board->ifaces_lock);
+                }
+                if (!len)
+                    break;
+                total += len;
+            }
+
+            // Don't spin on descriptors that stay signaled (e.g. hangup) without data
+            if (!total)
+                ty_delay(CAPTURE_POLL_TIMEOUT);
+        } else if (!set.count) {
+            ty_delay(CAPTURE_POLL_TIMEOUT);
+        }
+
+        for (unsigned int i = 0; i < set.count; i++)
+            ty_board_interface_close(ifaces[i]);
+        for (size_t i = 0; i < boards.count; i++)
+            ty_board_unref(boards.values[i]);
+        boards.count = 0;
+    }
+
+    ty_error_unmask();
+    ty_error_unmask();
+
+    _hs_array_release(&boards);
+    return 0;
+}
+
+void ty_board_set_capture(ty_board *board, bool capture)
+{
+    assert(board);
+
+    ty_mutex_lock(&board->ifaces_lock);
+    board->capture = capture;
+    if (capture && !board->capture_buf) {
+        // Capture still keeps the interface open if this fails
+        board->capture_buf = malloc(CAPTURE_BUFFER_SIZE);
+        if (!board->capture_buf)
+            ty_error(TY_ERROR_MEMORY, NULL);
+    } else if (!capture) {
+        free(board->capture_buf);
+        board->capture_buf = NULL;
+        board->capture_start = 0;
+        board->capture_len = 0;
+    }
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    _ty_board_update_capture(board);
+
+    if (capture) {
+        start_capture(board);
+    } else {
+        stop_capture(board);
+    }
+}
+
+bool ty_board_get_capture(const ty_board *board)
+{
+    assert(board);
 
-    board->model = model;
+    ty_mutex *lock = (ty_mutex *)&board->ifaces_lock;
+    bool capture;
+
+    ty_mutex_lock(lock);
+    capture = board->capture;
+    ty_mutex_unlock(lock);
+
+    return capture;
 }
 
-ty_model ty_board_get_model(const ty_board *board)
+void _ty_board_update_capture(ty_board *board)
 {
-    assert(board);
-    return board->model;
+    ty_board_interface *iface = NULL;
+
+    ty_mutex_lock(&board->ifaces_lock);
+
+    if (board->capture)
+        iface = board->cap2iface[TY_BOARD_CAPABILITY_SERIAL];
+
+    if (iface != board->capture_iface) {
+        ty_board_interface_close(board->capture_iface);
+        board->capture_iface = NULL;
+        // Buffer again until the consumer reads from the new interface
+        board->capture_attached = false;
+
+        // Errors are reported, we'll try again when the interface changes
+        if (iface && ty_board_interface_open(iface) >= 0)
+            board->capture_iface = iface;
+    }
+
+    ty_mutex_unlock(&board->ifaces_lock);
 }
 
 int ty_board_get_capabilities(const ty_board *board)
@@ -319,6 +1456,20 @@ ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeou
     ty_board_interface *iface;
     ssize_t r;
 
+    /* Return the output captured before we got here first, and stop the capture thread
+       from reading in our place. */
+    ty_mutex_lock(&board->ifaces_lock);
+    board->capture_attached = true;
+    if (board->capture_len) {
+        size_t len = read_capture_buffer(board, buf, size);
+
+        ty_mutex_unlock(&board->ifaces_lock);
+
+        ty_metric_add(board->serial_read_metric, (int64_t)len);
+        return (ssize_t)len;
+    }
+    ty_mutex_unlock(&board->ifaces_lock);
+
     r = ty_board_open_interface(board, TY_BOARD_CAPABILITY_SERIAL, &iface);
     if (r < 0)
         return r;
@@ -326,6 +1477,11 @@ ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeou
         return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", board->tag);
 
     r = (*iface->class_vtable->serial_read)(iface, buf, size, timeout);
+    if (r > 0) {
+        ty_metric_add(board->serial_read_metric, r);
+    } else if (r < 0) {
+        ty_metric_add(board->serial_error_metric, 1);
+    }
 
     ty_board_interface_close(iface);
     return r;
@@ -346,6 +1502,11 @@ ssize_t ty_board_serial_write(ty_board *board, const char *buf, size_t size)
         return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", board->tag);
 
     r = (*iface->class_vtable->serial_write)(iface, buf, size);
+    if (r > 0) {
+        ty_metric_add(board->serial_write_metric, r);
+    } else if (r < 0) {
+        ty_metric_add(board->serial_error_metric, 1);
+    }
 
     ty_board_interface_close(iface);
     return r;
@@ -448,6 +1609,9 @@ int ty_board_interface_open(ty_board_interface *iface)
         r = (*iface->class_vtable->open_interface)(iface);
         if (r < 0)
             goto cleanup;
+
+        if (iface->board && (iface->capabilities & (1 << TY_BOARD_CAPABILITY_SERIAL)))
+            ty_metric_add(iface->board->serial_open_metric, 1);
     }
     iface->open_count++;
 
@@ -547,26 +1711,368 @@ static void cleanup_task_board(ty_board **board_ptr)
     *board_ptr = NULL;
 }
 
-static int select_compatible_firmware(ty_board *board, ty_firmware **fws, unsigned int fws_count,
-                                      ty_firmware **rfw)
+static void free_usb_slots(void)
+{
+    for (size_t i = 0; i < usb_slots.root_ports.count; i++)
+        free(usb_slots.root_ports.values[i].key);
+    _hs_array_release(&usb_slots.root_ports);
+    for (size_t i = 0; i < usb_slots.hubs.count; i++)
+        free(usb_slots.hubs.values[i].key);
+    _hs_array_release(&usb_slots.hubs);
+
+    ty_cond_release(&usb_slots.cond);
+    ty_mutex_release(&usb_slots.mutex);
+    usb_slots.init = false;
+}
+
+int ty_board_set_usb_limits(unsigned int root_port_limit, unsigned int hub_limit)
+{
+    int r;
+
+    if (!usb_slots.init) {
+        r = ty_mutex_init(&usb_slots.mutex);
+        if (r < 0)
+            return r;
+        r = ty_cond_init(&usb_slots.cond);
+        if (r < 0) {
+            ty_mutex_release(&usb_slots.mutex);
+            return r;
+        }
+        usb_slots.init = true;
+        atexit(free_usb_slots);
+    }
+
+    ty_mutex_lock(&usb_slots.mutex);
+    usb_slots.root_port_limit = root_port_limit;
+    usb_slots.hub_limit = hub_limit;
+    ty_cond_broadcast(&usb_slots.cond);
+    ty_mutex_unlock(&usb_slots.mutex);
+
+    return 0;
+}
+
+/* Locations look like usb-<bus>-<port>[-<port>...]. The root port is the first port after
+   the bus number, and the hub is everything but the last port (the root hub itself for
+   boards plugged directly into the computer). */
+static bool parse_usb_topology(const char *location, char *root_port, char *hub, size_t size)
+{
+    const char *root_end = NULL, *hub_end = NULL;
+    unsigned int dashes = 0;
+
+    if (!location || strncmp(location, "usb-", 4) != 0 || strlen(location) >= size)
+        return false;
+
+    for (const char *ptr = location; *ptr; ptr++) {
+        if (*ptr == '-') {
+            if (++dashes == 3)
+                root_end = ptr;
+            hub_end = ptr;
+        }
+    }
+    if (dashes < 2)
+        return false;
+    if (!root_end)
+        root_end = location + strlen(location);
+
+    memcpy(root_port, location, (size_t)(root_end - location));
+    root_port[root_end - location] = 0;
+    memcpy(hub, location, (size_t)(hub_end - location));
+    hub[hub_end - location] = 0;
+
+    return true;
+}
+
+static int find_usb_slot(usb_slot_array *slots, const char *key)
+{
+    struct usb_slot *slot;
+    int r;
+
+    for (size_t i = 0; i < slots->count; i++) {
+        if (strcmp(slots->values[i].key, key) == 0)
+            return (int)i;
+    }
+
+    r = _hs_array_grow(slots, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    slot = &slots->values[slots->count];
+    slot->key = strdup(key);
+    if (!slot->key)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    slot->count = 0;
+
+    return (int)slots->count++;
+}
+
+static inline bool usb_slot_available(const struct usb_slot *slot, unsigned int limit)
+{
+    return !limit || slot->count < limit;
+}
+
+/* Wait until the board's root port and hub can take another upload or reboot. Returns 1
+   if a slot was taken (release it with release_usb_slot()), 0 if there are no limits. */
+static int acquire_usb_slot(ty_board *board)
+{
+    char root_port_key[256], hub_key[256];
+    int root_port_idx, hub_idx;
+    uint64_t start = 0;
+    const char *blocker = NULL;
+    int r;
+
+    if (!usb_slots.init)
+        return 0;
+    if (!parse_usb_topology(board->location, root_port_key, hub_key, sizeof(root_port_key)))
+        return 0;
+
+    ty_mutex_lock(&usb_slots.mutex);
+
+    if (!usb_slots.root_port_limit && !usb_slots.hub_limit) {
+        r = 0;
+        goto cleanup;
+    }
+
+    root_port_idx = find_usb_slot(&usb_slots.root_ports, root_port_key);
+    if (root_port_idx < 0) {
+        r = root_port_idx;
+        goto cleanup;
+    }
+    hub_idx = find_usb_slot(&usb_slots.hubs, hub_key);
+    if (hub_idx < 0) {
+        r = hub_idx;
+        goto cleanup;
+    }
+
+    while (true) {
+        const char *busy = NULL;
+
+        if (!usb_slot_available(&usb_slots.hubs.values[hub_idx], usb_slots.hub_limit)) {
+            busy = hub_key;
+        } else if (!usb_slot_available(&usb_slots.root_ports.values[root_port_idx],
+                                       usb_slots.root_port_limit)) {
+            busy = root_port_key;
+        }
+        if (!busy)
+            break;
+
+        if (!blocker) {
+            ty_log(TY_LOG_DEBUG, "Waiting for other boards on '%s' before using board '%s'",
+                   busy, board->tag);
+            ty_metric_add(ty_metric_get(TY_METRIC_COUNTER, "tytools_usb_slot_waits_total",
+                                        "Board operations delayed by USB topology limits",
+                                        "port", busy), 1);
+
+            start = ty_micros();
+            blocker = busy;
+
+            // Let the task pool run tasks for other hubs in the meantime
+            ty_mutex_unlock(&usb_slots.mutex);
+            _ty_task_block_begin();
+            ty_mutex_lock(&usb_slots.mutex);
+            continue;
+        }
+
+        ty_cond_wait(&usb_slots.cond, &usb_slots.mutex, -1);
+    }
+
+    usb_slots.root_ports.values[root_port_idx].count++;
+    usb_slots.hubs.values[hub_idx].count++;
+
+    r = 1;
+cleanup:
+    ty_mutex_unlock(&usb_slots.mutex);
+    if (blocker) {
+        _ty_task_block_end();
+        ty_metric_observe(ty_metric_get(TY_METRIC_HISTOGRAM, "tytools_usb_slot_wait_seconds",
+                                        "Time spent waiting for USB topology limits", NULL, NULL),
+                          ty_micros() - start);
+    }
+    if (r > 0)
+        ty_metric_add(ty_metric_get(TY_METRIC_GAUGE, "tytools_usb_slots_active",
+                                    "Uploads and reboots running per USB root port",
+                                    "port", root_port_key), 1);
+    return r;
+}
+
+static void release_usb_slot(ty_board *board)
+{
+    char root_port_key[256], hub_key[256];
+
+    parse_usb_topology(board->location, root_port_key, hub_key, sizeof(root_port_key));
+
+    ty_mutex_lock(&usb_slots.mutex);
+    for (size_t i = 0; i < usb_slots.root_ports.count; i++) {
+        if (strcmp(usb_slots.root_ports.values[i].key, root_port_key) == 0) {
+            usb_slots.root_ports.values[i].count--;
+            break;
+        }
+    }
+    for (size_t i = 0; i < usb_slots.hubs.count; i++) {
+        if (strcmp(usb_slots.hubs.values[i].key, hub_key) == 0) {
+            usb_slots.hubs.values[i].count--;
+            break;
+        }
+    }
+    ty_cond_broadcast(&usb_slots.cond);
+    ty_mutex_unlock(&usb_slots.mutex);
+
+    ty_metric_add(ty_metric_get(TY_METRIC_GAUGE, "tytools_usb_slots_active",
+                                "Uploads and reboots running per USB root port",
+                                "port", root_port_key), -1);
+}
+
+struct reboot_wait_context {
+    ty_board *board;
+    ty_board_interface *iface;
+    ty_board_capability capability;
+};
+
+static int reboot_wait_callback(ty_monitor *monitor, void *udata)
+{
+    TY_UNUSED(monitor);
+
+    struct reboot_wait_context *ctx = udata;
+    ty_board *board = ctx->board;
+    bool present = false;
+
+    if (board->status == TY_BOARD_STATUS_DROPPED)
+        return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' has disappeared", board->tag);
+    if (ty_board_has_capability(board, ctx->capability))
+        return 1;
+
+    ty_mutex_lock(&board->ifaces_lock);
+    for (size_t i = 0; i < board->ifaces.count; i++) {
+        if (board->ifaces.values[i] == ctx->iface) {
+            present = true;
+            break;
+        }
+    }
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    // The interface went away, the board has accepted the request
+    return present ? 0 : 2;
+}
+
+/* Try each interface able to reboot the board in turn (e.g. the serial baudrate magic
+   then the Seremu feature report). A board that accepts the request disconnects almost
+   immediately, so we only wait for the full delay once that happens. Returns 1 once
+   the board has the requested capability, or 0 if we did not see the board go away
+   after any request. Callers that cannot ask the user to push the button should wait
+   a bit more before they give up, the removal notification may just be late. */
+static int do_reboot_board(ty_board *board, ty_board_capability capability)
+{
+    ty_board_interface *ifaces[8];
+    unsigned int ifaces_count = 0;
+    struct reboot_wait_context ctx;
+    bool ignored = false;
+    int r;
+
+    if (!board->monitor)
+        return ty_error(TY_ERROR_NOT_FOUND, "Cannot wait on unmonitored board '%s'", board->tag);
+
+    ty_mutex_lock(&board->ifaces_lock);
+    for (size_t i = 0; i < board->ifaces.count && ifaces_count < TY_COUNTOF(ifaces); i++) {
+        ty_board_interface *iface = board->ifaces.values[i];
+
+        if (iface->capabilities & (1 << TY_BOARD_CAPABILITY_REBOOT))
+            ifaces[ifaces_count++] = ty_board_interface_ref(iface);
+    }
+    ty_mutex_unlock(&board->ifaces_lock);
+    if (!ifaces_count)
+        return ty_error(TY_ERROR_MODE, "Cannot reboot board '%s'", board->tag);
+
+    ctx.board = board;
+    ctx.capability = capability;
+
+    r = 0;
+    for (unsigned int i = 0; i < ifaces_count; i++) {
+        ty_board_interface *iface = ifaces[i];
+
+        // The error is reported, try the next strategy
+        r = ty_board_interface_open(iface);
+        if (r < 0)
+            continue;
+        r = (*iface->class_vtable->reboot)(iface);
+        ty_board_interface_close(iface);
+        if (r < 0)
+            continue;
+
+        TY_TRACE_BEGIN("libty", "reboot_wait", iface->name);
+        ctx.iface = iface;
+        r = ty_monitor_wait(board->monitor, reboot_wait_callback, &ctx, REBOOT_DISCONNECT_DELAY);
+        TY_TRACE_END("libty", "reboot_wait");
+        if (r < 0 || r == 1)
+            goto cleanup;
+        if (r == 2) {
+            // Now give the bootloader (or the new firmware) time to show up
+            r = ty_board_wait_for(board, capability, MANUAL_REBOOT_DELAY);
+            goto cleanup;
+        }
+
+        ty_log(TY_LOG_DEBUG, "Board '%s' ignored reboot request through %s interface",
+               board->tag, iface->name);
+        ignored = true;
+    }
+
+    // Only fail if we could not even send a request, otherwise let the user take over
+    if (ignored)
+        r = 0;
+
+cleanup:
+    for (unsigned int i = 0; i < ifaces_count; i++)
+        ty_board_interface_unref(ifaces[i]);
+    return r;
+}
+
+static int reboot_board(ty_board *board, ty_board_capability capability)
+{
+    int slot, r;
+
+    // Many boards re-enumerating at once on the same hub is as bad as many uploads
+    slot = acquire_usb_slot(board);
+    if (slot < 0)
+        return slot;
+    r = do_reboot_board(board, capability);
+    if (slot)
+        release_usb_slot(board);
+
+    return r;
+}
+
+// Bundles give the entry made for this model, or the first one if there is none
+static int get_model_firmware(ty_firmware *fw, ty_model model, ty_firmware **rfw)
+{
+    int idx;
+
+    if (!fw->entries_count) {
+        *rfw = ty_firmware_ref(fw);
+        return 0;
+    }
+
+    idx = ty_firmware_bundle_find(fw, model);
+    return ty_firmware_bundle_extract(fw, idx >= 0 ? (unsigned int)idx : 0, rfw);
+}
+
+static int select_compatible_firmware(const ty_board_snapshot *snap, ty_firmware **fws,
+                                      unsigned int fws_count, ty_firmware **rfw)
 {
     ty_model fw_models[64];
     unsigned int fw_models_count = 0;
+    int r;
 
     for (unsigned int i = 0; i < fws_count; i++) {
+        // This is cheap for bundles, the models are listed in the index
         fw_models_count = ty_firmware_identify(fws[i], fw_models, TY_COUNTOF(fw_models));
 
         for (unsigned int j = 0; j < fw_models_count; j++) {
-            if (fw_models[j] == board->model) {
-                *rfw = fws[i];
-                return 0;
+            if (fw_models[j] == snap->model) {
+                return get_model_firmware(fws[i], snap->model, rfw);
             }
         }
     }
 
     if (fws_count > 1) {
-        return ty_error(TY_ERROR_UNSUPPORTED, "No firmware is compatible with '%s' (%s)",
-                        board->tag, ty_models[board->model].name);
+        r = ty_error(TY_ERROR_UNSUPPORTED, "No firmware is compatible with '%s' (%s)",
+                     snap->tag, ty_models[snap->model].name);
     } else if (fw_models_count) {
         char buf[256], *ptr;
 
@@ -576,12 +2082,14 @@ static int select_compatible_firmware(ty_board *board, ty_firmware **fws, unsign
                             i ? (i + 1 < fw_models_count ? ", " : " and ") : "",
                             ty_models[fw_models[i]].name);
 
-        return ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is only compatible with %s",
-                        fws[0]->name, buf);
+        r = ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is only compatible with %s",
+                     fws[0]->name, buf);
     } else {
-        return ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is not compatible with '%s'",
-                        fws[0]->name, board->tag);
+        r = ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is not compatible with '%s'",
+                     fws[0]->name, snap->tag);
     }
+
+    return r;
 }
 
 static int upload_progress_callback(const ty_board *board, const ty_firmware *fw,
@@ -612,24 +2120,68 @@ static void unref_upload_firmware(void *ptr)
     ty_firmware_unref(ptr);
 }
 
+/* Firmwares given by filename are parsed here, in the worker thread, by the first upload
+   task that needs them. Tasks that share the loader wait for it and reuse the result. */
+static int load_upload_firmwares(ty_task *task)
+{
+    ty_firmware * const *fws;
+    unsigned int fws_count;
+    int r;
+
+    TY_TRACE_BEGIN("libty", "upload_load", task->u.upload.board->tag);
+    r = ty_firmware_loader_load(task->u.upload.loader, &fws, &fws_count);
+    TY_TRACE_END("libty", "upload_load");
+    if (r < 0)
+        return r;
+
+    if (fws_count > TY_UPLOAD_MAX_FIRMWARES) {
+        ty_log(TY_LOG_WARNING, "Cannot select more than %d firmwares per upload",
+               TY_UPLOAD_MAX_FIRMWARES);
+        fws_count = TY_UPLOAD_MAX_FIRMWARES;
+    }
+    if (task->u.upload.flags & TY_UPLOAD_NOCHECK)
+        fws_count = 1;
+
+    task->u.upload.fws = malloc(fws_count * sizeof(ty_firmware *));
+    if (!task->u.upload.fws)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    for (unsigned int i = 0; i < fws_count; i++)
+        task->u.upload.fws[i] = ty_firmware_ref(fws[i]);
+    task->u.upload.fws_count = fws_count;
+
+    return 0;
+}
+
 static int run_upload(ty_task *task)
 {
     ty_board *board = task->u.upload.board;
-    ty_firmware *fw;
-    int flags = task->u.upload.flags, r;
+    ty_board_snapshot *snap = NULL;
+    ty_firmware *fw = NULL;
+    int flags = task->u.upload.flags, slot, r;
+
+    if (task->u.upload.loader) {
+        r = load_upload_firmwares(task);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    // The monitor may change the board under us, work with one coherent view
+    snap = ty_board_get_snapshot(board);
 
     if (flags & TY_UPLOAD_NOCHECK) {
-        fw = task->u.upload.fws[0];
-    } else if (ty_models[board->model].mcu) {
-        r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
+        r = get_model_firmware(task->u.upload.fws[0], snap->model, &fw);
         if (r < 0)
-            return r;
+            goto cleanup;
+    } else if (ty_models[snap->model].mcu) {
+        r = select_compatible_firmware(snap, task->u.upload.fws, task->u.upload.fws_count, &fw);
+        if (r < 0)
+            goto cleanup;
     } else {
         // Maybe we can identify the board and test the firmwares in bootloader mode?
         fw = NULL;
     }
 
-    ty_log(TY_LOG_INFO, "Uploading to board '%s' (%s)", board->tag, ty_models[board->model].name);
+    ty_log(TY_LOG_INFO, "Uploading to board '%s' (%s)", snap->tag, ty_models[snap->model].name);
 
     // Can't upload directly, should we try to reboot or wait?
     if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD)) {
@@ -637,17 +2189,25 @@ static int run_upload(ty_task *task)
             ty_log(TY_LOG_INFO, "Waiting for device (press button to reboot)...");
         } else {
             ty_log(TY_LOG_INFO, "Triggering board reboot");
-            r = ty_board_reboot(board);
+            TY_TRACE_BEGIN("libty", "upload_reboot", board->tag);
+            r = reboot_board(board, TY_BOARD_CAPABILITY_UPLOAD);
+            TY_TRACE_END("libty", "upload_reboot");
             if (r < 0)
-                return r;
+                goto cleanup;
+            if (!r) {
+                ty_log(TY_LOG_INFO, "Reboot didn't work, press button manually");
+                flags |= TY_UPLOAD_WAIT;
+            }
         }
     }
 
 wait:
+    TY_TRACE_BEGIN("libty", "upload_wait", board->tag);
     r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD,
                            flags & TY_UPLOAD_WAIT ? -1 : MANUAL_REBOOT_DELAY);
+    TY_TRACE_END("libty", "upload_wait");
     if (r < 0)
-        return r;
+        goto cleanup;
     if (!r) {
         ty_log(TY_LOG_INFO, "Reboot didn't work, press button manually");
         flags |= TY_UPLOAD_WAIT;
@@ -655,34 +2215,54 @@ wait:
         goto wait;
     }
 
+    // The bootloader may tell us more about the board
     if (!fw) {
-        r = select_compatible_firmware(board, task->u.upload.fws, task->u.upload.fws_count, &fw);
+        ty_board_snapshot_unref(snap);
+        snap = ty_board_get_snapshot(board);
+
+        r = select_compatible_firmware(snap, task->u.upload.fws, task->u.upload.fws_count, &fw);
         if (r < 0)
-            return r;
+            goto cleanup;
     }
 
+    r = acquire_usb_slot(board);
+    if (r < 0)
+        goto cleanup;
+    slot = r;
+    TY_TRACE_BEGIN("libty", "upload_flash", board->tag);
     r = ty_board_upload(board, fw, upload_progress_callback, NULL);
+    TY_TRACE_END("libty", "upload_flash");
+    if (slot)
+        release_usb_slot(board);
     if (r < 0)
-        return r;
+        goto cleanup;
 
     if (!(flags & TY_UPLOAD_NORESET)) {
         ty_log(TY_LOG_INFO, "Sending reset command");
+        TY_TRACE_BEGIN("libty", "upload_reset", board->tag);
         r = ty_board_reset(board);
+        if (r >= 0)
+            r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
+        TY_TRACE_END("libty", "upload_reset");
         if (r < 0)
-            return r;
-
-        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RUN, FINAL_TASK_TIMEOUT);
-        if (r < 0)
-            return r;
-        if (!r)
-            return ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+            goto cleanup;
+        if (!r) {
+            r = ty_error(TY_ERROR_TIMEOUT, "Failed to reset board '%s'", board->tag);
+            goto cleanup;
+        }
     } else {
         ty_log(TY_LOG_INFO, "Firmware uploaded, reset the board to use it");
     }
 
-    task->result = ty_firmware_ref(fw);
+    task->result = fw;
     task->result_cleanup = unref_upload_firmware;
-    return 0;
+    fw = NULL;
+
+    r = 0;
+cleanup:
+    ty_firmware_unref(fw);
+    ty_board_snapshot_unref(snap);
+    return r;
 }
 
 static void finalize_upload(ty_task *task)
@@ -690,6 +2270,7 @@ static void finalize_upload(ty_task *task)
     for (unsigned int i = 0; i < task->u.upload.fws_count; i++)
         ty_firmware_unref(task->u.upload.fws[i]);
     free(task->u.upload.fws);
+    ty_firmware_loader_unref(task->u.upload.loader);
 
     cleanup_task_board(&task->u.upload.board);
 }
@@ -737,6 +2318,28 @@ error:
     return r;
 }
 
+int ty_upload_loader(ty_board *board, ty_firmware_loader *loader, int flags, ty_task **rtask)
+{
+    assert(board);
+    assert(loader);
+    assert(rtask);
+
+    ty_task *task = NULL;
+    int r;
+
+    r = new_board_task(board, "upload", run_upload, &task);
+    if (r < 0)
+        return r;
+    task->u.upload.board = ty_board_ref(board);
+    task->task_finalize = finalize_upload;
+
+    task->u.upload.loader = ty_firmware_loader_ref(loader);
+    task->u.upload.flags = flags;
+
+    *rtask = task;
+    return 0;
+}
+
 static int run_reset(ty_task *task)
 {
     ty_board *board = task->u.reset.board;
@@ -747,12 +2350,13 @@ static int run_reset(ty_task *task)
     if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_RESET) &&
             ty_board_has_capability(board, TY_BOARD_CAPABILITY_REBOOT)) {
         ty_log(TY_LOG_INFO, "Triggering board reboot");
-        r = ty_board_reboot(board);
+        r = reboot_board(board, TY_BOARD_CAPABILITY_RESET);
+        // We may just have missed the disconnection, give the board time to come back
+        if (!r)
+            r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RESET, MANUAL_REBOOT_DELAY);
         if (r < 0)
             return r;
-
-        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_RESET, MANUAL_REBOOT_DELAY);
-        if (r <= 0)
+        if (!r)
             return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
     }
 
@@ -806,15 +2410,14 @@ static int run_reboot(ty_task *task)
     }
 
     ty_log(TY_LOG_INFO, "Triggering board reboot");
-    r = ty_board_reboot(board);
-    if (r < 0)
-        return r;
-
-    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD, FINAL_TASK_TIMEOUT);
+    r = reboot_board(board, TY_BOARD_CAPABILITY_UPLOAD);
+    // We may just have missed the disconnection, give the board time to come back
+    if (!r)
+        r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_UPLOAD, FINAL_TASK_TIMEOUT);
     if (r < 0)
         return r;
     if (!r)
-        return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s", board->tag);
+        return ty_error(TY_ERROR_TIMEOUT, "Failed to reboot board '%s'", board->tag);
 
     return 0;
 }
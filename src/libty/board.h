@@ -20,11 +20,13 @@ struct ty_descriptor_set;
 struct hs_device;
 struct ty_monitor;
 struct ty_firmware;
+struct ty_firmware_loader;
 struct hs_port;
 struct ty_task;
 
 typedef struct ty_board ty_board;
 typedef struct ty_board_interface ty_board_interface;
+typedef struct ty_board_selector ty_board_selector;
 
 // Keep in sync with capability_names in board.c
 typedef enum ty_board_capability {
@@ -52,6 +54,25 @@ enum {
 
 #define TY_UPLOAD_MAX_FIRMWARES 256
 
+/* Immutable copy of the board state, published again each time something changes. Use it
+   to read several fields from other threads (tasks, UI) with a coherent view. */
+typedef struct ty_board_snapshot {
+    unsigned int refcount;
+    uint64_t generation;
+
+    ty_board_status status;
+    ty_model model;
+    int capabilities;
+    uint16_t vid;
+    uint16_t pid;
+
+    const char *id;
+    const char *tag;
+    const char *location;
+    const char *serial_number;
+    const char *description;
+} ty_board_snapshot;
+
 typedef int ty_board_list_interfaces_func(ty_board_interface *iface, void *udata);
 typedef int ty_board_upload_progress_func(const ty_board *board, const struct ty_firmware *fw,
                                           size_t uploaded_size, size_t flash_size, void *udata);
@@ -63,8 +84,23 @@ TY_PUBLIC void ty_board_unref(ty_board *board);
 
 TY_PUBLIC bool ty_board_matches_tag(ty_board *board, const char *id);
 
+/* Selectors are comma-separated lists of tags ([serial][-model][@location]) compiled
+   once. Serial and location parts accept '*' and '?' globs, the serial part can be
+   a numeric range (1000..2000, either bound is optional), the model part matches
+   model families ('Teensy 3' matches every Teensy 3.x). Terms starting with '!'
+   exclude boards. A board matches if it matches any positive term (or if there are
+   none) and no negative term. */
+TY_PUBLIC int ty_board_selector_new(const char *expr, ty_board_selector **rsel);
+TY_PUBLIC void ty_board_selector_free(ty_board_selector *sel);
+TY_PUBLIC const char *ty_board_selector_get_string(const ty_board_selector *sel);
+TY_PUBLIC bool ty_board_selector_matches(const ty_board_selector *sel, ty_board *board);
+
 TY_PUBLIC struct ty_monitor *ty_board_get_monitor(const ty_board *board);
 
+TY_PUBLIC ty_board_snapshot *ty_board_get_snapshot(ty_board *board);
+TY_PUBLIC ty_board_snapshot *ty_board_snapshot_ref(ty_board_snapshot *snap);
+TY_PUBLIC void ty_board_snapshot_unref(ty_board_snapshot *snap);
+
 TY_PUBLIC ty_board_status ty_board_get_status(const ty_board *board);
 
 TY_PUBLIC const char *ty_board_get_id(const ty_board *board);
@@ -78,6 +114,12 @@ TY_PUBLIC const char *ty_board_get_description(const ty_board *board);
 TY_PUBLIC void ty_board_set_model(ty_board *board, ty_model model);
 TY_PUBLIC ty_model ty_board_get_model(const ty_board *board);
 
+TY_PUBLIC int ty_board_load_model_cache(const char *filename);
+TY_PUBLIC int ty_board_set_usb_limits(unsigned int root_port_limit, unsigned int hub_limit);
+
+TY_PUBLIC void ty_board_set_capture(ty_board *board, bool capture);
+TY_PUBLIC bool ty_board_get_capture(const ty_board *board);
+
 TY_PUBLIC int ty_board_list_interfaces(ty_board *board, ty_board_list_interfaces_func *f, void *udata);
 TY_PUBLIC int ty_board_open_interface(ty_board *board, ty_board_capability cap, ty_board_interface **riface);
 
@@ -113,6 +155,8 @@ TY_PUBLIC void ty_board_interface_get_descriptors(const ty_board_interface *ifac
 
 TY_PUBLIC int ty_upload(ty_board *board, struct ty_firmware **fws, unsigned int fws_count,
                          int flags, struct ty_task **rtask);
+TY_PUBLIC int ty_upload_loader(ty_board *board, struct ty_firmware_loader *loader, int flags,
+                                struct ty_task **rtask);
 TY_PUBLIC int ty_reset(ty_board *board, struct ty_task **rtask);
 TY_PUBLIC int ty_reboot(ty_board *board, struct ty_task **rtask);
 TY_PUBLIC int ty_send(ty_board *board, const char *buf, size_t size, struct ty_task **rtask);
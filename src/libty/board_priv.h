@@ -56,14 +56,46 @@ struct ty_board {
     char *description;
     char *location;
 
+    // Derived from id and serial_number after each update, for board selectors
+    size_t id_serial_len;
+    const char *id_family;
+    bool serial_numeric;
+    uint64_t serial_value;
+
     ty_mutex ifaces_lock;
     _HS_ARRAY(ty_board_interface *) ifaces;
     int capabilities;
     ty_board_interface *cap2iface[16];
 
+    /* When capture is enabled, the monitor opens the serial interface as soon as it shows
+       up and the capture thread copies its output to capture_buf until a consumer calls
+       ty_board_serial_read(). Protected by ifaces_lock. */
+    bool capture;
+    ty_board_interface *capture_iface;
+    bool capture_attached;
+    char *capture_buf;
+    size_t capture_start;
+    size_t capture_len;
+    uint64_t capture_dropped;
+
     ty_task *current_task;
+
+    /* Swapped and referenced under snapshot_lock, the snapshot itself is never modified.
+       Readers never wait for ifaces_lock, which the capture thread holds while it reads. */
+    ty_mutex snapshot_lock;
+    ty_board_snapshot *snapshot;
+
+    struct ty_metric *serial_read_metric;
+    struct ty_metric *serial_write_metric;
+    struct ty_metric *serial_error_metric;
+    struct ty_metric *serial_open_metric;
 };
 
+void _ty_board_update_capture(ty_board *board);
+void _ty_board_update_selector_fields(ty_board *board);
+void _ty_board_update_model_cache(ty_board *board);
+void _ty_board_publish_snapshot(ty_board *board);
+
 TY_C_END
 
 #endif
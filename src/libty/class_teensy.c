@@ -16,7 +16,10 @@
 #include "board_priv.h"
 #include "class_priv.h"
 #include "firmware.h"
+#include "metrics.h"
+#include "recorder.h"
 #include "system.h"
+#include "trace.h"
 
 #define SEREMU_TX_SIZE 32
 #define SEREMU_RX_SIZE 64
@@ -458,6 +461,7 @@ static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t bloc
 {
     uint8_t buf[2048] = {0};
     uint64_t start;
+    int retries = 0;
 
     ssize_t r;
 
@@ -500,15 +504,21 @@ static int halfkay_send(hs_port *port, unsigned int halfkay_version, size_t bloc
 
     /* We may get errors along the way (while the bootloader works) so try again
        until timeout expires. */
+    TY_TRACE_BEGIN("libty", "halfkay_send", NULL);
     start = ty_millis();
     hs_error_mask(HS_ERROR_IO);
 restart:
     r = hs_hid_write(port, buf, size);
     if (r == HS_ERROR_IO && ty_millis() - start < timeout) {
+        ty_recorder_record(TY_RECORDER_EVENT_HALFKAY_RETRY, hs_port_get_device(port)->path,
+                           (int)addr, ++retries);
+        ty_metric_add(ty_metric_get(TY_METRIC_COUNTER, "tytools_halfkay_retries_total",
+                                    "HalfKay writes retried after an I/O error", NULL, NULL), 1);
         ty_delay(20);
         goto restart;
     }
     hs_error_unmask();
+    TY_TRACE_END("libty", "halfkay_send");
     if (r < 0) {
         if (r == HS_ERROR_IO)
             return ty_error(TY_ERROR_IO, "%s", hs_error_last_message());
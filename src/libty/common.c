@@ -15,19 +15,49 @@
 #endif
 #include <stdarg.h>
 #include "../libhs/common.h"
+#include "recorder.h"
 #include "system.h"
 #include "version.h"
 #include "task.h"
+#include "thread.h"
+
+struct async_message {
+    unsigned int sequence;
+
+    ty_log_level level;
+    int err;
+    char ctx[64];
+    char msg[512];
+};
+
+#define ASYNC_RING_SIZE 256
 
 int ty_config_verbosity = TY_LOG_INFO;
 
 static ty_message_func *message_handler = ty_message_default_handler;
 static void *message_handler_udata = NULL;
+static ty_log_level message_handler_level = TY_LOG_DEBUG;
 
 static TY_THREAD_LOCAL ty_err error_masks[16];
 static TY_THREAD_LOCAL unsigned int error_masks_count;
 
-static TY_THREAD_LOCAL char last_error_msg[512];
+/* Errors are formatted in the buffer not used by ty_error_last_message(), which is then
+   swapped. This keeps ty_error(err, "%s", ty_error_last_message()) working without an
+   intermediate copy. */
+static TY_THREAD_LOCAL char error_msgs[2][512];
+static TY_THREAD_LOCAL unsigned int error_msgs_index;
+
+static struct async_message *async_ring;
+static unsigned int async_enqueue_pos;
+static unsigned int async_dequeue_pos;
+static unsigned int async_dropped;
+static unsigned int async_enabled;
+static unsigned int async_producers;
+static unsigned int async_sleeping;
+static bool async_stop;
+static ty_thread async_thread;
+static ty_mutex async_mutex;
+static ty_cond async_cond;
 
 const char *ty_version_string(void)
 {
@@ -113,6 +143,28 @@ void ty_message_redirect(ty_message_func *f, void *udata)
 
     message_handler = f;
     message_handler_udata = udata;
+    message_handler_level = TY_LOG_DEBUG;
+}
+
+void ty_message_set_level(ty_log_level level)
+{
+    message_handler_level = level;
+}
+
+static bool log_level_is_wanted(ty_log_level level)
+{
+    ty_task *task;
+
+    if (log_level_is_enabled(level))
+        return true;
+
+    // Custom handlers (e.g. log windows) and task callbacks get what they asked for
+    if (level > message_handler_level)
+        return false;
+    if (message_handler != ty_message_default_handler)
+        return true;
+    task = ty_task_get_current();
+    return task && task->user_callback;
 }
 
 void ty_log(ty_log_level level, const char *fmt, ...)
@@ -120,9 +172,13 @@ void ty_log(ty_log_level level, const char *fmt, ...)
     assert(fmt);
 
     va_list ap;
-    char buf[sizeof(last_error_msg)];
+    char buf[sizeof(error_msgs[0])];
     ty_message_data msg = {0};
 
+    // Don't format messages nobody is going to see
+    if (!log_level_is_wanted(level))
+        return;
+
     va_start(ap, fmt);
     vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
@@ -189,28 +245,32 @@ bool ty_error_is_masked(int err)
 
 const char *ty_error_last_message(void)
 {
-    return last_error_msg;
+    return error_msgs[error_msgs_index];
 }
 
 int ty_error(ty_err err, const char *fmt, ...)
 {
     va_list ap;
-    char buf[sizeof(last_error_msg)];
+    char *buf = error_msgs[!error_msgs_index];
     ty_message_data msg = {0};
+    bool masked;
 
-    /* Don't copy directly to last_error_message because we need to support
-       ty_error(err, "%s", ty_error_last_message()). */
+    /* Masked errors are still formatted because callers may need ty_error_last_message(),
+       but they are not dispatched to the message handler. */
     if (fmt) {
         va_start(ap, fmt);
-        vsnprintf(buf, sizeof(buf), fmt, ap);
+        vsnprintf(buf, sizeof(error_msgs[0]), fmt, ap);
         va_end(ap);
     } else {
-        strncpy(buf, generic_error(err), sizeof(buf));
-        buf[sizeof(buf) - 1] = 0;
+        strncpy(buf, generic_error(err), sizeof(error_msgs[0]));
+        buf[sizeof(error_msgs[0]) - 1] = 0;
     }
-    strcpy(last_error_msg, buf);
+    error_msgs_index = !error_msgs_index;
 
-    if (!ty_error_is_masked(err)) {
+    // Masked errors are often the silent failures we want to see in the flight recorder
+    masked = ty_error_is_masked(err);
+    ty_recorder_record(TY_RECORDER_EVENT_ERROR, buf, err, masked);
+    if (!masked) {
         msg.type = TY_MESSAGE_LOG;
         msg.u.log.level = TY_LOG_ERROR;
         msg.u.log.err = err;
@@ -237,6 +297,191 @@ void ty_progress(const char *action, uint64_t value, uint64_t max)
     ty_message(&msg);
 }
 
+/* Bounded multi-producer ring (Vyukov-style sequence numbers), producers never block and
+   drop messages when it is full. The logger thread is the only consumer. */
+static bool push_async_message(const ty_message_data *msg)
+{
+    struct async_message *slot;
+    unsigned int pos;
+    size_t len;
+
+    pos = _ty_atomic_load(&async_enqueue_pos);
+    while (true) {
+        int diff;
+
+        slot = &async_ring[pos % ASYNC_RING_SIZE];
+        diff = (int)(_ty_atomic_load(&slot->sequence) - pos);
+
+        if (!diff) {
+            if (_ty_atomic_compare_exchange(&async_enqueue_pos, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            _ty_refcount_increase(&async_dropped);
+            return false;
+        } else {
+            pos = _ty_atomic_load(&async_enqueue_pos);
+        }
+    }
+
+    slot->level = msg->u.log.level;
+    slot->err = msg->u.log.err;
+    if (msg->ctx) {
+        strncpy(slot->ctx, msg->ctx, sizeof(slot->ctx));
+        slot->ctx[sizeof(slot->ctx) - 1] = 0;
+    } else {
+        slot->ctx[0] = 0;
+    }
+    len = strlen(msg->u.log.msg);
+    if (len >= sizeof(slot->msg))
+        len = sizeof(slot->msg) - 1;
+    memcpy(slot->msg, msg->u.log.msg, len);
+    slot->msg[len] = 0;
+
+    _ty_atomic_store(&slot->sequence, pos + 1);
+
+    if (_ty_atomic_load(&async_sleeping)) {
+        ty_mutex_lock(&async_mutex);
+        ty_cond_signal(&async_cond);
+        ty_mutex_unlock(&async_mutex);
+    }
+
+    return true;
+}
+
+static bool pop_async_message(void)
+{
+    struct async_message *slot = &async_ring[async_dequeue_pos % ASYNC_RING_SIZE];
+    ty_message_data msg = {0};
+
+    if (_ty_atomic_load(&slot->sequence) != async_dequeue_pos + 1)
+        return false;
+
+    msg.type = TY_MESSAGE_LOG;
+    msg.ctx = slot->ctx[0] ? slot->ctx : NULL;
+    msg.u.log.level = slot->level;
+    msg.u.log.err = slot->err;
+    msg.u.log.msg = slot->msg;
+    (*message_handler)(&msg, message_handler_udata);
+
+    _ty_atomic_store(&slot->sequence, async_dequeue_pos + ASYNC_RING_SIZE);
+    async_dequeue_pos++;
+
+    return true;
+}
+
+static void drain_async_messages(void)
+{
+    unsigned int dropped;
+
+    while (pop_async_message())
+        continue;
+
+    dropped = _ty_atomic_load(&async_dropped);
+    if (dropped) {
+        ty_message_data msg = {0};
+        char buf[64];
+
+        _ty_atomic_store(&async_dropped, 0);
+
+        snprintf(buf, sizeof(buf), "Dropped %u log messages", dropped);
+        msg.type = TY_MESSAGE_LOG;
+        msg.u.log.level = TY_LOG_WARNING;
+        msg.u.log.msg = buf;
+        (*message_handler)(&msg, message_handler_udata);
+    }
+}
+
+static int async_thread_main(void *udata)
+{
+    TY_UNUSED(udata);
+
+    while (true) {
+        drain_async_messages();
+
+        ty_mutex_lock(&async_mutex);
+        if (async_stop) {
+            ty_mutex_unlock(&async_mutex);
+            break;
+        }
+        _ty_atomic_store(&async_sleeping, 1);
+        // Check again, producers only signal if they see us sleeping
+        if (_ty_atomic_load(&async_ring[async_dequeue_pos % ASYNC_RING_SIZE].sequence) != async_dequeue_pos + 1)
+            ty_cond_wait(&async_cond, &async_mutex, 200);
+        _ty_atomic_store(&async_sleeping, 0);
+        ty_mutex_unlock(&async_mutex);
+    }
+
+    drain_async_messages();
+    return 0;
+}
+
+int ty_log_start_async(void)
+{
+    int r;
+
+    if (async_ring)
+        return 0;
+
+    async_ring = calloc(ASYNC_RING_SIZE, sizeof(*async_ring));
+    if (!async_ring)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    for (unsigned int i = 0; i < ASYNC_RING_SIZE; i++)
+        async_ring[i].sequence = i;
+    async_enqueue_pos = 0;
+    async_dequeue_pos = 0;
+    async_stop = false;
+
+    r = ty_mutex_init(&async_mutex);
+    if (r < 0)
+        goto error;
+    r = ty_cond_init(&async_cond);
+    if (r < 0) {
+        ty_mutex_release(&async_mutex);
+        goto error;
+    }
+
+    r = ty_thread_create(&async_thread, async_thread_main, NULL);
+    if (r < 0) {
+        ty_cond_release(&async_cond);
+        ty_mutex_release(&async_mutex);
+        goto error;
+    }
+
+    _ty_atomic_store(&async_enabled, 1);
+    return 0;
+
+error:
+    free(async_ring);
+    async_ring = NULL;
+    return r;
+}
+
+void ty_log_stop_async(void)
+{
+    if (!async_ring)
+        return;
+
+    /* Wait for producers that saw the sink enabled to get out of push_async_message(),
+       they never block so this does not take long. */
+    _ty_atomic_store(&async_enabled, 0);
+    while (_ty_atomic_load(&async_producers))
+        ty_delay(1);
+
+    ty_mutex_lock(&async_mutex);
+    async_stop = true;
+    ty_cond_signal(&async_cond);
+    ty_mutex_unlock(&async_mutex);
+    ty_thread_join(&async_thread);
+
+    // Producers that raced with the thread exit may have left a few messages behind
+    drain_async_messages();
+
+    ty_cond_release(&async_cond);
+    ty_mutex_release(&async_mutex);
+    free(async_ring);
+    async_ring = NULL;
+}
+
 void ty_message(ty_message_data *msg)
 {
     ty_task *task = msg->task;
@@ -247,7 +492,21 @@ void ty_message(ty_message_data *msg)
     if (!msg->ctx && task)
         msg->ctx = task->name;
 
-    (*message_handler)(msg, message_handler_udata);
+    /* Only log messages go through the asynchronous sink, progress and status messages
+       are rare and their handlers may need the task. */
+    if (msg->type == TY_MESSAGE_LOG) {
+        bool pushed = false;
+
+        _ty_refcount_increase(&async_producers);
+        if (_ty_atomic_load(&async_enabled))
+            pushed = push_async_message(msg);
+        _ty_refcount_decrease(&async_producers);
+
+        if (!pushed)
+            (*message_handler)(msg, message_handler_udata);
+    } else {
+        (*message_handler)(msg, message_handler_udata);
+    }
     if (task && task->user_callback)
         (*task->user_callback)(msg, task->user_callback_udata);
 }
@@ -283,10 +542,14 @@ void ty_libhs_log_handler(hs_log_level level, int err, const char *log, void *ud
         case HS_LOG_ERROR: {
             msg.u.log.level = TY_LOG_ERROR;
             msg.u.log.err = ty_libhs_translate_error(err);
-            strncpy(last_error_msg, log, sizeof(last_error_msg));
-            last_error_msg[sizeof(last_error_msg) - 1] = 0;
-            if (ty_error_is_masked(msg.u.log.err))
+            strncpy(error_msgs[!error_msgs_index], log, sizeof(error_msgs[0]));
+            error_msgs[!error_msgs_index][sizeof(error_msgs[0]) - 1] = 0;
+            error_msgs_index = !error_msgs_index;
+            if (ty_error_is_masked(msg.u.log.err)) {
+                ty_recorder_record(TY_RECORDER_EVENT_ERROR, log, msg.u.log.err, 1);
                 return;
+            }
+            ty_recorder_record(TY_RECORDER_EVENT_ERROR, log, msg.u.log.err, 0);
         } break;
     }
     msg.u.log.msg = log;
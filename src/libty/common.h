@@ -166,6 +166,8 @@ TY_PUBLIC const char *ty_version_string(void);
 
 TY_PUBLIC void ty_message_default_handler(const ty_message_data *msg, void *udata);
 TY_PUBLIC void ty_message_redirect(ty_message_func *f, void *udata);
+// Custom handlers get everything (TY_LOG_DEBUG) unless they opt out of verbose messages
+TY_PUBLIC void ty_message_set_level(ty_log_level level);
 
 TY_PUBLIC void ty_error_mask(ty_err err);
 TY_PUBLIC void ty_error_unmask(void);
@@ -173,6 +175,9 @@ TY_PUBLIC bool ty_error_is_masked(int err);
 
 TY_PUBLIC const char *ty_error_last_message(void);
 
+TY_PUBLIC int ty_log_start_async(void);
+TY_PUBLIC void ty_log_stop_async(void);
+
 TY_PUBLIC void ty_message(ty_message_data *msg);
 TY_PUBLIC void ty_log(ty_log_level level, const char *fmt, ...) TY_PRINTF_FORMAT(2, 3);
 TY_PUBLIC int ty_error(ty_err err, const char *fmt, ...) TY_PRINTF_FORMAT(2, 3);
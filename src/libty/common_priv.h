@@ -13,8 +13,109 @@
 
 #include "common.h"
 #include "compat_priv.h"
+#ifdef _MSC_VER
+    // Need that for InterlockedX functions
+    #include <windows.h>
+#endif
 
 void _ty_refcount_increase(unsigned int *rrefcount);
 unsigned int _ty_refcount_decrease(unsigned int *rrefcount);
 
+void _ty_recorder_release_thread(void);
+
+void _ty_task_block_begin(void);
+void _ty_task_block_end(void);
+
+struct ty_firmware;
+int _ty_firmware_adopt_bundle(struct ty_firmware *fw);
+int _ty_firmware_load_elf_file(struct ty_firmware *fw, FILE *fp);
+
+static inline unsigned int _ty_atomic_load(unsigned int *ptr)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedCompareExchange((volatile LONG *)ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void _ty_atomic_store(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    InterlockedExchange((volatile LONG *)ptr, (LONG)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline unsigned int _ty_atomic_fetch_add(unsigned int *ptr, unsigned int value)
+{
+#ifdef _MSC_VER
+    return (unsigned int)InterlockedExchangeAdd((volatile LONG *)ptr, (LONG)value);
+#else
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline uint64_t _ty_atomic_load64(uint64_t *ptr)
+{
+#ifdef _MSC_VER
+    return (uint64_t)InterlockedCompareExchange64((volatile LONG64 *)ptr, 0, 0);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void _ty_atomic_store64(uint64_t *ptr, uint64_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchange64((volatile LONG64 *)ptr, (LONG64)value);
+#else
+    __atomic_store_n(ptr, value, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void _ty_atomic_add64(uint64_t *ptr, uint64_t value)
+{
+#ifdef _MSC_VER
+    InterlockedExchangeAdd64((volatile LONG64 *)ptr, (LONG64)value);
+#else
+    __atomic_fetch_add(ptr, value, __ATOMIC_RELAXED);
+#endif
+}
+
+static inline void *_ty_atomic_load_ptr(void **ptr)
+{
+#ifdef _MSC_VER
+    return InterlockedCompareExchangePointer((PVOID volatile *)ptr, NULL, NULL);
+#else
+    return __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void *_ty_atomic_exchange_ptr(void **ptr, void *value)
+{
+#ifdef _MSC_VER
+    return InterlockedExchangePointer((PVOID volatile *)ptr, value);
+#else
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline bool _ty_atomic_compare_exchange(unsigned int *ptr, unsigned int *rexpected,
+                                               unsigned int value)
+{
+#ifdef _MSC_VER
+    unsigned int prev = (unsigned int)InterlockedCompareExchange((volatile LONG *)ptr,
+                                                                 (LONG)value, (LONG)*rexpected);
+    if (prev == *rexpected)
+        return true;
+    *rexpected = prev;
+    return false;
+#else
+    return __atomic_compare_exchange_n(ptr, rexpected, value, false, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST);
+#endif
+}
+
 #endif
@@ -12,14 +12,35 @@
 #include "class_priv.h"
 #include "firmware.h"
 #include "system.h"
+#include "thread.h"
+
+struct ty_firmware_loader {
+    unsigned int refcount;
+
+    char **filenames;
+    unsigned int filenames_count;
+
+    ty_mutex mutex;
+    bool loaded;
+    int ret;
+    char error[512];
+    ty_firmware **fws;
+    unsigned int fws_count;
+};
+
+static int adopt_bin(ty_firmware *fw);
 
 const ty_firmware_format ty_firmware_formats[] = {
-    {"elf",  ".elf", ty_firmware_load_elf},
-    {"ihex", ".hex", ty_firmware_load_ihex}
+    {"elf",    ".elf", ty_firmware_parse_elf,    NULL, _ty_firmware_load_elf_file},
+    {"ihex",   ".hex", ty_firmware_parse_ihex,   NULL},
+    {"bin",    ".bin", ty_firmware_parse_bin,    adopt_bin},
+    {"bundle", ".tyb", ty_firmware_parse_bundle, _ty_firmware_adopt_bundle}
 };
 const unsigned int ty_firmware_formats_count = TY_COUNTOF(ty_firmware_formats);
 
 #define FIRMWARE_STEP_SIZE 32768
+// ELF files with debug information are much bigger than the firmware itself
+#define FIRMWARE_MAX_FILE_SIZE (256 * 1024 * 1024)
 
 static const char *get_basename(const char *filename)
 {
@@ -73,39 +94,450 @@ error:
     return r;
 }
 
+static const ty_firmware_format *find_format(const char *format_name)
+{
+    for (unsigned int i = 0; i < ty_firmware_formats_count; i++) {
+        if (strcasecmp(ty_firmware_formats[i].name, format_name) == 0)
+            return &ty_firmware_formats[i];
+    }
+
+    ty_error(TY_ERROR_UNSUPPORTED, "Firmware file format '%s' unknown", format_name);
+    return NULL;
+}
+
+static const ty_firmware_format *find_format_by_extension(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    if (!ext)
+        return NULL;
+
+    for (unsigned int i = 0; i < ty_firmware_formats_count; i++) {
+        if (strcasecmp(ty_firmware_formats[i].ext, ext) == 0)
+            return &ty_firmware_formats[i];
+    }
+
+    return NULL;
+}
+
+static int open_file(const char *filename, FILE **rfp)
+{
+    FILE *fp;
+
+#ifdef _WIN32
+    fp = fopen(filename, "rb");
+#else
+    fp = fopen(filename, "rbe");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EACCES: {
+                return ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case EIO: {
+                return ty_error(TY_ERROR_IO, "I/O error while opening '%s' for reading", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                return ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", filename);
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", filename,
+                                strerror(errno));
+            } break;
+        }
+    }
+
+    *rfp = fp;
+    return 0;
+}
+
+static int read_stream(FILE *fp, const char *name, uint8_t **rmem, size_t *rlen)
+{
+    uint8_t *mem = NULL;
+    size_t len = 0, alloc_size = 0;
+    int r;
+
+    do {
+        if (len == alloc_size) {
+            uint8_t *tmp;
+
+            if (alloc_size >= FIRMWARE_MAX_FILE_SIZE) {
+                r = ty_error(TY_ERROR_RANGE, "Firmware file '%s' is too big", name);
+                goto error;
+            }
+
+            alloc_size = alloc_size ? alloc_size * 2 : 262144;
+            tmp = realloc(mem, alloc_size);
+            if (!tmp) {
+                r = ty_error(TY_ERROR_MEMORY, NULL);
+                goto error;
+            }
+            mem = tmp;
+        }
+
+        len += fread(mem + len, 1, alloc_size - len, fp);
+        if (ferror(fp)) {
+            r = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", name);
+            goto error;
+        }
+    } while (!feof(fp));
+
+    *rmem = mem;
+    *rlen = len;
+    return 0;
+
+error:
+    free(mem);
+    return r;
+}
+
+/* Formats with a load_file hook (ELF files can be big because of the debug information) are
+   read in place, with seeks to what they need. Other formats are read whole and parsed in
+   memory. */
 int ty_firmware_load(const char *filename, const char *format_name, ty_firmware **rfw)
 {
     assert(filename);
     assert(rfw);
 
     const ty_firmware_format *format = NULL;
+    FILE *fp = NULL;
+    ty_firmware *fw = NULL;
+    int r;
 
     if (format_name) {
-        for (unsigned int i = 0; i < ty_firmware_formats_count; i++) {
-            if (strcasecmp(ty_firmware_formats[i].name, format_name) == 0) {
-                format = &ty_firmware_formats[i];
-                break;
-            }
-        }
+        format = find_format(format_name);
         if (!format)
-            return ty_error(TY_ERROR_UNSUPPORTED, "Firmware file format '%s' unknown", format_name);
+            return TY_ERROR_UNSUPPORTED;
     } else {
-        const char *ext = strrchr(filename, '.');
-        if (!ext)
+        if (!strrchr(filename, '.'))
             return ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' has no file extension", filename);
-
-        for (unsigned int i = 0; i < ty_firmware_formats_count; i++) {
-            if (strcasecmp(ty_firmware_formats[i].ext, ext) == 0) {
-                format = &ty_firmware_formats[i];
-                break;
-            }
-        }
+        format = find_format_by_extension(filename);
         if (!format)
             return ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' uses unrecognized extension",
                             filename);
     }
 
-    return (*format->load)(filename, rfw);
+    r = open_file(filename, &fp);
+    if (r < 0)
+        goto cleanup;
+
+    if (format->load_file) {
+        r = ty_firmware_new(filename, &fw);
+        if (r < 0)
+            goto cleanup;
+        r = (*format->load_file)(fw, fp);
+        if (r < 0)
+            goto cleanup;
+
+        *rfw = fw;
+        fw = NULL;
+    } else {
+        r = ty_firmware_load_stream(fp, filename, format->name, rfw);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    ty_firmware_unref(fw);
+    if (fp)
+        fclose(fp);
+    return r;
+}
+
+// The stream is read until EOF, it does not need to be seekable (e.g. standard input)
+int ty_firmware_load_stream(FILE *fp, const char *name, const char *format_name,
+                            ty_firmware **rfw)
+{
+    assert(fp);
+    assert(rfw);
+
+    uint8_t *mem;
+    size_t len;
+    int r;
+
+    if (!name)
+        name = "<stream>";
+
+    r = read_stream(fp, name, &mem, &len);
+    if (r < 0)
+        return r;
+
+    // Bundles and raw images keep the buffer, other formats release it once parsed
+    return ty_firmware_load_mem_borrow(mem, len, name, format_name, free, mem, rfw);
+}
+
+int ty_firmware_loader_new(const char * const *filenames, unsigned int filenames_count,
+                           ty_firmware_loader **rloader)
+{
+    assert(filenames);
+    assert(filenames_count);
+    assert(rloader);
+
+    ty_firmware_loader *loader;
+    int r;
+
+    loader = calloc(1, sizeof(*loader));
+    if (!loader)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    loader->refcount = 1;
+
+    r = ty_mutex_init(&loader->mutex);
+    if (r < 0) {
+        free(loader);
+        return r;
+    }
+
+    loader->filenames = calloc(filenames_count, sizeof(*loader->filenames));
+    loader->fws = calloc(filenames_count, sizeof(*loader->fws));
+    if (!loader->filenames || !loader->fws) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    for (unsigned int i = 0; i < filenames_count; i++) {
+        loader->filenames[i] = strdup(filenames[i]);
+        if (!loader->filenames[i]) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto error;
+        }
+        loader->filenames_count++;
+    }
+
+    *rloader = loader;
+    return 0;
+
+error:
+    ty_firmware_loader_unref(loader);
+    return r;
+}
+
+ty_firmware_loader *ty_firmware_loader_ref(ty_firmware_loader *loader)
+{
+    assert(loader);
+
+    _ty_refcount_increase(&loader->refcount);
+    return loader;
+}
+
+void ty_firmware_loader_unref(ty_firmware_loader *loader)
+{
+    if (loader) {
+        if (_ty_refcount_decrease(&loader->refcount))
+            return;
+
+        for (unsigned int i = 0; i < loader->fws_count; i++)
+            ty_firmware_unref(loader->fws[i]);
+        free(loader->fws);
+        for (unsigned int i = 0; i < loader->filenames_count; i++)
+            free(loader->filenames[i]);
+        free(loader->filenames);
+
+        ty_mutex_release(&loader->mutex);
+    }
+
+    free(loader);
+}
+
+/* Files that fail to load are skipped as long as one of them works. The errors are reported
+   to the caller that loads the files, the others only get one if nothing could be loaded. */
+int ty_firmware_loader_load(ty_firmware_loader *loader, ty_firmware * const **rfws,
+                            unsigned int *rfws_count)
+{
+    assert(loader);
+    assert(rfws);
+    assert(rfws_count);
+
+    int r;
+
+    ty_mutex_lock(&loader->mutex);
+
+    if (!loader->loaded) {
+        for (unsigned int i = 0; i < loader->filenames_count; i++) {
+            ty_firmware *fw;
+
+            r = ty_firmware_load(loader->filenames[i], NULL, &fw);
+            if (r < 0) {
+                loader->ret = r;
+                snprintf(loader->error, sizeof(loader->error), "%s", ty_error_last_message());
+                continue;
+            }
+            loader->fws[loader->fws_count++] = fw;
+        }
+        if (loader->fws_count)
+            loader->ret = 0;
+        loader->loaded = true;
+
+        r = loader->ret;
+    } else if (loader->ret < 0) {
+        r = ty_error(loader->ret, "%s", loader->error);
+    } else {
+        r = 0;
+    }
+
+    ty_mutex_unlock(&loader->mutex);
+
+    // The array does not change once loaded
+    if (r >= 0) {
+        *rfws = loader->fws;
+        *rfws_count = loader->fws_count;
+    }
+    return r;
+}
+
+int ty_firmware_load_elf(const char *filename, ty_firmware **rfw)
+{
+    return ty_firmware_load(filename, "elf", rfw);
+}
+
+int ty_firmware_load_ihex(const char *filename, ty_firmware **rfw)
+{
+    return ty_firmware_load(filename, "ihex", rfw);
+}
+
+static const ty_firmware_format *detect_format(const uint8_t *mem, size_t len, const char *name)
+{
+    const ty_firmware_format *format;
+
+    if (len >= 4 && memcmp(mem, "\177ELF", 4) == 0)
+        return find_format("elf");
+    if (len >= 8 && memcmp(mem, "TYBUNDLE", 8) == 0)
+        return find_format("bundle");
+
+    // IHEX files are text files starting with a record
+    for (size_t i = 0; i < len; i++) {
+        if (mem[i] == ':')
+            return find_format("ihex");
+        if (!mem[i] || !strchr(" \t\r\n", mem[i]))
+            break;
+    }
+
+    // Raw binary images have no signature
+    format = find_format_by_extension(name);
+    if (!format)
+        ty_error(TY_ERROR_UNSUPPORTED, "Cannot detect format of firmware '%s'", name);
+    return format;
+}
+
+int ty_firmware_load_mem(const uint8_t *mem, size_t len, const char *name,
+                         const char *format_name, ty_firmware **rfw)
+{
+    assert(mem || !len);
+    assert(rfw);
+
+    const ty_firmware_format *format;
+    ty_firmware *fw = NULL;
+    int r;
+
+    if (!name)
+        name = "<memory>";
+
+    format = format_name ? find_format(format_name) : detect_format(mem, len, name);
+    if (!format)
+        return TY_ERROR_UNSUPPORTED;
+
+    r = ty_firmware_new(name, &fw);
+    if (r < 0)
+        goto cleanup;
+    r = (*format->parse)(fw, mem, len);
+    if (r < 0)
+        goto cleanup;
+
+    *rfw = fw;
+    fw = NULL;
+
+    r = 0;
+cleanup:
+    ty_firmware_unref(fw);
+    return r;
+}
+
+static void release_nothing(void *udata)
+{
+    TY_UNUSED(udata);
+}
+
+/* Raw binary images and bundles use the caller buffer as is, and release is called when the
+   firmware is destroyed (even on failure). Other formats are parsed into a new image and
+   release is called before this function returns, even on failure. */
+int ty_firmware_load_mem_borrow(uint8_t *mem, size_t len, const char *name,
+                                const char *format_name, ty_firmware_release_func *release,
+                                void *udata, ty_firmware **rfw)
+{
+    assert(mem || !len);
+    assert(rfw);
+
+    const ty_firmware_format *format;
+    ty_firmware *fw = NULL;
+    int r;
+
+    if (!name)
+        name = "<memory>";
+
+    format = format_name ? find_format(format_name) : detect_format(mem, len, name);
+    if (!format) {
+        r = TY_ERROR_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    r = ty_firmware_new(name, &fw);
+    if (r < 0)
+        goto cleanup;
+
+    if (format->adopt) {
+        fw->image = mem;
+        fw->size = len;
+        fw->image_release = release ? release : release_nothing;
+        fw->image_release_udata = udata;
+        release = NULL;
+
+        r = (*format->adopt)(fw);
+        if (r < 0)
+            goto cleanup;
+    } else {
+        r = (*format->parse)(fw, mem, len);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    *rfw = fw;
+    fw = NULL;
+
+    r = 0;
+cleanup:
+    if (release)
+        (*release)(udata);
+    ty_firmware_unref(fw);
+    return r;
+}
+
+static int adopt_bin(ty_firmware *fw)
+{
+    if (!fw->size)
+        return ty_error(TY_ERROR_PARSE, "Firmware '%s' is empty", fw->filename);
+    if (fw->size > TY_FIRMWARE_MAX_SIZE)
+        return ty_error(TY_ERROR_RANGE, "Firmware too big (max %u bytes) in '%s'",
+                        TY_FIRMWARE_MAX_SIZE, fw->filename);
+
+    return 0;
+}
+
+int ty_firmware_parse_bin(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(mem || !len);
+
+    int r;
+
+    if (!len)
+        return ty_error(TY_ERROR_PARSE, "Firmware '%s' is empty", fw->filename);
+
+    r = ty_firmware_expand_image(fw, len);
+    if (r < 0)
+        return r;
+    memcpy(fw->image, mem, len);
+
+    return 0;
 }
 
 ty_firmware *ty_firmware_ref(ty_firmware *fw)
@@ -122,7 +554,12 @@ void ty_firmware_unref(ty_firmware *fw)
         if (_ty_refcount_decrease(&fw->refcount))
             return;
 
-        free(fw->image);
+        if (fw->image_release) {
+            (*fw->image_release)(fw->image_release_udata);
+        } else {
+            free(fw->image);
+        }
+        free(fw->entries);
         free(fw->name);
         free(fw->filename);
     }
@@ -132,6 +569,9 @@ void ty_firmware_unref(ty_firmware *fw)
 
 int ty_firmware_expand_image(ty_firmware *fw, size_t size)
 {
+    // Borrowed images cannot grow
+    assert(!fw->image_release);
+
     if (size > fw->alloc_size) {
         uint8_t *tmp;
         size_t alloc_size;
@@ -161,6 +601,24 @@ unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
 
     unsigned int guesses_count = 0;
 
+    // Bundles already know, give every model supported by at least one entry
+    if (fw->entries_count) {
+        for (unsigned int i = 0; i < fw->entries_count; i++) {
+            const ty_firmware_bundle_entry *entry = &fw->entries[i];
+
+            for (unsigned int j = 0; j < entry->models_count; j++) {
+                bool known = false;
+
+                for (unsigned int k = 0; k < guesses_count; k++)
+                    known |= (rmodels[k] == entry->models[j]);
+                if (!known && guesses_count < max_models)
+                    rmodels[guesses_count++] = entry->models[j];
+            }
+        }
+
+        return guesses_count;
+    }
+
     for (unsigned int i = 0; i < _ty_classes_count; i++) {
         ty_model partial_guesses[16];
         unsigned int partial_count;
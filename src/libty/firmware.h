@@ -16,6 +16,20 @@
 
 TY_C_BEGIN
 
+#define TY_FIRMWARE_BUNDLE_MAX_ENTRIES 64
+#define TY_FIRMWARE_BUNDLE_MAX_MODELS 8
+
+typedef struct ty_firmware_bundle_entry {
+    const char *name;
+    ty_model models[TY_FIRMWARE_BUNDLE_MAX_MODELS];
+    unsigned int models_count;
+
+    uint32_t address;
+    size_t offset;
+    size_t size;
+    uint64_t hash;
+} ty_firmware_bundle_entry;
+
 typedef struct ty_firmware {
     unsigned int refcount;
 
@@ -25,15 +39,33 @@ typedef struct ty_firmware {
     size_t size;
 
     size_t alloc_size;
+
+    // Borrowed images (see ty_firmware_load_mem_borrow()) are released with this
+    void (*image_release)(void *udata);
+    void *image_release_udata;
+
+    // Bundles keep the whole file in image, use ty_firmware_bundle_extract() to get entries
+    ty_firmware_bundle_entry *entries;
+    unsigned int entries_count;
 } ty_firmware;
 
 typedef struct ty_firmware_format {
     const char *name;
     const char *ext;
 
-    int (*load)(const char *filename, ty_firmware **rfw);
+    int (*parse)(ty_firmware *fw, const uint8_t *mem, size_t len);
+    // Set for formats that can use the buffer as is (image and size are already set)
+    int (*adopt)(ty_firmware *fw);
+    // Set for formats that read files in place, ty_firmware_load() does not load them whole
+    int (*load_file)(ty_firmware *fw, FILE *fp);
 } ty_firmware_format;
 
+typedef void ty_firmware_release_func(void *udata);
+
+/* Loads a set of firmware files once for several users (e.g. one upload task per board),
+   the first one to call ty_firmware_loader_load() parses the files. */
+typedef struct ty_firmware_loader ty_firmware_loader;
+
 TY_PUBLIC extern const ty_firmware_format ty_firmware_formats[];
 TY_PUBLIC extern const unsigned int ty_firmware_formats_count;
 
@@ -42,8 +74,21 @@ TY_PUBLIC extern const unsigned int ty_firmware_formats_count;
 TY_PUBLIC int ty_firmware_new(const char *filename, ty_firmware **rfw);
 
 TY_PUBLIC int ty_firmware_load(const char *filename, const char *format_name, ty_firmware **rfw);
+TY_PUBLIC int ty_firmware_load_stream(FILE *fp, const char *name, const char *format_name,
+                                      ty_firmware **rfw);
 TY_PUBLIC int ty_firmware_load_elf(const char *filename, ty_firmware **rfw);
 TY_PUBLIC int ty_firmware_load_ihex(const char *filename, ty_firmware **rfw);
+TY_PUBLIC int ty_firmware_load_mem(const uint8_t *mem, size_t len, const char *name,
+                                   const char *format_name, ty_firmware **rfw);
+TY_PUBLIC int ty_firmware_load_mem_borrow(uint8_t *mem, size_t len, const char *name,
+                                          const char *format_name,
+                                          ty_firmware_release_func *release, void *udata,
+                                          ty_firmware **rfw);
+
+TY_PUBLIC int ty_firmware_parse_elf(ty_firmware *fw, const uint8_t *mem, size_t len);
+TY_PUBLIC int ty_firmware_parse_ihex(ty_firmware *fw, const uint8_t *mem, size_t len);
+TY_PUBLIC int ty_firmware_parse_bin(ty_firmware *fw, const uint8_t *mem, size_t len);
+TY_PUBLIC int ty_firmware_parse_bundle(ty_firmware *fw, const uint8_t *mem, size_t len);
 
 TY_PUBLIC ty_firmware *ty_firmware_ref(ty_firmware *fw);
 TY_PUBLIC void ty_firmware_unref(ty_firmware *fw);
@@ -53,6 +98,18 @@ TY_PUBLIC int ty_firmware_expand_image(ty_firmware *fw, size_t size);
 TY_PUBLIC unsigned int ty_firmware_identify(const ty_firmware *fw, ty_model *rmodels,
                                             unsigned int max_models);
 
+TY_PUBLIC int ty_firmware_loader_new(const char * const *filenames, unsigned int filenames_count,
+                                     ty_firmware_loader **rloader);
+TY_PUBLIC ty_firmware_loader *ty_firmware_loader_ref(ty_firmware_loader *loader);
+TY_PUBLIC void ty_firmware_loader_unref(ty_firmware_loader *loader);
+TY_PUBLIC int ty_firmware_loader_load(ty_firmware_loader *loader, ty_firmware * const **rfws,
+                                      unsigned int *rfws_count);
+
+TY_PUBLIC int ty_firmware_bundle_find(const ty_firmware *fw, ty_model model);
+TY_PUBLIC int ty_firmware_bundle_extract(ty_firmware *fw, unsigned int idx, ty_firmware **rfw);
+TY_PUBLIC int ty_firmware_bundle_save(const char *filename, ty_firmware * const *fws,
+                                      unsigned int fws_count);
+
 TY_C_END
 
 #endif
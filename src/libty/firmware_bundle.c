@@ -0,0 +1,414 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "class_priv.h"
+#include "firmware.h"
+#include "system.h"
+
+/* Bundles pack images for several models in one file, so we can pick the right one for each
+   board without parsing or identifying anything. Everything is little-endian:
+
+   - Header (64 bytes): magic "TYBUNDLE", version (u32), entries count (u32), entry size (u32)
+   - Entries (entry size bytes each): offset (u64), size (u64), load address (u32), models
+     count (u32), FNV-1a hash (u64), name (char[96]), model names (char[8][16])
+   - Raw images, each one aligned on a page boundary
+
+   Images are stored as is and the header is tiny, so a bundle can be memory-mapped and
+   given to ty_firmware_load_mem_borrow() without any copy. */
+
+#define BUNDLE_MAGIC "TYBUNDLE"
+#define BUNDLE_VERSION 1
+#define BUNDLE_HEADER_SIZE 64
+#define BUNDLE_ENTRY_SIZE 256
+#define BUNDLE_NAME_SIZE 96
+#define BUNDLE_MODEL_NAME_SIZE 16
+#define BUNDLE_ALIGNMENT 4096
+
+static uint32_t read_bundle_u32(const uint8_t *ptr)
+{
+    return (uint32_t)ptr[0] | ((uint32_t)ptr[1] << 8) | ((uint32_t)ptr[2] << 16) |
+           ((uint32_t)ptr[3] << 24);
+}
+
+static uint64_t read_bundle_u64(const uint8_t *ptr)
+{
+    return (uint64_t)read_bundle_u32(ptr) | ((uint64_t)read_bundle_u32(ptr + 4) << 32);
+}
+
+static void write_bundle_u32(uint8_t *ptr, uint32_t value)
+{
+    for (unsigned int i = 0; i < 4; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+static void write_bundle_u64(uint8_t *ptr, uint64_t value)
+{
+    write_bundle_u32(ptr, (uint32_t)value);
+    write_bundle_u32(ptr + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t hash_bundle_image(const uint8_t *image, size_t size)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= image[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static int bundle_parse_error(ty_firmware *fw)
+{
+    return ty_error(TY_ERROR_PARSE, "Malformed firmware bundle '%s'", fw->filename);
+}
+
+static int parse_bundle_entry(ty_firmware *fw, const uint8_t *ptr, size_t index_end,
+                              ty_firmware_bundle_entry *entry)
+{
+    uint64_t offset, size;
+    unsigned int models_count;
+
+    offset = read_bundle_u64(ptr);
+    size = read_bundle_u64(ptr + 8);
+    entry->address = read_bundle_u32(ptr + 16);
+    models_count = read_bundle_u32(ptr + 20);
+    entry->hash = read_bundle_u64(ptr + 24);
+
+    if (offset < index_end || offset > fw->size || !size || size > fw->size - offset)
+        return bundle_parse_error(fw);
+    if (size > TY_FIRMWARE_MAX_SIZE)
+        return ty_error(TY_ERROR_RANGE, "Firmware too big (max %u bytes) in '%s'",
+                        TY_FIRMWARE_MAX_SIZE, fw->filename);
+    // Images always start at address 0 in ty_firmware
+    if (entry->address)
+        return ty_error(TY_ERROR_UNSUPPORTED, "Unsupported load address 0x%"PRIx32" in '%s'",
+                        entry->address, fw->filename);
+    if (models_count > TY_FIRMWARE_BUNDLE_MAX_MODELS)
+        return bundle_parse_error(fw);
+    entry->offset = (size_t)offset;
+    entry->size = (size_t)size;
+
+    // Strings are NUL-padded, and we point directly into the buffer
+    entry->name = (const char *)ptr + 32;
+    if (!memchr(entry->name, 0, BUNDLE_NAME_SIZE))
+        return bundle_parse_error(fw);
+
+    // Skip models we don't know about, the bundle may come from a newer version
+    entry->models_count = 0;
+    for (unsigned int i = 0; i < models_count; i++) {
+        const char *model_name = (const char *)ptr + 32 + BUNDLE_NAME_SIZE +
+                                 i * BUNDLE_MODEL_NAME_SIZE;
+
+        if (!memchr(model_name, 0, BUNDLE_MODEL_NAME_SIZE))
+            return bundle_parse_error(fw);
+
+        for (ty_model model = 0; model < ty_models_count; model++) {
+            if (!strcmp(ty_models[model].name, model_name)) {
+                entry->models[entry->models_count++] = model;
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int _ty_firmware_adopt_bundle(ty_firmware *fw)
+{
+    uint32_t version, entries_count, entry_size;
+    size_t index_end;
+    int r;
+
+    if (fw->size < BUNDLE_HEADER_SIZE || memcmp(fw->image, BUNDLE_MAGIC, 8) != 0)
+        return ty_error(TY_ERROR_PARSE, "Missing bundle header in '%s'", fw->filename);
+    version = read_bundle_u32(fw->image + 8);
+    entries_count = read_bundle_u32(fw->image + 12);
+    entry_size = read_bundle_u32(fw->image + 16);
+
+    if (version != BUNDLE_VERSION)
+        return ty_error(TY_ERROR_UNSUPPORTED, "Unsupported bundle version %"PRIu32" in '%s'",
+                        version, fw->filename);
+    // Version 1 entries have a fixed size, and the math must not wrap on 32-bit builds
+    if (!entries_count || entries_count > TY_FIRMWARE_BUNDLE_MAX_ENTRIES ||
+            entry_size != BUNDLE_ENTRY_SIZE)
+        return bundle_parse_error(fw);
+    if ((uint64_t)BUNDLE_HEADER_SIZE + (uint64_t)entries_count * entry_size > fw->size)
+        return bundle_parse_error(fw);
+    index_end = BUNDLE_HEADER_SIZE + (size_t)entries_count * BUNDLE_ENTRY_SIZE;
+
+    fw->entries = calloc(entries_count, sizeof(*fw->entries));
+    if (!fw->entries)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    for (uint32_t i = 0; i < entries_count; i++) {
+        r = parse_bundle_entry(fw, fw->image + BUNDLE_HEADER_SIZE + (size_t)i * BUNDLE_ENTRY_SIZE,
+                               index_end, &fw->entries[i]);
+        if (r < 0)
+            return r;
+        fw->entries_count++;
+    }
+
+    return 0;
+}
+
+int ty_firmware_parse_bundle(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(mem || !len);
+
+    // Bundles are bigger than any single firmware, don't go through ty_firmware_expand_image()
+    fw->image = malloc(len ? len : 1);
+    if (!fw->image)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+    memcpy(fw->image, mem, len);
+    fw->size = len;
+    fw->alloc_size = len;
+
+    return _ty_firmware_adopt_bundle(fw);
+}
+
+int ty_firmware_bundle_find(const ty_firmware *fw, ty_model model)
+{
+    assert(fw);
+
+    for (unsigned int i = 0; i < fw->entries_count; i++) {
+        const ty_firmware_bundle_entry *entry = &fw->entries[i];
+
+        for (unsigned int j = 0; j < entry->models_count; j++) {
+            if (entry->models[j] == model)
+                return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+static void unref_bundle(void *udata)
+{
+    ty_firmware_unref(udata);
+}
+
+int ty_firmware_bundle_extract(ty_firmware *fw, unsigned int idx, ty_firmware **rfw)
+{
+    assert(fw);
+    assert(idx < fw->entries_count);
+    assert(rfw);
+
+    const ty_firmware_bundle_entry *entry = &fw->entries[idx];
+    ty_firmware *entry_fw = NULL;
+    int r;
+
+    // The index is trusted for selection, but we don't want to flash a corrupt image
+    if (hash_bundle_image(fw->image + entry->offset, entry->size) != entry->hash)
+        return ty_error(TY_ERROR_PARSE, "Firmware '%s' is corrupt in bundle '%s'",
+                        entry->name, fw->filename);
+
+    r = ty_firmware_new(fw->filename, &entry_fw);
+    if (r < 0)
+        goto error;
+    free(entry_fw->name);
+    entry_fw->name = strdup(entry->name);
+    if (!entry_fw->name) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto error;
+    }
+
+    // The entry uses the bundle memory directly, and keeps it alive
+    entry_fw->image = fw->image + entry->offset;
+    entry_fw->size = entry->size;
+    entry_fw->image_release = unref_bundle;
+    entry_fw->image_release_udata = ty_firmware_ref(fw);
+
+    *rfw = entry_fw;
+    return 0;
+
+error:
+    ty_firmware_unref(entry_fw);
+    return r;
+}
+
+// Selection takes the first entry compatible with a board
+static bool index_has_model(const uint8_t *index, unsigned int entries_count,
+                            const char *model_name)
+{
+    for (unsigned int i = 0; i < entries_count; i++) {
+        const uint8_t *ptr = index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE;
+        uint32_t models_count = read_bundle_u32(ptr + 20);
+
+        for (uint32_t j = 0; j < models_count; j++) {
+            if (!strcmp((const char *)ptr + 32 + BUNDLE_NAME_SIZE + j * BUNDLE_MODEL_NAME_SIZE,
+                        model_name))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+static int write_bundle_data(FILE *fp, const char *filename, const void *data, size_t size)
+{
+    if (size && fwrite(data, 1, size, fp) != size)
+        return ty_error(TY_ERROR_IO, "I/O error while writing '%s'", filename);
+    return 0;
+}
+
+int ty_firmware_bundle_save(const char *filename, ty_firmware * const *fws,
+                            unsigned int fws_count)
+{
+    assert(filename);
+    assert(fws);
+    assert(fws_count);
+
+    static const uint8_t padding[BUNDLE_ALIGNMENT];
+    char tmp_filename[TY_PATH_MAX_SIZE + 8] = "";
+    uint8_t *index = NULL;
+    size_t index_size, offset;
+    FILE *fp = NULL;
+    int r;
+
+    if (fws_count > TY_FIRMWARE_BUNDLE_MAX_ENTRIES)
+        return ty_error(TY_ERROR_RANGE, "Cannot bundle more than %d firmwares",
+                        TY_FIRMWARE_BUNDLE_MAX_ENTRIES);
+
+    index_size = BUNDLE_HEADER_SIZE + fws_count * BUNDLE_ENTRY_SIZE;
+    index = calloc(1, index_size);
+    if (!index) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    memcpy(index, BUNDLE_MAGIC, 8);
+    write_bundle_u32(index + 8, BUNDLE_VERSION);
+    write_bundle_u32(index + 12, fws_count);
+    write_bundle_u32(index + 16, BUNDLE_ENTRY_SIZE);
+
+    offset = index_size;
+    for (unsigned int i = 0; i < fws_count; i++) {
+        const ty_firmware *fw = fws[i];
+        uint8_t *ptr = index + BUNDLE_HEADER_SIZE + i * BUNDLE_ENTRY_SIZE;
+        ty_model models[TY_FIRMWARE_BUNDLE_MAX_MODELS];
+        unsigned int models_count;
+
+        if (fw->entries_count) {
+            r = ty_error(TY_ERROR_UNSUPPORTED, "Cannot put bundle '%s' in another bundle",
+                         fw->name);
+            goto cleanup;
+        }
+        models_count = ty_firmware_identify(fw, models, TY_COUNTOF(models));
+        if (!models_count) {
+            r = ty_error(TY_ERROR_UNSUPPORTED, "Cannot identify models compatible with '%s'",
+                         fw->name);
+            goto cleanup;
+        }
+
+        offset = (offset + BUNDLE_ALIGNMENT - 1) / BUNDLE_ALIGNMENT * BUNDLE_ALIGNMENT;
+        write_bundle_u64(ptr, offset);
+        write_bundle_u64(ptr + 8, fw->size);
+        write_bundle_u32(ptr + 16, 0);
+        write_bundle_u32(ptr + 20, models_count);
+        write_bundle_u64(ptr + 24, hash_bundle_image(fw->image, fw->size));
+        strncpy((char *)ptr + 32, fw->name, BUNDLE_NAME_SIZE - 1);
+        {
+            char buf[256];
+            size_t len = 0;
+
+            for (unsigned int j = 0; j < models_count && len < sizeof(buf); j++) {
+                len += (size_t)snprintf(buf + len, sizeof(buf) - len, "%s%s",
+                                        j ? ((j + 1 < models_count) ? ", " : " and ") : "",
+                                        ty_models[models[j]].name);
+            }
+            ty_log(TY_LOG_INFO, "Bundling '%s' for %s", fw->name, buf);
+        }
+        for (unsigned int j = 0; j < models_count; j++) {
+            const char *model_name = ty_models[models[j]].name;
+
+            assert(strlen(model_name) < BUNDLE_MODEL_NAME_SIZE);
+            strcpy((char *)ptr + 32 + BUNDLE_NAME_SIZE + j * BUNDLE_MODEL_NAME_SIZE, model_name);
+
+            if (index_has_model(index, i, model_name))
+                ty_log(TY_LOG_WARNING, "Firmware '%s' will never be used for %s, an earlier "
+                                       "firmware supports it", fw->name, model_name);
+        }
+
+        offset += fw->size;
+    }
+
+    /* Write the bundle next to the destination and move it in place, so that a failed or
+       interrupted save never leaves a truncated bundle behind. */
+    if (snprintf(tmp_filename, sizeof(tmp_filename), "%s.tmp", filename) >=
+            (int)sizeof(tmp_filename)) {
+        r = ty_error(TY_ERROR_PARAM, "Bundle path '%s' is too long", filename);
+        goto cleanup;
+    }
+
+#ifdef _WIN32
+    fp = fopen(tmp_filename, "wb");
+#else
+    fp = fopen(tmp_filename, "wbe");
+#endif
+    if (!fp) {
+        switch (errno) {
+            case EACCES: {
+                r = ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", filename);
+            } break;
+            case ENOENT:
+            case ENOTDIR: {
+                r = ty_error(TY_ERROR_NOT_FOUND, "Directory for '%s' does not exist", filename);
+            } break;
+
+            default: {
+                r = ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", tmp_filename,
+                             strerror(errno));
+            } break;
+        }
+        goto cleanup;
+    }
+
+    r = write_bundle_data(fp, filename, index, index_size);
+    if (r < 0)
+        goto cleanup;
+    offset = index_size;
+    for (unsigned int i = 0; i < fws_count; i++) {
+        size_t padding_size = (BUNDLE_ALIGNMENT - offset % BUNDLE_ALIGNMENT) % BUNDLE_ALIGNMENT;
+
+        r = write_bundle_data(fp, filename, padding, padding_size);
+        if (r < 0)
+            goto cleanup;
+        r = write_bundle_data(fp, filename, fws[i]->image, fws[i]->size);
+        if (r < 0)
+            goto cleanup;
+        offset += padding_size + fws[i]->size;
+    }
+    r = fclose(fp);
+    fp = NULL;
+    if (r != 0) {
+        r = ty_error(TY_ERROR_IO, "I/O error while writing '%s'", filename);
+        goto cleanup;
+    }
+
+#ifdef _WIN32
+    remove(filename);
+#endif
+    if (rename(tmp_filename, filename) < 0) {
+        r = ty_error(TY_ERROR_ACCESS, "Cannot move bundle to '%s': %s", filename,
+                     strerror(errno));
+        goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (r < 0 && tmp_filename[0])
+        remove(tmp_filename);
+    free(index);
+    return r;
+}
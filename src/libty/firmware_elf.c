@@ -56,10 +56,13 @@ typedef struct Elf32_Phdr {
 #define PT_NULL 0
 #define PT_LOAD 1
 
+// Files are read with seeks to the headers and segments, debug sections are never loaded
 struct loader_context {
     ty_firmware *fw;
 
     FILE *fp;
+    const uint8_t *mem;
+    size_t len;
 
     Elf32_Ehdr ehdr;
 };
@@ -84,27 +87,36 @@ static inline void reverse_uint32(uint32_t *u)
             | ((*u & 0xFF0000) >> 8) | ((*u & 0xFF000000) >> 24);
 }
 
-static int read_chunk(struct loader_context *ctx, off_t offset, size_t size, void *buf)
+static int read_chunk(struct loader_context *ctx, uint64_t offset, size_t size, void *buf)
 {
-    ssize_t r;
+    if (ctx->fp) {
+        ssize_t r;
 
 #ifdef _WIN32
-    r = _fseeki64(ctx->fp, offset, SEEK_SET);
+        r = _fseeki64(ctx->fp, (__int64)offset, SEEK_SET);
 #else
-    r = fseeko(ctx->fp, offset, SEEK_SET);
+        r = fseeko(ctx->fp, (off_t)offset, SEEK_SET);
 #endif
-    if (r < 0)
-        return ty_error(TY_ERROR_SYSTEM, "fseeko() failed: %s", strerror(errno));
-
-    r = (ssize_t)fread(buf, 1, size, ctx->fp);
-    if (r < (ssize_t)size) {
-        if (ferror(ctx->fp)) {
-            if (errno == EIO)
-                return ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", ctx->fw->filename);
-            return ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", ctx->fw->filename, strerror(errno));
+        if (r < 0)
+            return ty_error(TY_ERROR_SYSTEM, "fseeko() failed: %s", strerror(errno));
+
+        r = (ssize_t)fread(buf, 1, size, ctx->fp);
+        if (r < (ssize_t)size) {
+            if (ferror(ctx->fp)) {
+                if (errno == EIO)
+                    return ty_error(TY_ERROR_IO, "I/O error while reading from '%s'",
+                                    ctx->fw->filename);
+                return ty_error(TY_ERROR_SYSTEM, "fread('%s') failed: %s", ctx->fw->filename,
+                                strerror(errno));
+            }
+
+            return ty_error(TY_ERROR_PARSE, "ELF file '%s' is truncated", ctx->fw->filename);
         }
+    } else {
+        if (offset > ctx->len || size > ctx->len - offset)
+            return ty_error(TY_ERROR_PARSE, "ELF file '%s' is truncated", ctx->fw->filename);
 
-        return ty_error(TY_ERROR_PARSE, "ELF file '%s' is truncated", ctx->fw->filename);
+        memcpy(buf, ctx->mem + offset, size);
     }
 
     return 0;
@@ -114,7 +126,8 @@ static int load_program_header(struct loader_context *ctx, unsigned int i, Elf32
 {
     int r;
 
-    r = read_chunk(ctx, (off_t)(ctx->ehdr.e_phoff + i * ctx->ehdr.e_phentsize), sizeof(*rphdr), rphdr);
+    r = read_chunk(ctx, (uint64_t)ctx->ehdr.e_phoff + (uint64_t)i * ctx->ehdr.e_phentsize,
+                   sizeof(*rphdr), rphdr);
     if (r < 0)
         return r;
 
@@ -154,93 +167,71 @@ static int load_segment(struct loader_context *ctx, unsigned int i)
     return 1;
 }
 
-int ty_firmware_load_elf(const char *filename, ty_firmware **rfw)
+static int load_elf(struct loader_context *ctx)
 {
-    assert(filename);
-    assert(rfw);
-
-    struct loader_context ctx = {0};
     int r;
 
-    r = ty_firmware_new(filename, &ctx.fw);
+    r = read_chunk(ctx, 0, sizeof(ctx->ehdr), &ctx->ehdr);
     if (r < 0)
-        goto cleanup;
+        return r;
 
-#ifdef _WIN32
-    ctx.fp = fopen(ctx.fw->filename, "rb");
-#else
-    ctx.fp = fopen(ctx.fw->filename, "rbe");
-#endif
-    if (!ctx.fp) {
-        switch (errno) {
-            case EACCES: {
-                r = ty_error(TY_ERROR_ACCESS, "Permission denied for '%s'", ctx.fw->filename);
-            } break;
-            case EIO: {
-                r = ty_error(TY_ERROR_IO, "I/O error while opening '%s' for reading",
-                             ctx.fw->filename);
-            } break;
-            case ENOENT:
-            case ENOTDIR: {
-                r = ty_error(TY_ERROR_NOT_FOUND, "File '%s' does not exist", ctx.fw->filename);
-            } break;
-
-            default: {
-                r = ty_error(TY_ERROR_SYSTEM, "fopen('%s') failed: %s", ctx.fw->filename,
-                             strerror(errno));
-            } break;
-        }
-        goto cleanup;
-    }
+    if (memcmp(ctx->ehdr.e_ident, ELFMAG, SELFMAG) != 0)
+        return ty_error(TY_ERROR_PARSE, "Missing ELF signature in '%s'", ctx->fw->filename);
 
-    r = read_chunk(&ctx, 0, sizeof(ctx.ehdr), &ctx.ehdr);
-    if (r < 0)
-        goto cleanup;
+    if (ctx->ehdr.e_ident[EI_CLASS] != ELFCLASS32)
+        return ty_error(TY_ERROR_UNSUPPORTED, "ELF object '%s' is not supported (not 32-bit)",
+                        ctx->fw->filename);
 
-    if (memcmp(ctx.ehdr.e_ident, ELFMAG, SELFMAG) != 0) {
-        r = ty_error(TY_ERROR_PARSE, "Missing ELF signature in '%s'", ctx.fw->filename);
-        goto cleanup;
+    if (is_endianness_reversed(ctx)) {
+        reverse_uint16(&ctx->ehdr.e_type);
+        reverse_uint16(&ctx->ehdr.e_machine);
+        reverse_uint32(&ctx->ehdr.e_entry);
+        reverse_uint32(&ctx->ehdr.e_phoff);
+        reverse_uint32(&ctx->ehdr.e_shoff);
+        reverse_uint32(&ctx->ehdr.e_flags);
+        reverse_uint16(&ctx->ehdr.e_ehsize);
+        reverse_uint16(&ctx->ehdr.e_phentsize);
+        reverse_uint16(&ctx->ehdr.e_phnum);
+        reverse_uint16(&ctx->ehdr.e_shentsize);
+        reverse_uint16(&ctx->ehdr.e_shnum);
+        reverse_uint16(&ctx->ehdr.e_shstrndx);
     }
 
-    if (ctx.ehdr.e_ident[EI_CLASS] != ELFCLASS32) {
-        r = ty_error(TY_ERROR_UNSUPPORTED, "ELF object '%s' is not supported (not 32-bit)",
-                     ctx.fw->filename);
-        goto cleanup;
-    }
+    if (!ctx->ehdr.e_phoff)
+        return ty_error(TY_ERROR_PARSE, "ELF file '%s' has no program headers", ctx->fw->filename);
 
-    if (is_endianness_reversed(&ctx)) {
-        reverse_uint16(&ctx.ehdr.e_type);
-        reverse_uint16(&ctx.ehdr.e_machine);
-        reverse_uint32(&ctx.ehdr.e_entry);
-        reverse_uint32(&ctx.ehdr.e_phoff);
-        reverse_uint32(&ctx.ehdr.e_shoff);
-        reverse_uint32(&ctx.ehdr.e_flags);
-        reverse_uint16(&ctx.ehdr.e_ehsize);
-        reverse_uint16(&ctx.ehdr.e_phentsize);
-        reverse_uint16(&ctx.ehdr.e_phnum);
-        reverse_uint16(&ctx.ehdr.e_shentsize);
-        reverse_uint16(&ctx.ehdr.e_shnum);
-        reverse_uint16(&ctx.ehdr.e_shstrndx);
+    for (unsigned int i = 0; i < ctx->ehdr.e_phnum; i++) {
+        r = load_segment(ctx, i);
+        if (r < 0)
+            return r;
     }
 
-    if (!ctx.ehdr.e_phoff) {
-        r = ty_error(TY_ERROR_PARSE, "ELF file '%s' has no program headers", ctx.fw->filename);
-        goto cleanup;
-    }
+    return 0;
+}
 
-    for (unsigned int i = 0; i < ctx.ehdr.e_phnum; i++) {
-        r = load_segment(&ctx, i);
-        if (r < 0)
-            goto cleanup;
-    }
+int ty_firmware_parse_elf(ty_firmware *fw, const uint8_t *mem, size_t len)
+{
+    assert(fw);
+    assert(mem || !len);
+
+    struct loader_context ctx = {0};
+
+    ctx.fw = fw;
+    ctx.mem = mem;
+    ctx.len = len;
+
+    return load_elf(&ctx);
+}
+
+int _ty_firmware_load_elf_file(ty_firmware *fw, FILE *fp)
+{
+    assert(fw);
+    assert(fp);
+
+    struct loader_context ctx = {0};
 
-    *rfw = ctx.fw;
-    ctx.fw = NULL;
+    ctx.fw = fw;
+    ctx.fp = fp;
 
-    r = 0;
-cleanup:
-    if (ctx.fp)
-        fclose(ctx.fp);
-    ty_firmware_unref(ctx.fw);
-    return r;
+    return load_elf(&ctx);
 }
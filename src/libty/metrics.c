@@ -0,0 +1,336 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#ifndef _WIN32
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+#include "../libhs/array.h"
+#include "metrics.h"
+
+/* Histogram buckets are powers of two, from 1 ms to about 65 s. Durations are observed in
+   microseconds and exported in seconds, as Prometheus expects. */
+#define HISTOGRAM_BUCKETS 17
+
+struct ty_metric {
+    ty_metric_type type;
+    char *name;
+    char *help;
+    char *labels;
+
+    uint64_t value;
+    uint64_t sum;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+// Metrics are looked up once and cached by their users, a spinlock is enough
+static unsigned int registry_lock;
+static _HS_ARRAY(ty_metric *) registry;
+
+static void lock_registry(void)
+{
+    unsigned int expected = 0;
+
+    while (!_ty_atomic_compare_exchange(&registry_lock, &expected, 1))
+        expected = 0;
+}
+
+static void unlock_registry(void)
+{
+    _ty_atomic_store(&registry_lock, 0);
+}
+
+static char *format_labels(const char *label_name, const char *label_value)
+{
+    char *labels;
+    size_t len = 0;
+
+    labels = malloc(strlen(label_name) + 2 * strlen(label_value) + 6);
+    if (!labels)
+        return NULL;
+
+    len += (size_t)sprintf(labels, "{%s=\"", label_name);
+    for (const char *ptr = label_value; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') {
+            labels[len++] = '\\';
+            labels[len++] = *ptr;
+        } else if (*ptr == '\n') {
+            labels[len++] = '\\';
+            labels[len++] = 'n';
+        } else {
+            labels[len++] = *ptr;
+        }
+    }
+    strcpy(labels + len, "\"}");
+
+    return labels;
+}
+
+static void free_metric(ty_metric *metric)
+{
+    if (metric) {
+        free(metric->labels);
+        free(metric->help);
+        free(metric->name);
+    }
+
+    free(metric);
+}
+
+ty_metric *ty_metric_get(ty_metric_type type, const char *name, const char *help,
+                         const char *label_name, const char *label_value)
+{
+    assert(name);
+    assert(help);
+    assert(!label_name == !label_value);
+
+    char *labels = NULL;
+    ty_metric *metric = NULL;
+    int r;
+
+    if (label_name) {
+        labels = format_labels(label_name, label_value);
+        if (!labels) {
+            ty_error(TY_ERROR_MEMORY, NULL);
+            return NULL;
+        }
+    }
+
+    lock_registry();
+
+    for (size_t i = 0; i < registry.count; i++) {
+        ty_metric *it = registry.values[i];
+
+        if (strcmp(it->name, name) == 0 &&
+                (labels ? it->labels && strcmp(it->labels, labels) == 0 : !it->labels)) {
+            metric = it;
+            goto cleanup;
+        }
+    }
+
+    metric = calloc(1, sizeof(*metric));
+    if (!metric)
+        goto error;
+    metric->type = type;
+    metric->name = strdup(name);
+    metric->help = strdup(help);
+    if (!metric->name || !metric->help)
+        goto error;
+    metric->labels = labels;
+    labels = NULL;
+
+    r = _hs_array_push(&registry, metric);
+    if (r < 0)
+        goto error;
+
+cleanup:
+    unlock_registry();
+    free(labels);
+    return metric;
+
+error:
+    unlock_registry();
+    free_metric(metric);
+    free(labels);
+    ty_error(TY_ERROR_MEMORY, NULL);
+    return NULL;
+}
+
+void ty_metric_add(ty_metric *metric, int64_t value)
+{
+    if (!metric)
+        return;
+    assert(metric->type != TY_METRIC_HISTOGRAM);
+
+    _ty_atomic_add64(&metric->value, (uint64_t)value);
+}
+
+void ty_metric_set(ty_metric *metric, int64_t value)
+{
+    if (!metric)
+        return;
+    assert(metric->type == TY_METRIC_GAUGE);
+
+    _ty_atomic_store64(&metric->value, (uint64_t)value);
+}
+
+void ty_metric_observe(ty_metric *metric, uint64_t duration)
+{
+    if (!metric)
+        return;
+    assert(metric->type == TY_METRIC_HISTOGRAM);
+
+    // Buckets are cumulative in the output, only count the first matching one here
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (duration <= (uint64_t)1000 << i) {
+            _ty_atomic_add64(&metric->buckets[i], 1);
+            break;
+        }
+    }
+    _ty_atomic_add64(&metric->sum, duration);
+    _ty_atomic_add64(&metric->value, 1);
+}
+
+static void write_histogram(FILE *fp, ty_metric *metric)
+{
+    const char *labels = metric->labels ? metric->labels + 1 : "}";
+    const char *sep = metric->labels ? "," : "";
+    uint64_t cumulated = 0;
+
+    for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        cumulated += _ty_atomic_load64(&metric->buckets[i]);
+        fprintf(fp, "%s_bucket{le=\"%g\"%s%s %" PRIu64 "\n", metric->name,
+                (double)(1u << i) / 1000.0, sep, labels, cumulated);
+    }
+    fprintf(fp, "%s_bucket{le=\"+Inf\"%s%s %" PRIu64 "\n", metric->name, sep, labels,
+            _ty_atomic_load64(&metric->value));
+    fprintf(fp, "%s_sum%s %.6f\n", metric->name, metric->labels ? metric->labels : "",
+            (double)_ty_atomic_load64(&metric->sum) / 1000000.0);
+    fprintf(fp, "%s_count%s %" PRIu64 "\n", metric->name, metric->labels ? metric->labels : "",
+            _ty_atomic_load64(&metric->value));
+}
+
+int ty_metrics_write(FILE *fp)
+{
+    assert(fp);
+
+    static const char *type_names[] = {"counter", "gauge", "histogram"};
+    ty_metric **metrics;
+    size_t metrics_count;
+
+    // Metrics are never freed, but the registry array may move while we write
+    lock_registry();
+    metrics_count = registry.count;
+    metrics = malloc((metrics_count + 1) * sizeof(*metrics));
+    if (metrics)
+        memcpy(metrics, registry.values, metrics_count * sizeof(*metrics));
+    unlock_registry();
+    if (!metrics)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    // Samples of the same metric family must be grouped together
+    for (size_t i = 0; i < metrics_count; i++) {
+        ty_metric *family = metrics[i];
+
+        if (!family)
+            continue;
+
+        fprintf(fp, "# HELP %s %s\n", family->name, family->help);
+        fprintf(fp, "# TYPE %s %s\n", family->name, type_names[family->type]);
+
+        for (size_t j = i; j < metrics_count; j++) {
+            ty_metric *metric = metrics[j];
+
+            if (!metric || strcmp(metric->name, family->name) != 0)
+                continue;
+
+            if (metric->type == TY_METRIC_HISTOGRAM) {
+                write_histogram(fp, metric);
+            } else if (metric->type == TY_METRIC_GAUGE) {
+                fprintf(fp, "%s%s %" PRId64 "\n", metric->name, metric->labels ? metric->labels : "",
+                        (int64_t)_ty_atomic_load64(&metric->value));
+            } else {
+                fprintf(fp, "%s%s %" PRIu64 "\n", metric->name, metric->labels ? metric->labels : "",
+                        _ty_atomic_load64(&metric->value));
+            }
+            metrics[j] = NULL;
+        }
+    }
+
+    free(metrics);
+
+    fflush(fp);
+    if (ferror(fp))
+        return ty_error(TY_ERROR_IO, "I/O error while writing metrics");
+    return 0;
+}
+
+#ifndef _WIN32
+
+static int dump_to_socket(const char *path)
+{
+    struct sockaddr_un addr = {0};
+    int fd;
+    FILE *fp;
+    int r;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return ty_error(TY_ERROR_PARAM, "Socket path '%s' is too long", path);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        r = ty_error(TY_ERROR_IO, "Cannot connect to '%s': %s", path, strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    fp = fdopen(fd, "w");
+    if (!fp) {
+        r = ty_error(TY_ERROR_SYSTEM, "fdopen() failed: %s", strerror(errno));
+        close(fd);
+        return r;
+    }
+    r = ty_metrics_write(fp);
+    fclose(fp);
+
+    return r;
+}
+
+#endif
+
+int ty_metrics_dump(const char *path)
+{
+    assert(path);
+
+    char tmp_path[1024];
+    FILE *fp;
+    int r;
+
+#ifndef _WIN32
+    struct stat sb;
+    if (!stat(path, &sb) && S_ISSOCK(sb.st_mode))
+        return dump_to_socket(path);
+#endif
+
+    /* Write the metrics next to the destination and move them in place, so that collectors
+       (such as the node_exporter textfile collector) never read a partial file. */
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+        return ty_error(TY_ERROR_PARAM, "Metrics path '%s' is too long", path);
+
+    fp = fopen(tmp_path, "w");
+    if (!fp)
+        return ty_error(TY_ERROR_ACCESS, "Cannot write metrics to '%s': %s", tmp_path,
+                        strerror(errno));
+    r = ty_metrics_write(fp);
+    fclose(fp);
+    if (r < 0)
+        goto error;
+
+#ifdef _WIN32
+    remove(path);
+#endif
+    if (rename(tmp_path, path) < 0) {
+        r = ty_error(TY_ERROR_ACCESS, "Cannot move metrics to '%s': %s", path, strerror(errno));
+        goto error;
+    }
+
+    return 0;
+
+error:
+    remove(tmp_path);
+    return r;
+}
@@ -0,0 +1,38 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_METRICS_H
+#define TY_METRICS_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+typedef struct ty_metric ty_metric;
+
+typedef enum ty_metric_type {
+    TY_METRIC_COUNTER,
+    TY_METRIC_GAUGE,
+    TY_METRIC_HISTOGRAM
+} ty_metric_type;
+
+TY_PUBLIC ty_metric *ty_metric_get(ty_metric_type type, const char *name, const char *help,
+                                   const char *label_name, const char *label_value);
+
+TY_PUBLIC void ty_metric_add(ty_metric *metric, int64_t value);
+TY_PUBLIC void ty_metric_set(ty_metric *metric, int64_t value);
+TY_PUBLIC void ty_metric_observe(ty_metric *metric, uint64_t duration);
+
+TY_PUBLIC int ty_metrics_write(FILE *fp);
+TY_PUBLIC int ty_metrics_dump(const char *path);
+
+TY_C_END
+
+#endif
@@ -14,9 +14,12 @@
 #include "../libhs/monitor.h"
 #include "board_priv.h"
 #include "class_priv.h"
+#include "metrics.h"
 #include "monitor.h"
+#include "recorder.h"
 #include "system.h"
 #include "timer.h"
+#include "trace.h"
 
 struct callback {
     int id;
@@ -42,6 +45,8 @@ struct ty_monitor {
     _HS_ARRAY(ty_board *) boards;
     _hs_htable ifaces;
 
+    hs_monitor_stats device_stats;
+
     ty_thread_id main_thread_id;
 };
 
@@ -67,6 +72,9 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
     } else {
         board->status = status;
     }
+    // Everything the monitor changed is visible to other threads before callbacks run
+    _ty_board_publish_snapshot(board);
+    ty_recorder_record(TY_RECORDER_EVENT_BOARD_STATUS, board->tag, (int)status, (int)event);
 
     /* Notify callbacks and do some additional stuff as we go:
        - Drop callback that return r > 0
@@ -109,9 +117,26 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
     }
 
     r = ty_mutex_init(&board->ifaces_lock);
+    if (r < 0)
+        goto error;
+    r = ty_mutex_init(&board->snapshot_lock);
     if (r < 0)
         goto error;
 
+    // Boards are identified by location, the same port may see boards with different serials
+    board->serial_read_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_serial_read_bytes_total",
+                                              "Bytes read from the board serial interface",
+                                              "location", board->location);
+    board->serial_write_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_serial_written_bytes_total",
+                                               "Bytes written to the board serial interface",
+                                               "location", board->location);
+    board->serial_error_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_serial_errors_total",
+                                               "Serial I/O errors, the connection is usually dropped",
+                                               "location", board->location);
+    board->serial_open_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_serial_connections_total",
+                                              "Serial connections opened, including reconnections",
+                                              "location", board->location);
+
     board->vid = iface->dev->vid;
     board->pid = iface->dev->pid;
 
@@ -119,6 +144,7 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
     if (r <= 0)
         goto error;
     board->tag = board->id;
+    _ty_board_update_selector_fields(board);
 
     board->monitor = monitor;
     r = _hs_array_push(&monitor->boards, board);
@@ -146,6 +172,7 @@ static int close_board(ty_board *board)
     memset(board->cap2iface, 0, sizeof(board->cap2iface));
     board->capabilities &= 1 << TY_BOARD_CAPABILITY_UNIQUE;
     ty_mutex_unlock(&board->ifaces_lock);
+    _ty_board_update_capture(board);
 
     // Set missing board status
     r = change_board_status(board, TY_BOARD_STATUS_MISSING, TY_MONITOR_EVENT_DISAPPEARED);
@@ -261,6 +288,7 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
             return r;
         if (update_tag_pointer)
             board->tag = board->id;
+        _ty_board_update_selector_fields(board);
 
         /* The class function update_board() returns 1 if the interface is compatible with
            this board, or 0 if not. In the latter case, the old board is dropped and a new
@@ -351,6 +379,10 @@ static int add_interface_for_device(ty_monitor *monitor, hs_device *dev)
     if (r < 0)
         goto error;
 
+    _ty_board_update_model_cache(board);
+    // Start capturing serial output before anyone gets notified, to lose as little as possible
+    _ty_board_update_capture(board);
+
     return change_board_status(board, TY_BOARD_STATUS_ONLINE, event);
 
 error:
@@ -399,6 +431,7 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     }
 
     ty_mutex_unlock(&board->ifaces_lock);
+    _ty_board_update_capture(board);
 
     // Change status and trigger callbacks
     if (!board->ifaces.count) {
@@ -416,11 +449,25 @@ static int device_callback(hs_device *dev, void *udata)
 
     switch (dev->status) {
         case HS_DEVICE_STATUS_ONLINE: {
+            static ty_metric *added_metric;
+            if (!added_metric)
+                added_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_hotplug_events_total",
+                                             "Device hotplug events", "action", "add");
+            ty_metric_add(added_metric, 1);
+
+            ty_recorder_record(TY_RECORDER_EVENT_DEVICE_ADDED, dev->path, dev->vid, dev->pid);
             monitor->refresh_callback_ret = add_interface_for_device(monitor, dev);
             return !!monitor->refresh_callback_ret;
         } break;
 
         case HS_DEVICE_STATUS_DISCONNECTED: {
+            static ty_metric *removed_metric;
+            if (!removed_metric)
+                removed_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_hotplug_events_total",
+                                               "Device hotplug events", "action", "remove");
+            ty_metric_add(removed_metric, 1);
+
+            ty_recorder_record(TY_RECORDER_EVENT_DEVICE_REMOVED, dev->path, dev->vid, dev->pid);
             monitor->refresh_callback_ret = remove_interface_with_device(monitor, dev);
             return !!monitor->refresh_callback_ret;
         } break;
@@ -449,6 +496,21 @@ int ty_monitor_new(ty_monitor **rmonitor)
         monitor->drop_delay = DROP_BOARD_DELAY;
     }
 
+    if (getenv("TYTOOLS_USB_LIMITS")) {
+        const char *limits = getenv("TYTOOLS_USB_LIMITS");
+        unsigned int root_port_limit, hub_limit = 0;
+        char *end;
+
+        // <per root port>[,<per hub>], 0 means no limit
+        root_port_limit = (unsigned int)strtoul(limits, &end, 10);
+        if (*end == ',')
+            hub_limit = (unsigned int)strtoul(end + 1, NULL, 10);
+
+        r = ty_board_set_usb_limits(root_port_limit, hub_limit);
+        if (r < 0)
+            goto error;
+    }
+
     r = hs_monitor_new(_ty_class_match_specs, _ty_class_match_specs_count, &monitor->device_monitor);
     if (r < 0) {
         r = ty_libhs_translate_error(r);
@@ -578,7 +640,13 @@ int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *
         .f = f,
         .udata = udata
     };
-    return ty_libhs_translate_error(_hs_array_push(&monitor->callbacks, callback));
+    int r;
+
+    r = _hs_array_push(&monitor->callbacks, callback);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+
+    return callback.id;
 }
 
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
@@ -594,12 +662,42 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
     }
 }
 
+static void update_device_metrics(ty_monitor *monitor)
+{
+    static ty_metric *overflow_metric, *resync_metric;
+    hs_monitor_stats stats;
+
+    hs_monitor_get_stats(monitor->device_monitor, &stats);
+    if (stats.overflows == monitor->device_stats.overflows &&
+            stats.resync_events == monitor->device_stats.resync_events)
+        return;
+
+    if (!overflow_metric) {
+        overflow_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_hotplug_overflows_total",
+                                        "Dropped device notification bursts", NULL, NULL);
+        resync_metric = ty_metric_get(TY_METRIC_COUNTER, "tytools_hotplug_resync_events_total",
+                                      "Device events recovered by resynchronization", NULL, NULL);
+    }
+    ty_metric_add(overflow_metric, (int64_t)(stats.overflows - monitor->device_stats.overflows));
+    ty_metric_add(resync_metric, (int64_t)(stats.resync_events - monitor->device_stats.resync_events));
+
+    monitor->device_stats = stats;
+}
+
 int ty_monitor_refresh(ty_monitor *monitor)
 {
     assert(monitor);
 
+    static ty_metric *refresh_metric;
+    uint64_t start;
     int r;
 
+    if (!refresh_metric)
+        refresh_metric = ty_metric_get(TY_METRIC_HISTOGRAM, "tytools_monitor_refresh_duration_seconds",
+                                       "Duration of board monitor refreshes", NULL, NULL);
+    start = ty_micros();
+    TY_TRACE_BEGIN("libty", "ty_monitor_refresh", NULL);
+
     if (ty_timer_rearm(monitor->timer)) {
         int timer_delay = -1;
 
@@ -621,7 +719,7 @@ int ty_monitor_refresh(ty_monitor *monitor)
 
         r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
         if (r < 0)
-            return r;
+            goto cleanup;
         monitor->timer_running = (timer_delay >= 0);
     }
 
@@ -632,17 +730,24 @@ int ty_monitor_refresh(ty_monitor *monitor)
         if (monitor->refresh_callback_ret) {
             r = monitor->refresh_callback_ret;
             monitor->refresh_callback_ret = 0;
-            return r;
+            goto cleanup;
         }
 
-        return ty_libhs_translate_error(r);
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
     }
 
+    update_device_metrics(monitor);
+
     ty_mutex_lock(&monitor->refresh_mutex);
     ty_cond_broadcast(&monitor->refresh_cond);
     ty_mutex_unlock(&monitor->refresh_mutex);
 
-    return 0;
+    r = 0;
+cleanup:
+    TY_TRACE_END("libty", "ty_monitor_refresh");
+    ty_metric_observe(refresh_metric, ty_micros() - start);
+    return r;
 }
 
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
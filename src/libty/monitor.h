@@ -37,6 +37,8 @@ TY_PUBLIC void ty_monitor_stop(ty_monitor *monitor);
 
 TY_PUBLIC void ty_monitor_get_descriptors(const ty_monitor *monitor, struct ty_descriptor_set *set, int id);
 
+/* Returns the callback id (0 or more) to give to ty_monitor_deregister_callback(), or a
+   negative error code. */
 TY_PUBLIC int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
 TY_PUBLIC void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
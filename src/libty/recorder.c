@@ -0,0 +1,329 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "recorder.h"
+#include "system.h"
+#include "version.h"
+
+#include "thread.h"
+
+/* Each thread records into its own ring, allocated when it records its first event, so
+   writers never contend and nothing is locked. Threads started with ty_thread_create()
+   give their ring back when they exit, the next new thread takes it over and the old
+   events stay around until they are overwritten. Past RECORDER_MAX_RINGS threads, new
+   threads share the existing rings. */
+#define RECORDER_MAX_RINGS 64
+#define RECORDER_RING_SIZE 256
+
+struct recorder_event {
+    unsigned int sequence;
+    unsigned int order;
+
+    uint64_t time;
+    uint16_t event;
+    uint16_t ring;
+    int32_t a;
+    int32_t b;
+    char text[100];
+};
+
+struct recorder_ring {
+    unsigned int id;
+    unsigned int owned;
+
+    unsigned int head;
+    struct recorder_event events[RECORDER_RING_SIZE];
+};
+
+static struct recorder_ring *recorder_rings[RECORDER_MAX_RINGS];
+static unsigned int recorder_rings_count;
+static unsigned int recorder_order;
+static uint64_t recorder_start;
+
+static TY_THREAD_LOCAL struct recorder_ring *thread_ring;
+static TY_THREAD_LOCAL bool thread_ring_owned;
+
+static unsigned int dump_path_state;
+static ty_mutex dump_path_mutex;
+static char dump_path[1024];
+
+static const char *event_names[] = {
+    NULL,
+    "device-add",
+    "device-remove",
+    "board-status",
+    "halfkay-retry",
+    "task-status",
+    "error"
+};
+
+static unsigned int count_rings(void)
+{
+    unsigned int count = _ty_atomic_load(&recorder_rings_count);
+    return count < RECORDER_MAX_RINGS ? count : RECORDER_MAX_RINGS;
+}
+
+static struct recorder_ring *acquire_ring(void)
+{
+    struct recorder_ring *ring;
+    unsigned int idx;
+
+    if (!_ty_atomic_load64(&recorder_start))
+        _ty_atomic_store64(&recorder_start, ty_millis());
+
+    // Take over the ring of a thread that has exited
+    for (unsigned int i = 0; i < count_rings(); i++) {
+        unsigned int owned = 0;
+
+        ring = _ty_atomic_load_ptr((void **)&recorder_rings[i]);
+        if (ring && _ty_atomic_compare_exchange(&ring->owned, &owned, 1)) {
+            thread_ring_owned = true;
+            return ring;
+        }
+    }
+
+    idx = _ty_atomic_fetch_add(&recorder_rings_count, 1);
+    if (idx < RECORDER_MAX_RINGS) {
+        ring = calloc(1, sizeof(*ring));
+        if (!ring) {
+            // Leave a hole, readers skip NULL rings
+            return NULL;
+        }
+        ring->id = idx;
+        ring->owned = 1;
+        _ty_atomic_exchange_ptr((void **)&recorder_rings[idx], ring);
+
+        thread_ring_owned = true;
+        return ring;
+    }
+
+    // Too many live threads, share with another one (the head is atomic)
+    for (unsigned int i = 0; i < RECORDER_MAX_RINGS; i++) {
+        ring = _ty_atomic_load_ptr((void **)&recorder_rings[(idx + i) % RECORDER_MAX_RINGS]);
+        if (ring) {
+            thread_ring_owned = false;
+            return ring;
+        }
+    }
+    return NULL;
+}
+
+void _ty_recorder_release_thread(void)
+{
+    if (thread_ring && thread_ring_owned)
+        _ty_atomic_store(&thread_ring->owned, 0);
+    thread_ring = NULL;
+    thread_ring_owned = false;
+}
+
+void ty_recorder_record(ty_recorder_event event, const char *text, int a, int b)
+{
+    struct recorder_ring *ring = thread_ring;
+    struct recorder_event *ev;
+    unsigned int pos;
+    size_t len;
+
+    if (!ring) {
+        ring = acquire_ring();
+        if (!ring)
+            return;
+        thread_ring = ring;
+    }
+
+    pos = _ty_atomic_fetch_add(&ring->head, 1);
+    ev = &ring->events[pos % RECORDER_RING_SIZE];
+
+    // Readers ignore events whose sequence changes (or is zero) while they copy them
+    _ty_atomic_store(&ev->sequence, 0);
+    ev->order = _ty_atomic_fetch_add(&recorder_order, 1);
+    ev->time = ty_millis();
+    ev->event = (uint16_t)event;
+    ev->ring = (uint16_t)ring->id;
+    ev->a = a;
+    ev->b = b;
+    if (text) {
+        len = strlen(text);
+        if (len >= sizeof(ev->text))
+            len = sizeof(ev->text) - 1;
+        memcpy(ev->text, text, len);
+        ev->text[len] = 0;
+    } else {
+        ev->text[0] = 0;
+    }
+    _ty_atomic_store(&ev->sequence, pos + 1);
+}
+
+// Runs once, concurrent callers wait for the first one to finish
+static void init_dump_path(void)
+{
+    unsigned int state = 0;
+
+    if (_ty_atomic_load(&dump_path_state) == 2)
+        return;
+
+    if (_ty_atomic_compare_exchange(&dump_path_state, &state, 1)) {
+        const char *env = getenv("TYTOOLS_RECORDER");
+
+        ty_mutex_init(&dump_path_mutex);
+        if (env && strlen(env) < sizeof(dump_path))
+            strcpy(dump_path, env);
+
+        _ty_atomic_store(&dump_path_state, 2);
+    } else {
+        while (_ty_atomic_load(&dump_path_state) != 2)
+            ty_delay(1);
+    }
+}
+
+int ty_recorder_set_dump_path(const char *path)
+{
+    if (path && strlen(path) >= sizeof(dump_path))
+        return ty_error(TY_ERROR_PARAM, "Recorder dump path is too long");
+
+    init_dump_path();
+
+    ty_mutex_lock(&dump_path_mutex);
+    if (path) {
+        strcpy(dump_path, path);
+    } else {
+        dump_path[0] = 0;
+    }
+    ty_mutex_unlock(&dump_path_mutex);
+
+    return 0;
+}
+
+const char *ty_recorder_get_dump_path(void)
+{
+    init_dump_path();
+    return dump_path[0] ? dump_path : NULL;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const struct recorder_event *ev1 = a;
+    const struct recorder_event *ev2 = b;
+
+    return (int)(ev1->order - ev2->order);
+}
+
+static void print_event(FILE *fp, const struct recorder_event *ev)
+{
+    fprintf(fp, "%10.3f  T%u  %-14s ", (double)(ev->time - _ty_atomic_load64(&recorder_start)) / 1000.0,
+            ev->ring, event_names[ev->event]);
+
+    switch ((ty_recorder_event)ev->event) {
+        case TY_RECORDER_EVENT_DEVICE_ADDED:
+        case TY_RECORDER_EVENT_DEVICE_REMOVED: {
+            fprintf(fp, "%s  %04x:%04x\n", ev->text, ev->a, ev->b);
+        } break;
+
+        case TY_RECORDER_EVENT_BOARD_STATUS: {
+            static const char *status_names[] = {"dropped", "missing", "online"};
+            fprintf(fp, "%s  %s\n", ev->text,
+                    ev->a >= 0 && ev->a < (int)TY_COUNTOF(status_names) ? status_names[ev->a] : "?");
+        } break;
+
+        case TY_RECORDER_EVENT_HALFKAY_RETRY: {
+            fprintf(fp, "%s  address 0x%x, attempt %d\n", ev->text, ev->a, ev->b);
+        } break;
+
+        case TY_RECORDER_EVENT_TASK_STATUS: {
+            static const char *status_names[] = {"ready", "pending", "running", "finished"};
+            fprintf(fp, "%s  %s", ev->text,
+                    ev->a >= 0 && ev->a < (int)TY_COUNTOF(status_names) ? status_names[ev->a] : "?");
+            if (ev->a == TY_TASK_STATUS_FINISHED)
+                fprintf(fp, " (%d)", ev->b);
+            fputc('\n', fp);
+        } break;
+
+        case TY_RECORDER_EVENT_ERROR: {
+            fprintf(fp, "%s  (%d%s)\n", ev->text, ev->a, ev->b ? ", masked" : "");
+        } break;
+    }
+}
+
+int ty_recorder_dump_file(FILE *fp)
+{
+    assert(fp);
+
+    struct recorder_event *events;
+    size_t events_count = 0;
+
+    events = malloc(RECORDER_MAX_RINGS * RECORDER_RING_SIZE * sizeof(*events));
+    if (!events)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    for (unsigned int i = 0; i < count_rings(); i++) {
+        struct recorder_ring *ring = _ty_atomic_load_ptr((void **)&recorder_rings[i]);
+
+        if (!ring)
+            continue;
+
+        for (unsigned int j = 0; j < RECORDER_RING_SIZE; j++) {
+            struct recorder_event *ev = &ring->events[j];
+            struct recorder_event *copy = &events[events_count];
+            unsigned int sequence;
+
+            sequence = _ty_atomic_load(&ev->sequence);
+            if (!sequence)
+                continue;
+            memcpy(copy, ev, sizeof(*copy));
+            if (_ty_atomic_load(&ev->sequence) != sequence)
+                continue;
+            if (!copy->event || copy->event >= TY_COUNTOF(event_names))
+                continue;
+            copy->text[sizeof(copy->text) - 1] = 0;
+
+            events_count++;
+        }
+    }
+    qsort(events, events_count, sizeof(*events), compare_events);
+
+    fprintf(fp, "# TyTools %s flight recorder, %zu events\n", ty_version_string(), events_count);
+    for (size_t i = 0; i < events_count; i++)
+        print_event(fp, &events[i]);
+    fflush(fp);
+
+    free(events);
+
+    if (ferror(fp))
+        return ty_error(TY_ERROR_IO, "I/O error while writing flight recorder");
+    return 0;
+}
+
+int ty_recorder_dump(const char *path)
+{
+    char default_path[sizeof(dump_path)];
+    FILE *fp;
+    int r;
+
+    if (!path) {
+        init_dump_path();
+
+        ty_mutex_lock(&dump_path_mutex);
+        strcpy(default_path, dump_path);
+        ty_mutex_unlock(&dump_path_mutex);
+
+        if (!default_path[0])
+            return 0;
+        path = default_path;
+    }
+
+    fp = fopen(path, "w");
+    if (!fp)
+        return ty_error(TY_ERROR_ACCESS, "Cannot write flight recorder to '%s': %s", path,
+                        strerror(errno));
+    r = ty_recorder_dump_file(fp);
+    fclose(fp);
+
+    return r;
+}
@@ -0,0 +1,37 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_RECORDER_H
+#define TY_RECORDER_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+typedef enum ty_recorder_event {
+    TY_RECORDER_EVENT_DEVICE_ADDED = 1,
+    TY_RECORDER_EVENT_DEVICE_REMOVED,
+    TY_RECORDER_EVENT_BOARD_STATUS,
+    TY_RECORDER_EVENT_HALFKAY_RETRY,
+    TY_RECORDER_EVENT_TASK_STATUS,
+    TY_RECORDER_EVENT_ERROR
+} ty_recorder_event;
+
+TY_PUBLIC void ty_recorder_record(ty_recorder_event event, const char *text, int a, int b);
+
+TY_PUBLIC int ty_recorder_set_dump_path(const char *path);
+TY_PUBLIC const char *ty_recorder_get_dump_path(void);
+
+TY_PUBLIC int ty_recorder_dump(const char *path);
+TY_PUBLIC int ty_recorder_dump_file(FILE *fp);
+
+TY_C_END
+
+#endif
@@ -63,6 +63,7 @@ TY_PUBLIC char *ty_win32_strerror(unsigned long err);
 #endif
 
 TY_PUBLIC uint64_t ty_millis(void);
+TY_PUBLIC uint64_t ty_micros(void);
 TY_PUBLIC void ty_delay(unsigned int ms);
 
 TY_PUBLIC int ty_adjust_timeout(int timeout, uint64_t start);
@@ -32,6 +32,7 @@ struct child_report {
 
 static struct termios orig_termios;
 static bool saved_termios;
+static bool registered_restore;
 
 #ifdef __APPLE__
 
@@ -44,6 +45,15 @@ uint64_t ty_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t ty_micros(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000;
+}
+
 #else
 
 uint64_t ty_millis(void)
@@ -61,7 +71,25 @@ uint64_t ty_millis(void)
         return 0;
     }
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t ty_micros(void)
+{
+    struct timespec ts;
+    int r;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    r = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    r = clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    if (r < 0) {
+        ty_log(TY_LOG_WARNING, "clock_gettime() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
 #endif
@@ -388,7 +416,10 @@ int ty_terminal_setup(int flags)
         orig_termios = tio;
         saved_termios = true;
 
-        atexit(ty_terminal_restore);
+        if (!registered_restore) {
+            atexit(ty_terminal_restore);
+            registered_restore = true;
+        }
     }
 
     if (flags & TY_TERMINAL_RAW) {
@@ -421,4 +452,5 @@ void ty_terminal_restore(void)
         return;
 
     tcsetattr(STDIN_FILENO, TCSADRAIN, &orig_termios);
+    saved_termios = false;
 }
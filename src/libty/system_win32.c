@@ -24,6 +24,7 @@ static GetTickCount64_func *GetTickCount64_ = GetTickCount64_resolve;
 
 static DWORD orig_console_mode;
 static bool saved_console_mode;
+static bool registered_restore;
 
 char *ty_win32_strerror(DWORD err)
 {
@@ -80,6 +81,19 @@ uint64_t ty_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t ty_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER counter;
+
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&counter);
+
+    return (uint64_t)(counter.QuadPart / freq.QuadPart * 1000000 +
+                      counter.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+}
+
 void ty_delay(unsigned int ms)
 {
     Sleep(ms);
@@ -234,7 +248,10 @@ int ty_terminal_setup(int flags)
         orig_console_mode = mode;
         saved_console_mode = true;
 
-        atexit(ty_terminal_restore);
+        if (!registered_restore) {
+            atexit(ty_terminal_restore);
+            registered_restore = true;
+        }
     }
 
     mode |= ENABLE_PROCESSED_INPUT;
@@ -259,4 +276,5 @@ void ty_terminal_restore(void)
         return;
 
     SetConsoleMode(GetStdHandle(STD_INPUT_HANDLE), orig_console_mode);
+    saved_console_mode = false;
 }
@@ -10,8 +10,11 @@
 
 #include "common_priv.h"
 #include "../libhs/array.h"
+#include "metrics.h"
+#include "recorder.h"
 #include "system.h"
 #include "task.h"
+#include "trace.h"
 
 struct ty_pool {
     int unused_timeout;
@@ -21,6 +24,7 @@ struct ty_pool {
 
     _HS_ARRAY(ty_thread) worker_threads;
     size_t busy_workers;
+    size_t blocked_workers;
 
     _HS_ARRAY(ty_task *) pending_tasks;
     ty_cond pending_cond;
@@ -30,6 +34,27 @@ struct ty_pool {
 
 static ty_pool *default_pool;
 static TY_THREAD_LOCAL ty_task *current_task;
+static TY_THREAD_LOCAL ty_pool *current_pool;
+
+static struct {
+    ty_metric *queue_depth;
+    ty_metric *queue_wait;
+    ty_metric *active_threads;
+} pool_metrics;
+
+static void init_pool_metrics(void)
+{
+    if (pool_metrics.queue_depth)
+        return;
+
+    pool_metrics.queue_wait = ty_metric_get(TY_METRIC_HISTOGRAM, "tytools_pool_queue_wait_seconds",
+                                            "Time spent by tasks waiting for a worker thread",
+                                            NULL, NULL);
+    pool_metrics.active_threads = ty_metric_get(TY_METRIC_GAUGE, "tytools_pool_active_threads",
+                                                "Worker threads running a task", NULL, NULL);
+    pool_metrics.queue_depth = ty_metric_get(TY_METRIC_GAUGE, "tytools_pool_queue_depth",
+                                             "Tasks waiting for a worker thread", NULL, NULL);
+}
 
 int ty_pool_new(ty_pool **rpool)
 {
@@ -74,6 +99,7 @@ void ty_pool_free(ty_pool *pool)
                 ty_task *task = pool->pending_tasks.values[i];
                 ty_task_unref(task);
             }
+            ty_metric_add(pool_metrics.queue_depth, -(int64_t)pool->pending_tasks.count);
             _hs_array_release(&pool->pending_tasks);
             pool->max_threads = 0;
             ty_cond_broadcast(&pool->pending_cond);
@@ -246,6 +272,7 @@ static void change_task_status(ty_task *task, ty_task_status status)
     ty_message_data msg = {0};
 
     task->status = status;
+    ty_recorder_record(TY_RECORDER_EVENT_TASK_STATUS, task->name, (int)status, task->ret);
 
     ty_mutex_lock(&task->mutex);
     ty_cond_broadcast(&task->cond);
@@ -263,16 +290,41 @@ static void run_task(ty_task *task)
     assert(task->status <= TY_TASK_STATUS_PENDING);
 
     ty_task *previous_task;
+    char action[32];
+    uint64_t start;
 
     previous_task = current_task;
     current_task = task;
 
+    /* Board tasks are named "<action>@<board>", metrics are labelled by action only or we
+       would create new series for every board and never free them. */
+    {
+        size_t len = strcspn(task->name, "@");
+        if (len >= sizeof(action))
+            len = sizeof(action) - 1;
+        memcpy(action, task->name, len);
+        action[len] = 0;
+    }
+
     change_task_status(task, TY_TASK_STATUS_RUNNING);
+    TY_TRACE_BEGIN("libty", action, task->name);
+    start = ty_micros();
     task->ret = (*task->task_run)(task);
     if (task->task_finalize) {
         (*task->task_finalize)(task);
         task->task_finalize = NULL;
     }
+    TY_TRACE_END("libty", action);
+
+    ty_metric_observe(ty_metric_get(TY_METRIC_HISTOGRAM, "tytools_task_duration_seconds",
+                                    "Duration of board tasks (upload, reset, reboot)",
+                                    "action", action), ty_micros() - start);
+    if (task->ret < 0)
+        ty_metric_add(ty_metric_get(TY_METRIC_COUNTER, "tytools_task_failures_total",
+                                    "Failed board tasks", "action", action), 1);
+    // Keep the events that led to the failure, they will be overwritten soon
+    if (task->ret < 0)
+        ty_recorder_dump(NULL);
     change_task_status(task, TY_TASK_STATUS_FINISHED);
 
     current_task = previous_task;
@@ -282,6 +334,8 @@ static int worker_thread_main(void *udata)
 {
     ty_pool *pool = udata;
 
+    current_pool = pool;
+
     while (true) {
         uint64_t start;
         bool run;
@@ -293,7 +347,7 @@ static int worker_thread_main(void *udata)
         run = true;
         start = ty_millis();
         while (true) {
-            if (pool->worker_threads.count > pool->max_threads)
+            if (pool->worker_threads.count - pool->blocked_workers > pool->max_threads)
                 goto timeout;
             if (pool->pending_tasks.count) {
                 task = pool->pending_tasks.values[0];
@@ -310,7 +364,19 @@ static int worker_thread_main(void *udata)
         pool->busy_workers++;
         ty_mutex_unlock(&pool->mutex);
 
+        if (task->queue_time) {
+            uint64_t now = ty_micros();
+
+            ty_metric_add(pool_metrics.queue_depth, -1);
+            ty_metric_observe(pool_metrics.queue_wait, now - task->queue_time);
+            if (ty_trace_active)
+                ty_trace_complete("libty", "ty_pool_queue", task->name, task->queue_time,
+                                  now - task->queue_time);
+        }
+
+        ty_metric_add(pool_metrics.active_threads, 1);
         run_task(task);
+        ty_metric_add(pool_metrics.active_threads, -1);
         ty_task_unref(task);
     }
 
@@ -354,6 +420,38 @@ static int start_worker_thread(ty_pool *pool)
     return 0;
 }
 
+/* Tasks that wait for a shared resource (such as a USB hub slot) call this so that the pool
+   can start another worker for pending tasks, which may not need the same resource. Extra
+   workers exit once blocked workers resume. */
+void _ty_task_block_begin(void)
+{
+    ty_pool *pool = current_pool;
+
+    if (!pool)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    pool->blocked_workers++;
+    if (pool->pending_tasks.count && pool->busy_workers == pool->worker_threads.count &&
+            pool->worker_threads.count - pool->blocked_workers < pool->max_threads) {
+        // Not fatal, the task will just have to wait for a busy worker
+        start_worker_thread(pool);
+    }
+    ty_mutex_unlock(&pool->mutex);
+}
+
+void _ty_task_block_end(void)
+{
+    ty_pool *pool = current_pool;
+
+    if (!pool)
+        return;
+
+    ty_mutex_lock(&pool->mutex);
+    pool->blocked_workers--;
+    ty_mutex_unlock(&pool->mutex);
+}
+
 int ty_task_start(ty_task *task)
 {
     assert(task);
@@ -372,7 +470,7 @@ int ty_task_start(ty_task *task)
     ty_mutex_lock(&pool->mutex);
 
     if (pool->busy_workers == pool->worker_threads.count &&
-            pool->worker_threads.count < pool->max_threads) {
+            pool->worker_threads.count - pool->blocked_workers < pool->max_threads) {
         r = start_worker_thread(pool);
         if (r < 0)
             goto cleanup;
@@ -384,6 +482,9 @@ int ty_task_start(ty_task *task)
         goto cleanup;
     }
     ty_task_ref(task);
+    init_pool_metrics();
+    ty_metric_add(pool_metrics.queue_depth, 1);
+    task->queue_time = ty_micros();
     ty_cond_signal(&pool->pending_cond);
 
     change_task_status(task, TY_TASK_STATUS_PENDING);
@@ -413,6 +514,7 @@ int ty_task_wait(ty_task *task, ty_task_status status, int timeout)
                 for (size_t i = 0; i < pool->pending_tasks.count; i++) {
                     if (pool->pending_tasks.values[i] == task) {
                         _hs_array_remove(&pool->pending_tasks, i, 1);
+                        ty_metric_add(pool_metrics.queue_depth, -1);
                         break;
                     }
                 }
@@ -27,6 +27,7 @@ typedef struct ty_task {
     char *name;
     ty_task_status status;
     ty_pool *pool;
+    uint64_t queue_time;
 
     ty_message_func *user_callback;
     void *user_callback_udata;
@@ -48,6 +49,7 @@ typedef struct ty_task {
             struct ty_board *board;
             struct ty_firmware **fws;
             unsigned int fws_count;
+            struct ty_firmware_loader *loader;
             int flags;
         } upload;
 
@@ -26,13 +26,17 @@ struct thread_context {
 static void *thread_proc(void *udata)
 {
     struct thread_context ctx = *(struct thread_context *)udata;
+    int r;
 
     pthread_mutex_lock(&thread_mutex);
     ctx.thread->init = true;
     pthread_cond_broadcast(&thread_cond);
     pthread_mutex_unlock(&thread_mutex);
 
-    return (void *)(intptr_t)(*ctx.f)(ctx.udata);
+    r = (*ctx.f)(ctx.udata);
+    _ty_recorder_release_thread();
+
+    return (void *)(intptr_t)r;
 }
 
 int ty_thread_create(ty_thread *thread, ty_thread_func *f, void *udata)
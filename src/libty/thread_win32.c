@@ -41,6 +41,8 @@ static unsigned int __stdcall thread_proc(void *udata)
     SetEvent(ctx.ev);
 
     code.i = (*ctx.f)(ctx.udata);
+    _ty_recorder_release_thread();
+
     return code.dw;
 }
 
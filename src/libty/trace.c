@@ -0,0 +1,292 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "../libhs/common.h"
+#include "system.h"
+#include "thread.h"
+#include "trace.h"
+
+/* Events are written as they happen in the Trace Event Format (JSON array form), which is
+   understood by chrome://tracing and Perfetto. The closing bracket is optional in this
+   form, so traces of crashed processes can still be opened.
+
+   Several sessions can be open at once (e.g. a server-wide trace and the trace of one
+   server client), each writes to its own file. Sessions are refcounted by filename.
+   Each thread remembers the sessions that saw its open spans, so a session started in
+   the middle of a span does not get an E event without its B event. */
+
+#define MAX_SESSIONS 8
+#define MAX_SPAN_DEPTH 32
+
+struct trace_session {
+    FILE *fp;
+    char *filename;
+    unsigned int refcount;
+
+    unsigned int serial;
+    uint64_t origin;
+};
+
+bool ty_trace_active;
+
+static ty_mutex trace_mutex;
+static bool trace_mutex_ready;
+static struct trace_session trace_sessions[MAX_SESSIONS];
+static unsigned int trace_sessions_count;
+static unsigned int trace_last_serial;
+static unsigned int trace_epoch;
+static unsigned int trace_next_tid;
+
+static TY_THREAD_LOCAL unsigned int trace_tid;
+static TY_THREAD_LOCAL unsigned int trace_spans[MAX_SPAN_DEPTH];
+static TY_THREAD_LOCAL unsigned int trace_spans_depth;
+static TY_THREAD_LOCAL unsigned int trace_spans_epoch;
+
+static void write_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            fputc('\\', fp);
+            fputc(c, fp);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// Only sessions whose serial is at most max_serial get the event, returns the last serial
+static unsigned int write_event(char phase, const char *cat, const char *name,
+                                const char *detail, uint64_t ts, uint64_t duration,
+                                unsigned int max_serial)
+{
+    unsigned int serial;
+
+    if (!trace_tid)
+        trace_tid = _ty_atomic_fetch_add(&trace_next_tid, 1) + 1;
+
+    ty_mutex_lock(&trace_mutex);
+
+    for (unsigned int i = 0; i < MAX_SESSIONS; i++) {
+        struct trace_session *session = &trace_sessions[i];
+        FILE *fp = session->fp;
+
+        if (!fp || session->serial > max_serial)
+            continue;
+
+        fprintf(fp, "{\"ph\": \"%c\", \"cat\": ", phase);
+        write_string(fp, cat);
+        fputs(", \"name\": ", fp);
+        write_string(fp, name);
+        fprintf(fp, ", \"pid\": 1, \"tid\": %u, \"ts\": %" PRIu64, trace_tid,
+                ts > session->origin ? ts - session->origin : 0);
+        if (phase == 'X')
+            fprintf(fp, ", \"dur\": %" PRIu64, duration);
+        if (phase == 'i')
+            fputs(", \"s\": \"t\"", fp);
+        if (detail) {
+            fputs(", \"args\": {\"detail\": ", fp);
+            write_string(fp, detail);
+            fputc('}', fp);
+        }
+        fputs("},\n", fp);
+    }
+    serial = trace_last_serial;
+
+    ty_mutex_unlock(&trace_mutex);
+
+    return serial;
+}
+
+static void reset_stale_spans(void)
+{
+    unsigned int epoch = _ty_atomic_load(&trace_epoch);
+
+    // Spans left open when every session was stopped are meaningless now
+    if (trace_spans_epoch != epoch) {
+        trace_spans_depth = 0;
+        trace_spans_epoch = epoch;
+    }
+}
+
+static void begin_span(const char *cat, const char *name, const char *detail)
+{
+    unsigned int serial;
+
+    reset_stale_spans();
+
+    serial = write_event('B', cat, name, detail, ty_micros(), 0, UINT_MAX);
+    if (trace_spans_depth < MAX_SPAN_DEPTH)
+        trace_spans[trace_spans_depth] = serial;
+    trace_spans_depth++;
+}
+
+static void end_span(const char *cat, const char *name)
+{
+    unsigned int serial;
+
+    reset_stale_spans();
+
+    // The B event of this span was never recorded, don't write an orphan E event
+    if (!trace_spans_depth)
+        return;
+    trace_spans_depth--;
+    if (trace_spans_depth >= MAX_SPAN_DEPTH)
+        return;
+    serial = trace_spans[trace_spans_depth];
+
+    write_event('E', cat, name, NULL, ty_micros(), 0, serial);
+}
+
+static void trace_libhs_handler(const char *name, bool begin, void *udata)
+{
+    TY_UNUSED(udata);
+
+    if (begin) {
+        begin_span("libhs", name, NULL);
+    } else {
+        end_span("libhs", name);
+    }
+}
+
+int ty_trace_start(const char *filename)
+{
+    struct trace_session *session = NULL;
+    FILE *fp = NULL;
+    char *filename2 = NULL;
+    int r;
+
+    if (!filename) {
+        filename = getenv("TYTOOLS_TRACE");
+        if (!filename || !filename[0])
+            return 0;
+    }
+
+    if (!trace_mutex_ready) {
+        r = ty_mutex_init(&trace_mutex);
+        if (r < 0)
+            return r;
+        trace_mutex_ready = true;
+    }
+
+    ty_mutex_lock(&trace_mutex);
+
+    for (unsigned int i = 0; i < MAX_SESSIONS; i++) {
+        if (trace_sessions[i].fp && strcmp(trace_sessions[i].filename, filename) == 0) {
+            trace_sessions[i].refcount++;
+            r = (int)i + 1;
+            goto cleanup;
+        }
+    }
+    for (unsigned int i = 0; i < MAX_SESSIONS; i++) {
+        if (!trace_sessions[i].fp) {
+            session = &trace_sessions[i];
+            break;
+        }
+    }
+    if (!session) {
+        r = ty_error(TY_ERROR_BUSY, "Too many trace sessions");
+        goto cleanup;
+    }
+
+    filename2 = strdup(filename);
+    if (!filename2) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    fp = fopen(filename, "w");
+    if (!fp) {
+        r = ty_error(TY_ERROR_ACCESS, "Cannot open trace file '%s': %s", filename,
+                     strerror(errno));
+        goto cleanup;
+    }
+    fputs("[\n", fp);
+
+    session->fp = fp;
+    session->filename = filename2;
+    session->refcount = 1;
+    session->serial = ++trace_last_serial;
+    session->origin = ty_micros();
+    fp = NULL;
+    filename2 = NULL;
+
+    if (!trace_sessions_count++) {
+        hs_trace_set_handler(trace_libhs_handler, NULL);
+        ty_trace_active = true;
+    }
+
+    r = (int)(session - trace_sessions) + 1;
+cleanup:
+    ty_mutex_unlock(&trace_mutex);
+    if (fp)
+        fclose(fp);
+    free(filename2);
+    return r;
+}
+
+void ty_trace_stop(int session_id)
+{
+    struct trace_session *session;
+
+    if (session_id <= 0 || session_id > MAX_SESSIONS)
+        return;
+    session = &trace_sessions[session_id - 1];
+
+    ty_mutex_lock(&trace_mutex);
+
+    if (!session->fp || --session->refcount) {
+        ty_mutex_unlock(&trace_mutex);
+        return;
+    }
+
+    fputs("{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"args\": {\"name\": \"TyTools\"}}\n]\n",
+          session->fp);
+    fclose(session->fp);
+    free(session->filename);
+    memset(session, 0, sizeof(*session));
+
+    if (!--trace_sessions_count) {
+        ty_trace_active = false;
+        hs_trace_set_handler(NULL, NULL);
+        _ty_atomic_fetch_add(&trace_epoch, 1);
+    }
+
+    ty_mutex_unlock(&trace_mutex);
+
+    /* Keep the mutex around, threads that saw ty_trace_active before we changed it may
+       still be waiting for it. */
+}
+
+void ty_trace_begin(const char *cat, const char *name, const char *detail)
+{
+    begin_span(cat, name, detail);
+}
+
+void ty_trace_end(const char *cat, const char *name)
+{
+    end_span(cat, name);
+}
+
+void ty_trace_instant(const char *cat, const char *name, const char *detail)
+{
+    write_event('i', cat, name, detail, ty_micros(), 0, UINT_MAX);
+}
+
+void ty_trace_complete(const char *cat, const char *name, const char *detail,
+                       uint64_t start, uint64_t duration)
+{
+    write_event('X', cat, name, detail, start, duration, UINT_MAX);
+}
@@ -0,0 +1,49 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_TRACE_H
+#define TY_TRACE_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+TY_PUBLIC extern bool ty_trace_active;
+
+// Use the macros below in hot paths, they don't call anything when tracing is inactive
+#define TY_TRACE_BEGIN(cat, name, detail) \
+    do { \
+        if (ty_trace_active) \
+            ty_trace_begin((cat), (name), (detail)); \
+    } while (false)
+#define TY_TRACE_END(cat, name) \
+    do { \
+        if (ty_trace_active) \
+            ty_trace_end((cat), (name)); \
+    } while (false)
+#define TY_TRACE_INSTANT(cat, name, detail) \
+    do { \
+        if (ty_trace_active) \
+            ty_trace_instant((cat), (name), (detail)); \
+    } while (false)
+
+// Returns a session identifier for ty_trace_stop(), or 0 if TYTOOLS_TRACE is not set
+TY_PUBLIC int ty_trace_start(const char *filename);
+TY_PUBLIC void ty_trace_stop(int session);
+
+TY_PUBLIC void ty_trace_begin(const char *cat, const char *name, const char *detail);
+TY_PUBLIC void ty_trace_end(const char *cat, const char *name);
+TY_PUBLIC void ty_trace_instant(const char *cat, const char *name, const char *detail);
+TY_PUBLIC void ty_trace_complete(const char *cat, const char *name, const char *detail,
+                                 uint64_t start, uint64_t duration);
+
+TY_C_END
+
+#endif
@@ -0,0 +1,971 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // Needed for posix_openpt() and ptsname() with glibc
+    #define _GNU_SOURCE
+#endif
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
+#include "../libhs/device.h"
+#include "../libhs/serial.h"
+#include "../libty/firmware.h"
+#include "../libty/system.h"
+#include "../libty/thread.h"
+#include "main.h"
+
+enum bench_workload {
+    WORKLOAD_RX = 1,
+    WORKLOAD_TX = 2,
+    WORKLOAD_ECHO = 4,
+    WORKLOAD_UPLOAD = 8,
+    WORKLOAD_REBOOT = 16
+};
+
+enum peer_mode {
+    PEER_ECHO,
+    PEER_SINK,
+    PEER_SOURCE
+};
+
+struct bench_target {
+    const char *name;
+    const char *iface_name;
+
+    ty_board *board;
+    ty_board_interface *iface;
+
+    hs_port *port;
+};
+
+struct pty_peer {
+    int fd;
+    ty_thread thread;
+    bool started;
+
+    ty_mutex mutex;
+    enum peer_mode mode;
+    bool stop;
+};
+
+#define IO_TIMEOUT 2000
+#define WAIT_TIMEOUT 15000
+#define MAX_SAMPLES 10000
+
+static const char *bench_device;
+static bool bench_pty;
+static int bench_duration;
+static unsigned int bench_count;
+static unsigned int bench_size;
+static const char *bench_firmware;
+static bool bench_output_json;
+
+static unsigned int bench_results_count;
+
+static void print_bench_usage(FILE *f)
+{
+    fprintf(f, "usage: %s bench [options] <workloads>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Bench options:\n"
+               "   -D, --device <path>      Use serial device <path> instead of a board\n"
+               "       --pty                Use a pseudo-terminal with a built-in peer\n\n"
+               "   -d, --duration <ms>      Duration of throughput workloads (default: 5000)\n"
+               "   -n, --count <count>      Iterations for latency workloads\n"
+               "                            Defaults to 200 for echo, 3 for upload and reboot\n"
+               "   -s, --size <bytes>       Size of echo payloads (default: 32)\n"
+               "   -f, --firmware <file>    Firmware used by the upload workload\n\n"
+               "   -j, --json               Output results in JSON format\n\n");
+
+    fprintf(f, "Workloads:\n"
+               "   rx                       Read throughput, the board must stream data\n"
+               "   tx                       Write throughput\n"
+               "   echo                     Round-trip latency, the board must echo data back\n"
+               "   upload                   Duration of reboot, upload and reset phases\n"
+               "   reboot                   Reboot-to-bootloader and reset-to-run latencies\n\n"
+               "Serial workloads (rx, tx and echo) can run without hardware with --pty, or with\n"
+               "a loopback serial device and --device.\n");
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t sample1 = *(const uint64_t *)a;
+    uint64_t sample2 = *(const uint64_t *)b;
+
+    return (sample1 > sample2) - (sample1 < sample2);
+}
+
+static void print_json_string(const char *str)
+{
+    putchar('"');
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void begin_result(const char *name)
+{
+    if (bench_output_json) {
+        printf("%s\n    {\"workload\": \"%s\"", bench_results_count ? "," : "", name);
+    } else {
+        printf("%s:\n", name);
+    }
+    bench_results_count++;
+}
+
+static void end_result(void)
+{
+    if (bench_output_json)
+        printf("}");
+    fflush(stdout);
+}
+
+static void print_throughput(uint64_t bytes, uint64_t duration)
+{
+    double rate = duration ? (double)bytes * 1000000.0 / (double)duration : 0.0;
+
+    if (bench_output_json) {
+        printf(", \"bytes\": %" PRIu64 ", \"duration_us\": %" PRIu64 ", \"bytes_per_second\": %.0f",
+               bytes, duration, rate);
+    } else {
+        printf("  + bytes: %" PRIu64 " in %.3f s\n", bytes, (double)duration / 1000000.0);
+        printf("  + throughput: %.1f kB/s\n", rate / 1000.0);
+    }
+}
+
+static void print_latencies(const char *name, uint64_t *samples, unsigned int count)
+{
+    uint64_t total = 0;
+
+    if (!count)
+        return;
+
+    qsort(samples, count, sizeof(*samples), compare_samples);
+    for (unsigned int i = 0; i < count; i++)
+        total += samples[i];
+
+#define PERCENTILE(p) (samples[(count - 1) * (p) / 100])
+    if (bench_output_json) {
+        printf(", \"%s\": {\"count\": %u, \"min_us\": %" PRIu64 ", \"mean_us\": %" PRIu64
+               ", \"p50_us\": %" PRIu64 ", \"p90_us\": %" PRIu64 ", \"p99_us\": %" PRIu64
+               ", \"max_us\": %" PRIu64 "}", name, count, samples[0], total / count,
+               PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), samples[count - 1]);
+    } else {
+        printf("  + %s (%u samples, ms): min %.3f, mean %.3f, p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+               name, count, (double)samples[0] / 1000.0, (double)(total / count) / 1000.0,
+               (double)PERCENTILE(50) / 1000.0, (double)PERCENTILE(90) / 1000.0,
+               (double)PERCENTILE(99) / 1000.0, (double)samples[count - 1] / 1000.0);
+    }
+#undef PERCENTILE
+}
+
+#ifndef _WIN32
+
+static int peer_thread(void *udata)
+{
+    struct pty_peer *peer = udata;
+    char buf[4096];
+    char pattern[4096];
+    size_t pending = 0;
+
+    for (size_t i = 0; i < sizeof(pattern); i++)
+        pattern[i] = (char)('0' + i % 64);
+
+    while (true) {
+        struct pollfd pfd = {.fd = peer->fd, .events = POLLIN};
+        enum peer_mode mode;
+        bool stop;
+        ssize_t r;
+
+        ty_mutex_lock(&peer->mutex);
+        mode = peer->mode;
+        stop = peer->stop;
+        ty_mutex_unlock(&peer->mutex);
+        if (stop)
+            break;
+
+        if (mode == PEER_SOURCE || pending)
+            pfd.events |= POLLOUT;
+        r = poll(&pfd, 1, 100);
+        if (r <= 0)
+            continue;
+
+        if (pending && (pfd.revents & POLLOUT)) {
+            r = write(peer->fd, buf, pending);
+            if (r > 0) {
+                memmove(buf, buf + r, pending - (size_t)r);
+                pending -= (size_t)r;
+            }
+        } else if (mode == PEER_SOURCE && (pfd.revents & POLLOUT)) {
+            r = write(peer->fd, pattern, sizeof(pattern));
+            TY_UNUSED(r);
+        }
+
+        if (!pending && (pfd.revents & POLLIN)) {
+            r = read(peer->fd, buf, sizeof(buf));
+            if (r > 0 && mode == PEER_ECHO)
+                pending = (size_t)r;
+        } else if (pfd.revents & (POLLERR | POLLHUP)) {
+            // The slave side is not open (yet), don't spin
+            ty_delay(10);
+        }
+    }
+
+    return 0;
+}
+
+static int start_pty_peer(struct pty_peer *peer, const char **rpath)
+{
+    const char *path;
+    bool mutex_ready = false;
+    int r;
+
+    peer->fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (peer->fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "posix_openpt() failed: %s", strerror(errno));
+    if (grantpt(peer->fd) < 0 || unlockpt(peer->fd) < 0 || !(path = ptsname(peer->fd))) {
+        r = ty_error(TY_ERROR_SYSTEM, "Failed to set up pseudo-terminal: %s", strerror(errno));
+        goto error;
+    }
+    fcntl(peer->fd, F_SETFL, fcntl(peer->fd, F_GETFL) | O_NONBLOCK);
+    fcntl(peer->fd, F_SETFD, FD_CLOEXEC);
+
+    r = ty_mutex_init(&peer->mutex);
+    if (r < 0)
+        goto error;
+    mutex_ready = true;
+    peer->mode = PEER_ECHO;
+
+    r = ty_thread_create(&peer->thread, peer_thread, peer);
+    if (r < 0)
+        goto error;
+    peer->started = true;
+
+    *rpath = path;
+    return 0;
+
+error:
+    // Leave nothing behind, stop_pty_peer() releases the mutex whenever the fd is valid
+    if (mutex_ready)
+        ty_mutex_release(&peer->mutex);
+    close(peer->fd);
+    peer->fd = -1;
+    return r;
+}
+
+static void stop_pty_peer(struct pty_peer *peer)
+{
+    if (peer->started) {
+        ty_mutex_lock(&peer->mutex);
+        peer->stop = true;
+        ty_mutex_unlock(&peer->mutex);
+
+        ty_thread_join(&peer->thread);
+        peer->started = false;
+    }
+    if (peer->fd >= 0) {
+        ty_mutex_release(&peer->mutex);
+        close(peer->fd);
+        peer->fd = -1;
+    }
+}
+
+static void set_peer_mode(struct pty_peer *peer, enum peer_mode mode)
+{
+    if (!peer->started)
+        return;
+
+    ty_mutex_lock(&peer->mutex);
+    peer->mode = mode;
+    ty_mutex_unlock(&peer->mutex);
+}
+
+#else
+
+static int start_pty_peer(struct pty_peer *peer, const char **rpath)
+{
+    TY_UNUSED(peer);
+    TY_UNUSED(rpath);
+
+    return ty_error(TY_ERROR_UNSUPPORTED, "Pseudo-terminals are not supported on this platform");
+}
+
+static void stop_pty_peer(struct pty_peer *peer)
+{
+    TY_UNUSED(peer);
+}
+
+static void set_peer_mode(struct pty_peer *peer, enum peer_mode mode)
+{
+    TY_UNUSED(peer);
+    TY_UNUSED(mode);
+}
+
+#endif
+
+static int open_target_serial(struct bench_target *target)
+{
+    int r;
+
+    if (target->port || target->iface)
+        return 0;
+
+    if (!target->board) {
+        r = hs_port_open_serial_path(target->name, HS_PORT_MODE_RW, &target->port);
+        if (r < 0)
+            return ty_libhs_translate_error(r);
+        target->iface_name = "Device";
+
+        return 0;
+    }
+
+    r = ty_board_wait_for(target->board, TY_BOARD_CAPABILITY_SERIAL, WAIT_TIMEOUT);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_TIMEOUT, "Board '%s' is not available for serial I/O",
+                        target->name);
+
+    r = ty_board_open_interface(target->board, TY_BOARD_CAPABILITY_SERIAL, &target->iface);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O", target->name);
+    target->iface_name = ty_board_interface_get_name(target->iface);
+
+    return 0;
+}
+
+static void close_target_serial(struct bench_target *target)
+{
+    hs_port_close(target->port);
+    target->port = NULL;
+    ty_board_interface_close(target->iface);
+    target->iface = NULL;
+}
+
+static ssize_t read_target(struct bench_target *target, char *buf, size_t size, int timeout)
+{
+    ssize_t r;
+
+    if (target->port) {
+        r = hs_serial_read(target->port, (uint8_t *)buf, size, timeout);
+        if (r < 0)
+            return ty_libhs_translate_error((int)r);
+        return r;
+    } else {
+        return ty_board_serial_read(target->board, buf, size, timeout);
+    }
+}
+
+static ssize_t write_target(struct bench_target *target, const char *buf, size_t size)
+{
+    ssize_t r;
+
+    if (target->port) {
+        r = hs_serial_write(target->port, (const uint8_t *)buf, size, IO_TIMEOUT);
+        if (r < 0)
+            return ty_libhs_translate_error((int)r);
+        return r;
+    } else {
+        return ty_board_serial_write(target->board, buf, size);
+    }
+}
+
+static int drain_target(struct bench_target *target)
+{
+    char buf[1024];
+    ssize_t r;
+
+    do {
+        r = read_target(target, buf, sizeof(buf), 50);
+    } while (r > 0);
+
+    return (int)r;
+}
+
+static int bench_rx(struct bench_target *target, struct pty_peer *peer)
+{
+    char buf[8192];
+    uint64_t bytes = 0, start, end;
+    ssize_t r;
+
+    r = open_target_serial(target);
+    if (r < 0)
+        return (int)r;
+    set_peer_mode(peer, PEER_SOURCE);
+
+    // Start measuring with the first byte, the board may need some time to start streaming
+    r = read_target(target, buf, sizeof(buf), IO_TIMEOUT);
+    if (r < 0)
+        goto cleanup;
+    if (!r) {
+        r = ty_error(TY_ERROR_TIMEOUT, "No data received from '%s', is it streaming?", target->name);
+        goto cleanup;
+    }
+
+    start = ty_micros();
+    end = start + (uint64_t)bench_duration * 1000;
+    while (true) {
+        uint64_t now = ty_micros();
+        if (now >= end)
+            break;
+
+        r = read_target(target, buf, sizeof(buf), (int)((end - now + 999) / 1000));
+        if (r < 0)
+            goto cleanup;
+        bytes += (uint64_t)r;
+    }
+    end = ty_micros();
+
+    begin_result("rx");
+    print_throughput(bytes, end - start);
+    end_result();
+
+    r = 0;
+cleanup:
+    set_peer_mode(peer, PEER_ECHO);
+    return (int)r;
+}
+
+static int bench_tx(struct bench_target *target, struct pty_peer *peer)
+{
+    char buf[4096];
+    char discard[4096];
+    uint64_t bytes = 0, start, end;
+    ssize_t r;
+
+    r = open_target_serial(target);
+    if (r < 0)
+        return (int)r;
+    set_peer_mode(peer, PEER_SINK);
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+        buf[i] = (char)('0' + i % 64);
+
+    start = ty_micros();
+    end = start + (uint64_t)bench_duration * 1000;
+    while (ty_micros() < end) {
+        r = write_target(target, buf, sizeof(buf));
+        if (r < 0)
+            goto cleanup;
+        bytes += (uint64_t)r;
+
+        // Boards running an echo sketch block if nobody reads what they send back
+        r = read_target(target, discard, sizeof(discard), 0);
+        if (r < 0)
+            goto cleanup;
+    }
+    end = ty_micros();
+
+    begin_result("tx");
+    print_throughput(bytes, end - start);
+    end_result();
+
+    r = drain_target(target);
+cleanup:
+    set_peer_mode(peer, PEER_ECHO);
+    return (int)r;
+}
+
+static int bench_echo(struct bench_target *target)
+{
+    unsigned int count = bench_count ? bench_count : 200;
+    char *payload = NULL, *received = NULL;
+    uint64_t *samples = NULL;
+    int r;
+
+    if (count > MAX_SAMPLES)
+        count = MAX_SAMPLES;
+
+    r = open_target_serial(target);
+    if (r < 0)
+        return r;
+    r = drain_target(target);
+    if (r < 0)
+        return r;
+
+    payload = malloc(bench_size);
+    received = malloc(bench_size);
+    samples = malloc(count * sizeof(*samples));
+    if (!payload || !received || !samples) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        size_t len = 0;
+        uint64_t start;
+
+        for (unsigned int j = 0; j < bench_size; j++)
+            payload[j] = (char)('a' + (i + j) % 26);
+
+        start = ty_micros();
+        r = (int)write_target(target, payload, bench_size);
+        if (r < 0)
+            goto cleanup;
+        while (len < bench_size) {
+            ssize_t ret = read_target(target, received + len, bench_size - len, IO_TIMEOUT);
+            if (ret < 0) {
+                r = (int)ret;
+                goto cleanup;
+            }
+            if (!ret) {
+                r = ty_error(TY_ERROR_TIMEOUT, "Timed out while waiting for echo from '%s'",
+                             target->name);
+                goto cleanup;
+            }
+            len += (size_t)ret;
+        }
+        samples[i] = ty_micros() - start;
+
+        if (memcmp(payload, received, bench_size) != 0) {
+            r = ty_error(TY_ERROR_OTHER, "Echoed data from '%s' does not match", target->name);
+            goto cleanup;
+        }
+    }
+
+    begin_result("echo");
+    if (bench_output_json) {
+        printf(", \"size\": %u", bench_size);
+    } else {
+        printf("  + payload: %u bytes\n", bench_size);
+    }
+    print_latencies("latency", samples, count);
+    end_result();
+
+    r = 0;
+cleanup:
+    free(samples);
+    free(received);
+    free(payload);
+    return r;
+}
+
+static int wait_for_capability(struct bench_target *target, ty_board_capability cap)
+{
+    int r;
+
+    r = ty_board_wait_for(target->board, cap, WAIT_TIMEOUT);
+    if (r < 0)
+        return r;
+    if (!r)
+        return ty_error(TY_ERROR_TIMEOUT, "Timed out while waiting for '%s' (%s capability)",
+                        target->name, ty_board_capability_get_name(cap));
+
+    return 0;
+}
+
+static int reboot_target(struct bench_target *target, uint64_t *rtime)
+{
+    uint64_t start;
+    int r;
+
+    start = ty_micros();
+    r = ty_board_reboot(target->board);
+    if (r < 0)
+        return r;
+    r = wait_for_capability(target, TY_BOARD_CAPABILITY_UPLOAD);
+    if (r < 0)
+        return r;
+    *rtime = ty_micros() - start;
+
+    return 0;
+}
+
+static int reset_target(struct bench_target *target, uint64_t *rtime)
+{
+    uint64_t start;
+    int r;
+
+    start = ty_micros();
+    r = ty_board_reset(target->board);
+    if (r < 0)
+        return r;
+    r = wait_for_capability(target, TY_BOARD_CAPABILITY_RUN);
+    if (r < 0)
+        return r;
+    *rtime = ty_micros() - start;
+
+    return 0;
+}
+
+static int bench_reboot(struct bench_target *target)
+{
+    unsigned int count = bench_count ? bench_count : 3;
+    uint64_t *samples;
+    int r;
+
+    if (count > MAX_SAMPLES)
+        count = MAX_SAMPLES;
+
+    // The serial interface goes away with each reboot
+    close_target_serial(target);
+
+    samples = calloc(count * 2, sizeof(*samples));
+    if (!samples)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    if (!ty_board_has_capability(target->board, TY_BOARD_CAPABILITY_RUN)) {
+        uint64_t dummy;
+
+        r = reset_target(target, &dummy);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        r = reboot_target(target, &samples[i]);
+        if (r < 0)
+            goto cleanup;
+        r = reset_target(target, &samples[count + i]);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    begin_result("reboot");
+    print_latencies("reboot", samples, count);
+    print_latencies("reset", samples + count, count);
+    end_result();
+
+    r = 0;
+cleanup:
+    free(samples);
+    return r;
+}
+
+struct upload_progress_context {
+    uint64_t first;
+};
+
+static int upload_progress_callback(const ty_board *board, const ty_firmware *fw,
+                                    size_t uploaded_size, size_t flash_size, void *udata)
+{
+    TY_UNUSED(board);
+    TY_UNUSED(fw);
+    TY_UNUSED(uploaded_size);
+    TY_UNUSED(flash_size);
+
+    struct upload_progress_context *ctx = udata;
+
+    if (!ctx->first)
+        ctx->first = ty_micros();
+
+    return 0;
+}
+
+static int bench_upload(struct bench_target *target)
+{
+    unsigned int count = bench_count ? bench_count : 3;
+    ty_firmware *fw = NULL;
+    uint64_t load_time;
+    uint64_t *samples = NULL;
+    uint64_t program_bytes = 0, program_time = 0;
+    int r;
+
+    if (count > MAX_SAMPLES)
+        count = MAX_SAMPLES;
+    if (!bench_firmware)
+        return ty_error(TY_ERROR_PARAM, "The upload workload needs a firmware (--firmware)");
+
+    close_target_serial(target);
+
+    load_time = ty_micros();
+    r = ty_firmware_load(bench_firmware, NULL, &fw);
+    if (r < 0)
+        goto cleanup;
+    load_time = ty_micros() - load_time;
+
+    {
+        ty_model models[8];
+        unsigned int models_count;
+        ty_model model = ty_board_get_model(target->board);
+        // Boards identified only by family can't be checked, same as ty_upload()
+        bool compatible = !ty_models[model].mcu;
+
+        models_count = ty_firmware_identify(fw, models, TY_COUNTOF(models));
+        for (unsigned int i = 0; i < models_count; i++)
+            compatible |= (models[i] == model);
+        if (!compatible) {
+            r = ty_error(TY_ERROR_UNSUPPORTED, "Firmware '%s' is not compatible with '%s'",
+                         fw->name, target->name);
+            goto cleanup;
+        }
+    }
+
+    // Reboot, first block, program (whole upload) and reset
+    samples = calloc(count * 4, sizeof(*samples));
+    if (!samples) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        struct upload_progress_context ctx = {0};
+        uint64_t start;
+
+        if (ty_board_has_capability(target->board, TY_BOARD_CAPABILITY_UPLOAD)) {
+            samples[i] = 0;
+        } else {
+            r = reboot_target(target, &samples[i]);
+            if (r < 0)
+                goto cleanup;
+        }
+
+        start = ty_micros();
+        r = ty_board_upload(target->board, fw, upload_progress_callback, &ctx);
+        if (r < 0)
+            goto cleanup;
+        samples[count + i] = (ctx.first ? ctx.first : ty_micros()) - start;
+        samples[2 * count + i] = ty_micros() - start;
+        program_bytes += fw->size;
+        program_time += samples[2 * count + i];
+
+        r = reset_target(target, &samples[3 * count + i]);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    begin_result("upload");
+    if (bench_output_json) {
+        printf(", \"firmware\": {\"name\": ");
+        print_json_string(fw->name);
+        printf(", \"size\": %zu, \"load_us\": %" PRIu64 "}", fw->size, load_time);
+    } else {
+        printf("  + firmware: %s, %zu bytes, loaded in %.3f ms\n", fw->name, fw->size,
+               (double)load_time / 1000.0);
+    }
+    print_latencies("reboot", samples, count);
+    print_latencies("first_block", samples + count, count);
+    print_latencies("program", samples + 2 * count, count);
+    print_latencies("reset", samples + 3 * count, count);
+    print_throughput(program_bytes, program_time);
+    end_result();
+
+    r = 0;
+cleanup:
+    free(samples);
+    ty_firmware_unref(fw);
+    return r;
+}
+
+static int parse_workloads(ty_optline_context *optl, int *rworkloads)
+{
+    int workloads = 0;
+    char *name;
+
+    while ((name = ty_optline_consume_non_option(optl))) {
+        if (strcmp(name, "rx") == 0) {
+            workloads |= WORKLOAD_RX;
+        } else if (strcmp(name, "tx") == 0) {
+            workloads |= WORKLOAD_TX;
+        } else if (strcmp(name, "echo") == 0) {
+            workloads |= WORKLOAD_ECHO;
+        } else if (strcmp(name, "upload") == 0) {
+            workloads |= WORKLOAD_UPLOAD;
+        } else if (strcmp(name, "reboot") == 0) {
+            workloads |= WORKLOAD_REBOOT;
+        } else {
+            ty_log(TY_LOG_ERROR, "Unknown workload '%s'", name);
+            return -1;
+        }
+    }
+    if (!workloads) {
+        ty_log(TY_LOG_ERROR, "Missing workload");
+        return -1;
+    }
+
+    *rworkloads = workloads;
+    return 0;
+}
+
+static bool parse_number(ty_optline_context *optl, const char *opt, long min, long *rvalue)
+{
+    char *value, *end;
+    long n;
+
+    value = ty_optline_get_value(optl);
+    if (!value) {
+        ty_log(TY_LOG_ERROR, "Option '%s' takes an argument", opt);
+        return false;
+    }
+
+    errno = 0;
+    n = strtol(value, &end, 10);
+    if (errno || end == value || *end || n < min || n > INT_MAX) {
+        ty_log(TY_LOG_ERROR, "Option '%s' expects a number >= %ld", opt, min);
+        return false;
+    }
+
+    *rvalue = n;
+    return true;
+}
+
+int bench(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    int workloads;
+    struct bench_target target = {0};
+    struct pty_peer peer = {.fd = -1};
+    bool json_open = false;
+    int r;
+
+    bench_device = NULL;
+    bench_pty = false;
+    bench_duration = 5000;
+    bench_count = 0;
+    bench_size = 32;
+    bench_firmware = NULL;
+    bench_output_json = false;
+    bench_results_count = 0;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        long value;
+
+        if (strcmp(opt, "--help") == 0) {
+            print_bench_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--device") == 0 || strcmp(opt, "-D") == 0) {
+            bench_device = ty_optline_get_value(&optl);
+            if (!bench_device) {
+                ty_log(TY_LOG_ERROR, "Option '--device' takes an argument");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--pty") == 0) {
+            bench_pty = true;
+        } else if (strcmp(opt, "--duration") == 0 || strcmp(opt, "-d") == 0) {
+            if (!parse_number(&optl, opt, 1, &value)) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            bench_duration = (int)value;
+        } else if (strcmp(opt, "--count") == 0 || strcmp(opt, "-n") == 0) {
+            if (!parse_number(&optl, opt, 1, &value)) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            bench_count = (unsigned int)value;
+        } else if (strcmp(opt, "--size") == 0 || strcmp(opt, "-s") == 0) {
+            if (!parse_number(&optl, opt, 1, &value)) {
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+            bench_size = (unsigned int)value;
+        } else if (strcmp(opt, "--firmware") == 0 || strcmp(opt, "-f") == 0) {
+            bench_firmware = ty_optline_get_value(&optl);
+            if (!bench_firmware) {
+                ty_log(TY_LOG_ERROR, "Option '--firmware' takes an argument");
+                print_bench_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--json") == 0 || strcmp(opt, "-j") == 0) {
+            bench_output_json = true;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_bench_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (parse_workloads(&optl, &workloads) < 0) {
+        print_bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (bench_pty && bench_device) {
+        ty_log(TY_LOG_ERROR, "Options '--pty' and '--device' cannot be used together");
+        return EXIT_FAILURE;
+    }
+    if ((bench_pty || bench_device) && (workloads & (WORKLOAD_UPLOAD | WORKLOAD_REBOOT))) {
+        ty_log(TY_LOG_ERROR, "Workloads upload and reboot need a board");
+        return EXIT_FAILURE;
+    }
+
+    if (bench_pty) {
+        r = start_pty_peer(&peer, &target.name);
+        if (r < 0)
+            goto cleanup;
+    } else if (bench_device) {
+        target.name = bench_device;
+    } else {
+        r = get_board(&target.board);
+        if (r < 0)
+            goto cleanup;
+        target.name = ty_board_get_tag(target.board);
+    }
+
+    if (bench_output_json) {
+        printf("{\"version\": ");
+        print_json_string(ty_version_string());
+        printf(", \"target\": ");
+        print_json_string(target.name);
+        printf(", \"results\": [");
+        json_open = true;
+    } else {
+        printf("Target: %s\n", target.name);
+    }
+
+    if (workloads & WORKLOAD_RX) {
+        r = bench_rx(&target, &peer);
+        if (r < 0)
+            goto cleanup;
+    }
+    if (workloads & WORKLOAD_TX) {
+        r = bench_tx(&target, &peer);
+        if (r < 0)
+            goto cleanup;
+    }
+    if (workloads & WORKLOAD_ECHO) {
+        r = bench_echo(&target);
+        if (r < 0)
+            goto cleanup;
+    }
+    if (workloads & WORKLOAD_UPLOAD) {
+        r = bench_upload(&target);
+        if (r < 0)
+            goto cleanup;
+    }
+    if (workloads & WORKLOAD_REBOOT) {
+        r = bench_reboot(&target);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    if (!bench_output_json && target.iface_name)
+        printf("Serial interface: %s\n", target.iface_name);
+
+    r = 0;
+cleanup:
+    // Keep the output valid JSON even when a workload fails
+    if (json_open) {
+        printf("\n  ], \"interface\": ");
+        print_json_string(target.iface_name ? target.iface_name : "");
+        printf(", \"success\": %s}\n", r < 0 ? "false" : "true");
+        fflush(stdout);
+    }
+    close_target_serial(&target);
+    ty_board_unref(target.board);
+    stop_pty_peer(&peer);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
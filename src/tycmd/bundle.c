@@ -0,0 +1,92 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "main.h"
+#include "../libty/firmware.h"
+
+static const char *bundle_firmware_format;
+
+static void print_bundle_usage(FILE *f)
+{
+    fprintf(f, "usage: %s bundle [options] <bundle> <firmwares>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Bundle options:\n"
+               "   -f, --format <format>    Firmware file format (autodetected by default)\n\n"
+               "Each firmware is identified once and stored with the models it supports, upload\n"
+               "picks the right one for each board. The first firmware wins if several of them\n"
+               "support the same model.\n");
+}
+
+int bundle(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    ty_firmware *fws[TY_FIRMWARE_BUNDLE_MAX_ENTRIES];
+    unsigned int fws_count = 0;
+    int r;
+
+    bundle_firmware_format = NULL;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_bundle_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--format") == 0 || strcmp(opt, "-f") == 0) {
+            bundle_firmware_format = ty_optline_get_value(&optl);
+            if (!bundle_firmware_format) {
+                ty_log(TY_LOG_ERROR, "Option '--format' takes an argument");
+                print_bundle_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_bundle_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (!filename) {
+        ty_log(TY_LOG_ERROR, "Missing bundle filename");
+        print_bundle_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // Unlike upload, a bundle missing one of the firmwares is not useful
+    while ((opt = ty_optline_consume_non_option(&optl))) {
+        if (fws_count >= TY_COUNTOF(fws)) {
+            r = ty_error(TY_ERROR_RANGE, "Cannot bundle more than %zu firmwares",
+                         TY_COUNTOF(fws));
+            goto cleanup;
+        }
+
+        r = load_firmware(opt, bundle_firmware_format, &fws[fws_count]);
+        if (r < 0)
+            goto cleanup;
+        fws_count++;
+    }
+    if (!fws_count) {
+        ty_log(TY_LOG_ERROR, "Missing firmware filename");
+        print_bundle_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    // The models of each firmware are logged while it gets identified
+    r = ty_firmware_bundle_save(filename, fws, fws_count);
+
+cleanup:
+    for (unsigned int i = 0; i < fws_count; i++)
+        ty_firmware_unref(fws[i]);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
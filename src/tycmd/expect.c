@@ -0,0 +1,1048 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include "../libhs/array.h"
+#include "../libty/system.h"
+#include "main.h"
+
+#define MAX_LINE_SIZE 4096
+#define MAX_BOARDS 48
+#define MAX_JUMPS 10000
+#define BUFFER_SIZE 8192
+#define DEFAULT_TIMEOUT 10000
+
+enum instruction_type {
+    INSTRUCTION_STEP,
+    INSTRUCTION_SEND,
+    INSTRUCTION_EXPECT,
+    INSTRUCTION_EXPECT_REGEX,
+    INSTRUCTION_DELAY,
+    INSTRUCTION_LABEL,
+    INSTRUCTION_GOTO,
+    INSTRUCTION_ONFAIL,
+    INSTRUCTION_FAIL,
+    INSTRUCTION_PASS
+};
+
+struct instruction {
+    enum instruction_type type;
+    unsigned int line;
+
+    char *arg;
+    int timeout;
+    // Resolved label for GOTO and ONFAIL, -1 means stop for ONFAIL
+    int target;
+};
+
+struct script {
+    const char *filename;
+    _HS_ARRAY(struct instruction) instructions;
+};
+
+struct step_result {
+    char *name;
+    uint64_t start;
+    uint64_t end;
+
+    unsigned int activity;
+    bool failed;
+    char *message;
+};
+
+struct board_run {
+    ty_board *board;
+    char *tag;
+    ty_board_interface *iface;
+
+    unsigned int pc;
+    int onfail;
+    unsigned int jumps;
+    uint64_t deadline;
+
+    char buf[BUFFER_SIZE];
+    size_t buf_len;
+
+    uint64_t start;
+    uint64_t end;
+    _HS_ARRAY(struct step_result) steps;
+    bool done;
+    bool failed;
+};
+
+static bool expect_all;
+static const char *expect_json_filename;
+static const char *expect_junit_filename;
+
+static void print_expect_usage(FILE *f)
+{
+    fprintf(f, "usage: %s expect [options] <script>\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Expect options:\n"
+               "   -a, --all                Run the script on all boards (matching --board)\n"
+               "       --json <file>        Write JSON report to <file> ('-' for stdout)\n"
+               "       --junit <file>       Write JUnit XML report to <file> ('-' for stdout)\n\n");
+
+    fprintf(f, "Script instructions:\n"
+               "   step <name>              Start a new test step, reported separately\n"
+               "   send <text>              Send text to the board (escapes such as \\n work)\n"
+               "   expect <text> [<ms>]     Wait for text in the board serial output\n"
+               "   expect -r <regex> [<ms>] Wait for a regular expression match\n"
+               "   delay <ms>               Wait before the next instruction\n"
+               "   label <name>             Define a label for goto and onfail\n"
+               "   goto <label>             Continue execution at label\n"
+               "   onfail <label>|stop      Jump to label on the next failure, or stop (default)\n"
+               "   fail [<message>]         Fail the current step\n"
+               "   pass                     End the run, it passes even if a failure was handled\n\n"
+               "Expect timeouts default to %d ms. Regular expressions support . [] * + ? ^ $ and\n"
+               "\\d \\w \\s classes, put them between single quotes to keep backslashes intact.\n",
+               DEFAULT_TIMEOUT);
+}
+
+static void free_script(struct script *script)
+{
+    for (size_t i = 0; i < script->instructions.count; i++)
+        free(script->instructions.values[i].arg);
+    _hs_array_release(&script->instructions);
+}
+
+static int parse_instruction(char **args, int args_count, struct instruction *inst)
+{
+    const char *cmd = args[0];
+    int r;
+
+    inst->timeout = -1;
+    inst->target = -1;
+
+    if (strcmp(cmd, "step") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: step <name>");
+        inst->type = INSTRUCTION_STEP;
+    } else if (strcmp(cmd, "send") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: send <text>");
+        inst->type = INSTRUCTION_SEND;
+    } else if (strcmp(cmd, "expect") == 0) {
+        inst->type = INSTRUCTION_EXPECT;
+        if (args_count >= 2 && strcmp(args[1], "-r") == 0) {
+            inst->type = INSTRUCTION_EXPECT_REGEX;
+            args++;
+            args_count--;
+        }
+        if (args_count < 2 || args_count > 3 || !args[1][0])
+            return ty_error(TY_ERROR_PARSE, "Usage: expect [-r] <pattern> [<ms>]");
+
+        inst->timeout = DEFAULT_TIMEOUT;
+        if (args_count == 3) {
+            r = parse_duration(args[2], &inst->timeout);
+            if (r < 0)
+                return r;
+        }
+    } else if (strcmp(cmd, "delay") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: delay <ms>");
+        inst->type = INSTRUCTION_DELAY;
+        r = parse_duration(args[1], &inst->timeout);
+        if (r < 0)
+            return r;
+        if (inst->timeout < 0)
+            return ty_error(TY_ERROR_PARSE, "Cannot delay forever");
+        args_count = 1;
+    } else if (strcmp(cmd, "label") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: label <name>");
+        inst->type = INSTRUCTION_LABEL;
+    } else if (strcmp(cmd, "goto") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: goto <label>");
+        inst->type = INSTRUCTION_GOTO;
+    } else if (strcmp(cmd, "onfail") == 0) {
+        if (args_count != 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: onfail <label>|stop");
+        inst->type = INSTRUCTION_ONFAIL;
+    } else if (strcmp(cmd, "fail") == 0) {
+        if (args_count > 2)
+            return ty_error(TY_ERROR_PARSE, "Usage: fail [<message>]");
+        inst->type = INSTRUCTION_FAIL;
+    } else if (strcmp(cmd, "pass") == 0) {
+        if (args_count != 1)
+            return ty_error(TY_ERROR_PARSE, "Usage: pass");
+        inst->type = INSTRUCTION_PASS;
+    } else {
+        return ty_error(TY_ERROR_PARSE, "Unknown instruction '%s'", cmd);
+    }
+
+    if (args_count >= 2) {
+        inst->arg = strdup(args[1]);
+        if (!inst->arg)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+static int find_label(const struct script *script, const char *name)
+{
+    for (size_t i = 0; i < script->instructions.count; i++) {
+        const struct instruction *inst = &script->instructions.values[i];
+
+        if (inst->type == INSTRUCTION_LABEL && strcmp(inst->arg, name) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static int load_script(const char *filename, struct script *rscript)
+{
+    struct script script = {0};
+    FILE *fp;
+    char line[MAX_LINE_SIZE];
+    unsigned int line_number = 0;
+    int r;
+
+    script.filename = filename;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return ty_error(TY_ERROR_NOT_FOUND, "Cannot open '%s': %s", filename, strerror(errno));
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *args[8];
+        int args_count;
+        struct instruction inst = {0};
+
+        line_number++;
+
+        if (!strchr(line, '\n') && !feof(fp)) {
+            r = ty_error(TY_ERROR_PARSE, "%s:%u: Line is too long", filename, line_number);
+            goto cleanup;
+        }
+
+        args_count = split_command_line(line, args, TY_COUNTOF(args));
+        if (args_count < 0) {
+            r = ty_error(TY_ERROR_PARSE, "%s:%u: Malformed instruction", filename, line_number);
+            goto cleanup;
+        }
+        if (!args_count)
+            continue;
+
+        r = parse_instruction(args, args_count, &inst);
+        if (r < 0) {
+            free(inst.arg);
+            r = ty_error(TY_ERROR_PARSE, "%s:%u: Invalid instruction", filename, line_number);
+            goto cleanup;
+        }
+        inst.line = line_number;
+
+        r = _hs_array_push(&script.instructions, inst);
+        if (r < 0) {
+            free(inst.arg);
+            r = ty_libhs_translate_error(r);
+            goto cleanup;
+        }
+    }
+    if (ferror(fp)) {
+        r = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", filename);
+        goto cleanup;
+    }
+
+    // Resolve labels once, instead of searching them on each jump
+    for (size_t i = 0; i < script.instructions.count; i++) {
+        struct instruction *inst = &script.instructions.values[i];
+
+        if (inst->type == INSTRUCTION_GOTO ||
+                (inst->type == INSTRUCTION_ONFAIL && strcmp(inst->arg, "stop") != 0)) {
+            inst->target = find_label(&script, inst->arg);
+            if (inst->target < 0) {
+                r = ty_error(TY_ERROR_PARSE, "%s:%u: Unknown label '%s'", filename, inst->line,
+                             inst->arg);
+                goto cleanup;
+            }
+        }
+    }
+
+    *rscript = script;
+    memset(&script, 0, sizeof(script));
+    r = 0;
+
+cleanup:
+    free_script(&script);
+    fclose(fp);
+    return r;
+}
+
+/* Small backtracking matcher, enough for typical device output checks. It supports
+   literals, '.', classes ('[a-z]', '[^0-9]', '\d', '\w', '\s' and their negations),
+   the '*', '+' and '?' quantifiers and the '^' and '$' anchors. */
+
+static char unescape_char(char c)
+{
+    switch (c) {
+        case 'n': { return '\n'; } break;
+        case 'r': { return '\r'; } break;
+        case 't': { return '\t'; } break;
+    }
+
+    return c;
+}
+
+static bool match_escape(char e, unsigned char c)
+{
+    switch (e) {
+        case 'd': { return isdigit(c); } break;
+        case 'D': { return !isdigit(c); } break;
+        case 'w': { return isalnum(c) || c == '_'; } break;
+        case 'W': { return !isalnum(c) && c != '_'; } break;
+        case 's': { return isspace(c); } break;
+        case 'S': { return !isspace(c); } break;
+    }
+
+    return (unsigned char)unescape_char(e) == c;
+}
+
+static const char *skip_atom(const char *re)
+{
+    if (re[0] == '\\' && re[1])
+        return re + 2;
+
+    if (re[0] == '[') {
+        const char *ptr = re + 1;
+
+        if (*ptr == '^')
+            ptr++;
+        if (*ptr == ']')
+            ptr++;
+        while (*ptr && *ptr != ']') {
+            if (ptr[0] == '\\' && ptr[1])
+                ptr++;
+            ptr++;
+        }
+
+        return *ptr ? ptr + 1 : ptr;
+    }
+
+    return re + 1;
+}
+
+static bool match_class(const char *re, unsigned char c)
+{
+    const char *ptr = re + 1;
+    bool negate = false;
+    bool matched = false;
+
+    if (*ptr == '^') {
+        negate = true;
+        ptr++;
+    }
+
+    for (bool first = true; *ptr && (*ptr != ']' || first); first = false) {
+        unsigned char lo, hi;
+
+        if (ptr[0] == '\\' && ptr[1]) {
+            if (strchr("dDwWsS", ptr[1])) {
+                matched |= match_escape(ptr[1], c);
+                ptr += 2;
+                continue;
+            }
+            lo = (unsigned char)unescape_char(ptr[1]);
+            ptr += 2;
+        } else {
+            lo = (unsigned char)*ptr++;
+        }
+
+        hi = lo;
+        if (ptr[0] == '-' && ptr[1] && ptr[1] != ']') {
+            if (ptr[1] == '\\' && ptr[2]) {
+                hi = (unsigned char)unescape_char(ptr[2]);
+                ptr += 3;
+            } else {
+                hi = (unsigned char)ptr[1];
+                ptr += 2;
+            }
+        }
+
+        if (c >= lo && c <= hi)
+            matched = true;
+    }
+
+    return matched != negate;
+}
+
+static bool match_atom(const char *re, unsigned char c)
+{
+    switch (re[0]) {
+        case '.': { return c != '\n'; } break;
+        case '\\': { return re[1] ? match_escape(re[1], c) : c == '\\'; } break;
+        case '[': { return match_class(re, c); } break;
+    }
+
+    return (unsigned char)re[0] == c;
+}
+
+static const char *match_here(const char *re, const char *text, const char *end)
+{
+    while (re[0]) {
+        const char *next;
+
+        if (re[0] == '$' && !re[1])
+            return (text == end || *text == '\r' || *text == '\n') ? text : NULL;
+
+        next = skip_atom(re);
+        if (*next == '*' || *next == '+' || *next == '?') {
+            size_t min = (*next == '+');
+            size_t max = (*next == '?') ? 1 : SIZE_MAX;
+            size_t count = 0;
+
+            while (count < max && text + count < end && match_atom(re, (unsigned char)text[count]))
+                count++;
+
+            // Greedy, give characters back until the rest matches
+            while (count >= min) {
+                const char *match_end = match_here(next + 1, text + count, end);
+                if (match_end)
+                    return match_end;
+                if (!count)
+                    break;
+                count--;
+            }
+
+            return NULL;
+        }
+
+        if (text == end || !match_atom(re, (unsigned char)*text))
+            return NULL;
+        re = next;
+        text++;
+    }
+
+    return text;
+}
+
+static const char *match_regex(const char *re, const char *buf, size_t size)
+{
+    const char *end = buf + size;
+
+    if (re[0] == '^') {
+        for (const char *start = buf; start <= end; start++) {
+            if (start == buf || start[-1] == '\n') {
+                const char *match_end = match_here(re + 1, start, end);
+                if (match_end)
+                    return match_end;
+            }
+        }
+    } else {
+        for (const char *start = buf; start <= end; start++) {
+            const char *match_end = match_here(re, start, end);
+            if (match_end)
+                return match_end;
+        }
+    }
+
+    return NULL;
+}
+
+static int begin_step(struct board_run *run, const char *name)
+{
+    struct step_result step = {0};
+    int r;
+
+    // Drop the implicit first step if nothing happened in it
+    if (run->steps.count == 1 && !run->steps.values[0].name && !run->steps.values[0].activity)
+        run->steps.count = 0;
+
+    if (run->steps.count) {
+        struct step_result *prev = &run->steps.values[run->steps.count - 1];
+        if (!prev->end)
+            prev->end = ty_millis();
+    }
+
+    if (name) {
+        step.name = strdup(name);
+        if (!step.name)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+    step.start = ty_millis();
+
+    r = _hs_array_push(&run->steps, step);
+    if (r < 0) {
+        free(step.name);
+        return ty_libhs_translate_error(r);
+    }
+
+    return 0;
+}
+
+static void finish_run(struct board_run *run)
+{
+    if (run->steps.count == 1 && !run->steps.values[0].name && !run->steps.values[0].activity)
+        run->steps.count = 0;
+    if (run->steps.count) {
+        struct step_result *step = &run->steps.values[run->steps.count - 1];
+        if (!step->end)
+            step->end = ty_millis();
+    }
+
+    ty_board_interface_close(run->iface);
+    run->iface = NULL;
+
+    run->end = ty_millis();
+    run->done = true;
+
+    ty_log(TY_LOG_INFO, "%s: %s (%" PRIu64 " ms)", run->tag, run->failed ? "FAIL" : "PASS",
+           run->end - run->start);
+}
+
+static void fail_step(const struct script *script, struct board_run *run, const char *fmt, ...)
+{
+    struct step_result *step = &run->steps.values[run->steps.count - 1];
+    unsigned int line = run->pc < script->instructions.count ? script->instructions.values[run->pc].line : 0;
+    char msg[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    ty_log(TY_LOG_DEBUG, "%s: %s:%u: %s", run->tag, script->filename, line, msg);
+
+    step->activity++;
+    if (!step->failed) {
+        step->failed = true;
+        step->message = strdup(msg);
+    }
+    run->failed = true;
+    run->deadline = 0;
+
+    // Failure handlers are one-shot, or a failing handler would loop forever
+    if (run->onfail >= 0) {
+        run->pc = (unsigned int)run->onfail;
+        run->onfail = -1;
+    } else {
+        finish_run(run);
+    }
+}
+
+static void disconnect_run(struct board_run *run)
+{
+    ty_board_interface_close(run->iface);
+    run->iface = NULL;
+}
+
+static void connect_run(struct board_run *run)
+{
+    if (run->iface || run->done)
+        return;
+    if (!ty_board_has_capability(run->board, TY_BOARD_CAPABILITY_SERIAL))
+        return;
+
+    if (ty_board_open_interface(run->board, TY_BOARD_CAPABILITY_SERIAL, &run->iface) <= 0)
+        run->iface = NULL;
+}
+
+static void read_run(struct board_run *run)
+{
+    while (run->iface) {
+        ssize_t r;
+
+        // Keep the most recent output when the script does not consume it fast enough
+        if (BUFFER_SIZE - run->buf_len < 1024) {
+            memmove(run->buf, run->buf + BUFFER_SIZE / 2, run->buf_len - BUFFER_SIZE / 2);
+            run->buf_len -= BUFFER_SIZE / 2;
+        }
+
+        r = ty_board_serial_read(run->board, run->buf + run->buf_len, BUFFER_SIZE - run->buf_len, 0);
+        if (r < 0) {
+            // Boards often reset or reboot during tests, reconnect when they come back
+            disconnect_run(run);
+            break;
+        }
+        if (!r)
+            break;
+
+        run->buf_len += (size_t)r;
+    }
+}
+
+static int set_deadline(struct board_run *run, int timeout)
+{
+    uint64_t now = ty_millis();
+
+    if (!run->deadline)
+        run->deadline = timeout >= 0 ? now + (uint64_t)timeout : UINT64_MAX;
+
+    return now >= run->deadline;
+}
+
+static int advance_run(const struct script *script, struct board_run *run)
+{
+    int r;
+
+    while (!run->done) {
+        const struct instruction *inst;
+        struct step_result *step;
+
+        if (run->pc >= script->instructions.count) {
+            finish_run(run);
+            break;
+        }
+        inst = &script->instructions.values[run->pc];
+        step = &run->steps.values[run->steps.count - 1];
+
+        switch (inst->type) {
+            case INSTRUCTION_STEP: {
+                r = begin_step(run, inst->arg);
+                if (r < 0)
+                    return r;
+                run->pc++;
+            } break;
+
+            case INSTRUCTION_SEND: {
+                if (!run->iface) {
+                    if (set_deadline(run, DEFAULT_TIMEOUT)) {
+                        fail_step(script, run, "Board is not available for serial I/O");
+                        break;
+                    }
+                    return 0;
+                }
+
+                step->activity++;
+                r = (int)ty_board_serial_write(run->board, inst->arg, strlen(inst->arg));
+                if (r < 0) {
+                    // Try again once the board is back
+                    disconnect_run(run);
+                    continue;
+                }
+
+                run->deadline = 0;
+                run->pc++;
+            } break;
+
+            case INSTRUCTION_EXPECT:
+            case INSTRUCTION_EXPECT_REGEX: {
+                const char *match_end;
+
+                if (inst->type == INSTRUCTION_EXPECT_REGEX) {
+                    match_end = match_regex(inst->arg, run->buf, run->buf_len);
+                } else {
+                    size_t len = strlen(inst->arg);
+
+                    match_end = find_text(run->buf, run->buf_len, inst->arg, len);
+                    if (match_end)
+                        match_end += len;
+                }
+
+                if (match_end) {
+                    size_t consumed = (size_t)(match_end - run->buf);
+
+                    memmove(run->buf, match_end, run->buf_len - consumed);
+                    run->buf_len -= consumed;
+
+                    step->activity++;
+                    run->deadline = 0;
+                    run->pc++;
+                } else if (set_deadline(run, inst->timeout)) {
+                    fail_step(script, run, "Timed out while waiting for '%s'", inst->arg);
+                } else {
+                    return 0;
+                }
+            } break;
+
+            case INSTRUCTION_DELAY: {
+                if (!set_deadline(run, inst->timeout))
+                    return 0;
+
+                step->activity++;
+                run->deadline = 0;
+                run->pc++;
+            } break;
+
+            case INSTRUCTION_LABEL: {
+                run->pc++;
+            } break;
+
+            case INSTRUCTION_GOTO: {
+                if (++run->jumps > MAX_JUMPS) {
+                    fail_step(script, run, "Too many jumps, is there an infinite loop?");
+                    break;
+                }
+                run->pc = (unsigned int)inst->target;
+            } break;
+
+            case INSTRUCTION_ONFAIL: {
+                run->onfail = inst->target;
+                run->pc++;
+            } break;
+
+            case INSTRUCTION_FAIL: {
+                fail_step(script, run, "%s", inst->arg ? inst->arg : "Failed");
+            } break;
+
+            // Failed steps are still reported, but the recovery path decides the verdict
+            case INSTRUCTION_PASS: {
+                run->failed = false;
+                finish_run(run);
+            } break;
+        }
+    }
+
+    return 0;
+}
+
+static void print_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (const char *ptr = str; *ptr; ptr++) {
+        unsigned char c = (unsigned char)*ptr;
+
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void print_xml_string(FILE *fp, const char *str)
+{
+    for (const char *ptr = str; *ptr; ptr++) {
+        switch (*ptr) {
+            case '<': { fputs("&lt;", fp); } break;
+            case '>': { fputs("&gt;", fp); } break;
+            case '&': { fputs("&amp;", fp); } break;
+            case '"': { fputs("&quot;", fp); } break;
+            default: {
+                if ((unsigned char)*ptr >= 0x20 || *ptr == '\t' || *ptr == '\n') {
+                    fputc(*ptr, fp);
+                } else {
+                    fprintf(fp, "&#x%x;", (unsigned char)*ptr);
+                }
+            } break;
+        }
+    }
+}
+
+static const char *get_step_name(const struct script *script, const struct step_result *step)
+{
+    return step->name ? step->name : script->filename;
+}
+
+static void write_json_report(FILE *fp, const struct script *script, const struct board_run *runs,
+                              unsigned int runs_count)
+{
+    fprintf(fp, "{\"script\": ");
+    print_json_string(fp, script->filename);
+    fprintf(fp, ", \"boards\": [");
+    for (unsigned int i = 0; i < runs_count; i++) {
+        const struct board_run *run = &runs[i];
+
+        fprintf(fp, "%s\n  {\"tag\": ", i ? "," : "");
+        print_json_string(fp, run->tag);
+        fprintf(fp, ", \"result\": \"%s\", \"duration\": %" PRIu64 ", \"steps\": [",
+                run->failed ? "fail" : "pass", run->end - run->start);
+        for (size_t j = 0; j < run->steps.count; j++) {
+            const struct step_result *step = &run->steps.values[j];
+
+            fprintf(fp, "%s\n    {\"name\": ", j ? "," : "");
+            print_json_string(fp, get_step_name(script, step));
+            fprintf(fp, ", \"result\": \"%s\", \"duration\": %" PRIu64,
+                    step->failed ? "fail" : "pass", step->end - step->start);
+            if (step->message) {
+                fprintf(fp, ", \"message\": ");
+                print_json_string(fp, step->message);
+            }
+            fprintf(fp, "}");
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n]}\n");
+}
+
+static void write_junit_report(FILE *fp, const struct script *script, const struct board_run *runs,
+                               unsigned int runs_count)
+{
+    fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n");
+    for (unsigned int i = 0; i < runs_count; i++) {
+        const struct board_run *run = &runs[i];
+        unsigned int failures = 0;
+
+        for (size_t j = 0; j < run->steps.count; j++)
+            failures += run->steps.values[j].failed;
+
+        fprintf(fp, "  <testsuite name=\"");
+        print_xml_string(fp, run->tag);
+        fprintf(fp, "\" tests=\"%zu\" failures=\"%u\" time=\"%.3f\">\n", run->steps.count, failures,
+                (double)(run->end - run->start) / 1000.0);
+        for (size_t j = 0; j < run->steps.count; j++) {
+            const struct step_result *step = &run->steps.values[j];
+
+            fprintf(fp, "    <testcase classname=\"");
+            print_xml_string(fp, script->filename);
+            fprintf(fp, "\" name=\"");
+            print_xml_string(fp, get_step_name(script, step));
+            fprintf(fp, "\" time=\"%.3f\"", (double)(step->end - step->start) / 1000.0);
+            if (step->failed) {
+                fprintf(fp, ">\n      <failure message=\"");
+                print_xml_string(fp, step->message ? step->message : "");
+                fprintf(fp, "\"/>\n    </testcase>\n");
+            } else {
+                fprintf(fp, "/>\n");
+            }
+        }
+        fprintf(fp, "  </testsuite>\n");
+    }
+    fprintf(fp, "</testsuites>\n");
+}
+
+static int write_report(const char *filename, const struct script *script,
+                        const struct board_run *runs, unsigned int runs_count,
+                        void (*write)(FILE *fp, const struct script *script,
+                                      const struct board_run *runs, unsigned int runs_count))
+{
+    FILE *fp;
+
+    if (strcmp(filename, "-") == 0) {
+        fp = stdout;
+    } else {
+        fp = fopen(filename, "w");
+        if (!fp)
+            return ty_error(TY_ERROR_IO, "Cannot open '%s' for writing: %s", filename, strerror(errno));
+    }
+
+    (*write)(fp, script, runs, runs_count);
+
+    if (fp != stdout) {
+        if (fclose(fp) != 0)
+            return ty_error(TY_ERROR_IO, "I/O error while writing '%s'", filename);
+    } else {
+        fflush(fp);
+    }
+
+    return 0;
+}
+
+static int run_script(ty_monitor *monitor, const struct script *script, struct board_run *runs,
+                      unsigned int runs_count)
+{
+    int r;
+
+    for (unsigned int i = 0; i < runs_count; i++) {
+        struct board_run *run = &runs[i];
+
+        run->onfail = -1;
+        run->start = ty_millis();
+        r = begin_step(run, NULL);
+        if (r < 0)
+            return r;
+
+        connect_run(run);
+    }
+
+    while (true) {
+        ty_descriptor_set set = {0};
+        uint64_t now, next_deadline = UINT64_MAX;
+        unsigned int remaining = 0;
+
+        /* Device events (disconnections, new interfaces) and serial data from all boards
+           are handled here, nothing in this loop blocks besides ty_poll(). */
+        r = ty_monitor_refresh(monitor);
+        if (r < 0)
+            return r;
+
+        for (unsigned int i = 0; i < runs_count; i++) {
+            struct board_run *run = &runs[i];
+
+            if (run->done)
+                continue;
+
+            if (ty_board_get_status(run->board) == TY_BOARD_STATUS_DROPPED) {
+                disconnect_run(run);
+                fail_step(script, run, "Board has disappeared");
+                if (run->done)
+                    continue;
+            }
+
+            connect_run(run);
+            read_run(run);
+
+            r = advance_run(script, run);
+            if (r < 0)
+                return r;
+        }
+
+        ty_monitor_get_descriptors(monitor, &set, 1);
+        for (unsigned int i = 0; i < runs_count; i++) {
+            struct board_run *run = &runs[i];
+
+            if (run->done)
+                continue;
+
+            remaining++;
+            if (run->iface)
+                ty_board_interface_get_descriptors(run->iface, &set, (int)i + 2);
+            if (run->deadline && run->deadline < next_deadline)
+                next_deadline = run->deadline;
+        }
+        if (!remaining)
+            break;
+
+        now = ty_millis();
+        if (next_deadline == UINT64_MAX) {
+            r = ty_poll(&set, -1);
+        } else {
+            r = ty_poll(&set, next_deadline > now ? (int)(next_deadline - now) : 0);
+        }
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+int expect(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    struct script script = {0};
+    ty_monitor *monitor;
+    ty_board *boards[MAX_BOARDS];
+    unsigned int boards_count = 0;
+    struct board_run *runs = NULL;
+    bool failed = false;
+    int r;
+
+    expect_all = false;
+    expect_json_filename = NULL;
+    expect_junit_filename = NULL;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_expect_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--all") == 0 || strcmp(opt, "-a") == 0) {
+            expect_all = true;
+        } else if (strcmp(opt, "--json") == 0) {
+            expect_json_filename = ty_optline_get_value(&optl);
+            if (!expect_json_filename) {
+                ty_log(TY_LOG_ERROR, "Option '--json' takes an argument");
+                print_expect_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--junit") == 0) {
+            expect_junit_filename = ty_optline_get_value(&optl);
+            if (!expect_junit_filename) {
+                ty_log(TY_LOG_ERROR, "Option '--junit' takes an argument");
+                print_expect_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_expect_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (!filename) {
+        ty_log(TY_LOG_ERROR, "Missing script filename");
+        print_expect_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_expect_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    r = load_script(filename, &script);
+    if (r < 0)
+        goto cleanup;
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        goto cleanup;
+    if (expect_all) {
+        r = get_boards(boards, TY_COUNTOF(boards));
+        if (r < 0)
+            goto cleanup;
+        boards_count = (unsigned int)r;
+    } else {
+        r = get_board(&boards[0]);
+        if (r < 0)
+            goto cleanup;
+        boards_count = 1;
+    }
+
+    runs = calloc(boards_count, sizeof(*runs));
+    if (!runs) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < boards_count; i++) {
+        runs[i].board = boards[i];
+        // Capture output from the start, even if the script resets the board
+        ty_board_set_capture(boards[i], true);
+        // Keep the tag, the board may be gone by the time we write reports
+        runs[i].tag = strdup(ty_board_get_tag(boards[i]));
+        if (!runs[i].tag) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+    }
+
+    r = run_script(monitor, &script, runs, boards_count);
+    if (r < 0)
+        goto cleanup;
+
+    for (unsigned int i = 0; i < boards_count; i++)
+        failed |= runs[i].failed;
+
+    if (expect_json_filename) {
+        r = write_report(expect_json_filename, &script, runs, boards_count, write_json_report);
+        if (r < 0)
+            goto cleanup;
+    }
+    if (expect_junit_filename) {
+        r = write_report(expect_junit_filename, &script, runs, boards_count, write_junit_report);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    r = failed ? TY_ERROR_OTHER : 0;
+cleanup:
+    if (runs) {
+        for (unsigned int i = 0; i < boards_count; i++) {
+            struct board_run *run = &runs[i];
+
+            for (size_t j = 0; j < run->steps.count; j++) {
+                free(run->steps.values[j].name);
+                free(run->steps.values[j].message);
+            }
+            _hs_array_release(&run->steps);
+            ty_board_interface_close(run->iface);
+            free(run->tag);
+        }
+        free(runs);
+    }
+    for (unsigned int i = 0; i < boards_count; i++) {
+        ty_board_set_capture(boards[i], false);
+        ty_board_unref(boards[i]);
+    }
+    free_script(&script);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
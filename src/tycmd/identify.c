@@ -12,8 +12,8 @@
 #include "main.h"
 #include "../libty/firmware.h"
 
-static const char *identify_firmware_format = NULL;
-static bool identify_output_json = false;
+static const char *identify_firmware_format;
+static bool identify_output_json;
 
 static void print_identify_usage(FILE *f)
 {
@@ -32,6 +32,9 @@ int identify(int argc, char *argv[])
     ty_optline_context optl;
     char *opt;
 
+    identify_firmware_format = NULL;
+    identify_output_json = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -64,7 +67,7 @@ int identify(int argc, char *argv[])
         unsigned int fw_models_count = 0;
         int r;
 
-        r = ty_firmware_load(opt, identify_firmware_format, &fw);
+        r = load_firmware(opt, identify_firmware_format, &fw);
         if (!r)
             fw_models_count = ty_firmware_identify(fw, fw_models, TY_COUNTOF(fw_models));
         ty_firmware_unref(fw);
@@ -21,9 +21,9 @@ enum collection_type {
     COLLECTION_OBJECT = '{'
 };
 
-static enum output_format list_output = OUTPUT_PLAIN;
-static bool list_verbose = false;
-static bool list_watch = false;
+static enum output_format list_output;
+static bool list_verbose;
+static bool list_watch;
 
 static enum collection_type list_collections[8];
 static unsigned int list_collection_depth;
@@ -204,6 +204,12 @@ int list(int argc, char *argv[])
     ty_monitor *monitor;
     int r;
 
+    list_output = OUTPUT_PLAIN;
+    list_verbose = false;
+    list_watch = false;
+    list_collection_depth = 0;
+    list_collection_started = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -250,11 +256,26 @@ int list(int argc, char *argv[])
         return EXIT_FAILURE;
 
     if (list_watch) {
-        r = ty_monitor_register_callback(monitor, list_callback, NULL);
-        if (r < 0)
+        ty_descriptor_set set = {0};
+        int callback_id;
+
+        callback_id = ty_monitor_register_callback(monitor, list_callback, NULL);
+        if (callback_id < 0)
             return EXIT_FAILURE;
 
-        r = ty_monitor_wait(monitor, NULL, NULL, -1);
+        ty_monitor_get_descriptors(monitor, &set, 1);
+        // Stop watching when the tycmd client goes away (server mode)
+        get_client_descriptors(&set, 2);
+
+        do {
+            r = ty_monitor_refresh(monitor);
+            if (r < 0)
+                break;
+
+            r = ty_poll(&set, -1);
+        } while (r == 1);
+
+        ty_monitor_deregister_callback(monitor, callback_id);
         if (r < 0)
             return EXIT_FAILURE;
     }
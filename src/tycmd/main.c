@@ -12,8 +12,11 @@
     #include <signal.h>
     #include <sys/wait.h>
 #endif
+#include <sys/stat.h>
 #include "../libhs/common.h"
+#include "../libty/firmware.h"
 #include "../libty/system.h"
+#include "../libty/trace.h"
 #include "main.h"
 
 struct command {
@@ -22,28 +25,62 @@ struct command {
     const char *description;
 };
 
+int bench(int argc, char *argv[]);
+int bundle(int argc, char *argv[]);
+int expect(int argc, char *argv[]);
 int identify(int argc, char *argv[]);
 int list(int argc, char *argv[]);
+int metrics(int argc, char *argv[]);
 int monitor(int argc, char *argv[]);
+int recorder(int argc, char *argv[]);
 int reset(int argc, char *argv[]);
+int run(int argc, char *argv[]);
+int server(int argc, char *argv[]);
 int upload(int argc, char *argv[]);
 
 static const struct command commands[] = {
+    {"bench",    bench,    "Measure serial, upload and reboot performance"},
+    {"bundle",   bundle,   "Pack firmwares for several models in a single file"},
+    {"expect",   expect,   "Run send/expect test script on one or more boards"},
     {"identify", identify, "Identify models compatible with firmware"},
     {"list",     list,     "List available boards"},
+    {"metrics",  metrics,  "Write metrics in the Prometheus text format"},
     {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
+    {"recorder", recorder, "Dump recent debug events from the flight recorder"},
     {"reset",    reset,    "Reset board"},
+    {"run",      run,      "Run a script of tycmd commands"},
+    {"server",   server,   "Keep a board monitor running for other tycmd commands"},
     {"upload",   upload,   "Upload new firmware"},
     {0}
 };
 
 const char *tycmd_executable_name;
 
-static const char *main_board_tag = NULL;
+static char *main_board_tag = NULL;
+static ty_board_selector *main_board_selector = NULL;
+static char *default_board_tag = NULL;
+
+static int main_trace_session;
+static int command_trace_session;
 
 static ty_monitor *main_board_monitor;
 static ty_board *main_board;
 
+struct firmware_cache_entry {
+    char *filename;
+    char *format;
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t ctime;
+    int64_t size;
+
+    ty_firmware *fw;
+};
+
+static struct firmware_cache_entry firmware_cache[16];
+static unsigned int firmware_cache_next;
+
 static void print_version(FILE *f)
 {
     fprintf(f, "%s %s\n", tycmd_executable_name, ty_version_string());
@@ -74,7 +111,8 @@ void print_common_options(FILE *f)
                "       --help               Show help message\n"
                "       --version            Display version information\n\n"
                "   -B, --board <tag>        Work with board <tag> instead of first detected\n"
-               "   -q, --quiet              Disable output, use -qqq to silence errors\n");
+               "   -q, --quiet              Disable output, use -qqq to silence errors\n"
+               "       --trace <file>       Write a Chrome/Perfetto trace of this command\n");
 }
 
 static inline unsigned int get_board_priority(ty_board *board)
@@ -89,7 +127,7 @@ static int board_callback(ty_board *board, ty_monitor_event event, void *udata)
     switch (event) {
         case TY_MONITOR_EVENT_ADDED: {
             if ((!main_board || get_board_priority(board) > get_board_priority(main_board))
-                    && ty_board_matches_tag(board, main_board_tag)) {
+                    && ty_board_selector_matches(main_board_selector, board)) {
                 ty_board_unref(main_board);
                 main_board = ty_board_ref(board);
             }
@@ -154,6 +192,11 @@ int get_board(ty_board **rboard)
     if (r < 0)
         return r;
 
+    /* The monitor may have been started before the board tag was known (e.g. in server
+       mode), so select the board now if needed. */
+    if (!main_board)
+        ty_monitor_list(main_board_monitor, board_callback, NULL);
+
     if (!main_board) {
         if (main_board_tag) {
             return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tag);
@@ -166,24 +209,302 @@ int get_board(ty_board **rboard)
     return 0;
 }
 
+static int replace_tag(char **rtag, const char *tag)
+{
+    char *new_tag = NULL;
+
+    if (tag) {
+        new_tag = strdup(tag);
+        if (!new_tag)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+    }
+
+    free(*rtag);
+    *rtag = new_tag;
+
+    return 0;
+}
+
+static int set_board_tag(const char *tag)
+{
+    ty_board_selector *selector = NULL;
+    int r;
+
+    if (tag == main_board_tag || (tag && main_board_tag && strcmp(tag, main_board_tag) == 0))
+        return 0;
+
+    // Compile the selector once, it is evaluated for each board we see
+    if (tag) {
+        r = ty_board_selector_new(tag, &selector);
+        if (r < 0)
+            return r;
+    }
+
+    r = replace_tag(&main_board_tag, tag);
+    if (r < 0) {
+        ty_board_selector_free(selector);
+        return r;
+    }
+    ty_board_selector_free(main_board_selector);
+    main_board_selector = selector;
+
+    // The board will be selected again on the next get_board() call
+    ty_board_unref(main_board);
+    main_board = NULL;
+
+    return 0;
+}
+
+struct get_boards_context {
+    ty_board **boards;
+    unsigned int max_boards;
+    unsigned int count;
+};
+
+static int get_boards_callback(ty_board *board, ty_monitor_event event, void *udata)
+{
+    TY_UNUSED(event);
+
+    struct get_boards_context *ctx = udata;
+
+    if (ty_board_get_status(board) != TY_BOARD_STATUS_ONLINE ||
+            !ty_board_selector_matches(main_board_selector, board))
+        return 0;
+    if (ctx->count == ctx->max_boards) {
+        ty_log(TY_LOG_WARNING, "Too many boards, considering only %u boards", ctx->max_boards);
+        return 1;
+    }
+
+    ctx->boards[ctx->count++] = ty_board_ref(board);
+    return 0;
+}
+
+int get_boards(ty_board **rboards, unsigned int max_boards)
+{
+    struct get_boards_context ctx;
+    int r;
+
+    r = init_monitor();
+    if (r < 0)
+        return r;
+
+    ctx.boards = rboards;
+    ctx.max_boards = max_boards;
+    ctx.count = 0;
+
+    r = ty_monitor_list(main_board_monitor, get_boards_callback, &ctx);
+    if (r < 0) {
+        for (unsigned int i = 0; i < ctx.count; i++)
+            ty_board_unref(rboards[i]);
+        return r;
+    }
+
+    if (!ctx.count) {
+        if (main_board_tag) {
+            return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' not found", main_board_tag);
+        } else {
+            return ty_error(TY_ERROR_NOT_FOUND, "No board available");
+        }
+    }
+
+    return (int)ctx.count;
+}
+
+const char *get_board_tag(void)
+{
+    return main_board_tag;
+}
+
+int set_default_board_tag(const char *tag)
+{
+    int r;
+
+    r = replace_tag(&default_board_tag, tag);
+    if (r < 0)
+        return r;
+
+    return set_board_tag(tag);
+}
+
+// Rebuilds often take less than a second, keep the sub-second part when the platform has it
+static void get_stat_times(const struct stat *sb, int64_t *rmtime, int64_t *rctime)
+{
+#if defined(__APPLE__)
+    *rmtime = (int64_t)sb->st_mtimespec.tv_sec * 1000000000 + sb->st_mtimespec.tv_nsec;
+    *rctime = (int64_t)sb->st_ctimespec.tv_sec * 1000000000 + sb->st_ctimespec.tv_nsec;
+#elif defined(_WIN32)
+    *rmtime = (int64_t)sb->st_mtime * 1000000000;
+    *rctime = (int64_t)sb->st_ctime * 1000000000;
+#else
+    *rmtime = (int64_t)sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+    *rctime = (int64_t)sb->st_ctim.tv_sec * 1000000000 + sb->st_ctim.tv_nsec;
+#endif
+}
+
+int load_firmware(const char *filename, const char *format_name, ty_firmware **rfw)
+{
+    struct stat sb;
+    int64_t mtime, change_time;
+    struct firmware_cache_entry *entry;
+    ty_firmware *fw = NULL;
+    int r;
+
+    /* Scripts and server clients tend to upload the same firmware over and over, reuse it
+       as long as the file does not change. Files we cannot stat are simply not cached.
+       Linkers usually replace the file, so the inode changes even when the timestamps
+       are too coarse to tell two builds apart. */
+    if (stat(filename, &sb) < 0)
+        return ty_firmware_load(filename, format_name, rfw);
+    get_stat_times(&sb, &mtime, &change_time);
+
+    for (unsigned int i = 0; i < TY_COUNTOF(firmware_cache); i++) {
+        entry = &firmware_cache[i];
+
+        if (entry->fw && strcmp(entry->filename, filename) == 0 &&
+                (entry->format == format_name ||
+                 (entry->format && format_name && strcmp(entry->format, format_name) == 0)) &&
+                entry->dev == (uint64_t)sb.st_dev && entry->ino == (uint64_t)sb.st_ino &&
+                entry->mtime == mtime && entry->ctime == change_time &&
+                entry->size == (int64_t)sb.st_size) {
+            *rfw = ty_firmware_ref(entry->fw);
+            return 0;
+        }
+    }
+
+    r = ty_firmware_load(filename, format_name, &fw);
+    if (r < 0)
+        return r;
+
+    entry = &firmware_cache[firmware_cache_next];
+    firmware_cache_next = (firmware_cache_next + 1) % TY_COUNTOF(firmware_cache);
+
+    ty_firmware_unref(entry->fw);
+    free(entry->filename);
+    free(entry->format);
+    memset(entry, 0, sizeof(*entry));
+
+    entry->filename = strdup(filename);
+    entry->format = format_name ? strdup(format_name) : NULL;
+    if (entry->filename && (entry->format || !format_name)) {
+        entry->dev = (uint64_t)sb.st_dev;
+        entry->ino = (uint64_t)sb.st_ino;
+        entry->mtime = mtime;
+        entry->ctime = change_time;
+        entry->size = (int64_t)sb.st_size;
+        entry->fw = ty_firmware_ref(fw);
+    } else {
+        free(entry->filename);
+        free(entry->format);
+        memset(entry, 0, sizeof(*entry));
+    }
+
+    *rfw = fw;
+    return 0;
+}
+
+static void clear_firmware_cache(void)
+{
+    for (unsigned int i = 0; i < TY_COUNTOF(firmware_cache); i++) {
+        struct firmware_cache_entry *entry = &firmware_cache[i];
+
+        ty_firmware_unref(entry->fw);
+        free(entry->filename);
+        free(entry->format);
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+int parse_duration(const char *str, int *rms)
+{
+    char *end;
+    long ms;
+
+    errno = 0;
+    ms = strtol(str, &end, 10);
+    if (errno || end == str || *end || ms < -1 || ms > INT_MAX)
+        return ty_error(TY_ERROR_PARSE, "Invalid duration '%s'", str);
+
+    *rms = (int)ms;
+    return 0;
+}
+
+// Serial data may contain NUL bytes, so strstr() is not an option
+const char *find_text(const char *buf, size_t size, const char *text, size_t text_len)
+{
+    if (text_len > size)
+        return NULL;
+
+    for (size_t i = 0; i <= size - text_len; i++) {
+        if (memcmp(buf + i, text, text_len) == 0)
+            return buf + i;
+    }
+
+    return NULL;
+}
+
 bool parse_common_option(ty_optline_context *optl, char *arg)
 {
     if (strcmp(arg, "--board") == 0 || strcmp(arg, "-B") == 0) {
-        main_board_tag = ty_optline_get_value(optl);
-        if (!main_board_tag) {
+        char *tag = ty_optline_get_value(optl);
+        if (!tag) {
             ty_log(TY_LOG_ERROR, "Option '--board' takes an argument");
             return false;
         }
-        return true;
+        return set_board_tag(tag) >= 0;
     } else if (strcmp(arg, "--quiet") == 0 || strcmp(arg, "-q") == 0) {
         ty_config_verbosity--;
         return true;
+    } else if (strcmp(arg, "--trace") == 0) {
+        char *filename = ty_optline_get_value(optl);
+        if (!filename) {
+            ty_log(TY_LOG_ERROR, "Option '--trace' takes an argument");
+            return false;
+        }
+        // Server clients get their own session, the server-wide trace keeps going
+        ty_trace_stop(command_trace_session);
+        command_trace_session = ty_trace_start(filename);
+        return command_trace_session > 0;
     } else {
         ty_log(TY_LOG_ERROR, "Unknown option '%s'", arg);
         return false;
     }
 }
 
+static const struct command *find_command(const char *name)
+{
+    for (const struct command *cmd = commands; cmd->name; cmd++) {
+        if (strcmp(cmd->name, name) == 0)
+            return cmd;
+    }
+
+    return NULL;
+}
+
+int run_command(int argc, char *argv[])
+{
+    const struct command *cmd;
+    int r;
+
+    /* Commands can run several times in the same process (server mode, scripts), go back
+       to the default board but keep it selected if it has not changed. */
+    if (set_board_tag(default_board_tag) < 0)
+        return EXIT_FAILURE;
+
+    cmd = find_command(argv[0]);
+    if (!cmd || cmd->f == server) {
+        ty_log(TY_LOG_ERROR, "Unknown command '%s'", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    r = (*cmd->f)(argc, argv);
+
+    // The trace started with --trace only covers this command
+    ty_trace_stop(command_trace_session);
+    command_trace_session = 0;
+
+    return r;
+}
+
 int main(int argc, char *argv[])
 {
     const struct command *cmd;
@@ -202,7 +523,21 @@ int main(int argc, char *argv[])
     }
 
     hs_log_set_handler(ty_libhs_log_handler, NULL);
+    main_trace_session = ty_trace_start(NULL);
+
+    /* Hand the command over to a running tycmd server if there is one, it has everything
+       set up already (models, device monitor, task pool). */
+    if (argc >= 2 && (cmd = find_command(argv[1])) && cmd->f != server) {
+        r = forward_command(argc - 1, argv + 1);
+        if (r >= 0)
+            return r;
+    }
+
     r = ty_models_load_patch(NULL);
+    if (r == TY_ERROR_MEMORY)
+        return EXIT_FAILURE;
+    // Lets us check firmware compatibility without rebooting boards we've seen before
+    r = ty_board_load_model_cache(NULL);
     if (r == TY_ERROR_MEMORY)
         return EXIT_FAILURE;
 
@@ -224,11 +559,8 @@ int main(int argc, char *argv[])
         return EXIT_SUCCESS;
     }
 
-    for (cmd = commands; cmd->name; cmd++) {
-        if (strcmp(cmd->name, argv[1]) == 0)
-            break;
-    }
-    if (!cmd->name) {
+    cmd = find_command(argv[1]);
+    if (!cmd) {
         ty_log(TY_LOG_ERROR, "Unknown command '%s'", argv[1]);
         print_main_usage(stderr);
         return EXIT_FAILURE;
@@ -238,6 +570,12 @@ int main(int argc, char *argv[])
 
     ty_board_unref(main_board);
     ty_monitor_free(main_board_monitor);
+    clear_firmware_cache();
+    ty_board_selector_free(main_board_selector);
+    free(main_board_tag);
+    free(default_board_tag);
+    ty_trace_stop(command_trace_session);
+    ty_trace_stop(main_trace_session);
 
     return r;
 }
@@ -16,6 +16,7 @@
 #include "../libty/class.h"
 #include "../libty/monitor.h"
 #include "../libty/optline.h"
+#include "../libty/system.h"
 
 TY_C_BEGIN
 
@@ -26,6 +27,20 @@ bool parse_common_option(ty_optline_context *optl, char *arg);
 
 int get_monitor(ty_monitor **rmonitor);
 int get_board(ty_board **rboard);
+int get_boards(ty_board **rboards, unsigned int max_boards);
+const char *get_board_tag(void);
+int set_default_board_tag(const char *tag);
+
+int load_firmware(const char *filename, const char *format_name, struct ty_firmware **rfw);
+
+int parse_duration(const char *str, int *rms);
+const char *find_text(const char *buf, size_t size, const char *text, size_t text_len);
+
+int run_command(int argc, char *argv[]);
+int split_command_line(char *line, char **args, unsigned int max_args);
+
+int forward_command(int argc, char *argv[]);
+void get_client_descriptors(ty_descriptor_set *set, int id);
 
 TY_C_END
 
@@ -0,0 +1,62 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/metrics.h"
+#include "main.h"
+
+static void print_metrics_usage(FILE *f)
+{
+    fprintf(f, "usage: %s metrics [options] [<file>]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Write the current metrics (hotplug events, monitor refreshes, serial traffic,\n"
+               "task durations and failures, HalfKay retries) in the Prometheus text format, to\n"
+               "<file> or to the standard output if <file> is missing or '-'. The file is\n"
+               "replaced atomically, or written to if it is a UNIX socket. This is mostly\n"
+               "useful with a running tycmd server.\n\n"
+               "Set TYTOOLS_METRICS to a filename to make the server (and TyCommander) write\n"
+               "their metrics there periodically.\n");
+}
+
+int metrics(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_metrics_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_metrics_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_metrics_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (!filename || strcmp(filename, "-") == 0) {
+        r = ty_metrics_write(stdout);
+    } else {
+        r = ty_metrics_dump(filename);
+    }
+
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,13 +26,11 @@ enum {
 #define BUFFER_SIZE 8192
 #define ERROR_IO_TIMEOUT 5000
 
-static int monitor_term_flags = 0;
-static hs_serial_config monitor_serial_config = {
-    .baudrate = 115200
-};
-static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
-static bool monitor_reconnect = false;
-static int monitor_timeout_eof = 200;
+static int monitor_term_flags;
+static hs_serial_config monitor_serial_config;
+static int monitor_directions;
+static bool monitor_reconnect;
+static int monitor_timeout_eof;
 
 #ifdef _WIN32
 static bool monitor_fake_echo;
@@ -227,6 +225,8 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
 
     if (monitor_directions & DIRECTION_INPUT)
         ty_board_interface_get_descriptors(iface, set, 2);
+    // Stop monitoring when the tycmd client goes away (server mode)
+    get_client_descriptors(set, 4);
 #ifdef _WIN32
     if (monitor_directions & DIRECTION_OUTPUT) {
         if (monitor_input_available) {
@@ -252,6 +252,7 @@ static int loop(ty_board *board, int outfd)
 {
     ty_descriptor_set set = {0};
     int timeout;
+    bool waiting, pending;
     char buf[BUFFER_SIZE];
     ssize_t r;
 
@@ -260,6 +261,9 @@ restart:
     if (r < 0)
         return (int)r;
     timeout = -1;
+    waiting = false;
+    // Output buffered by libty (see ty_board_set_capture) does not wake up ty_poll()
+    pending = monitor_reconnect && (monitor_directions & DIRECTION_INPUT);
 
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
@@ -267,9 +271,14 @@ restart:
         if (!set.count)
             return 0;
 
-        r = ty_poll(&set, timeout);
-        if (r < 0)
-            return (int)r;
+        if (pending) {
+            r = 2;
+            pending = false;
+        } else {
+            r = ty_poll(&set, timeout);
+            if (r < 0)
+                return (int)r;
+        }
 
         switch (r) {
             case 0: {
@@ -284,12 +293,20 @@ restart:
                 if (!ty_board_has_capability(board, TY_BOARD_CAPABILITY_SERIAL)) {
                     if (!monitor_reconnect)
                         return 0;
-
-                    ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
-                    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, -1);
-                    if (r < 0)
-                        return (int)r;
-
+                    if (ty_board_get_status(board) == TY_BOARD_STATUS_DROPPED)
+                        return ty_error(TY_ERROR_NOT_FOUND, "Board '%s' has disappeared",
+                                        ty_board_get_tag(board));
+
+                    /* Keep polling the monitor (and the client in server mode) until the
+                       serial interface comes back. */
+                    if (!waiting) {
+                        ty_log(TY_LOG_INFO, "Waiting for '%s'...", ty_board_get_tag(board));
+                        ty_descriptor_set_remove(&set, 2);
+                        ty_descriptor_set_remove(&set, 3);
+                        timeout = -1;
+                        waiting = true;
+                    }
+                } else if (waiting) {
                     goto restart;
                 }
             } break;
@@ -372,6 +389,10 @@ restart:
                     return (int)r;
                 }
             } break;
+
+            case 4: {
+                return 0;
+            } break;
         }
     }
 }
@@ -384,6 +405,13 @@ int monitor(int argc, char *argv[])
     int outfd = -1;
     int r;
 
+    monitor_term_flags = 0;
+    memset(&monitor_serial_config, 0, sizeof(monitor_serial_config));
+    monitor_serial_config.baudrate = 115200;
+    monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
+    monitor_reconnect = false;
+    monitor_timeout_eof = 200;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -568,6 +596,9 @@ int monitor(int argc, char *argv[])
     r = get_board(&board);
     if (r < 0)
         goto cleanup;
+    // Buffer the output across resets so nothing is lost before we reconnect
+    if (monitor_reconnect)
+        ty_board_set_capture(board, true);
 
     r = loop(board, outfd);
 
@@ -575,6 +606,11 @@ cleanup:
 #ifdef _WIN32
     stop_stdin_thread();
 #endif
+    if (outfd >= 0) {
+        dup2(outfd, STDOUT_FILENO);
+        close(outfd);
+    }
+    ty_terminal_restore();
     ty_board_unref(board);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
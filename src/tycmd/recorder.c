@@ -0,0 +1,61 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/recorder.h"
+#include "main.h"
+
+static void print_recorder_usage(FILE *f)
+{
+    fprintf(f, "usage: %s recorder [options] [<file>]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "The flight recorder keeps the last debug events (device changes, board status\n"
+               "changes, HalfKay retries, task changes and errors) even when debug output is\n"
+               "disabled. This command writes them to <file>, or to the standard output if\n"
+               "<file> is missing or '-'. This is mostly useful with a running tycmd server,\n"
+               "which can also be told to dump its events with SIGUSR1.\n\n"
+               "Set TYTOOLS_RECORDER to a filename to dump the events when a task fails.\n");
+}
+
+int recorder(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    int r;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_recorder_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_recorder_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_recorder_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (!filename || strcmp(filename, "-") == 0) {
+        r = ty_recorder_dump_file(stdout);
+    } else {
+        r = ty_recorder_dump(filename);
+    }
+
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -11,7 +11,7 @@
 #include "../libty/task.h"
 #include "main.h"
 
-static bool reset_bootloader = false;
+static bool reset_bootloader;
 
 static void print_reset_usage(FILE *f)
 {
@@ -32,6 +32,8 @@ int reset(int argc, char *argv[])
     ty_task *task = NULL;
     int r;
 
+    reset_bootloader = false;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -0,0 +1,391 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../libty/system.h"
+#include "main.h"
+
+#define MAX_LINE_SIZE 4096
+#define MAX_STEP_ARGS 64
+#define DEFAULT_WAIT_TIMEOUT 10000
+
+struct step_command {
+    const char *name;
+    int (*f)(int argc, char *argv[]);
+    const char *usage;
+};
+
+static bool run_keep_going;
+
+static int select_step(int argc, char *argv[]);
+static int wait_step(int argc, char *argv[]);
+static int capture_step(int argc, char *argv[]);
+static int sleep_step(int argc, char *argv[]);
+
+static const struct step_command step_commands[] = {
+    {"select",  select_step,  "select <tag>            Use board <tag> in the next steps"},
+    {"wait",    wait_step,    "wait <text> [<ms>]      Wait for <text> in the board serial output"},
+    {"capture", capture_step, "capture <ms>            Copy the board serial output for <ms>"},
+    {"sleep",   sleep_step,   "sleep <ms>              Do nothing for <ms>"},
+    {0}
+};
+
+static void print_run_usage(FILE *f)
+{
+    fprintf(f, "usage: %s run [options] [<script>]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Run options:\n"
+               "   -k, --keep-going         Continue with the next steps after a failure\n\n");
+
+    fprintf(f, "The script is read from standard input if <script> is missing or '-'. Each line is\n"
+               "a tycmd command without the program name (e.g. 'upload -w blink.hex'), or one of:\n");
+    for (const struct step_command *cmd = step_commands; cmd->name; cmd++)
+        fprintf(f, "   %s\n", cmd->usage);
+    fprintf(f, "\nAll steps share the same board monitor, board selection and loaded firmwares.\n"
+               "Serial output is only read during wait and capture steps. Empty lines and lines\n"
+               "starting with '#' are ignored, quote arguments that contain spaces.\n");
+}
+
+static int select_step(int argc, char *argv[])
+{
+    if (argc != 2)
+        return ty_error(TY_ERROR_PARSE, "Usage: select <tag>");
+
+    return set_default_board_tag(argv[1]);
+}
+
+static int open_serial(ty_board **rboard, ty_board_interface **riface, int timeout)
+{
+    ty_board *board = NULL;
+    ty_board_interface *iface = NULL;
+    int r;
+
+    r = get_board(&board);
+    if (r < 0)
+        goto error;
+
+    // The board may still be rebooting after an upload or a reset step
+    r = ty_board_wait_for(board, TY_BOARD_CAPABILITY_SERIAL, timeout);
+    if (r < 0)
+        goto error;
+    if (!r) {
+        r = ty_error(TY_ERROR_TIMEOUT, "Board '%s' is not available for serial I/O",
+                     ty_board_get_tag(board));
+        goto error;
+    }
+
+    r = ty_board_open_interface(board, TY_BOARD_CAPABILITY_SERIAL, &iface);
+    if (r < 0)
+        goto error;
+    if (!r) {
+        r = ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O",
+                     ty_board_get_tag(board));
+        goto error;
+    }
+
+    *rboard = board;
+    *riface = iface;
+    return 0;
+
+error:
+    ty_board_unref(board);
+    return r;
+}
+
+static int wait_step(int argc, char *argv[])
+{
+    const char *text;
+    size_t text_len;
+    int timeout = DEFAULT_WAIT_TIMEOUT;
+    ty_board *board = NULL;
+    ty_board_interface *iface = NULL;
+    char buf[1024 + MAX_LINE_SIZE];
+    size_t buf_len = 0;
+    uint64_t start;
+    int r;
+
+    if (argc < 2 || argc > 3)
+        return ty_error(TY_ERROR_PARSE, "Usage: wait <text> [<ms>]");
+    text = argv[1];
+    text_len = strlen(text);
+    if (!text_len)
+        return ty_error(TY_ERROR_PARSE, "Cannot wait for empty text");
+    if (argc == 3) {
+        r = parse_duration(argv[2], &timeout);
+        if (r < 0)
+            return r;
+    }
+
+    start = ty_millis();
+
+    r = open_serial(&board, &iface, timeout);
+    if (r < 0)
+        return r;
+
+    while (true) {
+        ssize_t len;
+
+        // Keep enough of the previous data to find text split across reads
+        if (buf_len >= text_len) {
+            memmove(buf, buf + buf_len - text_len + 1, text_len - 1);
+            buf_len = text_len - 1;
+        }
+
+        len = ty_board_serial_read(board, buf + buf_len, sizeof(buf) - buf_len,
+                                   ty_adjust_timeout(timeout, start));
+        if (len < 0) {
+            r = (int)len;
+            goto cleanup;
+        }
+        if (!len) {
+            r = ty_error(TY_ERROR_TIMEOUT, "Timed out while waiting for '%s'", text);
+            goto cleanup;
+        }
+
+        fwrite(buf + buf_len, 1, (size_t)len, stdout);
+        fflush(stdout);
+        buf_len += (size_t)len;
+
+        if (find_text(buf, buf_len, text, text_len))
+            break;
+    }
+
+    r = 0;
+cleanup:
+    ty_board_interface_close(iface);
+    ty_board_unref(board);
+    return r;
+}
+
+static int capture_step(int argc, char *argv[])
+{
+    int duration;
+    ty_board *board = NULL;
+    ty_board_interface *iface = NULL;
+    uint64_t start;
+    int r;
+
+    if (argc != 2)
+        return ty_error(TY_ERROR_PARSE, "Usage: capture <ms>");
+    r = parse_duration(argv[1], &duration);
+    if (r < 0)
+        return r;
+
+    start = ty_millis();
+
+    r = open_serial(&board, &iface, duration);
+    if (r < 0)
+        return r;
+
+    while (true) {
+        char buf[1024];
+        ssize_t len;
+        int timeout;
+
+        timeout = ty_adjust_timeout(duration, start);
+        if (!timeout)
+            break;
+
+        len = ty_board_serial_read(board, buf, sizeof(buf), timeout);
+        if (len < 0) {
+            r = (int)len;
+            goto cleanup;
+        }
+
+        fwrite(buf, 1, (size_t)len, stdout);
+        fflush(stdout);
+    }
+
+    r = 0;
+cleanup:
+    ty_board_interface_close(iface);
+    ty_board_unref(board);
+    return r;
+}
+
+static int sleep_step(int argc, char *argv[])
+{
+    int duration;
+    int r;
+
+    if (argc != 2)
+        return ty_error(TY_ERROR_PARSE, "Usage: sleep <ms>");
+    r = parse_duration(argv[1], &duration);
+    if (r < 0)
+        return r;
+    if (duration < 0)
+        return ty_error(TY_ERROR_PARSE, "Cannot sleep forever");
+
+    ty_delay((unsigned int)duration);
+    return 0;
+}
+
+int split_command_line(char *line, char **args, unsigned int max_args)
+{
+    char *src = line, *dest = line;
+    unsigned int count = 0;
+
+    while (true) {
+        char quote = 0;
+
+        while (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n')
+            src++;
+        if (!*src || (*src == '#' && !count))
+            break;
+
+        if (count == max_args)
+            return ty_error(TY_ERROR_PARSE, "Too many arguments (maximum is %u)", max_args);
+        args[count++] = dest;
+
+        while (*src && (quote || !strchr(" \t\r\n", *src))) {
+            if (*src == quote) {
+                quote = 0;
+            } else if (!quote && (*src == '"' || *src == '\'')) {
+                quote = *src;
+            } else if (*src == '\\' && quote != '\'' && src[1]) {
+                src++;
+                *dest++ = *src == 'n' ? '\n' : (*src == 'r' ? '\r' : (*src == 't' ? '\t' : *src));
+            } else {
+                *dest++ = *src;
+            }
+            src++;
+        }
+        if (quote)
+            return ty_error(TY_ERROR_PARSE, "Missing closing quote");
+
+        if (*src)
+            src++;
+        *dest++ = 0;
+    }
+
+    return (int)count;
+}
+
+static int run_step(int argc, char *argv[])
+{
+    ty_monitor *monitor;
+    int r;
+
+    // Process device changes from the previous steps (e.g. a rebooted board)
+    r = get_monitor(&monitor);
+    if (r < 0)
+        return r;
+    r = ty_monitor_refresh(monitor);
+    if (r < 0)
+        return r;
+
+    for (const struct step_command *cmd = step_commands; cmd->name; cmd++) {
+        if (strcmp(cmd->name, argv[0]) == 0)
+            return (*cmd->f)(argc, argv);
+    }
+    if (strcmp(argv[0], "run") == 0)
+        return ty_error(TY_ERROR_PARSE, "Scripts cannot run other scripts");
+
+    r = run_command(argc, argv);
+    return r == EXIT_SUCCESS ? 0 : TY_ERROR_OTHER;
+}
+
+int run(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *filename;
+    FILE *fp = NULL;
+    char line[MAX_LINE_SIZE];
+    unsigned int line_number = 0;
+    unsigned int failures = 0;
+    int verbosity;
+    int r;
+
+    run_keep_going = false;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_run_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--keep-going") == 0 || strcmp(opt, "-k") == 0) {
+            run_keep_going = true;
+        } else if (!parse_common_option(&optl, opt)) {
+            print_run_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    filename = ty_optline_consume_non_option(&optl);
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "Too many positional arguments");
+        print_run_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (!filename || strcmp(filename, "-") == 0) {
+        filename = "<stdin>";
+        fp = stdin;
+    } else {
+        fp = fopen(filename, "r");
+        if (!fp) {
+            ty_log(TY_LOG_ERROR, "Cannot open '%s': %s", filename, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Steps start from the board selected with -B, if any
+    r = get_board_tag() ? set_default_board_tag(get_board_tag()) : 0;
+    if (r < 0)
+        goto cleanup;
+    verbosity = ty_config_verbosity;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *args[MAX_STEP_ARGS];
+        int args_count;
+
+        line_number++;
+
+        if (!strchr(line, '\n') && !feof(fp)) {
+            r = ty_error(TY_ERROR_PARSE, "%s:%u: Line is too long", filename, line_number);
+            goto cleanup;
+        }
+
+        args_count = split_command_line(line, args, TY_COUNTOF(args));
+        if (args_count < 0) {
+            r = ty_error(TY_ERROR_PARSE, "%s:%u: Malformed command", filename, line_number);
+            goto cleanup;
+        }
+        if (!args_count)
+            continue;
+
+        ty_log(TY_LOG_DEBUG, "%s:%u: Running '%s'", filename, line_number, args[0]);
+
+        ty_config_verbosity = verbosity;
+        r = run_step(args_count, args);
+        ty_config_verbosity = verbosity;
+        fflush(stdout);
+        if (r < 0) {
+            ty_log(TY_LOG_ERROR, "%s:%u: Step '%s' failed", filename, line_number, args[0]);
+            failures++;
+            if (!run_keep_going)
+                goto cleanup;
+        }
+    }
+    if (ferror(fp)) {
+        r = ty_error(TY_ERROR_IO, "I/O error while reading '%s'", filename);
+        goto cleanup;
+    }
+
+    r = failures ? TY_ERROR_OTHER : 0;
+cleanup:
+    set_default_board_tag(NULL);
+    if (fp && fp != stdin)
+        fclose(fp);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,858 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+    // Needed for struct ucred with glibc
+    #define _GNU_SOURCE
+#endif
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+#endif
+#include "../libty/metrics.h"
+#include "../libty/recorder.h"
+#include "../libty/system.h"
+#include "../libty/task.h"
+#include "main.h"
+
+/* The server and its clients exchange small frames over a local stream socket. Each frame
+   starts with a fixed header (payload size and frame type, in host byte order since both
+   ends run on the same machine), followed by the payload:
+
+   - SERVER_HELLO: uint32_t protocol version, sent when the server picks up a client
+   - CLIENT_RUN: uint32_t argc, NUL-terminated working directory, NUL-terminated arguments;
+     the client standard descriptors (stdin, stdout, stderr) are attached with SCM_RIGHTS
+   - SERVER_EXIT: int32_t exit code of the command */
+
+#define PROTOCOL_VERSION 1
+#define MAX_FRAME_SIZE 65536
+#define HELLO_TIMEOUT 250
+#define RUN_TIMEOUT 2000
+#define METRICS_INTERVAL 10000
+
+enum frame_type {
+    FRAME_SERVER_HELLO = 1,
+    FRAME_CLIENT_RUN = 2,
+    FRAME_SERVER_EXIT = 3
+};
+
+struct frame_header {
+    uint32_t size;
+    uint8_t type;
+    uint8_t reserved[3];
+};
+
+static const char *server_socket_path;
+
+static void print_server_usage(FILE *f)
+{
+    fprintf(f, "usage: %s server [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Server options:\n"
+               "   -s, --socket <path>      Listen on this socket instead of the default one\n\n"
+               "Other tycmd commands use the server transparently when it is running, set\n"
+               "TYCMD_SOCKET to use another socket path, or to an empty value to disable it.\n");
+}
+
+#ifdef _WIN32
+
+int server(int argc, char *argv[])
+{
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+    TY_UNUSED(server_socket_path);
+
+    print_server_usage(stderr);
+    ty_log(TY_LOG_ERROR, "Server mode is not supported on this platform");
+    return EXIT_FAILURE;
+}
+
+int forward_command(int argc, char *argv[])
+{
+    TY_UNUSED(argc);
+    TY_UNUSED(argv);
+
+    return -1;
+}
+
+void get_client_descriptors(ty_descriptor_set *set, int id)
+{
+    TY_UNUSED(set);
+    TY_UNUSED(id);
+}
+
+#else
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+static int server_client_fd = -1;
+static int server_interrupt_pipe[2] = {-1, -1};
+
+static const char *get_default_socket_path(void)
+{
+    static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+    if (getenv("TYCMD_SOCKET"))
+        return getenv("TYCMD_SOCKET");
+
+    if (!path[0]) {
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        int len;
+
+        // The /tmp fallback lives in a private directory, see prepare_socket_directory()
+        if (runtime_dir && runtime_dir[0]) {
+            len = snprintf(path, sizeof(path), "%s/%s.sock", runtime_dir, TY_CONFIG_TYCMD_EXECUTABLE);
+        } else {
+            len = snprintf(path, sizeof(path), "/tmp/%s-%u/%s.sock", TY_CONFIG_TYCMD_EXECUTABLE,
+                           (unsigned int)getuid(), TY_CONFIG_TYCMD_EXECUTABLE);
+        }
+        if (len < 0 || (size_t)len >= sizeof(path))
+            path[0] = 0;
+    }
+
+    return path;
+}
+
+/* Anyone can create files in /tmp, so make sure the directory containing the default
+   socket belongs to us and cannot be reached by other users before we trust it. */
+static int prepare_socket_directory(const char *path)
+{
+    char dir[TY_PATH_MAX_SIZE];
+    const char *slash;
+    struct stat sb;
+
+    if (getenv("TYCMD_SOCKET") || (getenv("XDG_RUNTIME_DIR") && getenv("XDG_RUNTIME_DIR")[0]))
+        return 0;
+
+    slash = strrchr(path, '/');
+    if (!slash || (size_t)(slash - path) >= sizeof(dir))
+        return ty_error(TY_ERROR_RANGE, "Socket path '%s' is too long", path);
+    memcpy(dir, path, (size_t)(slash - path));
+    dir[slash - path] = 0;
+
+    if (mkdir(dir, S_IRWXU) < 0 && errno != EEXIST)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to create '%s': %s", dir, strerror(errno));
+    if (lstat(dir, &sb) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to stat '%s': %s", dir, strerror(errno));
+    if (!S_ISDIR(sb.st_mode) || sb.st_uid != getuid() || (sb.st_mode & (S_IRWXG | S_IRWXO)))
+        return ty_error(TY_ERROR_ACCESS, "Refusing to use '%s', it is not a private directory", dir);
+
+    return 0;
+}
+
+// Both ends must run as the same user, the server runs commands with the client descriptors
+static int check_peer_user(int fd)
+{
+    uid_t uid;
+
+#if defined(SO_PEERCRED)
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to get socket peer credentials: %s", strerror(errno));
+    uid = cred.uid;
+#else
+    gid_t gid;
+
+    if (getpeereid(fd, &uid, &gid) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to get socket peer credentials: %s", strerror(errno));
+#endif
+
+    if (uid != getuid())
+        return ty_error(TY_ERROR_ACCESS, "Rejecting socket peer running as another user (%u)",
+                        (unsigned int)uid);
+
+    return 0;
+}
+
+static int fill_socket_address(const char *path, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return ty_error(TY_ERROR_RANGE, "Socket path '%s' is too long", path);
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+static int create_socket(void)
+{
+    int fd;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "socket() failed: %s", strerror(errno));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    return fd;
+}
+
+static int wait_readable(int fd, int timeout)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    uint64_t start;
+    int r;
+
+    start = ty_millis();
+restart:
+    r = poll(&pfd, 1, ty_adjust_timeout(timeout, start));
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        return ty_error(TY_ERROR_SYSTEM, "poll() failed: %s", strerror(errno));
+    }
+
+    return r;
+}
+
+static int send_frame(int fd, enum frame_type type, const void *payload, size_t size,
+                      const int *fds, unsigned int fds_count)
+{
+    struct frame_header header = {0};
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    ssize_t r;
+
+    assert(size <= MAX_FRAME_SIZE);
+    assert(fds_count <= 3);
+
+    header.size = (uint32_t)size;
+    header.type = (uint8_t)type;
+
+    iov[0].iov_base = &header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = size;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = size ? 2 : 1;
+
+    if (fds_count) {
+        struct cmsghdr *cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(fds_count * sizeof(int));
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds_count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fds_count * sizeof(int));
+    }
+
+restart:
+    r = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (r < 0) {
+        if (errno == EINTR)
+            goto restart;
+        return ty_error(TY_ERROR_IO, "Failed to send frame to tycmd peer: %s", strerror(errno));
+    }
+    // Local stream sockets with tiny frames, anything else is not worth handling
+    if ((size_t)r != sizeof(header) + size)
+        return ty_error(TY_ERROR_IO, "Partial frame sent to tycmd peer");
+
+    return 0;
+}
+
+static ssize_t recv_full(int fd, void *buf, size_t size, int *rfds, unsigned int *rfds_count)
+{
+    size_t received = 0;
+
+    while (received < size) {
+        struct iovec iov;
+        struct msghdr msg = {0};
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(3 * sizeof(int))];
+        } control;
+        ssize_t r;
+
+        iov.iov_base = (uint8_t *)buf + received;
+        iov.iov_len = size - received;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (rfds) {
+            msg.msg_control = control.buf;
+            msg.msg_controllen = sizeof(control.buf);
+        }
+
+        r = recvmsg(fd, &msg, 0);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return ty_error(TY_ERROR_IO, "Failed to receive frame from tycmd peer: %s",
+                            strerror(errno));
+        }
+        if (!r)
+            return ty_error(TY_ERROR_IO, "Connection closed by tycmd peer");
+
+        if (rfds) {
+            for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                    unsigned int count = (unsigned int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+                    for (unsigned int i = 0; i < count; i++) {
+                        int fd2;
+
+                        memcpy(&fd2, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                        if (*rfds_count < 3) {
+                            fcntl(fd2, F_SETFD, FD_CLOEXEC);
+                            rfds[(*rfds_count)++] = fd2;
+                        } else {
+                            close(fd2);
+                        }
+                    }
+                }
+            }
+        }
+
+        received += (size_t)r;
+    }
+
+    return (ssize_t)received;
+}
+
+static int recv_frame(int fd, int timeout, enum frame_type type, void *payload, size_t max_size,
+                      size_t *rsize, int *rfds, unsigned int *rfds_count)
+{
+    struct frame_header header;
+    ssize_t r;
+
+    r = wait_readable(fd, timeout);
+    if (r < 0)
+        return (int)r;
+    if (!r)
+        return ty_error(TY_ERROR_TIMEOUT, "Timed out while waiting for tycmd peer");
+
+    r = recv_full(fd, &header, sizeof(header), rfds, rfds_count);
+    if (r < 0)
+        return (int)r;
+    if (header.type != type || header.size > max_size)
+        return ty_error(TY_ERROR_PARSE, "Received malformed frame from tycmd peer");
+
+    if (header.size) {
+        r = recv_full(fd, payload, header.size, rfds, rfds_count);
+        if (r < 0)
+            return (int)r;
+    }
+
+    if (rsize)
+        *rsize = header.size;
+    return 0;
+}
+
+int forward_command(int argc, char *argv[])
+{
+    const char *path;
+    struct sockaddr_un addr;
+    char *payload = NULL;
+    size_t payload_size;
+    int fd = -1;
+    uint32_t version;
+    int32_t code;
+    int r;
+
+    path = get_default_socket_path();
+    if (!path[0])
+        return -1;
+
+    // Cheap check to avoid creating a socket when no server has ever been started
+    if (access(path, F_OK) < 0)
+        return -1;
+
+    ty_error_mask(TY_ERROR_SYSTEM);
+    ty_error_mask(TY_ERROR_RANGE);
+    fd = create_socket();
+    r = fd >= 0 ? fill_socket_address(path, &addr) : fd;
+    ty_error_unmask();
+    ty_error_unmask();
+    if (r < 0)
+        goto cleanup;
+
+    r = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (r < 0) {
+        ty_log(TY_LOG_DEBUG, "Cannot connect to tycmd server at '%s': %s", path, strerror(errno));
+        r = -1;
+        goto cleanup;
+    }
+    r = check_peer_user(fd);
+    if (r < 0) {
+        r = -1;
+        goto cleanup;
+    }
+
+    /* The server handles one command at a time, run the command ourselves if it does not
+       pick us up fast enough. Nothing has been sent yet so it will just drop us. */
+    ty_error_mask(TY_ERROR_TIMEOUT);
+    ty_error_mask(TY_ERROR_IO);
+    ty_error_mask(TY_ERROR_PARSE);
+    r = recv_frame(fd, HELLO_TIMEOUT, FRAME_SERVER_HELLO, &version, sizeof(version), NULL, NULL, NULL);
+    ty_error_unmask();
+    ty_error_unmask();
+    ty_error_unmask();
+    if (r < 0 || version != PROTOCOL_VERSION) {
+        ty_log(TY_LOG_DEBUG, "Ignoring unavailable or incompatible tycmd server");
+        r = -1;
+        goto cleanup;
+    }
+
+    // Build the run request
+    {
+        char cwd[TY_PATH_MAX_SIZE];
+        uint32_t args_count = (uint32_t)argc;
+        char *ptr;
+
+        if (!getcwd(cwd, sizeof(cwd))) {
+            r = -1;
+            goto cleanup;
+        }
+
+        payload_size = sizeof(args_count) + strlen(cwd) + 1;
+        for (int i = 0; i < argc; i++)
+            payload_size += strlen(argv[i]) + 1;
+        if (payload_size > MAX_FRAME_SIZE) {
+            r = -1;
+            goto cleanup;
+        }
+
+        payload = malloc(payload_size);
+        if (!payload) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+
+        memcpy(payload, &args_count, sizeof(args_count));
+        ptr = payload + sizeof(args_count);
+        ptr = stpcpy(ptr, cwd) + 1;
+        for (int i = 0; i < argc; i++)
+            ptr = stpcpy(ptr, argv[i]) + 1;
+    }
+
+    {
+        int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+        r = send_frame(fd, FRAME_CLIENT_RUN, payload, payload_size, fds, TY_COUNTOF(fds));
+        if (r < 0)
+            goto fail;
+    }
+
+    r = recv_frame(fd, -1, FRAME_SERVER_EXIT, &code, sizeof(code), NULL, NULL, NULL);
+    if (r < 0)
+        goto fail;
+
+    r = (int)code;
+    goto cleanup;
+
+fail:
+    r = EXIT_FAILURE;
+cleanup:
+    free(payload);
+    if (fd >= 0)
+        close(fd);
+    return r;
+}
+
+void get_client_descriptors(ty_descriptor_set *set, int id)
+{
+    if (server_client_fd >= 0)
+        ty_descriptor_set_add(set, server_client_fd, id);
+}
+
+static int redirect_descriptors(const int *fds, int *saved_fds)
+{
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; i++) {
+        saved_fds[i] = -1;
+
+        if (fds[i] < 0)
+            continue;
+
+        saved_fds[i] = dup(i);
+        if (saved_fds[i] < 0)
+            return ty_error(TY_ERROR_SYSTEM, "dup() failed: %s", strerror(errno));
+        fcntl(saved_fds[i], F_SETFD, FD_CLOEXEC);
+
+        if (dup2(fds[i], i) < 0)
+            return ty_error(TY_ERROR_SYSTEM, "dup2() failed: %s", strerror(errno));
+    }
+
+    return 0;
+}
+
+static void restore_descriptors(const int *saved_fds)
+{
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);
+    clearerr(stderr);
+
+    for (int i = 0; i < 3; i++) {
+        if (saved_fds[i] >= 0) {
+            dup2(saved_fds[i], i);
+            close(saved_fds[i]);
+        }
+    }
+}
+
+static int handle_client(ty_monitor *monitor, int fd)
+{
+    uint32_t version = PROTOCOL_VERSION;
+    char *payload = NULL;
+    size_t payload_size;
+    int fds[3] = {-1, -1, -1};
+    unsigned int fds_count = 0;
+    int saved_fds[3] = {-1, -1, -1};
+    int cwd_fd = -1;
+    char **args = NULL;
+    uint32_t args_count;
+    int32_t code;
+    int r;
+
+    r = send_frame(fd, FRAME_SERVER_HELLO, &version, sizeof(version), NULL, 0);
+    if (r < 0)
+        goto cleanup;
+
+    payload = malloc(MAX_FRAME_SIZE + 1);
+    if (!payload) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    // Clients that gave up waiting for us close the connection without sending anything
+    ty_error_mask(TY_ERROR_IO);
+    r = recv_frame(fd, RUN_TIMEOUT, FRAME_CLIENT_RUN, payload, MAX_FRAME_SIZE, &payload_size,
+                   fds, &fds_count);
+    ty_error_unmask();
+    if (r < 0)
+        goto cleanup;
+    if (payload_size < sizeof(args_count) + 1 || fds_count != 3) {
+        r = ty_error(TY_ERROR_PARSE, "Received malformed request from tycmd client");
+        goto cleanup;
+    }
+    payload[payload_size] = 0;
+
+    // Unpack working directory and command arguments
+    {
+        const char *cwd;
+        char *ptr, *end;
+
+        memcpy(&args_count, payload, sizeof(args_count));
+        if (!args_count || args_count > MAX_FRAME_SIZE / 2) {
+            r = ty_error(TY_ERROR_PARSE, "Received malformed request from tycmd client");
+            goto cleanup;
+        }
+
+        args = calloc(args_count + 1, sizeof(*args));
+        if (!args) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+
+        ptr = payload + sizeof(args_count);
+        end = payload + payload_size;
+
+        cwd = ptr;
+        ptr += strlen(ptr) + 1;
+        for (uint32_t i = 0; i < args_count; i++) {
+            if (ptr >= end) {
+                r = ty_error(TY_ERROR_PARSE, "Received malformed request from tycmd client");
+                goto cleanup;
+            }
+            args[i] = ptr;
+            ptr += strlen(ptr) + 1;
+        }
+
+        cwd_fd = open(".", O_RDONLY | O_CLOEXEC);
+        if (cwd_fd < 0 || chdir(cwd) < 0) {
+            r = ty_error(TY_ERROR_SYSTEM, "Cannot change to client directory '%s': %s",
+                         cwd, strerror(errno));
+            goto cleanup;
+        }
+    }
+
+    r = redirect_descriptors(fds, saved_fds);
+    if (r < 0)
+        goto cleanup;
+
+    /* Process pending device events right away, so that the command sees the same thing
+       it would see after a full enumeration. */
+    r = ty_monitor_refresh(monitor);
+    if (r < 0) {
+        code = EXIT_FAILURE;
+    } else {
+        int verbosity = ty_config_verbosity;
+
+        server_client_fd = fd;
+        ty_config_verbosity = TY_LOG_INFO;
+        code = run_command((int)args_count, args);
+        ty_config_verbosity = verbosity;
+        server_client_fd = -1;
+    }
+
+    restore_descriptors(saved_fds);
+
+    ty_error_mask(TY_ERROR_IO);
+    r = send_frame(fd, FRAME_SERVER_EXIT, &code, sizeof(code), NULL, 0);
+    ty_error_unmask();
+
+cleanup:
+    if (cwd_fd >= 0) {
+        if (fchdir(cwd_fd) < 0)
+            ty_log(TY_LOG_WARNING, "Failed to restore working directory: %s", strerror(errno));
+        close(cwd_fd);
+    }
+    free(args);
+    for (unsigned int i = 0; i < fds_count; i++)
+        close(fds[i]);
+    free(payload);
+    return r;
+}
+
+static void interrupt_handler(int signum)
+{
+    // SIGUSR1 asks for a flight recorder dump, other signals stop the server
+    char c = signum == SIGUSR1 ? 'd' : 'q';
+
+    int errno_save = errno;
+    ssize_t r = write(server_interrupt_pipe[1], &c, 1);
+    TY_UNUSED(r);
+    errno = errno_save;
+}
+
+static int init_interrupt_handler(void)
+{
+    struct sigaction sa = {0};
+
+    if (pipe(server_interrupt_pipe) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "pipe() failed: %s", strerror(errno));
+    for (unsigned int i = 0; i < 2; i++) {
+        fcntl(server_interrupt_pipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(server_interrupt_pipe[i], F_SETFL, O_NONBLOCK);
+    }
+
+    sa.sa_handler = interrupt_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    // Clients may go away at any time, don't die writing to their output
+    signal(SIGPIPE, SIG_IGN);
+
+    return 0;
+}
+
+static int listen_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    mode_t old_umask;
+    int fd;
+    int r;
+
+    r = fill_socket_address(path, &addr);
+    if (r < 0)
+        return r;
+    r = prepare_socket_directory(path);
+    if (r < 0)
+        return r;
+
+    fd = create_socket();
+    if (fd < 0)
+        return fd;
+
+    /* Find out if another server is running before removing what may be a stale socket
+       left behind by a crashed server. */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        close(fd);
+        return ty_error(TY_ERROR_EXISTS, "Another server is already listening on '%s'", path);
+    }
+    unlink(path);
+
+    // Don't leave a window where the socket is reachable by other users
+    old_umask = umask(S_IRWXG | S_IRWXO);
+    r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (r < 0) {
+        // The failed connect() attempt may have left the socket unusable on some systems
+        close(fd);
+        fd = create_socket();
+        if (fd < 0) {
+            umask(old_umask);
+            return fd;
+        }
+        r = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+    umask(old_umask);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "Failed to bind socket '%s': %s", path, strerror(errno));
+        close(fd);
+        return r;
+    }
+
+    r = listen(fd, 16);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "listen() failed: %s", strerror(errno));
+        close(fd);
+        unlink(path);
+        return r;
+    }
+
+    return fd;
+}
+
+int server(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    ty_monitor *monitor;
+    ty_pool *pool;
+    ty_descriptor_set set = {0};
+    int listen_fd = -1;
+    const char *metrics_path;
+    uint64_t metrics_time;
+    int r;
+
+    server_socket_path = NULL;
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_server_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--socket") == 0 || strcmp(opt, "-s") == 0) {
+            server_socket_path = ty_optline_get_value(&optl);
+            if (!server_socket_path) {
+                ty_log(TY_LOG_ERROR, "Option '--socket' takes an argument");
+                print_server_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (!parse_common_option(&optl, opt)) {
+            print_server_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "No positional argument is allowed");
+        print_server_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    if (!server_socket_path)
+        server_socket_path = get_default_socket_path();
+    if (!server_socket_path[0]) {
+        ty_log(TY_LOG_ERROR, "Server socket path is empty or too long");
+        return EXIT_FAILURE;
+    }
+
+    r = init_interrupt_handler();
+    if (r < 0)
+        goto cleanup;
+
+    r = get_monitor(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = ty_pool_get_default(&pool);
+    if (r < 0)
+        goto cleanup;
+
+    listen_fd = listen_socket(server_socket_path);
+    if (listen_fd < 0) {
+        r = listen_fd;
+        goto cleanup;
+    }
+
+    ty_monitor_get_descriptors(monitor, &set, 1);
+    ty_descriptor_set_add(&set, listen_fd, 2);
+    ty_descriptor_set_add(&set, server_interrupt_pipe[0], 3);
+
+    ty_log(TY_LOG_INFO, "Listening on '%s'", server_socket_path);
+
+    metrics_path = getenv("TYTOOLS_METRICS");
+    if (metrics_path && !metrics_path[0])
+        metrics_path = NULL;
+    metrics_time = ty_millis();
+
+    while (true) {
+        r = ty_poll(&set, metrics_path ? ty_adjust_timeout(METRICS_INTERVAL, metrics_time) : -1);
+        if (r < 0)
+            goto cleanup;
+
+        if (metrics_path && ty_millis() - metrics_time >= METRICS_INTERVAL) {
+            // Errors are logged, the server keeps running anyway
+            ty_metrics_dump(metrics_path);
+            metrics_time = ty_millis();
+        }
+
+        if (r == 1) {
+            r = ty_monitor_refresh(monitor);
+            if (r < 0)
+                goto cleanup;
+        } else if (r == 2) {
+            int client_fd = accept(listen_fd, NULL, NULL);
+            if (client_fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                r = ty_error(TY_ERROR_SYSTEM, "accept() failed: %s", strerror(errno));
+                goto cleanup;
+            }
+            fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+            // Errors are reported by the server, but they only concern this client
+            if (check_peer_user(client_fd) == 0)
+                handle_client(monitor, client_fd);
+            close(client_fd);
+        } else if (r == 3) {
+            char buf[16];
+            ssize_t len;
+            bool stop = false;
+
+            while ((len = read(server_interrupt_pipe[0], buf, sizeof(buf))) > 0)
+                stop |= !!memchr(buf, 'q', (size_t)len);
+            if (stop) {
+                ty_log(TY_LOG_INFO, "Stopping server");
+                break;
+            }
+
+            if (ty_recorder_get_dump_path()) {
+                ty_log(TY_LOG_INFO, "Dumping flight recorder to '%s'", ty_recorder_get_dump_path());
+                ty_recorder_dump(NULL);
+            } else {
+                ty_recorder_dump_file(stderr);
+            }
+        }
+    }
+
+    r = 0;
+cleanup:
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(server_socket_path);
+    }
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
@@ -8,12 +8,16 @@
 
    See the LICENSE file for more details. */
 
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
 #include "../libty/firmware.h"
 #include "../libty/task.h"
 #include "main.h"
 
-static int upload_flags = 0;
-static const char *upload_firmware_format = NULL;
+static int upload_flags;
+static const char *upload_firmware_format;
 
 static void print_upload_usage(FILE *f)
 {
@@ -27,7 +31,8 @@ static void print_upload_usage(FILE *f)
                "       --nocheck            Force upload even if the board is not compatible\n"
                "       --noreset            Do not reset the device once the upload is finished\n"
                "   -f, --format <format>    Firmware file format (autodetected by default)\n\n"
-               "You can pass multiple firmwares, and the first compatible one will be used.\n");
+               "You can pass multiple firmwares, and the first compatible one will be used.\n"
+               "Use '-' to read a firmware from the standard input.\n");
 
     fprintf(f, "Supported firmware formats: ");
     for (unsigned int i = 0; i < ty_firmware_formats_count; i++)
@@ -35,6 +40,16 @@ static void print_upload_usage(FILE *f)
     fprintf(f, ".\n");
 }
 
+static int load_firmware_stdin(const char *format_name, ty_firmware **rfw)
+{
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    // The firmware takes ownership of the buffer, raw binary images are not even copied
+    return ty_firmware_load_stream(stdin, "<stdin>", format_name, rfw);
+}
+
 int upload(int argc, char *argv[])
 {
     ty_optline_context optl;
@@ -43,8 +58,12 @@ int upload(int argc, char *argv[])
     ty_firmware *fws[TY_UPLOAD_MAX_FIRMWARES];
     unsigned int fws_count;
     ty_task *task = NULL;
+    bool stdin_used = false;
     int r;
 
+    upload_flags = 0;
+    upload_firmware_format = NULL;
+
     ty_optline_init_argv(&optl, argc, argv);
     while ((opt = ty_optline_next_option(&optl))) {
         if (strcmp(opt, "--help") == 0) {
@@ -76,7 +95,17 @@ int upload(int argc, char *argv[])
             break;
         }
 
-        r = ty_firmware_load(opt, upload_firmware_format, &fws[fws_count]);
+        if (strcmp(opt, "-") == 0) {
+            if (stdin_used) {
+                ty_log(TY_LOG_WARNING, "Ignoring repeated '-' firmware argument");
+                continue;
+            }
+            stdin_used = true;
+
+            r = load_firmware_stdin(upload_firmware_format, &fws[fws_count]);
+        } else {
+            r = load_firmware(opt, upload_firmware_format, &fws[fws_count]);
+        }
         if (!r)
             fws_count++;
     }
@@ -17,10 +17,13 @@
 #include <QTextBlock>
 #include <QTextCursor>
 
+#include <algorithm>
+
 #include "board.hpp"
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
 #include "../libty/class.h"
+#include "../libty/trace.h"
 #include "database.hpp"
 #include "monitor.hpp"
 
@@ -28,6 +31,9 @@ using namespace std;
 
 #define MAX_RECENT_FIRMWARES 4
 #define SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+// Bounds the catch-up work when a view shows the board again, the log file has the rest
+#define SERIAL_BACKLOG_SIZE (static_cast<size_t>(1024 * 1024))
+#define SERIAL_BACKLOG_CHUNK_SIZE (static_cast<size_t>(64 * 1024))
 
 Board::Board(ty_board *board, QObject *parent)
     : QObject(parent), board_(ty_board_ref(board))
@@ -54,11 +60,18 @@ Board::Board(ty_board *board, QObject *parent)
     error_timer_.setInterval(TY_SHOW_ERROR_TIMEOUT);
     error_timer_.setSingleShot(true);
     connect(&error_timer_, &QTimer::timeout, this, &Board::updateStatus);
+
+    serial_backlog_timer_.setInterval(0);
+    serial_backlog_timer_.setSingleShot(true);
+    connect(&serial_backlog_timer_, &QTimer::timeout, this, &Board::flushSerialBacklogChunk);
 }
 
 Board::~Board()
 {
-    ty_board_interface_close(serial_iface_);
+    /* The serial thread calls serialReceived() directly, wait for it to let go of the
+       notifier (and close the interface) before the members it uses are destroyed. */
+    closeSerialInterface();
+    serial_notifier_.clearSync();
     ty_board_unref(board_);
 }
 
@@ -69,16 +82,7 @@ void Board::loadSettings(Monitor *monitor)
     if (r < 0)
         throw bad_alloc();
 
-    firmware_ = db_.get("firmware", "").toString();
-    if (firmware_.isEmpty() || !QFileInfo::exists(firmware_))
-        firmware_ = "";
-    recent_firmwares_ = db_.get("recentFirmwares", QStringList()).toStringList();
-    recent_firmwares_.erase(remove_if(recent_firmwares_.begin(), recent_firmwares_.end(),
-                                      [](const QString &filename) { return filename.isEmpty() || !QFileInfo::exists(filename); }),
-                            recent_firmwares_.end());
-    if (recent_firmwares_.count() > MAX_RECENT_FIRMWARES)
-        recent_firmwares_.erase(recent_firmwares_.begin() + MAX_RECENT_FIRMWARES,
-                                recent_firmwares_.end());
+    firmwares_loaded_ = false;
     reset_after_ = db_.get("resetAfter", true).toBool();
     serial_codec_name_ = db_.get("serialCodec", "UTF-8").toString();
     serial_codec_ = QTextCodec::codecForName(serial_codec_name_.toUtf8());
@@ -121,12 +125,36 @@ void Board::loadSettings(Monitor *monitor)
     emit settingsChanged();
 }
 
+void Board::loadFirmwares() const
+{
+    if (firmwares_loaded_)
+        return;
+
+    firmware_ = db_.get("firmware", "").toString();
+    if (firmware_.isEmpty() || !QFileInfo::exists(firmware_))
+        firmware_ = "";
+    recent_firmwares_ = db_.get("recentFirmwares", QStringList()).toStringList();
+    recent_firmwares_.erase(remove_if(recent_firmwares_.begin(), recent_firmwares_.end(),
+                                      [](const QString &filename) { return filename.isEmpty() || !QFileInfo::exists(filename); }),
+                            recent_firmwares_.end());
+    if (recent_firmwares_.count() > MAX_RECENT_FIRMWARES)
+        recent_firmwares_.erase(recent_firmwares_.begin() + MAX_RECENT_FIRMWARES,
+                                recent_firmwares_.end());
+
+    firmwares_loaded_ = true;
+}
+
 bool Board::updateSerialInterface()
 {
+    /* Let libty buffer the serial output as soon as the interface comes back (e.g. after
+       a reset), so we don't lose the first lines while the GUI catches up. */
+    ty_board_set_capture(board_, enable_serial_);
+
     if (enable_serial_ && hasCapability(TY_BOARD_CAPABILITY_SERIAL)) {
         openSerialInterface();
         if (!serial_iface_) {
             enable_serial_ = false;
+            ty_board_set_capture(board_, false);
             return false;
         }
     } else {
@@ -141,50 +169,57 @@ bool Board::matchesTag(const QString &id)
     return ty_board_matches_tag(board_, id.toLocal8Bit().constData());
 }
 
+std::shared_ptr<const ty_board_snapshot> Board::snapshot() const
+{
+    return std::shared_ptr<const ty_board_snapshot>(ty_board_get_snapshot(board_),
+                                                    [](const ty_board_snapshot *snap) {
+        ty_board_snapshot_unref(const_cast<ty_board_snapshot *>(snap));
+    });
+}
+
 uint16_t Board::capabilities() const
 {
-    return ty_board_get_capabilities(board_);
+    return static_cast<uint16_t>(snapshot()->capabilities);
 }
 
 bool Board::hasCapability(ty_board_capability cap) const
 {
-    return ty_board_has_capability(board_, cap);
+    return snapshot()->capabilities & (1 << cap);
 }
 
 ty_model Board::model() const
 {
-    return ty_board_get_model(board_);
+    return snapshot()->model;
 }
 
 QString Board::modelName() const
 {
-    ty_model model = ty_board_get_model(board_);
-    return ty_models[model].name;
+    return ty_models[snapshot()->model].name;
 }
 
 QString Board::tag() const
 {
-    return ty_board_get_tag(board_);
+    return snapshot()->tag;
 }
 
 QString Board::id() const
 {
-    return ty_board_get_id(board_);
+    return snapshot()->id;
 }
 
 QString Board::location() const
 {
-    return ty_board_get_location(board_);
+    return snapshot()->location;
 }
 
 QString Board::serialNumber() const
 {
-    return ty_board_get_serial_number(board_);
+    return snapshot()->serial_number;
 }
 
 QString Board::description() const
 {
-    return ty_board_get_description(board_);
+    return snapshot()->description;
 }
 
 std::vector<BoardInterfaceInfo> Board::interfaces() const
@@ -272,18 +307,52 @@ QString Board::makeCapabilityString(uint16_t capabilities, QString empty_str)
 
 TaskInterface Board::upload(const QString &filename)
 {
-    shared_ptr<Firmware> fw;
-    if (!filename.isEmpty()) {
-        fw = Firmware::load(filename);
-    } else {
-        if (firmware_.isEmpty())
+    if (filename.isEmpty()) {
+        auto firmware = this->firmware();
+        if (firmware.isEmpty())
             return watchTask(make_task<FailedTask>(tr("No firmware set for board '%1'").arg(tag())));
-        fw = Firmware::load(firmware_);
+        return upload(QStringList{firmware});
     }
-    if (!fw)
+
+    return upload(QStringList{filename});
+}
+
+TaskInterface Board::upload(const QStringList &filenames)
+{
+    return upload(filenames, reset_after_);
+}
+
+TaskInterface Board::upload(const QStringList &filenames, bool reset_after)
+{
+    if (filenames.isEmpty())
+        return watchTask(make_task<FailedTask>(tr("No firmware to upload to board '%1'").arg(tag())));
+
+    auto loader = FirmwareLoader::create(filenames);
+    if (!loader)
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
 
-    return upload({fw});
+    return upload(loader, reset_after);
+}
+
+TaskInterface Board::upload(const shared_ptr<FirmwareLoader> &loader)
+{
+    return upload(loader, reset_after_);
+}
+
+/* Parsing big firmwares can take a while, especially on network shares, so the upload task
+   loads them in the task pool instead of doing it here in the GUI thread. Boards that share
+   the loader share the load. */
+TaskInterface Board::upload(const shared_ptr<FirmwareLoader> &loader, bool reset_after)
+{
+    ty_task *task;
+    int r;
+
+    r = ty_upload_loader(board_, loader->loader(), reset_after ? 0 : TY_UPLOAD_NORESET, &task);
+    if (r < 0)
+        return watchTask(make_task<FailedTask>(ty_error_last_message()));
+    task->pool = pool_;
+
+    return watchUploadTask(task);
 }
 
 TaskInterface Board::upload(const vector<shared_ptr<Firmware>> &fws)
@@ -307,15 +376,7 @@ TaskInterface Board::upload(const vector<shared_ptr<Firmware>> &fws, bool reset_
         return watchTask(make_task<FailedTask>(ty_error_last_message()));
     task->pool = pool_;
 
-    auto task2 = make_task<TyTask>(task);
-    watchTask(task2);
-    connect(&task_watcher_, &TaskWatcher::finished, this,
-            [=](bool success, shared_ptr<void> result) {
-        if (success)
-            addUploadedFirmware(static_cast<ty_firmware *>(result.get()));
-    });
-
-    return task2;
+    return watchUploadTask(task);
 }
 
 TaskInterface Board::reset()
@@ -377,11 +438,18 @@ TaskInterface Board::sendFile(const QString &filename)
 
 void Board::appendFakeSerialRead(const QString &s)
 {
-    if (serial_log_file_.isOpen()) {
+    bool backlog = serial_background_ || serial_backlog_flushing_;
+
+    if (serial_log_file_.isOpen() || backlog) {
         auto buf = serial_codec_->fromUnicode(s);
-        QMutexLocker locker(&serial_lock_);
-        writeToSerialLog(buf.constData(), buf.size());
-        locker.unlock();
+        if (serial_log_file_.isOpen()) {
+            QMutexLocker locker(&serial_lock_);
+            writeToSerialLog(buf.constData(), buf.size());
+        }
+        if (backlog) {
+            appendToSerialBacklog(buf.constData(), static_cast<size_t>(buf.size()));
+            return;
+        }
     }
 
     QTextCursor cursor(&serial_document_);
@@ -406,6 +474,7 @@ void Board::setTag(const QString &tag)
 
 void Board::setFirmware(const QString &firmware)
 {
+    loadFirmwares();
     if (firmware == firmware_)
         return;
 
@@ -417,6 +486,7 @@ void Board::setFirmware(const QString &firmware)
 
 void Board::clearRecentFirmwares()
 {
+    loadFirmwares();
     if (recent_firmwares_.isEmpty())
         return;
 
@@ -508,6 +578,20 @@ TaskInterface Board::startUpload(const QString &filename)
     return task;
 }
 
+TaskInterface Board::startUpload(const QStringList &filenames)
+{
+    auto task = upload(filenames);
+    task.start();
+    return task;
+}
+
+TaskInterface Board::startUpload(const shared_ptr<FirmwareLoader> &loader)
+{
+    auto task = upload(loader);
+    task.start();
+    return task;
+}
+
 TaskInterface Board::startUpload(const vector<shared_ptr<Firmware>> &fws)
 {
     auto task = upload(fws);
@@ -571,6 +655,8 @@ void Board::serialReceived(ty_descriptor desc)
 {
     Q_UNUSED(desc);
 
+    TY_TRACE_BEGIN("tycommander", "serial_ingest", ty_board_get_tag(board_));
+
     QMutexLocker locker(&serial_lock_);
 
     ty_error_mask(TY_ERROR_MODE);
@@ -605,6 +691,8 @@ void Board::serialReceived(ty_descriptor desc)
 
     if (!previous_len && serial_buf_len_)
         QMetaObject::invokeMethod(this, "appendBufferToSerialDocument", Qt::QueuedConnection);
+
+    TY_TRACE_END("tycommander", "serial_ingest");
 }
 
 // You need to lock serial_lock_ before you call this
@@ -645,8 +733,147 @@ void Board::writeToSerialLog(const char *buf, size_t len)
     }
 }
 
+void Board::setSerialBackground(bool background)
+{
+    if (background == serial_background_)
+        return;
+
+    serial_background_ = background;
+    if (background) {
+        // Whatever is left of the catch-up stays in the backlog
+        serial_backlog_timer_.stop();
+        serial_backlog_flushing_ = false;
+    } else {
+        flushSerialBacklog();
+    }
+}
+
+// Ring buffer, so that chatty boards only cost a memcpy while hidden
+void Board::appendToSerialBacklog(const char *buf, size_t len)
+{
+    if (serial_backlog_.isEmpty())
+        serial_backlog_.resize(SERIAL_BACKLOG_SIZE);
+    if (len > SERIAL_BACKLOG_SIZE) {
+        serial_backlog_dropped_ += len - SERIAL_BACKLOG_SIZE;
+        buf += len - SERIAL_BACKLOG_SIZE;
+        len = SERIAL_BACKLOG_SIZE;
+    }
+
+    auto end = (serial_backlog_pos_ + serial_backlog_len_) % SERIAL_BACKLOG_SIZE;
+    auto part_len = min(len, SERIAL_BACKLOG_SIZE - end);
+    memcpy(serial_backlog_.data() + end, buf, part_len);
+    memcpy(serial_backlog_.data(), buf + part_len, len - part_len);
+
+    serial_backlog_len_ += len;
+    if (serial_backlog_len_ > SERIAL_BACKLOG_SIZE) {
+        auto excess = serial_backlog_len_ - SERIAL_BACKLOG_SIZE;
+        serial_backlog_pos_ = (serial_backlog_pos_ + excess) % SERIAL_BACKLOG_SIZE;
+        serial_backlog_len_ = SERIAL_BACKLOG_SIZE;
+        serial_backlog_dropped_ += excess;
+    }
+}
+
+/* Decoding and laying out up to 1 MiB of text takes a while, so the backlog is inserted
+   in chunks, one per event loop iteration, to keep the GUI responsive. */
+void Board::flushSerialBacklog()
+{
+    if (serial_backlog_flushing_)
+        return;
+    if (!serial_backlog_len_ && !serial_backlog_dropped_) {
+        clearSerialBacklog();
+        return;
+    }
+
+    trimSerialBacklog();
+
+    QTextCursor cursor(&serial_document_);
+    cursor.movePosition(QTextCursor::End);
+    if (serial_backlog_dropped_) {
+        // The decoder state is meaningless after a gap
+        serial_decoder_.reset(serial_codec_->makeDecoder());
+        cursor.insertText(tr("\n[%1 kiB of serial output skipped while hidden]\n")
+                          .arg((serial_backlog_dropped_ + 1023) / 1024));
+        serial_backlog_dropped_ = 0;
+    }
+
+    serial_backlog_flushing_ = true;
+    flushSerialBacklogChunk();
+}
+
+void Board::flushSerialBacklogChunk()
+{
+    if (!serial_backlog_len_) {
+        clearSerialBacklog();
+        return;
+    }
+
+    TY_TRACE_BEGIN("tycommander", "serial_catchup", ty_board_get_tag(board_));
+
+    auto len = min(min(serial_backlog_len_, SERIAL_BACKLOG_CHUNK_SIZE),
+                   SERIAL_BACKLOG_SIZE - serial_backlog_pos_);
+    auto str = serial_decoder_->toUnicode(serial_backlog_.constData() + serial_backlog_pos_,
+                                          static_cast<int>(len));
+    serial_backlog_pos_ = (serial_backlog_pos_ + len) % SERIAL_BACKLOG_SIZE;
+    serial_backlog_len_ -= len;
+
+    QTextCursor cursor(&serial_document_);
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(str);
+
+    if (serial_backlog_len_) {
+        serial_backlog_timer_.start();
+    } else {
+        clearSerialBacklog();
+    }
+
+    TY_TRACE_END("tycommander", "serial_catchup");
+}
+
+// Lines beyond the scrollback limit would be inserted only to be removed right away
+void Board::trimSerialBacklog()
+{
+    auto limit = static_cast<size_t>(serial_document_.maximumBlockCount());
+    if (!limit)
+        return;
+
+    size_t lines = 0;
+    for (size_t i = serial_backlog_len_; i--;) {
+        auto pos = (serial_backlog_pos_ + i) % SERIAL_BACKLOG_SIZE;
+
+        if (serial_backlog_.constData()[pos] == '\n' && ++lines == limit) {
+            serial_backlog_pos_ = (serial_backlog_pos_ + i + 1) % SERIAL_BACKLOG_SIZE;
+            serial_backlog_len_ -= i + 1;
+
+            // We start over in the middle of the stream
+            serial_decoder_.reset(serial_codec_->makeDecoder());
+            serial_document_.clear();
+            break;
+        }
+    }
+}
+
+void Board::clearSerialBacklog()
+{
+    serial_backlog_timer_.stop();
+    serial_backlog_flushing_ = false;
+    serial_backlog_ = QByteArray();
+    serial_backlog_pos_ = 0;
+    serial_backlog_len_ = 0;
+    serial_backlog_dropped_ = 0;
+}
+
 void Board::appendBufferToSerialDocument()
 {
+    // Nobody is looking (or the backlog is still being caught up), keep the raw output aside
+    if (serial_background_ || serial_backlog_flushing_) {
+        QMutexLocker locker(&serial_lock_);
+        appendToSerialBacklog(serial_buf_, serial_buf_len_);
+        serial_buf_len_ = 0;
+        return;
+    }
+
+    TY_TRACE_BEGIN("tycommander", "serial_append", ty_board_get_tag(board_));
+
     QMutexLocker locker(&serial_lock_);
     auto str = serial_decoder_->toUnicode(serial_buf_, static_cast<int>(serial_buf_len_));
     serial_buf_len_ = 0;
@@ -655,6 +882,8 @@ void Board::appendBufferToSerialDocument()
     QTextCursor cursor(&serial_document_);
     cursor.movePosition(QTextCursor::End);
     cursor.insertText(str);
+
+    TY_TRACE_END("tycommander", "serial_append");
 }
 
 void Board::notifyFinished(bool success, std::shared_ptr<void> result)
@@ -681,6 +910,7 @@ void Board::refreshBoard()
         if (hasCapability(TY_BOARD_CAPABILITY_SERIAL)) {
             if (serial_clear_when_available_) {
                 serial_document_.clear();
+                clearSerialBacklog();
                 updateSerialLogState(true);
             }
             serial_clear_when_available_ = false;
@@ -726,6 +956,9 @@ bool Board::openSerialInterface()
         hs_serial_set_config(port, &config);
     }
 
+    // Fetch the output libty captured while the interface was closed, it won't wake us up
+    serialReceived(ty_descriptor());
+
     return true;
 }
 
@@ -734,9 +967,16 @@ void Board::closeSerialInterface()
     if (!serial_iface_)
         return;
 
-    serial_notifier_.clear();
-    ty_board_interface_close(serial_iface_);
+    /* The serial thread may still be watching the descriptors, close the interface once
+       it has stopped. This does not wait for the serial thread, and the callback keeps
+       its own board reference in case this object is gone by then. */
+    auto iface = serial_iface_;
+    auto board = ty_board_ref(board_);
     serial_iface_ = nullptr;
+    serial_notifier_.clear([=]() {
+        ty_board_interface_close(iface);
+        ty_board_unref(board);
+    });
 }
 
 void Board::updateSerialLogState(bool new_file)
@@ -786,11 +1026,25 @@ TaskInterface Board::watchTask(TaskInterface task)
     return task_;
 }
 
+TaskInterface Board::watchUploadTask(ty_task *task)
+{
+    auto task2 = make_task<TyTask>(task);
+    watchTask(task2);
+    connect(&task_watcher_, &TaskWatcher::finished, this,
+            [=](bool success, shared_ptr<void> result) {
+        if (success)
+            addUploadedFirmware(static_cast<ty_firmware *>(result.get()));
+    });
+
+    return task2;
+}
+
 void Board::addUploadedFirmware(ty_firmware *fw)
 {
     status_firmware_ = fw->name;
 
     auto filename = fw->filename;
+    loadFirmwares();
     recent_firmwares_.removeAll(filename);
     recent_firmwares_.prepend(filename);
     if (recent_firmwares_.count() > MAX_RECENT_FIRMWARES)
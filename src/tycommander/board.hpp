@@ -61,9 +61,21 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     QFile serial_log_file_;
     bool serial_clear_when_available_ = false;
 
+    // Raw output kept aside while no window shows the board, see setSerialBackground()
+    bool serial_background_ = false;
+    QByteArray serial_backlog_;
+    size_t serial_backlog_pos_ = 0;
+    size_t serial_backlog_len_ = 0;
+    size_t serial_backlog_dropped_ = 0;
+    // Catch-up happens in chunks, new output keeps going to the backlog until it is done
+    bool serial_backlog_flushing_ = false;
+    QTimer serial_backlog_timer_;
+
     QTimer error_timer_;
 
-    QString firmware_;
+    // Loaded on first use because checking that the files still exist is slow
+    mutable bool firmwares_loaded_ = false;
+    mutable QString firmware_;
     bool reset_after_;
     QString serial_codec_name_;
     bool clear_on_reset_;
@@ -76,7 +88,7 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     QIcon status_icon_;
 
     QString status_firmware_;
-    QStringList recent_firmwares_;
+    mutable QStringList recent_firmwares_;
 
     ty_pool *pool_ = nullptr;
 
@@ -95,6 +107,9 @@ public:
 
     bool matchesTag(const QString &id);
 
+    // Consistent view of the fields below, the monitor thread may change them at any time
+    std::shared_ptr<const ty_board_snapshot> snapshot() const;
+
     uint16_t capabilities() const;
     bool hasCapability(ty_board_capability cap) const;
 
@@ -114,8 +129,16 @@ public:
     QString statusText() const { return status_text_; }
     QIcon statusIcon() const { return status_icon_; }
 
-    QString firmware() const { return firmware_; }
-    QStringList recentFirmwares() const { return recent_firmwares_; }
+    QString firmware() const
+    {
+        loadFirmwares();
+        return firmware_;
+    }
+    QStringList recentFirmwares() const
+    {
+        loadFirmwares();
+        return recent_firmwares_;
+    }
     bool resetAfter() const { return reset_after_; }
     QString serialCodecName() const { return serial_codec_name_; }
     QTextCodec *serialCodec() const { return serial_codec_; }
@@ -127,11 +150,16 @@ public:
 
     bool serialOpen() const { return serial_iface_; }
     QTextDocument &serialDocument() { return serial_document_; }
+    bool serialBackground() const { return serial_background_; }
 
     static QStringList makeCapabilityList(uint16_t capabilities);
     static QString makeCapabilityString(uint16_t capabilities, QString empty_str = QString());
 
     TaskInterface upload(const QString &filename = QString());
+    TaskInterface upload(const QStringList &filenames);
+    TaskInterface upload(const QStringList &filenames, bool reset_after);
+    TaskInterface upload(const std::shared_ptr<FirmwareLoader> &loader);
+    TaskInterface upload(const std::shared_ptr<FirmwareLoader> &loader, bool reset_after);
     TaskInterface upload(const std::vector<std::shared_ptr<Firmware>> &fws);
     TaskInterface upload(const std::vector<std::shared_ptr<Firmware>> &fws, bool reset_after);
     TaskInterface reset();
@@ -156,8 +184,11 @@ public slots:
     void setScrollBackLimit(unsigned int limit);
     void setEnableSerial(bool enable, bool persist = true);
     void setSerialLogSize(size_t size);
+    void setSerialBackground(bool background);
 
     TaskInterface startUpload(const QString &filename = QString());
+    TaskInterface startUpload(const QStringList &filenames);
+    TaskInterface startUpload(const std::shared_ptr<FirmwareLoader> &loader);
     TaskInterface startUpload(const std::vector<std::shared_ptr<Firmware>> &fws);
     TaskInterface startUpload(const std::vector<std::shared_ptr<Firmware>> &fws, bool reset_after);
     TaskInterface startReset();
@@ -193,7 +224,13 @@ private:
     void setThreadPool(ty_pool *pool) { pool_ = pool; }
 
     void writeToSerialLog(const char *buf, size_t len);
+    void appendToSerialBacklog(const char *buf, size_t len);
+    void flushSerialBacklog();
+    void flushSerialBacklogChunk();
+    void trimSerialBacklog();
+    void clearSerialBacklog();
 
+    void loadFirmwares() const;
     void refreshBoard();
     bool updateSerialInterface();
     bool openSerialInterface();
@@ -203,6 +240,7 @@ private:
     void addUploadedFirmware(ty_firmware *fw);
 
     TaskInterface watchTask(TaskInterface task);
+    TaskInterface watchUploadTask(ty_task *task);
 
     friend class Monitor;
 };
@@ -61,10 +61,11 @@ void BoardItemDelegate::paint(QPainter *painter, const QStyleOptionViewItem &opt
 
     widget_.resize(option.rect.size());
 
-    widget_.setIcon(board->statusIcon());
-    widget_.setModel(board->modelName());
-    widget_.setTag(board->tag());
-    widget_.setStatus(board->statusText());
+    // Use the strings cached by the model instead of rebuilding them for each paint
+    widget_.setIcon(index.data(Qt::DecorationRole).value<QIcon>());
+    widget_.setModel(index.sibling(index.row(), Monitor::COLUMN_MODEL).data().toString());
+    widget_.setTag(index.data(Qt::EditRole).toString());
+    widget_.setStatus(index.sibling(index.row(), Monitor::COLUMN_STATUS).data().toString());
 
     auto task = board->task();
     if (task.status() == TY_TASK_STATUS_RUNNING) {
@@ -265,19 +265,23 @@ vector<TaskInterface> ClientHandler::makeUploadTasks(const vector<shared_ptr<Boa
 {
     vector<TaskInterface> tasks;
 
+    // Boards associated with the same firmware share one load of the file
     if (filenames.isEmpty()) {
+        QHash<QString, shared_ptr<FirmwareLoader>> loaders;
         unsigned int fws_count = 0;
         for (auto &board: boards) {
-            if (!board->firmware().isEmpty()) {
+            auto firmware = board->firmware();
+            if (!firmware.isEmpty()) {
                 fws_count++;
 
-                auto fw = Firmware::load(board->firmware());
-                if (!fw) {
+                auto &loader = loaders[firmware];
+                if (!loader)
+                    loader = FirmwareLoader::create(QStringList{firmware});
+                if (loader) {
+                    tasks.push_back(board->upload(loader));
+                } else {
                     tasks.push_back(make_task<FailedTask>(ty_error_last_message()));
-                    continue;
                 }
-
-                tasks.push_back(board->upload({fw}));
             }
         }
         if (!fws_count) {
@@ -290,21 +294,13 @@ vector<TaskInterface> ClientHandler::makeUploadTasks(const vector<shared_ptr<Boa
             tasks.push_back(make_task<FailedTask>(msg));
         }
     } else {
-        vector<shared_ptr<Firmware>> fws;
-        fws.reserve(filenames.count());
-        for (auto &filename: filenames) {
-            auto fw = Firmware::load(filename);
-            if (!fw) {
-                tasks.push_back(make_task<FailedTask>(ty_error_last_message()));
-                continue;
-            }
-            fws.push_back(fw);
-        }
-
-        if (!fws.empty()) {
-            for (auto &board: boards)
-                tasks.push_back(board->upload(fws));
+        auto loader = FirmwareLoader::create(filenames);
+        if (!loader) {
+            tasks.push_back(make_task<FailedTask>(ty_error_last_message()));
+            return tasks;
         }
+        for (auto &board: boards)
+            tasks.push_back(board->upload(loader));
     }
 
     return tasks;
@@ -325,9 +321,22 @@ vector<shared_ptr<Board>> ClientHandler::selectedBoards()
         boards = monitor->boards();
     } else {
         auto filters = multi_ ? filters_ : QStringList{filters_.last()};
+
+        // Compile each filter once instead of parsing it again for every board
+        vector<unique_ptr<ty_board_selector, decltype(&ty_board_selector_free)>> selectors;
+        for (auto &filter: filters) {
+            ty_board_selector *selector;
+            if (ty_board_selector_new(filter.toLocal8Bit().constData(), &selector) < 0) {
+                notifyLog(TY_LOG_ERROR, ty_error_last_message());
+                notifyFinished(false);
+                return {};
+            }
+            selectors.emplace_back(selector, ty_board_selector_free);
+        }
+
         boards = monitor->find([&](Board &board) {
-            for (auto &filter: filters) {
-                if (board.matchesTag(filter))
+            for (auto &selector: selectors) {
+                if (ty_board_selector_matches(selector.get(), board.board()))
                     return true;
             }
             return false;
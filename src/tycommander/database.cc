@@ -14,26 +14,68 @@
 
 using namespace std;
 
+#define FLUSH_DELAY 1000
+
+SettingsDatabase::SettingsDatabase(QSettings *settings)
+    : settings_(settings)
+{
+    flush_timer_.setInterval(FLUSH_DELAY);
+    flush_timer_.setSingleShot(true);
+    QObject::connect(&flush_timer_, &QTimer::timeout, [=]() { flush(); });
+}
+
+SettingsDatabase::~SettingsDatabase()
+{
+    flush();
+}
+
+void SettingsDatabase::setSettings(QSettings *settings)
+{
+    flush();
+    settings_ = settings;
+}
+
 void SettingsDatabase::put(const QString &key, const QVariant &value)
 {
-    settings_->setValue(key, value);
+    pending_.insert(key, value);
+    if (!flush_timer_.isActive())
+        flush_timer_.start();
 }
 
 void SettingsDatabase::remove(const QString &key)
 {
+    // QSettings::remove() also removes child keys, keep it simple and apply pending values now
+    flush();
     settings_->remove(key);
 }
 
 QVariant SettingsDatabase::get(const QString &key, const QVariant &default_value) const
 {
+    auto it = pending_.find(key);
+    if (it != pending_.end())
+        return *it;
+
     return settings_->value(key, default_value);
 }
 
 void SettingsDatabase::clear()
 {
+    pending_.clear();
+    flush_timer_.stop();
     settings_->clear();
 }
 
+void SettingsDatabase::flush()
+{
+    flush_timer_.stop();
+    if (pending_.isEmpty())
+        return;
+
+    for (auto it = pending_.cbegin(); it != pending_.cend(); it++)
+        settings_->setValue(it.key(), it.value());
+    pending_.clear();
+}
+
 void DatabaseInterface::setGroup(const QString &group)
 {
     group_ = group;
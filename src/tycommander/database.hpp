@@ -11,7 +11,9 @@
 #ifndef DATABASE_HH
 #define DATABASE_HH
 
+#include <QHash>
 #include <QString>
+#include <QTimer>
 #include <QVariant>
 
 class QSettings;
@@ -30,11 +32,16 @@ public:
 class SettingsDatabase : public Database {
     QSettings *settings_;
 
+    /* Values are written to QSettings a bit later (or on destruction), so that bursts of
+       changes (e.g. when many boards show up) are coalesced. */
+    QHash<QString, QVariant> pending_;
+    QTimer flush_timer_;
+
 public:
-    SettingsDatabase(QSettings *settings = nullptr)
-        : settings_(settings) {}
+    SettingsDatabase(QSettings *settings = nullptr);
+    ~SettingsDatabase();
 
-    void setSettings(QSettings *settings) { settings_ = settings; }
+    void setSettings(QSettings *settings);
     QSettings *settings() const { return settings_; }
 
     void put(const QString &key, const QVariant &value) override;
@@ -42,6 +49,8 @@ public:
     QVariant get(const QString &key, const QVariant &default_value) const override;
 
     void clear() override;
+
+    void flush();
 };
 
 class DatabaseInterface {
@@ -27,6 +27,11 @@ DescriptorNotifier::DescriptorNotifier(ty_descriptor_set *set, QObject *parent)
         addDescriptorSet(set);
 }
 
+DescriptorNotifier::~DescriptorNotifier()
+{
+    clearSync();
+}
+
 void DescriptorNotifier::addDescriptorSet(ty_descriptor_set *set)
 {
     for (unsigned int i = 0; i < set->count; i++)
@@ -35,13 +40,22 @@ void DescriptorNotifier::addDescriptorSet(ty_descriptor_set *set)
 
 void DescriptorNotifier::addDescriptor(ty_descriptor desc)
 {
+    unsigned int generation = generation_;
+
     execute([=]() {
+        if (generation != generation_)
+            return;
+
+        auto filter = [=](ty_descriptor desc) {
+            if (generation == generation_)
+                emit activated(desc);
+        };
 #ifdef _WIN32
         auto notifier = new QWinEventNotifier(desc, this);
-        connect(notifier, &QWinEventNotifier::activated, this, &DescriptorNotifier::activated);
+        connect(notifier, &QWinEventNotifier::activated, this, filter);
 #else
         auto notifier = new QSocketNotifier(desc, QSocketNotifier::Read, this);
-        connect(notifier, &QSocketNotifier::activated, this, &DescriptorNotifier::activated);
+        connect(notifier, &QSocketNotifier::activated, this, filter);
 #endif
 
         notifier->setEnabled(enabled_);
@@ -51,26 +65,62 @@ void DescriptorNotifier::addDescriptor(ty_descriptor desc)
 
 void DescriptorNotifier::setEnabled(bool enable)
 {
+    enabled_ = enable;
+
     execute([=]() {
-        enabled_ = enable;
         for (auto notifier: notifiers_)
-            notifier->setEnabled(enable);
+            notifier->setEnabled(enabled_);
     });
 }
 
-void DescriptorNotifier::clear()
+void DescriptorNotifier::clear(function<void()> cleared)
 {
-    execute([=]() {
-        for (auto notifier: notifiers_)
-            delete notifier;
-        notifiers_.clear();
-    });
+    generation_++;
+    if (cleared) {
+        QMutexLocker locker(&cleared_mutex_);
+        cleared_callbacks_.push_back(cleared);
+    }
+
+    execute([=]() { clearNotifiers(); });
+}
+
+void DescriptorNotifier::clearSync()
+{
+    generation_++;
+    executeSync([=]() { clearNotifiers(); });
+}
+
+void DescriptorNotifier::clearNotifiers()
+{
+    for (auto notifier: notifiers_)
+        delete notifier;
+    notifiers_.clear();
+
+    // Queued and synchronous clears may race for these, whoever takes them runs them
+    vector<function<void()>> callbacks;
+    {
+        QMutexLocker locker(&cleared_mutex_);
+        callbacks.swap(cleared_callbacks_);
+    }
+    for (auto &f: callbacks)
+        f();
 }
 
 void DescriptorNotifier::execute(function<void()> f)
 {
     if (thread() != QThread::currentThread()) {
         // See descriptor_notifier.hpp for information about std_function_void_void
+        QMetaObject::invokeMethod(this, "executeAsync", Qt::QueuedConnection,
+                                  Q_ARG(std_function_void_void, f));
+    } else {
+        f();
+    }
+}
+
+void DescriptorNotifier::executeSync(function<void()> f)
+{
+    // Once the thread has stopped, nothing can race with us
+    if (thread() != QThread::currentThread() && thread()->isRunning()) {
         QMetaObject::invokeMethod(this, "executeAsync", Qt::BlockingQueuedConnection,
                                   Q_ARG(std_function_void_void, f));
     } else {
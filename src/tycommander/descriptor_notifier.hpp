@@ -17,6 +17,9 @@
     #include <QSocketNotifier>
 #endif
 
+#include <QMutex>
+
+#include <atomic>
 #include <functional>
 #include <vector>
 
@@ -31,13 +34,21 @@ class DescriptorNotifier : public QObject {
     std::vector<QSocketNotifier *> notifiers_;
 #endif
 
-    bool enabled_ = true;
+    /* Changes made from another thread are queued to the notifier thread and never wait
+       for it. Each clear() starts a new generation, descriptors added (or activated) in
+       a previous one are ignored. */
+    std::atomic<bool> enabled_ {true};
+    std::atomic<unsigned int> generation_ {0};
+
+    QMutex cleared_mutex_;
+    std::vector<std::function<void()>> cleared_callbacks_;
 
 public:
     DescriptorNotifier(QObject *parent = nullptr)
         : QObject(parent) {}
     DescriptorNotifier(ty_descriptor desc, QObject *parent = nullptr);
     DescriptorNotifier(ty_descriptor_set *set, QObject *parent = nullptr);
+    ~DescriptorNotifier();
 
     void addDescriptorSet(ty_descriptor_set *set);
     void addDescriptor(ty_descriptor desc);
@@ -55,15 +66,27 @@ public:
 
     bool isEnabled() const { return enabled_; }
 
+    /* The descriptors may still be watched when clear() returns. Use the callback to
+       release them once they are not (it runs in the notifier thread, or when the
+       notifier is destroyed). */
+    void clear(std::function<void()> cleared);
+    /* Same thing but waits for the notifier thread (if it is still running), use it on
+       destruction paths. Notifiers must be destroyed in their own thread, and activated()
+       is not emitted anymore once this returns. */
+    void clearSync();
+
 public slots:
     void setEnabled(bool enable);
-    void clear();
+    void clear() { clear(nullptr); }
 
 signals:
     void activated(ty_descriptor desc);
 
 private:
+    void clearNotifiers();
+
     void execute(std::function<void()> f);
+    void executeSync(std::function<void()> f);
     /* On Qt 5.2.1, QMetaObject::invokeMethod() fails on templated types
        such as std::function<void()>. */
     typedef std::function<void()> std_function_void_void;
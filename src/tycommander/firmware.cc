@@ -8,6 +8,8 @@
 
    See the LICENSE file for more details. */
 
+#include <vector>
+
 #include "firmware.hpp"
 
 using namespace std;
@@ -34,3 +36,40 @@ shared_ptr<Firmware> Firmware::load(const QString &filename)
 
     return make_shared<FirmwareSharedEnabler>(fw);
 }
+
+FirmwareLoader::~FirmwareLoader()
+{
+    ty_firmware_loader_unref(loader_);
+}
+
+/* Nothing is read here, the files are parsed by the first upload task that runs with this
+   loader, and the other tasks that share it reuse the result. */
+shared_ptr<FirmwareLoader> FirmwareLoader::create(const QStringList &filenames)
+{
+    struct FirmwareLoaderSharedEnabler : public FirmwareLoader {
+        FirmwareLoaderSharedEnabler(ty_firmware_loader *loader)
+            : FirmwareLoader(loader) {}
+    };
+
+    vector<QByteArray> filenames2;
+    vector<const char *> filenames3;
+    ty_firmware_loader *loader;
+    int r;
+
+    if (filenames.isEmpty())
+        return nullptr;
+
+    filenames2.reserve(static_cast<size_t>(filenames.count()));
+    filenames3.reserve(static_cast<size_t>(filenames.count()));
+    for (auto &filename: filenames) {
+        filenames2.push_back(filename.toLocal8Bit());
+        filenames3.push_back(filenames2.back().constData());
+    }
+
+    r = ty_firmware_loader_new(&filenames3[0], static_cast<unsigned int>(filenames3.size()),
+                               &loader);
+    if (r < 0)
+        return nullptr;
+
+    return make_shared<FirmwareLoaderSharedEnabler>(loader);
+}
@@ -12,6 +12,7 @@
 #define FIRMWARE_HH
 
 #include <QString>
+#include <QStringList>
 
 #include <memory>
 
@@ -41,4 +42,24 @@ private:
         : fw_(fw) {}
 };
 
+class FirmwareLoader {
+    ty_firmware_loader *loader_ = nullptr;
+
+public:
+    ~FirmwareLoader();
+
+    FirmwareLoader& operator=(const FirmwareLoader &other) = delete;
+    FirmwareLoader(const FirmwareLoader &other) = delete;
+    FirmwareLoader& operator=(const FirmwareLoader &&other) = delete;
+    FirmwareLoader(const FirmwareLoader &&other) = delete;
+
+    static std::shared_ptr<FirmwareLoader> create(const QStringList &filenames);
+
+    ty_firmware_loader *loader() const { return loader_; }
+
+private:
+    FirmwareLoader(ty_firmware_loader *loader)
+        : loader_(loader) {}
+};
+
 #endif
@@ -8,10 +8,12 @@
 
    See the LICENSE file for more details. */
 
+#include <QFileDialog>
 #include <QMenu>
 
 #include <memory>
 
+#include "../libty/recorder.h"
 #include "log_dialog.hpp"
 
 using namespace std;
@@ -70,5 +72,18 @@ void LogDialog::showLogContextMenu(const QPoint &pos)
 
     unique_ptr<QMenu> menu(edit->createStandardContextMenu());
     menu->addAction(tr("Clear"), edit, SLOT(clear()));
+    menu->addSeparator();
+    menu->addAction(tr("Save Flight Recorder..."), this, SLOT(saveFlightRecorder()));
     menu->exec(edit->viewport()->mapToGlobal(pos));
 }
+
+void LogDialog::saveFlightRecorder()
+{
+    auto filename = QFileDialog::getSaveFileName(this, tr("Save Flight Recorder"),
+                                                 "recorder.txt");
+    if (filename.isEmpty())
+        return;
+
+    // Errors are reported through the log
+    ty_recorder_dump(filename.toLocal8Bit().constData());
+}
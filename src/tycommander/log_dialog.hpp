@@ -29,6 +29,7 @@ private:
 
 private slots:
     void showLogContextMenu(const QPoint &pos);
+    void saveFlightRecorder();
 };
 
 #endif
@@ -19,6 +19,8 @@
     #include <stdlib.h>
 #endif
 
+#include <functional>
+
 #include "../libhs/common.h"
 #include "../libty/class.h"
 #include "tycommander.hpp"
@@ -144,6 +146,7 @@ int main(int argc, char *argv[])
     qRegisterMetaType<ty_descriptor>("ty_descriptor");
     qRegisterMetaType<SessionPeer::CloseReason>("SessionPeer::CloseReason");
     qRegisterMetaType<uint64_t>("uint64_t");
+    qRegisterMetaType<std::function<void()>>("std_function_void_void");
 
     TyCommander app(argc, argv);
 #ifdef _WIN32
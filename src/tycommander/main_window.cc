@@ -296,6 +296,11 @@ bool MainWindow::event(QEvent *ev)
     if (ev->type() == QEvent::StatusTip)
         return true;
 
+    // Wait for the new state to settle before we look at all the windows
+    if (ev->type() == QEvent::Show || ev->type() == QEvent::Hide ||
+            ev->type() == QEvent::WindowStateChange)
+        QMetaObject::invokeMethod(tyCommander, "updateSerialBackground", Qt::QueuedConnection);
+
     return QMainWindow::event(ev);
 }
 
@@ -376,11 +381,22 @@ void MainWindow::uploadToSelection()
         return;
     }
 
+    // Boards associated with the same firmware share one load of the file
+    QHash<QString, shared_ptr<FirmwareLoader>> loaders;
     unsigned int fws_count = 0;
     for (auto &board: selected_boards_) {
-        if (!board->firmware().isEmpty()) {
+        auto firmware = board->firmware();
+        if (!firmware.isEmpty()) {
             fws_count++;
-            board->startUpload();
+
+            auto &loader = loaders[firmware];
+            if (!loader)
+                loader = FirmwareLoader::create(QStringList{firmware});
+            if (loader) {
+                board->startUpload(loader);
+            } else {
+                board->startUpload();
+            }
         }
     }
     if (!fws_count)
@@ -398,23 +414,17 @@ void MainWindow::uploadNewToSelection()
     if (filenames.isEmpty())
         return;
 
-    vector<shared_ptr<Firmware>> fws;
-    fws.reserve(filenames.count());
-    for (auto filename: filenames) {
-        auto fw = Firmware::load(QDir::toNativeSeparators(filename));
-        if (!fw)
-            continue;
-
-        fws.push_back(fw);
-    }
-    if (fws.empty()) {
-        for (auto &board: selected_boards_)
-            board->notifyLog(TY_LOG_ERROR, ty_error_last_message());
+    /* The first upload task to run parses the firmwares in the background, the others wait
+       for it and reuse them. Each task reports loading errors. */
+    for (auto &filename: filenames)
+        filename = QDir::toNativeSeparators(filename);
+    auto loader = FirmwareLoader::create(filenames);
+    if (!loader) {
+        tyCommander->reportError(ty_error_last_message());
         return;
     }
-
     for (auto &board: selected_boards_)
-        board->startUpload(fws);
+        board->startUpload(loader);
 }
 
 void MainWindow::dropAssociationForSelection()
@@ -701,7 +711,9 @@ void MainWindow::disableBoardWidgets()
 void MainWindow::updateWindowTitle()
 {
     if (current_board_) {
-        setWindowTitle(QString("%1 | %2 | %3").arg(current_board_->tag(), current_board_->modelName(),
+        auto snap = current_board_->snapshot();
+        setWindowTitle(QString("%1 | %2 | %3").arg(QString(snap->tag),
+                                                   QString(ty_models[snap->model].name),
                                                    QCoreApplication::applicationName()));
     } else if (selected_boards_.size() > 0) {
         setWindowTitle(tr("%1 boards selected | %2").arg(selected_boards_.size())
@@ -859,6 +871,9 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
         connect(current_board_, &Board::statusChanged, this, &MainWindow::refreshStatus);
         connect(current_board_, &Board::progressChanged, this, &MainWindow::refreshProgress);
 
+        // Catch up before the view scrolls to the end of the document
+        if (isVisible() && !isMinimized())
+            current_board_->setSerialBackground(false);
         enableBoardWidgets();
         refreshActions();
         refreshInfo();
@@ -879,6 +894,9 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
         updateWindowTitle();
         updateFirmwareMenus();
     }
+
+    // The previous board may not be shown anywhere anymore
+    tyCommander->updateSerialBackground();
 }
 
 void MainWindow::openBoardListContextMenu(const QPoint &pos)
@@ -905,11 +923,13 @@ void MainWindow::refreshActions()
     bool upload = false, reset = false, reboot = false, send = false;
     for (auto &board: selected_boards_) {
         if (board->taskStatus() == TY_TASK_STATUS_READY) {
-            upload |= board->hasCapability(TY_BOARD_CAPABILITY_UPLOAD) ||
-                      board->hasCapability(TY_BOARD_CAPABILITY_REBOOT);
-            reset |= board->hasCapability(TY_BOARD_CAPABILITY_RESET) ||
-                     board->hasCapability(TY_BOARD_CAPABILITY_REBOOT);
-            reboot |= board->hasCapability(TY_BOARD_CAPABILITY_REBOOT);
+            // Read the capabilities once, they can change between two snapshots
+            auto capabilities = board->capabilities();
+            bool can_reboot = capabilities & (1 << TY_BOARD_CAPABILITY_REBOOT);
+
+            upload |= (capabilities & (1 << TY_BOARD_CAPABILITY_UPLOAD)) || can_reboot;
+            reset |= (capabilities & (1 << TY_BOARD_CAPABILITY_RESET)) || can_reboot;
+            reboot |= can_reboot;
         }
         send |= board->serialOpen();
     }
@@ -930,11 +950,13 @@ void MainWindow::refreshInfo()
 {
     updateWindowTitle();
 
-    idText->setText(current_board_->id());
-    modelText->setText(current_board_->modelName());
-    locationText->setText(current_board_->location());
-    serialNumberText->setText(current_board_->serialNumber());
-    descriptionText->setText(current_board_->description());
+    // One snapshot for all the fields, so that they describe the same state of the board
+    auto snap = current_board_->snapshot();
+    idText->setText(snap->id);
+    modelText->setText(ty_models[snap->model].name);
+    locationText->setText(snap->location);
+    serialNumberText->setText(snap->serial_number);
+    descriptionText->setText(snap->description);
 
     updateSerialLogLink();
 }
@@ -90,9 +90,7 @@ void Monitor::setIgnoreGeneric(bool ignore_generic)
         for (size_t i = 0; i < boards_.size(); i++) {
             auto &board = boards_[i];
             if (board->model() == TY_MODEL_GENERIC) {
-                beginRemoveRows(QModelIndex(), static_cast<int>(i), static_cast<int>(i));
-                boards_.erase(boards_.begin() + static_cast<int>(i));
-                endRemoveRows();
+                removeBoardItem(boards_.begin() + static_cast<int>(i));
                 i--;
             }
         }
@@ -214,8 +212,10 @@ void Monitor::stop()
     serial_thread_.wait();
 
     if (!boards_.empty()) {
-        beginRemoveRows(QModelIndex(), 0, static_cast<int>(boards_.size()));
+        beginRemoveRows(QModelIndex(), 0, static_cast<int>(boards_.size()) - 1);
         boards_.clear();
+        board_rows_.clear();
+        board_items_.clear();
         endRemoveRows();
     }
 
@@ -304,42 +304,43 @@ QVariant Monitor::data(const QModelIndex &index, int role) const
     if (!index.isValid() || index.row() >= static_cast<int>(boards_.size()))
         return QVariant();
 
-    auto board = boards_[index.row()];
+    auto &board = boards_[index.row()];
     if (role == ROLE_BOARD)
         return QVariant::fromValue(board.get());
+    if (role == ROLE_PROGRESS) {
+        auto task = board->task();
+        return task.status() == TY_TASK_STATUS_RUNNING ? task.progress() : 0;
+    }
 
     if (index.column() == 0) {
         switch (role) {
             case Qt::ToolTipRole:
-                return tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5")
-                       .arg(board->modelName())
-                       .arg(board->location())
-                       .arg(board->serialNumber())
-                       .arg(board->statusText())
-                       .arg(Board::makeCapabilityString(board->capabilities(), tr("(none)")));
+                return boardItem(index.row()).tooltip;
             case Qt::DecorationRole:
-                return board->statusIcon();
+                return boardItem(index.row()).status_icon;
             case Qt::EditRole:
-                return board->tag();
+                return boardItem(index.row()).tag;
         }
     }
 
     if (role == Qt::DisplayRole) {
+        auto &item = boardItem(index.row());
+
         switch (index.column()) {
         case COLUMN_BOARD:
-            return board->tag();
+            return item.tag;
         case COLUMN_MODEL:
-            return board->modelName();
+            return item.model_name;
         case COLUMN_STATUS:
-            return board->statusText();
+            return item.status_text;
         case COLUMN_IDENTITY:
-            return board->id();
+            return item.id;
         case COLUMN_LOCATION:
-            return board->location();
+            return item.location;
         case COLUMN_SERIAL_NUMBER:
-            return board->serialNumber();
+            return item.serial_number;
         case COLUMN_DESCRIPTION:
-            return board->description();
+            return item.description;
         }
     }
 
@@ -390,8 +391,44 @@ int Monitor::handleEvent(ty_board *board, ty_monitor_event event, void *udata)
 
 Monitor::iterator Monitor::findBoardIterator(ty_board *board)
 {
-    return find_if(boards_.begin(), boards_.end(),
-                   [=](std::shared_ptr<Board> &ptr) { return ptr->board() == board; });
+    auto row = board_rows_.value(board, -1);
+    return row >= 0 ? boards_.begin() + row : boards_.end();
+}
+
+const Monitor::BoardItem &Monitor::boardItem(int row) const
+{
+    auto &board = boards_[row];
+    auto &item = board_items_[row];
+
+    // Take all the fields from the same snapshot, or the tooltip may mix two states
+    shared_ptr<const ty_board_snapshot> snap;
+    if (!(item.valid & ITEM_INFO) || !(item.valid & ITEM_TOOLTIP))
+        snap = board->snapshot();
+
+    if (!(item.valid & ITEM_INFO)) {
+        item.tag = snap->tag;
+        item.model_name = ty_models[snap->model].name;
+        item.id = snap->id;
+        item.location = snap->location;
+        item.serial_number = snap->serial_number;
+        item.description = snap->description;
+    }
+    if (!(item.valid & ITEM_STATUS)) {
+        item.status_text = board->statusText();
+        item.status_icon = board->statusIcon();
+    }
+    if (!(item.valid & ITEM_TOOLTIP)) {
+        item.tooltip = tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5")
+                       .arg(item.model_name)
+                       .arg(item.location)
+                       .arg(item.serial_number)
+                       .arg(item.status_text)
+                       .arg(Board::makeCapabilityString(static_cast<uint16_t>(snap->capabilities),
+                                                        tr("(none)")));
+    }
+    item.valid = ITEM_INFO | ITEM_STATUS | ITEM_TOOLTIP;
+
+    return item;
 }
 
 void Monitor::handleAddedEvent(ty_board *board)
@@ -418,7 +455,7 @@ void Monitor::handleAddedEvent(ty_board *board)
     board_wrapper->serial_notifier_.moveToThread(&serial_thread_);
 
     connect(board_wrapper, &Board::infoChanged, this, [=]() {
-        refreshBoardItem(findBoardIterator(board));
+        refreshBoardItem(board, ITEM_INFO | ITEM_TOOLTIP);
     });
     // Don't capture board_wrapper_ptr, this should be obvious but I made the mistake once
     connect(board_wrapper, &Board::interfacesChanged, this, [=]() {
@@ -427,13 +464,14 @@ void Monitor::handleAddedEvent(ty_board *board)
             configureBoardDatabase(*board_wrapper);
             board_wrapper->loadSettings(this);
         }
-        refreshBoardItem(findBoardIterator(board));
+        // Capabilities only show up in the tooltip
+        refreshBoardItem(board, ITEM_TOOLTIP);
     });
     connect(board_wrapper, &Board::statusChanged, this, [=]() {
-        refreshBoardItem(findBoardIterator(board));
+        refreshBoardItem(board, ITEM_STATUS | ITEM_TOOLTIP);
     });
     connect(board_wrapper, &Board::progressChanged, this, [=]() {
-        refreshBoardItem(findBoardIterator(board));
+        refreshBoardProgress(board);
     });
     connect(board_wrapper, &Board::dropped, this, [=]() {
         removeBoardItem(findBoardIterator(board));
@@ -441,7 +479,9 @@ void Monitor::handleAddedEvent(ty_board *board)
 
     beginInsertRows(QModelIndex(), static_cast<int>(boards_.size()),
                     static_cast<int>(boards_.size()));
+    board_rows_.insert(board, static_cast<int>(boards_.size()));
     boards_.push_back(board_wrapper_ptr);
+    board_items_.emplace_back();
     endInsertRows();
 
     emit boardAdded(board_wrapper);
@@ -457,21 +497,53 @@ void Monitor::handleChangedEvent(ty_board *board)
     ptr->refreshBoard();
 }
 
-void Monitor::refreshBoardItem(iterator it)
+void Monitor::refreshBoardItem(ty_board *board, int parts)
 {
-    auto index = createIndex(it - boards_.begin(), 0);
-    dataChanged(index, index);
+    auto row = board_rows_.value(board, -1);
+    if (row < 0)
+        return;
+    board_items_[row].valid &= ~parts;
+
+    if (parts & ITEM_INFO) {
+        emit dataChanged(createIndex(row, 0), createIndex(row, COLUMN_COUNT - 1),
+                         {Qt::DisplayRole, Qt::EditRole, Qt::ToolTipRole});
+    }
+    if (parts & ITEM_STATUS) {
+        emit dataChanged(createIndex(row, 0), createIndex(row, 0),
+                         {Qt::DecorationRole, Qt::ToolTipRole});
+        emit dataChanged(createIndex(row, COLUMN_STATUS), createIndex(row, COLUMN_STATUS),
+                         {Qt::DisplayRole});
+    }
+    if (parts == ITEM_TOOLTIP)
+        emit dataChanged(createIndex(row, 0), createIndex(row, 0), {Qt::ToolTipRole});
+}
+
+void Monitor::refreshBoardProgress(ty_board *board)
+{
+    auto row = board_rows_.value(board, -1);
+    if (row < 0)
+        return;
+
+    emit dataChanged(createIndex(row, 0), createIndex(row, 0), {ROLE_PROGRESS});
 }
 
 void Monitor::removeBoardItem(iterator it)
 {
-    beginRemoveRows(QModelIndex(), it - boards_.begin(), it - boards_.begin());
+    int row = static_cast<int>(it - boards_.begin());
+
+    beginRemoveRows(QModelIndex(), row, row);
+    board_rows_.remove((*it)->board());
     boards_.erase(it);
+    board_items_.erase(board_items_.begin() + row);
+    for (int i = row; i < static_cast<int>(boards_.size()); i++)
+        board_rows_[boards_[i]->board()] = i;
     endRemoveRows();
 }
 
 void Monitor::configureBoardDatabase(Board &board)
 {
-    board.setDatabase(db_.subDatabase(board.id()));
-    board.setCache(cache_.subDatabase(board.id()));
+    auto id = board.id();
+
+    board.setDatabase(db_.subDatabase(id));
+    board.setCache(cache_.subDatabase(id));
 }
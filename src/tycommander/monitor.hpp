@@ -12,6 +12,8 @@
 #define MONITOR_HH
 
 #include <QAbstractListModel>
+#include <QHash>
+#include <QIcon>
 #include <QThread>
 
 #include <memory>
@@ -45,6 +47,31 @@ class Monitor : public QAbstractListModel {
 
     std::vector<std::shared_ptr<Board>> boards_;
 
+    /* Row of each board, and display data for each row (same order as boards_). The
+       strings are built lazily and invalidated when the board signals a change. */
+    struct BoardItem {
+        int valid = 0;
+
+        QString tag;
+        QString model_name;
+        QString id;
+        QString location;
+        QString serial_number;
+        QString description;
+
+        QString status_text;
+        QIcon status_icon;
+
+        QString tooltip;
+    };
+    enum BoardItemPart {
+        ITEM_INFO = 1,
+        ITEM_STATUS = 2,
+        ITEM_TOOLTIP = 4
+    };
+    QHash<ty_board *, int> board_rows_;
+    mutable std::vector<BoardItem> board_items_;
+
 public:
     typedef decltype(boards_)::iterator iterator;
     typedef decltype(boards_)::const_iterator const_iterator;
@@ -62,7 +89,8 @@ public:
     };
 
     enum CustomRole {
-        ROLE_BOARD = Qt::UserRole + 1
+        ROLE_BOARD = Qt::UserRole + 1,
+        ROLE_PROGRESS
     };
 
     Monitor(QObject *parent = nullptr);
@@ -129,12 +157,14 @@ private slots:
 
 private:
     iterator findBoardIterator(ty_board *board);
+    const BoardItem &boardItem(int row) const;
 
     static int handleEvent(ty_board *board, ty_monitor_event event, void *udata);
     void handleAddedEvent(ty_board *board);
     void handleChangedEvent(ty_board *board);
 
-    void refreshBoardItem(iterator it);
+    void refreshBoardItem(ty_board *board, int parts);
+    void refreshBoardProgress(ty_board *board);
     void removeBoardItem(iterator it);
 
     void configureBoardDatabase(Board &board);
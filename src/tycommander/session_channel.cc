@@ -9,7 +9,6 @@
    See the LICENSE file for more details. */
 
 #include <QCoreApplication>
-#include <QDataStream>
 #include <QDir>
 
 #ifdef _WIN32
@@ -223,12 +222,18 @@ void SessionPeer::send(const QStringList &arguments)
     if (socket_->state() != QLocalSocket::ConnectedState)
         return;
 
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::WriteOnly);
-    stream << arguments;
+    // See session_channel.hpp for the frame format
+    QByteArray buf(sizeof(uint32_t), 0);
+    for (auto &arg: arguments) {
+        auto arg_utf8 = arg.toUtf8();
+        uint32_t arg_len = static_cast<uint32_t>(arg_utf8.size());
+
+        buf.append(reinterpret_cast<char *>(&arg_len), sizeof(arg_len));
+        buf.append(arg_utf8);
+    }
+    uint32_t length = static_cast<uint32_t>(buf.size() - sizeof(uint32_t));
+    memcpy(buf.data(), &length, sizeof(length));
 
-    uint32_t length = buf.size();
-    socket_->write(reinterpret_cast<char *>(&length), sizeof(length));
     socket_->write(buf);
 }
 
@@ -238,7 +243,7 @@ void SessionPeer::dataReceived()
         return;
 
     while (true) {
-        // Get the length first (first 8 bytes)
+        // Get the length first (first 4 bytes)
         if (!expected_length_) {
             if (socket_->bytesAvailable() < static_cast<qint64>(sizeof(expected_length_)))
                 break;
@@ -256,9 +261,24 @@ void SessionPeer::dataReceived()
         auto buf = socket_->read(static_cast<qint64>(expected_length_));
         expected_length_ = 0;
 
-        QDataStream stream(buf);
         QStringList arguments;
-        stream >> arguments;
+        for (int offset = 0; offset < buf.size();) {
+            uint32_t arg_len;
+
+            if (buf.size() - offset < static_cast<int>(sizeof(arg_len))) {
+                close(Error);
+                return;
+            }
+            memcpy(&arg_len, buf.constData() + offset, sizeof(arg_len));
+            offset += sizeof(arg_len);
+            if (arg_len > static_cast<uint32_t>(buf.size() - offset)) {
+                close(Error);
+                return;
+            }
+
+            arguments.append(QString::fromUtf8(buf.constData() + offset, static_cast<int>(arg_len)));
+            offset += static_cast<int>(arg_len);
+        }
         emit received(arguments);
     }
 }
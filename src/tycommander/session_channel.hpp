@@ -17,6 +17,10 @@
 
 #include <memory>
 
+/* Each message is a list of strings, sent as a frame: a 32-bit payload length followed by
+   the strings, each made of a 32-bit length and the UTF-8 bytes (without NUL). Integers use
+   the host byte order because the channel is local. tycommanderc_posix.c implements the
+   client side of this in C. */
 class SessionPeer : public QObject {
     Q_OBJECT
 
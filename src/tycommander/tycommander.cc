@@ -10,12 +10,15 @@
 
 #include <QDir>
 #include <QElapsedTimer>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QProcess>
+#include <QSet>
 #include <QSettings>
 #include <QStandardPaths>
 #include <QTextCodec>
 #include <QThread>
+#include <QTimer>
 
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
@@ -23,11 +26,15 @@
 #endif
 
 #include "arduino_install.hpp"
+#include "board.hpp"
 #include "client_handler.hpp"
 #include "../libty/common.h"
 #include "log_dialog.hpp"
 #include "main_window.hpp"
+#include "../libty/metrics.h"
 #include "../libty/optline.h"
+#include "../libty/recorder.h"
+#include "../libty/trace.h"
 #include "task.hpp"
 #include "tycommander.hpp"
 
@@ -64,17 +71,13 @@ TyCommander::TyCommander(int &argc, char *argv[])
     setApplicationName(TY_CONFIG_TYCOMMANDER_NAME);
     setApplicationVersion(ty_version_string());
 
-    // This can be triggered from multiple threads, but Qt can queue signals appropriately
+    /* This can be triggered from multiple threads (including the libty logger thread),
+       messages are batched and delivered to the main thread by flushLogs(). */
     ty_message_redirect([](const ty_message_data *msg, void *) {
         ty_message_default_handler(msg, nullptr);
 
-        if (msg->type == TY_MESSAGE_LOG) {
-            if (msg->u.log.level <= TY_LOG_WARNING) {
-                tyCommander->reportError(msg->u.log.msg, msg->ctx);
-            } else {
-                tyCommander->reportDebug(msg->u.log.msg, msg->ctx);
-            }
-        }
+        if (msg->type == TY_MESSAGE_LOG)
+            tyCommander->queueLog(msg->u.log.level <= TY_LOG_WARNING, msg->u.log.msg, msg->ctx);
     }, nullptr);
 
     initDatabase("tyqt", tycommander_db_);
@@ -103,13 +106,22 @@ TyCommander::TyCommander(int &argc, char *argv[])
 
 TyCommander::~TyCommander()
 {
+    auto metrics_path = getenv("TYTOOLS_METRICS");
+    if (metrics_path && metrics_path[0])
+        ty_metrics_dump(metrics_path);
+    ty_trace_stop(trace_session_);
+    ty_log_stop_async();
     ty_message_redirect(ty_message_default_handler, nullptr);
 }
 
 QString TyCommander::clientFilePath()
 {
-#ifdef _WIN32
+#if defined(_WIN32)
     return applicationDirPath() + "/" TY_CONFIG_TYCOMMANDER_EXECUTABLE "C.exe";
+#elif defined(__linux__)
+    // The Qt-less client starts much faster, use it when it is installed
+    auto client = applicationDirPath() + "/" TY_CONFIG_TYCOMMANDER_EXECUTABLE "c";
+    return QFileInfo::exists(client) ? client : applicationFilePath();
 #else
     return applicationFilePath();
 #endif
@@ -150,6 +162,38 @@ void TyCommander::reportDebug(const QString &msg, const QString &ctx)
     emit globalDebug(msg, ctx);
 }
 
+void TyCommander::queueLog(bool error, const QString &msg, const QString &ctx)
+{
+    bool flush;
+    {
+        lock_guard<mutex> locker(pending_logs_mutex_);
+
+        flush = pending_logs_.empty();
+        pending_logs_.push_back({error, msg, ctx});
+    }
+
+    // One queued call per batch, instead of one queued signal per message
+    if (flush)
+        QMetaObject::invokeMethod(this, "flushLogs", Qt::QueuedConnection);
+}
+
+void TyCommander::flushLogs()
+{
+    vector<PendingLog> logs;
+    {
+        lock_guard<mutex> locker(pending_logs_mutex_);
+        logs.swap(pending_logs_);
+    }
+
+    for (auto &log: logs) {
+        if (log.error) {
+            emit globalError(log.msg, log.ctx);
+        } else {
+            emit globalDebug(log.msg, log.ctx);
+        }
+    }
+}
+
 void TyCommander::setVisible(bool visible)
 {
     if (visible) {
@@ -171,6 +215,22 @@ void TyCommander::setVisible(bool visible)
     action_visible_->setChecked(visible);
 }
 
+/* Boards that no visible window shows keep their raw serial output aside, and their
+   documents catch up once a window shows them again. Idle CPU use would otherwise grow
+   with each chatty board while we sit in the tray. */
+void TyCommander::updateSerialBackground()
+{
+    QSet<Board *> shown_boards;
+    for (auto widget: topLevelWidgets()) {
+        auto win = qobject_cast<MainWindow *>(widget);
+        if (win && win->isVisible() && !win->isMinimized() && win->currentBoard())
+            shown_boards.insert(win->currentBoard());
+    }
+
+    for (auto &board: monitor_.boards())
+        board->setSerialBackground(!shown_boards.contains(board.get()));
+}
+
 void TyCommander::setShowTrayIcon(bool show_tray_icon)
 {
     show_tray_icon_ = show_tray_icon;
@@ -265,15 +325,27 @@ int TyCommander::runMainInstance(int argc, char *argv[])
     monitor_.setCache(&monitor_cache_);
     monitor_.loadSettings();
 
+    // Keep the debug events that led to the last failed task, unless TYTOOLS_RECORDER is set
+    if (!ty_recorder_get_dump_path()) {
+        auto dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        if (QDir().mkpath(dir))
+            ty_recorder_set_dump_path(QDir(dir).filePath("recorder.txt").toLocal8Bit().constData());
+    }
+
     log_dialog_ = unique_ptr<LogDialog>(new LogDialog());
     log_dialog_->setAttribute(Qt::WA_QuitOnClose, false);
     log_dialog_->setWindowIcon(QIcon(":/tycommander"));
     connect(this, &TyCommander::globalError, log_dialog_.get(), &LogDialog::appendError);
     connect(this, &TyCommander::globalDebug, log_dialog_.get(), &LogDialog::appendDebug);
 
+    /* Format and dispatch log messages in a background thread, so that the monitor and
+       the board tasks don't wait for the log window. */
+    ty_log_start_async();
+
     if (show_tray_icon_)
         tray_icon_.show();
     action_visible_->setChecked(!hide_on_startup_);
+    connect(&monitor_, &Monitor::boardAdded, this, &TyCommander::updateSerialBackground);
     auto win = new MainWindow();
     win->setAttribute(Qt::WA_DeleteOnClose);
     if (!hide_on_startup_)
@@ -284,6 +356,17 @@ int TyCommander::runMainInstance(int argc, char *argv[])
        happens because quitWhenLastClosed is true, but this works. */
     connect(this, &TyCommander::lastWindowClosed, this, &TyCommander::quit);
 
+    // Write a Chrome/Perfetto trace if TYTOOLS_TRACE is set, errors go to the log
+    trace_session_ = ty_trace_start(nullptr);
+
+    // Export metrics periodically (file or UNIX socket) if TYTOOLS_METRICS is set
+    auto metrics_path = getenv("TYTOOLS_METRICS");
+    if (metrics_path && metrics_path[0]) {
+        auto metrics_timer = new QTimer(this);
+        connect(metrics_timer, &QTimer::timeout, this, [=]() { ty_metrics_dump(metrics_path); });
+        metrics_timer->start(10000);
+    }
+
     if (!monitor_.start()) {
         showClientError(ty_error_last_message());
         return EXIT_FAILURE;
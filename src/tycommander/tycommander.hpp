@@ -17,6 +17,8 @@
 #include <QSystemTrayIcon>
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "database.hpp"
 #include "monitor.hpp"
@@ -31,6 +33,12 @@ class SelectorDialog;
 class TyCommander : public QApplication {
     Q_OBJECT
 
+    struct PendingLog {
+        bool error;
+        QString msg;
+        QString ctx;
+    };
+
     int argc_;
     char **argv_;
     QString command_;
@@ -62,6 +70,11 @@ class TyCommander : public QApplication {
 
     std::unique_ptr<LogDialog> log_dialog_;
 
+    std::mutex pending_logs_mutex_;
+    std::vector<PendingLog> pending_logs_;
+
+    int trace_session_ = 0;
+
 public:
     TyCommander(int &argc, char *argv[]);
     virtual ~TyCommander();
@@ -105,6 +118,7 @@ public slots:
     void setHideOnStartup(bool hide_on_startup);
 
     void setVisible(bool visible);
+    void updateSerialBackground();
 
 signals:
     void settingsChanged();
@@ -120,7 +134,10 @@ private:
     void showClientMessage(const QString &msg);
     void showClientError(const QString &msg);
 
+    void queueLog(bool error, const QString &msg, const QString &ctx);
+
 private slots:
+    void flushLogs();
     void trayActivated(QSystemTrayIcon::ActivationReason reason);
 
     void acceptClient();
@@ -0,0 +1,462 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Minimal client for the TyCommander session channel, which does not need Qt. It
+   handles the board commands used by the Arduino integration (upload, reset, etc.)
+   and executes the full TyCommander binary for everything else. See
+   session_channel.hpp for the protocol. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../libty/common.h"
+#include "../libty/optline.h"
+#include "../libty/system.h"
+
+#define AUTOSTART_TIMEOUT 3000
+#define MAX_FRAME_SIZE (1024 * 1024)
+
+struct frame_buffer {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static const char *const client_commands[] = {
+    "reset",
+    "reboot",
+    "upload",
+    "attach",
+    "detach",
+    NULL
+};
+
+static char tycommander_path[4096];
+
+static bool find_tycommander(void)
+{
+    ssize_t len;
+    char *ptr;
+
+    len = readlink("/proc/self/exe", tycommander_path, sizeof(tycommander_path) - 1);
+    if (len < 0)
+        return false;
+    tycommander_path[len] = 0;
+
+    ptr = strrchr(tycommander_path, '/');
+    if (!ptr)
+        return false;
+    ptr++;
+
+    len = snprintf(ptr, (size_t)(tycommander_path + sizeof(tycommander_path) - ptr),
+                   "%s", TY_CONFIG_TYCOMMANDER_EXECUTABLE);
+    return len < tycommander_path + sizeof(tycommander_path) - ptr;
+}
+
+static int exec_tycommander(char *argv[])
+{
+    argv[0] = tycommander_path;
+    execv(tycommander_path, argv);
+
+    ty_log(TY_LOG_ERROR, "Failed to execute '%s': %s", tycommander_path, strerror(errno));
+    return EXIT_FAILURE;
+}
+
+static bool start_tycommander(void)
+{
+    pid_t pid;
+
+    // Double fork, the main instance must survive us and we don't want to reap it
+    pid = fork();
+    if (pid < 0)
+        return false;
+    if (!pid) {
+        setsid();
+        if (!fork()) {
+            execl(tycommander_path, tycommander_path, "-qqq", (char *)NULL);
+            _exit(127);
+        }
+        _exit(0);
+    }
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+        continue;
+
+    return true;
+}
+
+static int connect_tycommander(void)
+{
+    struct sockaddr_un addr = {0};
+    const char *tmp_dir;
+    size_t tmp_len;
+    int fd;
+
+    /* QLocalServer puts relative socket names in QDir::tempPath(), and SessionChannel
+       names them after the application and the user. */
+    tmp_dir = getenv("TMPDIR");
+    if (!tmp_dir || !tmp_dir[0])
+        tmp_dir = "/tmp";
+    tmp_len = strlen(tmp_dir);
+    while (tmp_len > 1 && tmp_dir[tmp_len - 1] == '/')
+        tmp_len--;
+
+    addr.sun_family = AF_UNIX;
+    if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%.*s/%s-%u", (int)tmp_len,
+                         tmp_dir, TY_CONFIG_TYCOMMANDER_NAME,
+                         (unsigned int)getuid()) >= sizeof(addr.sun_path))
+        return -1;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool append_frame(struct frame_buffer *buf, unsigned int count, ...)
+{
+    va_list ap;
+    size_t frame_offset;
+    uint32_t frame_len;
+    bool success = false;
+
+    frame_offset = buf->len;
+    buf->len += sizeof(frame_len);
+
+    va_start(ap, count);
+    for (unsigned int i = 0; i < count; i++) {
+        const char *arg = va_arg(ap, const char *);
+        uint32_t arg_len = (uint32_t)strlen(arg);
+
+        if (buf->len + sizeof(arg_len) + arg_len + sizeof(frame_len) > buf->size) {
+            size_t new_size = (buf->len + sizeof(arg_len) + arg_len) * 2 + 64;
+            char *new_data;
+
+            new_data = realloc(buf->data, new_size);
+            if (!new_data) {
+                ty_error(TY_ERROR_MEMORY, NULL);
+                goto cleanup;
+            }
+            buf->data = new_data;
+            buf->size = new_size;
+        }
+
+        memcpy(buf->data + buf->len, &arg_len, sizeof(arg_len));
+        buf->len += sizeof(arg_len);
+        memcpy(buf->data + buf->len, arg, arg_len);
+        buf->len += arg_len;
+    }
+
+    frame_len = (uint32_t)(buf->len - frame_offset - sizeof(frame_len));
+    memcpy(buf->data + frame_offset, &frame_len, sizeof(frame_len));
+
+    success = true;
+cleanup:
+    va_end(ap);
+    return success;
+}
+
+static bool append_list_frame(struct frame_buffer *buf, const char *first, char **args,
+                              unsigned int count)
+{
+    size_t frame_offset = buf->len;
+    uint32_t frame_len;
+
+    if (!append_frame(buf, 1, first))
+        return false;
+    for (unsigned int i = 0; i < count; i++) {
+        // Merge the next single-argument frame into this one
+        size_t arg_offset = buf->len;
+
+        if (!append_frame(buf, 1, args[i]))
+            return false;
+        memmove(buf->data + arg_offset, buf->data + arg_offset + sizeof(frame_len),
+                buf->len - arg_offset - sizeof(frame_len));
+        buf->len -= sizeof(frame_len);
+    }
+
+    frame_len = (uint32_t)(buf->len - frame_offset - sizeof(frame_len));
+    memcpy(buf->data + frame_offset, &frame_len, sizeof(frame_len));
+
+    return true;
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t r = write(fd, buf, len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        buf += r;
+        len -= (size_t)r;
+    }
+
+    return true;
+}
+
+static ssize_t read_all(int fd, char *buf, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len) {
+        ssize_t r = read(fd, buf + total, len - total);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (!r)
+            break;
+
+        total += (size_t)r;
+    }
+
+    return (ssize_t)total;
+}
+
+// Returns the argument count (arguments point into buf), 0 on EOF, -1 on error
+static int read_frame(int fd, char *buf, size_t size, char **args, unsigned int max_args)
+{
+    uint32_t frame_len;
+    unsigned int count = 0;
+    size_t offset = 0;
+    ssize_t r;
+
+    r = read_all(fd, (char *)&frame_len, sizeof(frame_len));
+    if (r <= 0)
+        return (int)r;
+    if (r < (ssize_t)sizeof(frame_len) || frame_len >= size)
+        return -1;
+    r = read_all(fd, buf, frame_len);
+    if (r < (ssize_t)frame_len)
+        return -1;
+
+    /* Arguments are not NUL-terminated on the wire, shift each one left over its length
+       header and terminate it. */
+    while (offset < frame_len && count < max_args) {
+        uint32_t arg_len;
+
+        if (frame_len - offset < sizeof(arg_len))
+            return -1;
+        memcpy(&arg_len, buf + offset, sizeof(arg_len));
+        if (arg_len > frame_len - offset - sizeof(arg_len))
+            return -1;
+
+        args[count] = buf + offset;
+        memmove(args[count], buf + offset + sizeof(arg_len), arg_len);
+        args[count][arg_len] = 0;
+        count++;
+
+        offset += sizeof(arg_len) + arg_len;
+    }
+
+    // Empty messages are valid but useless, skip them
+    if (!count)
+        return read_frame(fd, buf, size, args, max_args);
+
+    return (int)count;
+}
+
+static bool process_answer(char **args, unsigned int count, bool wait, int *rret)
+{
+    const char *cmd = args[0];
+
+    if (strcmp(cmd, "log") == 0) {
+        ty_message_data msg = {0};
+
+        if (count < 4)
+            return true;
+
+        msg.ctx = args[1][0] ? args[1] : NULL;
+        msg.type = TY_MESSAGE_LOG;
+        msg.u.log.level = (ty_log_level)strtol(args[2], NULL, 10);
+        msg.u.log.msg = args[3];
+
+        ty_message(&msg);
+    } else if (strcmp(cmd, "progress") == 0) {
+        ty_message_data msg = {0};
+
+        if (count < 5)
+            return true;
+
+        msg.ctx = args[1][0] ? args[1] : NULL;
+        msg.type = TY_MESSAGE_PROGRESS;
+        msg.u.progress.action = args[2];
+        msg.u.progress.value = strtoull(args[3], NULL, 10);
+        msg.u.progress.max = strtoull(args[4], NULL, 10);
+
+        ty_message(&msg);
+    } else if (strcmp(cmd, "start") == 0) {
+        if (!wait) {
+            *rret = 0;
+            return false;
+        }
+    } else if (strcmp(cmd, "exit") == 0) {
+        *rret = count >= 2 ? (int)strtol(args[1], NULL, 10) : 0;
+        return false;
+    }
+
+    return true;
+}
+
+static bool is_client_command(const char *cmd)
+{
+    for (const char *const *ptr = client_commands; *ptr; ptr++) {
+        if (strcmp(*ptr, cmd) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    const char *command;
+    bool autostart = false, wait = false, multi = false, persist = false;
+    char *filters[32];
+    unsigned int filters_count = 0;
+    const char *usbtype = NULL;
+    char workdir[4096];
+    struct frame_buffer buf = {0};
+    int fd = -1;
+    int ret = EXIT_FAILURE;
+
+    if (!find_tycommander()) {
+        ty_log(TY_LOG_ERROR, "Cannot find %s executable", TY_CONFIG_TYCOMMANDER_NAME);
+        return EXIT_FAILURE;
+    }
+
+    // Let the full executable deal with everything else, including help and errors
+    if (argc < 2 || !is_client_command(argv[1]))
+        return exec_tycommander(argv);
+    command = argv[1];
+
+    ty_optline_init_argv(&optl, argc - 1, argv + 1);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--quiet") == 0 || strcmp(opt, "-q") == 0) {
+            ty_config_verbosity--;
+        } else if (strcmp(opt, "--autostart") == 0) {
+            autostart = true;
+        } else if (strcmp(opt, "--wait") == 0 || strcmp(opt, "-w") == 0) {
+            wait = true;
+        } else if (strcmp(opt, "--multi") == 0 || strcmp(opt, "-m") == 0) {
+            multi = true;
+        } else if (strcmp(opt, "--persist") == 0 || strcmp(opt, "-p") == 0) {
+            persist = true;
+        } else if (strcmp(opt, "--board") == 0 || strcmp(opt, "-B") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value || filters_count == TY_COUNTOF(filters))
+                return exec_tycommander(argv);
+
+            filters[filters_count++] = value;
+        } else if (strcmp(opt, "--usbtype") == 0) {
+            usbtype = ty_optline_get_value(&optl);
+            if (!usbtype)
+                return exec_tycommander(argv);
+        } else {
+            return exec_tycommander(argv);
+        }
+    }
+
+    fd = connect_tycommander();
+    if (fd < 0 && autostart) {
+        uint64_t start = ty_millis();
+
+        if (!start_tycommander()) {
+            ty_log(TY_LOG_ERROR, "Failed to start %s main instance", TY_CONFIG_TYCOMMANDER_NAME);
+            goto cleanup;
+        }
+        while (fd < 0 && ty_millis() - start < AUTOSTART_TIMEOUT) {
+            ty_delay(20);
+            fd = connect_tycommander();
+        }
+    }
+    if (fd < 0) {
+        ty_log(TY_LOG_ERROR, "Cannot connect to main instance");
+        goto cleanup;
+    }
+
+    // Same hack as TyCommander::executeRemoteCommand() for the Arduino integration
+    if (usbtype && !strstr(usbtype, "_SERIAL"))
+        filters_count = 0;
+
+    if (!getcwd(workdir, sizeof(workdir))) {
+        ty_log(TY_LOG_ERROR, "Failed to get working directory: %s", strerror(errno));
+        goto cleanup;
+    }
+    if (!append_frame(&buf, 2, "workdir", workdir))
+        goto cleanup;
+    if (multi && !append_frame(&buf, 1, "multi"))
+        goto cleanup;
+    if (persist && !append_frame(&buf, 1, "persist"))
+        goto cleanup;
+    if (filters_count && !append_list_frame(&buf, "select", filters, filters_count))
+        goto cleanup;
+    {
+        char *args[64];
+        unsigned int args_count = 0;
+
+        while ((opt = ty_optline_consume_non_option(&optl)) && args_count < TY_COUNTOF(args))
+            args[args_count++] = opt;
+        if (!append_list_frame(&buf, command, args, args_count))
+            goto cleanup;
+    }
+    if (!write_all(fd, buf.data, buf.len)) {
+        ty_log(TY_LOG_ERROR, "Failed to send command to main instance: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    free(buf.data);
+    buf.data = malloc(MAX_FRAME_SIZE);
+    if (!buf.data) {
+        ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    while (true) {
+        char *args[16];
+        int count;
+
+        count = read_frame(fd, buf.data, MAX_FRAME_SIZE, args, TY_COUNTOF(args));
+        if (count <= 0) {
+            ty_log(TY_LOG_ERROR, "Main instance closed the connection");
+            ret = EXIT_FAILURE;
+            break;
+        }
+
+        if (!process_answer(args, (unsigned int)count, wait, &ret))
+            break;
+    }
+
+cleanup:
+    if (fd >= 0)
+        close(fd);
+    free(buf.data);
+    return ret;
+}
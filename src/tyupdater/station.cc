@@ -0,0 +1,270 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QDateTime>
+#include <QStringList>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTimer>
+
+#include <algorithm>
+
+#include "../tycommander/board.hpp"
+#include "../tycommander/firmware.hpp"
+#include "../tycommander/monitor.hpp"
+#include "../tycommander/task.hpp"
+#include "station.hpp"
+#include "tyupdater.hpp"
+
+using namespace std;
+
+#define CHECK_TIMEOUT 10000
+
+static QString escapeCsvField(QString field)
+{
+    if (field.contains(',') || field.contains('"') || field.contains('\n')) {
+        field.replace("\"", "\"\"");
+        field = QString("\"%1\"").arg(field);
+    }
+    return field;
+}
+
+FlashStation::FlashStation(Monitor *monitor, QObject *parent)
+    : QObject(parent)
+{
+    connect(monitor, &Monitor::boardAdded, this, &FlashStation::addBoard);
+}
+
+FlashStation::~FlashStation()
+{
+    // Don't leave serial ports open for boards we were checking
+    for (auto &unit: units_) {
+        if (unit->check)
+            unit->board->setEnableSerial(unit->serial_enabled, false);
+    }
+}
+
+bool FlashStation::start(const QString &firmware, const QString &csv_filename,
+                         const QString &check_string)
+{
+    stop();
+
+    auto fw = Firmware::load(firmware);
+    if (!fw)
+        return false;
+
+    csv_file_.close();
+    if (!csv_filename.isEmpty()) {
+        csv_file_.setFileName(csv_filename);
+        if (!csv_file_.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+            tyUpdater->reportError(tr("Cannot open '%1': %2")
+                                   .arg(csv_filename, csv_file_.errorString()));
+            return false;
+        }
+        if (!csv_file_.size())
+            csv_file_.write("time,serial_number,location,model,firmware,result,duration,message\n");
+    }
+
+    firmware_ = fw;
+    check_string_ = check_string;
+
+    success_count_ = 0;
+    failure_count_ = 0;
+    total_cycle_time_ = 0;
+    elapsed_.start();
+
+    running_ = true;
+    emit statsChanged();
+
+    return true;
+}
+
+void FlashStation::stop()
+{
+    // Boards already started are finished and recorded
+    running_ = false;
+    emit statsChanged();
+}
+
+QString FlashStation::firmwareName() const
+{
+    return firmware_ ? firmware_->name() : QString();
+}
+
+double FlashStation::boardsPerHour() const
+{
+    if (!elapsed_.isValid() || elapsed_.elapsed() < 1000)
+        return 0.0;
+
+    return (success_count_ + failure_count_) / (elapsed_.elapsed() / 3600000.0);
+}
+
+double FlashStation::meanCycleTime() const
+{
+    auto count = success_count_ + failure_count_;
+    return count ? total_cycle_time_ / count / 1000.0 : 0.0;
+}
+
+void FlashStation::addBoard(Board *board)
+{
+    if (!running_)
+        return;
+    if (!board->hasCapability(TY_BOARD_CAPABILITY_UPLOAD) &&
+            !board->hasCapability(TY_BOARD_CAPABILITY_REBOOT))
+        return;
+
+    unique_ptr<Unit> unit(new Unit);
+    auto ptr = unit.get();
+
+    unit->board = board->shared_from_this();
+    unit->serial_number = board->serialNumber();
+    unit->location = board->location();
+    unit->firmware = firmware_->name();
+    unit->timer.start();
+
+    if (!check_string_.isEmpty()) {
+        unit->check = true;
+        unit->check_string = check_string_;
+
+        /* Open the serial port right away, libty keeps it open across the reset so we get
+           everything the new firmware prints. Output from the old firmware is dropped
+           when the board shows up in bootloader mode. */
+        unit->serial_enabled = board->enableSerial();
+        board->setEnableSerial(true, false);
+
+        auto doc = &board->serialDocument();
+        connect(doc, &QTextDocument::contentsChange, this, [=](int position, int, int added) {
+            if (!added)
+                return;
+
+            QTextCursor cursor(doc);
+            cursor.setPosition(position);
+            cursor.setPosition(position + added, QTextCursor::KeepAnchor);
+            ptr->check_buffer += cursor.selectedText();
+            checkSerial(ptr);
+        });
+        connect(board, &Board::interfacesChanged, this, [=]() {
+            if (ptr->board->hasCapability(TY_BOARD_CAPABILITY_UPLOAD))
+                ptr->check_buffer.clear();
+        });
+    }
+    connect(board, &Board::dropped, this, [=]() {
+        finishUnit(ptr, false, tr("Board disappeared"));
+    });
+
+    auto task = board->upload({firmware_}, true);
+    unit->watcher = new TaskWatcher(this);
+    unit->watcher->setTask(&task);
+    connect(unit->watcher, &TaskWatcher::log, this, [=](ty_log_level level, const QString &msg) {
+        if (level <= TY_LOG_WARNING)
+            ptr->last_error = msg;
+    });
+    connect(unit->watcher, &TaskWatcher::finished, this, [=](bool success, shared_ptr<void>) {
+        if (!success) {
+            finishUnit(ptr, false, ptr->last_error.isEmpty() ? tr("Upload failed") : ptr->last_error);
+        } else if (ptr->check) {
+            startCheck(ptr);
+        } else {
+            finishUnit(ptr, true, QString());
+        }
+    });
+
+    units_.push_back(move(unit));
+    task.start();
+
+    emit statsChanged();
+}
+
+void FlashStation::startCheck(Unit *unit)
+{
+    unit->check_timer = new QTimer(this);
+    unit->check_timer->setSingleShot(true);
+    connect(unit->check_timer, &QTimer::timeout, this, [=]() {
+        finishUnit(unit, false, tr("Serial check timed out"));
+    });
+    unit->check_timer->start(CHECK_TIMEOUT);
+
+    checkSerial(unit);
+}
+
+void FlashStation::checkSerial(Unit *unit)
+{
+    // Wait for the upload to finish, the old firmware may print the same thing
+    if (!unit->check_timer)
+        return;
+
+    if (unit->check_buffer.contains(unit->check_string)) {
+        finishUnit(unit, true, QString());
+    } else if (unit->check_buffer.size() > unit->check_string.size()) {
+        unit->check_buffer.remove(0, unit->check_buffer.size() - unit->check_string.size());
+    }
+}
+
+void FlashStation::finishUnit(Unit *unit, bool success, const QString &message)
+{
+    auto it = find_if(units_.begin(), units_.end(),
+                      [=](const unique_ptr<Unit> &ptr) { return ptr.get() == unit; });
+    if (it == units_.end())
+        return;
+
+    auto cycle_time = unit->timer.elapsed();
+
+    // We may be called from these objects' signals, so delete them later
+    unit->board->disconnect(this);
+    unit->board->serialDocument().disconnect(this);
+    unit->watcher->disconnect(this);
+    unit->watcher->deleteLater();
+    if (unit->check_timer) {
+        unit->check_timer->stop();
+        unit->check_timer->disconnect(this);
+        unit->check_timer->deleteLater();
+    }
+    if (unit->check)
+        unit->board->setEnableSerial(unit->serial_enabled, false);
+
+    if (success) {
+        success_count_++;
+    } else {
+        failure_count_++;
+    }
+    total_cycle_time_ += static_cast<uint64_t>(cycle_time);
+    writeRecord(*unit, success, cycle_time / 1000.0, message);
+
+    // Same thing for the board, this may be the last reference and we may be in its signal
+    auto board = unit->board;
+    QTimer::singleShot(0, this, [board]() {});
+
+    units_.erase(it);
+    emit statsChanged();
+}
+
+void FlashStation::writeRecord(const Unit &unit, bool success, double duration,
+                               const QString &message)
+{
+    if (!csv_file_.isOpen())
+        return;
+
+    // The model is usually only known once the board has been in bootloader mode
+    QStringList fields = {
+        QDateTime::currentDateTime().toString(Qt::ISODate),
+        unit.serial_number,
+        unit.location,
+        unit.board->modelName(),
+        unit.firmware,
+        success ? "success" : "failure",
+        QString::number(duration, 'f', 1),
+        message
+    };
+    for (auto &field: fields)
+        field = escapeCsvField(field);
+
+    csv_file_.write((fields.join(',') + '\n').toUtf8());
+    csv_file_.flush();
+}
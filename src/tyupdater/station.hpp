@@ -0,0 +1,91 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef STATION_HH
+#define STATION_HH
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QObject>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+class Board;
+class Firmware;
+class Monitor;
+class QTimer;
+class TaskWatcher;
+
+/* Station mode uploads a pinned firmware to every board plugged in after it starts,
+   optionally waits for a string on the serial output, and appends one CSV record per
+   board. Uploads run in parallel, up to the size of the monitor task pool. */
+class FlashStation : public QObject {
+    Q_OBJECT
+
+    struct Unit {
+        std::shared_ptr<Board> board;
+        QString serial_number;
+        QString location;
+        QString firmware;
+
+        QElapsedTimer timer;
+        TaskWatcher *watcher = nullptr;
+        QString last_error;
+
+        bool check = false;
+        QString check_string;
+        bool serial_enabled = false;
+        QString check_buffer;
+        QTimer *check_timer = nullptr;
+    };
+
+    bool running_ = false;
+    std::shared_ptr<Firmware> firmware_;
+    QString check_string_;
+    QFile csv_file_;
+
+    std::vector<std::unique_ptr<Unit>> units_;
+
+    QElapsedTimer elapsed_;
+    unsigned int success_count_ = 0;
+    unsigned int failure_count_ = 0;
+    uint64_t total_cycle_time_ = 0;
+
+public:
+    FlashStation(Monitor *monitor, QObject *parent = nullptr);
+    virtual ~FlashStation();
+
+    bool start(const QString &firmware, const QString &csv_filename, const QString &check_string);
+    void stop();
+    bool isRunning() const { return running_; }
+
+    QString firmwareName() const;
+
+    unsigned int pendingCount() const { return static_cast<unsigned int>(units_.size()); }
+    unsigned int successCount() const { return success_count_; }
+    unsigned int failureCount() const { return failure_count_; }
+    double boardsPerHour() const;
+    double meanCycleTime() const;
+
+signals:
+    void statsChanged();
+
+private:
+    void addBoard(Board *board);
+    void startCheck(Unit *unit);
+    void checkSerial(Unit *unit);
+    void finishUnit(Unit *unit, bool success, const QString &message);
+
+    void writeRecord(const Unit &unit, bool success, double duration, const QString &message);
+};
+
+#endif
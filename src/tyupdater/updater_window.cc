@@ -10,6 +10,7 @@
 
 #include <QDesktopServices>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QUrl>
 
 #include "../tycommander/board.hpp"
@@ -31,7 +32,7 @@ QVariant UpdaterWindowModelFilter::data(const QModelIndex &index, int role) cons
 }
 
 UpdaterWindow::UpdaterWindow(QWidget *parent)
-    : QMainWindow(parent), monitor_(tyUpdater->monitor())
+    : QMainWindow(parent), monitor_(tyUpdater->monitor()), station_(monitor_)
 {
     setupUi(this);
     setWindowTitle(QApplication::applicationName());
@@ -42,6 +43,7 @@ UpdaterWindow::UpdaterWindow(QWidget *parent)
 
     connect(actionUpload, &QAction::triggered, this, &UpdaterWindow::uploadNewToCurrent);
     connect(actionReset, &QAction::triggered, this, &UpdaterWindow::resetCurrent);
+    connect(actionStation, &QAction::toggled, this, &UpdaterWindow::toggleStation);
     connect(actionQuit, &QAction::triggered, this, &TyUpdater::quit);
 
     connect(actionOpenLog, &QAction::triggered, tyUpdater, &TyUpdater::showLogWindow);
@@ -66,6 +68,15 @@ UpdaterWindow::UpdaterWindow(QWidget *parent)
     // Error messages
     connect(tyUpdater, &TyUpdater::globalError, this, &UpdaterWindow::showErrorMessage);
 
+    // Station counters, the status bar palette is meant for errors
+    station_label_ = new QLabel(this);
+    station_label_->setPalette(QApplication::palette());
+    station_label_->setVisible(false);
+    statusBar()->addPermanentWidget(station_label_);
+    connect(&station_, &FlashStation::statsChanged, this, &UpdaterWindow::refreshStation);
+    station_timer_.setInterval(5000);
+    connect(&station_timer_, &QTimer::timeout, this, &UpdaterWindow::refreshStation);
+
     if (!current_board_)
         changeCurrentBoard(nullptr);
 }
@@ -104,6 +115,33 @@ void UpdaterWindow::resetCurrent()
     current_board_->startReset();
 }
 
+void UpdaterWindow::toggleStation(bool enable)
+{
+    if (!enable) {
+        station_.stop();
+        return;
+    }
+
+    auto firmware = QFileDialog::getOpenFileName(this, tr("Select the firmware to upload"),
+                                                 QString(), browseFirmwareFilter());
+    if (firmware.isEmpty()) {
+        actionStation->setChecked(false);
+        return;
+    }
+    auto csv_filename = QFileDialog::getSaveFileName(this, tr("Append results to CSV file (optional)"),
+                                                     QString(), tr("CSV Files (*.csv);;All Files (*)"),
+                                                     nullptr, QFileDialog::DontConfirmOverwrite);
+    bool ok;
+    auto check_string = QInputDialog::getText(this, tr("Serial check"),
+                                              tr("Text expected on the serial output after upload\n"
+                                                 "(leave empty to skip the check):"),
+                                              QLineEdit::Normal, QString(), &ok);
+    if (!ok || !station_.start(firmware, csv_filename, check_string)) {
+        actionStation->setChecked(false);
+        return;
+    }
+}
+
 void UpdaterWindow::openWebsite()
 {
     QDesktopServices::openUrl(QUrl(TY_CONFIG_URL_WEBSITE));
@@ -167,6 +205,35 @@ void UpdaterWindow::refreshProgress()
     }
 }
 
+void UpdaterWindow::refreshStation()
+{
+    auto done = station_.successCount() + station_.failureCount();
+
+    if (!station_.isRunning() && !done && !station_.pendingCount()) {
+        station_label_->setVisible(false);
+        station_timer_.stop();
+        return;
+    }
+
+    auto success_rate = done ? 100.0 * station_.successCount() / done : 0.0;
+    station_label_->setText(tr("%1%2: %3 ok (%4%), %5 failed, %6 running | %7/h | %8 s/board")
+                            .arg(station_.firmwareName())
+                            .arg(station_.isRunning() ? QString() : tr(" (stopped)"))
+                            .arg(station_.successCount())
+                            .arg(success_rate, 0, 'f', 1)
+                            .arg(station_.failureCount())
+                            .arg(station_.pendingCount())
+                            .arg(station_.boardsPerHour(), 0, 'f', 0)
+                            .arg(station_.meanCycleTime(), 0, 'f', 1));
+    station_label_->setVisible(true);
+
+    if (station_.isRunning() || station_.pendingCount()) {
+        station_timer_.start();
+    } else {
+        station_timer_.stop();
+    }
+}
+
 QString UpdaterWindow::browseFirmwareFilter() const
 {
     QString exts;
@@ -12,11 +12,14 @@
 #define UPDATER_WINDOW_HH
 
 #include <QIdentityProxyModel>
+#include <QLabel>
 #include <QProgressBar>
+#include <QTimer>
 
 #include <memory>
 
 #include "../libty/common.h"
+#include "station.hpp"
 #include "ui_updater_window.h"
 
 class Board;
@@ -40,6 +43,10 @@ class UpdaterWindow : public QMainWindow, private Ui::UpdaterWindow {
 
     std::shared_ptr<Board> current_board_;
 
+    FlashStation station_;
+    QLabel *station_label_;
+    QTimer station_timer_;
+
 public:
     UpdaterWindow(QWidget *parent = nullptr);
 
@@ -50,6 +57,7 @@ public slots:
 
     void uploadNewToCurrent();
     void resetCurrent();
+    void toggleStation(bool enable);
 
     void openWebsite();
     void openBugReports();
@@ -58,6 +66,7 @@ private:
     void changeCurrentBoard(Board *board);
     void refreshActions();
     void refreshProgress();
+    void refreshStation();
 
     QString browseFirmwareFilter() const;
 
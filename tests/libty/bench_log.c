@@ -0,0 +1,76 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libty/system.h"
+
+#define ITERATIONS 2000000
+
+static unsigned int handled;
+
+static void count_handler(const ty_message_data *msg, void *udata)
+{
+    TY_UNUSED(msg);
+    TY_UNUSED(udata);
+
+    handled++;
+}
+
+static void report(const char *name, uint64_t start, unsigned int iterations)
+{
+    uint64_t elapsed = ty_millis() - start;
+    printf("%-28s %8.1f ns/call\n", name, (double)elapsed * 1000000.0 / iterations);
+}
+
+int main(void)
+{
+    const char *path = "/dev/hidraw0";
+    uint64_t start;
+
+    ty_config_verbosity = TY_LOG_INFO;
+
+    start = ty_millis();
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+        ty_log(TY_LOG_DEBUG, "Read %u bytes from '%s'", i, path);
+    report("disabled debug log", start, ITERATIONS);
+
+    ty_error_mask(TY_ERROR_IO);
+    start = ty_millis();
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+        ty_error(TY_ERROR_IO, "I/O error while reading from '%s'", path);
+    report("masked error", start, ITERATIONS);
+    ty_error_unmask();
+
+    ty_message_redirect(count_handler, NULL);
+
+    start = ty_millis();
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+        ty_log(TY_LOG_DEBUG, "Read %u bytes from '%s'", i, path);
+    report("debug log (sync handler)", start, ITERATIONS);
+
+    if (ty_log_start_async() < 0)
+        return 1;
+    start = ty_millis();
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+        ty_log(TY_LOG_DEBUG, "Read %u bytes from '%s'", i, path);
+    report("debug log (async handler)", start, ITERATIONS);
+    ty_log_stop_async();
+
+    ty_message_set_level(TY_LOG_INFO);
+    start = ty_millis();
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+        ty_log(TY_LOG_DEBUG, "Read %u bytes from '%s'", i, path);
+    report("debug log (info handler)", start, ITERATIONS);
+
+    ty_message_redirect(ty_message_default_handler, NULL);
+    printf("%u messages handled\n", handled);
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #define _XOPEN_SOURCE 600
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#include "test_libty.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/serial.h"
+#include "../../src/libty/board_priv.h"
+#include "../../src/libty/monitor.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/task.h"
+#include "../../src/libty/thread.h"
+
+static ty_board *create_fake_board(const char *id)
+{
+    ty_board *board = calloc(1, sizeof(*board));
+    if (!board)
+        abort();
+
+    board->refcount = 1;
+    board->model = TY_MODEL_TEENSY;
+    board->id = strdup(id);
+    if (!board->id)
+        abort();
+    board->tag = board->id;
+    if (ty_mutex_init(&board->ifaces_lock) < 0 || ty_mutex_init(&board->snapshot_lock) < 0)
+        abort();
+
+    return board;
+}
+
+// Ports are opened by the tests, before the interface is used
+static int open_dummy_interface(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+    return 0;
+}
+
+static void close_dummy_interface(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+}
+
+// Longer than the delay in which libty expects a rebooting board to disconnect
+#ifdef _WIN32
+    #define LATE_REBOOT_DELAY 5500
+#else
+    #define LATE_REBOOT_DELAY 1500
+#endif
+
+static unsigned int ignored_reboots;
+
+// Pretend the removal notification never comes (or is very late)
+static int ignore_reboot(ty_board_interface *iface)
+{
+    TY_UNUSED(iface);
+
+    _ty_atomic_fetch_add(&ignored_reboots, 1);
+    return 0;
+}
+
+static const struct _ty_class_vtable reboot_vtable = {
+    .open_interface = open_dummy_interface,
+    .close_interface = close_dummy_interface,
+    .reboot = ignore_reboot
+};
+
+static void test_board_reboot_late(void)
+{
+    ty_board *board = create_fake_board("reboot-Teensy");
+    ty_board_interface *iface;
+    ty_monitor *monitor;
+    ty_task *task;
+    uint64_t start;
+
+    if (ty_monitor_new(&monitor) < 0)
+        abort();
+
+    iface = calloc(1, sizeof(*iface));
+    if (!iface)
+        abort();
+    iface->class_vtable = &reboot_vtable;
+    iface->refcount = 1;
+    iface->board = board;
+    iface->name = "Dummy";
+    iface->capabilities = 1 << TY_BOARD_CAPABILITY_REBOOT;
+    if (ty_mutex_init(&iface->open_lock) < 0)
+        abort();
+    if (_hs_array_push(&board->ifaces, iface) < 0)
+        abort();
+
+    board->monitor = monitor;
+    board->status = TY_BOARD_STATUS_ONLINE;
+    board->capabilities = 1 << TY_BOARD_CAPABILITY_REBOOT;
+
+    // Keep the task messages out of the test output
+    ty_config_verbosity = TY_LOG_WARNING;
+    ASSERT(ty_reboot(board, &task) == 0);
+    ASSERT(ty_task_start(task) == 0);
+
+    // Show up in bootloader mode once the disconnection window is over
+    start = ty_millis();
+    while (!_ty_atomic_load(&ignored_reboots) && ty_millis() - start < 2000)
+        ty_delay(10);
+    ty_delay(LATE_REBOOT_DELAY);
+    board->capabilities |= 1 << TY_BOARD_CAPABILITY_UPLOAD;
+    ty_monitor_refresh(monitor);
+
+    ASSERT(ty_task_join(task) == 0);
+    ASSERT(_ty_atomic_load(&ignored_reboots) == 1);
+    ty_config_verbosity = TY_LOG_INFO;
+
+    ty_task_unref(task);
+    ty_board_unref(board);
+    ty_monitor_free(monitor);
+}
+
+static bool file_contains(const char *filename, const char *text)
+{
+    char buf[1024];
+    size_t len;
+    FILE *fp;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return false;
+    len = fread(buf, 1, sizeof(buf) - 1, fp);
+    buf[len] = 0;
+    fclose(fp);
+
+    return strstr(buf, text);
+}
+
+static void write_file(const char *filename, const char *text)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        abort();
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static void test_board_model_cache(void)
+{
+    const char *filename = "test_board_models.ini";
+    ty_board *board = create_fake_board("3000-Teensy");
+    uint64_t start;
+
+    write_file(filename, "[Models]\n1000 = Teensy LC\n");
+    ASSERT(ty_board_load_model_cache(filename) == 0);
+
+    // Another process saves its own board after we've loaded the file
+    write_file(filename, "[Models]\n1000 = Teensy LC\n2000 = Teensy 3.2\n");
+
+    board->serial_number = strdup("3000");
+    if (!board->serial_number)
+        abort();
+    board->model = TY_MODEL_TEENSY_36;
+    board->capabilities = 1 << TY_BOARD_CAPABILITY_UNIQUE;
+    _ty_board_update_model_cache(board);
+
+    start = ty_millis();
+    while (!file_contains(filename, "3000") && ty_millis() - start < 2000)
+        ty_delay(10);
+    ASSERT(file_contains(filename, "1000 = Teensy LC"));
+    ASSERT(file_contains(filename, "2000 = Teensy 3.2"));
+    ASSERT(file_contains(filename, "3000 = Teensy 3.6"));
+
+    ty_board_unref(board);
+    remove(filename);
+    remove("test_board_models.ini.lock");
+}
+
+struct snapshot_reader {
+    ty_board *board;
+    unsigned int incoherent;
+};
+
+static int read_snapshots(void *udata)
+{
+    struct snapshot_reader *reader = udata;
+
+    for (unsigned int i = 0; i < 20000; i++) {
+        ty_board_snapshot *snap = ty_board_get_snapshot(reader->board);
+
+        // Tags and models are always changed together below
+        if (strcmp(snap->tag, snap->model == TY_MODEL_TEENSY_36 ? "even" : "odd") != 0)
+            reader->incoherent++;
+        ty_board_snapshot_unref(snap);
+    }
+
+    return 0;
+}
+
+static void test_board_snapshot(void)
+{
+    ty_board *board = create_fake_board("714230-Teensy");
+    struct snapshot_reader reader = {board, 0};
+    ty_board_snapshot *snap, *snap2;
+    ty_thread thread;
+
+    board->model = TY_MODEL_TEENSY_36;
+    board->location = strdup("usb-1-2");
+    if (!board->location)
+        abort();
+    _ty_board_publish_snapshot(board);
+
+    snap = ty_board_get_snapshot(board);
+    ASSERT_STR_EQUAL(snap->tag, "714230-Teensy");
+    ASSERT(snap->tag == snap->id);
+    ASSERT(snap->model == TY_MODEL_TEENSY_36);
+
+    // Old snapshots stay valid and unchanged
+    ASSERT(ty_board_set_tag(board, "bench-1") == 0);
+    snap2 = ty_board_get_snapshot(board);
+    ASSERT_STR_EQUAL(snap->tag, "714230-Teensy");
+    ASSERT_STR_EQUAL(snap2->tag, "bench-1");
+    ASSERT_STR_EQUAL(snap2->location, "usb-1-2");
+    ASSERT(snap2->generation > snap->generation);
+    ty_board_snapshot_unref(snap2);
+    ty_board_snapshot_unref(snap);
+
+    ASSERT(ty_board_set_tag(board, "even") == 0);
+    ASSERT(ty_thread_create(&thread, read_snapshots, &reader) == 0);
+    for (unsigned int i = 0; i < 2000; i++) {
+        ty_mutex_lock(&board->ifaces_lock);
+        board->model = (i % 2) ? TY_MODEL_TEENSY_35 : TY_MODEL_TEENSY_36;
+        if (board->tag != board->id)
+            free(board->tag);
+        board->tag = strdup((i % 2) ? "odd" : "even");
+        ty_mutex_unlock(&board->ifaces_lock);
+
+        _ty_board_publish_snapshot(board);
+    }
+    ty_thread_join(&thread);
+    ASSERT(!reader.incoherent);
+
+    ty_board_unref(board);
+}
+
+#ifndef _WIN32
+
+static ssize_t read_fake_serial(ty_board_interface *iface, char *buf, size_t size, int timeout)
+{
+    return hs_serial_read(iface->port, (uint8_t *)buf, size, timeout);
+}
+
+static const struct _ty_class_vtable fake_vtable = {
+    .open_interface = open_dummy_interface,
+    .close_interface = close_dummy_interface,
+    .serial_read = read_fake_serial
+};
+
+static size_t get_capture_len(ty_board *board)
+{
+    size_t len;
+
+    ty_mutex_lock(&board->ifaces_lock);
+    len = board->capture_len;
+    ty_mutex_unlock(&board->ifaces_lock);
+
+    return len;
+}
+
+static void test_board_capture(void)
+{
+    ty_board *board = create_fake_board("capture-Teensy");
+    ty_board_interface *iface;
+    char buf[64];
+    size_t len = 0;
+    uint64_t start;
+    int master;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+        abort();
+
+    iface = calloc(1, sizeof(*iface));
+    if (!iface)
+        abort();
+    iface->class_vtable = &fake_vtable;
+    iface->refcount = 1;
+    iface->board = board;
+    iface->capabilities = 1 << TY_BOARD_CAPABILITY_SERIAL;
+    if (ty_mutex_init(&iface->open_lock) < 0)
+        abort();
+    if (hs_port_open_serial_path(ptsname(master), HS_PORT_MODE_RW, &iface->port) < 0)
+        abort();
+
+    if (_hs_array_push(&board->ifaces, iface) < 0)
+        abort();
+    board->cap2iface[TY_BOARD_CAPABILITY_SERIAL] = iface;
+
+    // Output printed before anyone reads is kept by libty
+    ty_board_set_capture(board, true);
+    ASSERT(ty_board_get_capture(board));
+    if (write(master, "hello", 5) != 5)
+        abort();
+    start = ty_millis();
+    while (get_capture_len(board) < 5 && ty_millis() - start < 2000)
+        ty_delay(10);
+    ASSERT(get_capture_len(board) == 5);
+
+    // Buffered data comes first, then the consumer reads from the interface directly
+    if (write(master, "world", 5) != 5)
+        abort();
+    start = ty_millis();
+    while (len < 10 && ty_millis() - start < 2000) {
+        ssize_t r = ty_board_serial_read(board, buf + len, sizeof(buf) - len, 100);
+        if (r < 0)
+            break;
+        len += (size_t)r;
+    }
+    buf[len] = 0;
+    ASSERT_STR_EQUAL(buf, "helloworld");
+    ASSERT(get_capture_len(board) == 0);
+
+    ty_board_set_capture(board, false);
+    ASSERT(!ty_board_get_capture(board));
+    ASSERT(!board->capture_iface && !board->capture_buf);
+
+    ty_board_unref(board);
+    close(master);
+}
+
+#endif
+
+void test_board(void)
+{
+    test_board_reboot_late();
+    test_board_model_cache();
+    test_board_snapshot();
+#ifndef _WIN32
+    test_board_capture();
+#endif
+}
@@ -0,0 +1,300 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/firmware.h"
+
+static const char ihex_image[] =
+    ":0400100001020304E2\r\n"
+    ":00000001FF\r\n";
+
+// 32-bit little-endian ELF with a single 4-byte PT_LOAD segment at 0x10
+static const uint8_t elf_image[] = {
+    0x7F, 'E', 'L', 'F', 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    2, 0, 40, 0, 1, 0, 0, 0, 0, 0, 0, 0, 52, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 52, 0, 32, 0, 1, 0, 0, 0,
+    0, 0, 0, 0,
+
+    1, 0, 0, 0, 84, 0, 0, 0, 0, 0, 0, 0, 0x10, 0, 0, 0,
+    4, 0, 0, 0, 4, 0, 0, 0, 5, 0, 0, 0, 4, 0, 0, 0,
+
+    1, 2, 3, 4
+};
+
+static bool check_image(const ty_firmware *fw)
+{
+    static const uint8_t expected[] = {1, 2, 3, 4};
+    return fw->size == 0x14 && memcmp(fw->image + 0x10, expected, sizeof(expected)) == 0;
+}
+
+static void release_counter(void *udata)
+{
+    (*(unsigned int *)udata)++;
+}
+
+static void test_firmware_mem_formats(void)
+{
+    ty_firmware *fw;
+
+    ASSERT(ty_firmware_load_mem((const uint8_t *)ihex_image, strlen(ihex_image), "test.hex",
+                                NULL, &fw) == 0);
+    ASSERT(check_image(fw));
+    ASSERT_STR_EQUAL(fw->name, "test.hex");
+    ty_firmware_unref(fw);
+
+    // Formats are detected from the content, the name does not matter
+    ASSERT(ty_firmware_load_mem((const uint8_t *)ihex_image, strlen(ihex_image), NULL,
+                                NULL, &fw) == 0);
+    ASSERT(check_image(fw));
+    ty_firmware_unref(fw);
+
+    ASSERT(ty_firmware_load_mem(elf_image, sizeof(elf_image), "firmware", NULL, &fw) == 0);
+    ASSERT(check_image(fw));
+    ty_firmware_unref(fw);
+
+    ASSERT(ty_firmware_load_mem(elf_image, sizeof(elf_image), NULL, "bin", &fw) == 0);
+    ASSERT(fw->size == sizeof(elf_image));
+    ty_firmware_unref(fw);
+}
+
+static void test_firmware_mem_errors(void)
+{
+    ty_firmware *fw = NULL;
+
+    ty_error_mask(TY_ERROR_PARSE);
+    ty_error_mask(TY_ERROR_UNSUPPORTED);
+    ASSERT(ty_firmware_load_mem(elf_image, sizeof(elf_image) - 1, NULL, NULL, &fw) == TY_ERROR_PARSE);
+    ASSERT(ty_firmware_load_mem((const uint8_t *)ihex_image, 13, NULL, NULL, &fw) == TY_ERROR_PARSE);
+    ASSERT(ty_firmware_load_mem((const uint8_t *)"foo", 3, NULL, NULL, &fw) == TY_ERROR_UNSUPPORTED);
+    ASSERT(ty_firmware_load_mem((const uint8_t *)"foo", 3, NULL, "foo", &fw) == TY_ERROR_UNSUPPORTED);
+    ty_error_unmask();
+    ty_error_unmask();
+    ASSERT(!fw);
+}
+
+static void test_firmware_mem_borrow(void)
+{
+    uint8_t image[] = {1, 2, 3, 4, 5};
+    unsigned int released = 0;
+    ty_firmware *fw;
+
+    // Raw images are used in place until the firmware is destroyed
+    ASSERT(ty_firmware_load_mem_borrow(image, sizeof(image), "test.bin", NULL, release_counter,
+                                       &released, &fw) == 0);
+    ASSERT(fw->image == image && fw->size == sizeof(image));
+    ASSERT(!released);
+    ty_firmware_unref(fw);
+    ASSERT(released == 1);
+
+    // Other formats are parsed and the buffer is released right away
+    released = 0;
+    ASSERT(ty_firmware_load_mem_borrow((uint8_t *)elf_image, sizeof(elf_image), NULL, NULL,
+                                       release_counter, &released, &fw) == 0);
+    ASSERT(released == 1);
+    ASSERT(check_image(fw));
+    ty_firmware_unref(fw);
+    ASSERT(released == 1);
+
+    released = 0;
+    ty_error_mask(TY_ERROR_PARSE);
+    ASSERT(ty_firmware_load_mem_borrow((uint8_t *)elf_image, 20, NULL, "elf", release_counter,
+                                       &released, &fw) == TY_ERROR_PARSE);
+    ty_error_unmask();
+    ASSERT(released == 1);
+}
+
+static void test_firmware_files(void)
+{
+    ty_firmware *fw = NULL;
+    FILE *fp;
+
+    // ELF files are read with seeks, the trailing garbage stands in for debug sections
+    fp = fopen("test_firmware.elf", "wb");
+    if (!fp)
+        abort();
+    fwrite(elf_image, 1, sizeof(elf_image), fp);
+    for (unsigned int i = 0; i < 65536; i++)
+        fputc(0xAA, fp);
+    fclose(fp);
+    ASSERT(ty_firmware_load("test_firmware.elf", NULL, &fw) == 0);
+    ASSERT(check_image(fw));
+    ASSERT_STR_EQUAL(fw->name, "test_firmware.elf");
+    ty_firmware_unref(fw);
+
+    fp = fopen("test_firmware.elf", "rb");
+    if (!fp)
+        abort();
+    ASSERT(ty_firmware_load_stream(fp, "stream", NULL, &fw) == 0);
+    ASSERT(check_image(fw));
+    ASSERT_STR_EQUAL(fw->name, "stream");
+    ty_firmware_unref(fw);
+    fclose(fp);
+
+    fp = fopen("test_firmware.elf", "wb");
+    if (!fp)
+        abort();
+    fwrite(elf_image, 1, sizeof(elf_image) - 1, fp);
+    fclose(fp);
+    fw = NULL;
+    ty_error_mask(TY_ERROR_PARSE);
+    ASSERT(ty_firmware_load("test_firmware.elf", NULL, &fw) == TY_ERROR_PARSE);
+    ty_error_unmask();
+    ASSERT(!fw);
+
+    remove("test_firmware.elf");
+}
+
+// Just enough of a vector table for teensy_identify_models()
+static ty_firmware *create_arm_firmware(const char *name, uint32_t stack_addr,
+                                        uint32_t reset_addr)
+{
+    ty_firmware *fw;
+
+    if (ty_firmware_new(name, &fw) < 0 || ty_firmware_expand_image(fw, 0x400) < 0)
+        abort();
+    memset(fw->image, 0, fw->size);
+    for (unsigned int i = 0; i < 4; i++) {
+        fw->image[i] = (uint8_t)(stack_addr >> (i * 8));
+        fw->image[4 + i] = (uint8_t)(reset_addr >> (i * 8));
+    }
+
+    return fw;
+}
+
+static void test_firmware_bundle(void)
+{
+    ty_firmware *fws[2], *bundle, *fw;
+    ty_model models[8];
+    int idx;
+
+    fws[0] = create_arm_firmware("lc.hex", 0x20001800, 0xC1);
+    fws[1] = create_arm_firmware("t36.hex", 0x20030000, 0x1D1);
+    // Keep the bundled models out of the test output
+    ty_config_verbosity = TY_LOG_WARNING;
+    ASSERT(ty_firmware_bundle_save("test_firmware.tyb", fws, 2) == 0);
+    ty_config_verbosity = TY_LOG_INFO;
+    ASSERT(!fopen("test_firmware.tyb.tmp", "rb"));
+
+    ASSERT(ty_firmware_load("test_firmware.tyb", NULL, &bundle) == 0);
+    remove("test_firmware.tyb");
+    ASSERT(bundle->entries_count == 2);
+    ASSERT(ty_firmware_identify(bundle, models, TY_COUNTOF(models)) == 2);
+    ASSERT(models[0] == TY_MODEL_TEENSY_LC && models[1] == TY_MODEL_TEENSY_36);
+
+    // Images are page-aligned so that bundles can be mapped and used in place
+    idx = ty_firmware_bundle_find(bundle, TY_MODEL_TEENSY_36);
+    ASSERT(idx == 1);
+    ASSERT(!(bundle->entries[idx].offset % 4096));
+    ASSERT(ty_firmware_bundle_extract(bundle, (unsigned int)idx, &fw) == 0);
+    ASSERT_STR_EQUAL(fw->name, "t36.hex");
+    ASSERT(fw->size == fws[1]->size && !memcmp(fw->image, fws[1]->image, fw->size));
+    ASSERT(fw->image == bundle->image + bundle->entries[idx].offset);
+    ASSERT(ty_firmware_bundle_find(bundle, TY_MODEL_TEENSY_35) < 0);
+
+    // The entry keeps the bundle memory alive
+    ty_firmware_unref(bundle);
+    ASSERT(ty_firmware_identify(fw, models, TY_COUNTOF(models)) == 1);
+    ASSERT(models[0] == TY_MODEL_TEENSY_36);
+    ty_firmware_unref(fw);
+
+    ty_firmware_unref(fws[1]);
+    ty_firmware_unref(fws[0]);
+}
+
+static void test_firmware_bundle_errors(void)
+{
+    ty_firmware *fws[1], *bundle = NULL, *fw = NULL;
+    uint8_t header[64] = "TYBUNDLE";
+
+    ty_error_mask(TY_ERROR_PARSE);
+    ty_error_mask(TY_ERROR_UNSUPPORTED);
+
+    // Unknown version, then an index that does not fit
+    ASSERT(ty_firmware_load_mem(header, sizeof(header), NULL, NULL, &bundle) == TY_ERROR_UNSUPPORTED);
+    header[8] = 1;
+    header[12] = 1;
+    header[17] = 1;
+    ASSERT(ty_firmware_load_mem(header, sizeof(header), NULL, NULL, &bundle) == TY_ERROR_PARSE);
+    ASSERT(!bundle);
+
+    // Entry sizes that would make the index wrap around on 32-bit builds
+    header[12] = 2;
+    header[16] = 0x80;
+    header[17] = 0;
+    header[19] = 0x80;
+    ASSERT(ty_firmware_load_mem(header, sizeof(header), NULL, NULL, &bundle) == TY_ERROR_PARSE);
+    ASSERT(!bundle);
+
+    // Firmwares we cannot identify would never be picked
+    fws[0] = create_arm_firmware("unknown.hex", 0x20000000, 0x11);
+    ASSERT(ty_firmware_bundle_save("test_firmware.tyb", fws, 1) == TY_ERROR_UNSUPPORTED);
+    ty_firmware_unref(fws[0]);
+
+    // Corrupt images are caught before we try to upload them
+    fws[0] = create_arm_firmware("t36.hex", 0x20030000, 0x1D1);
+    ty_config_verbosity = TY_LOG_WARNING;
+    ASSERT(ty_firmware_bundle_save("test_firmware.tyb", fws, 1) == 0);
+    ty_config_verbosity = TY_LOG_INFO;
+    ty_firmware_unref(fws[0]);
+    ASSERT(ty_firmware_load("test_firmware.tyb", NULL, &bundle) == 0);
+    remove("test_firmware.tyb");
+    bundle->image[bundle->entries[0].offset + 100] ^= 0xFF;
+    ASSERT(ty_firmware_bundle_extract(bundle, 0, &fw) == TY_ERROR_PARSE);
+    ASSERT(!fw);
+    ty_firmware_unref(bundle);
+
+    ty_error_unmask();
+    ty_error_unmask();
+}
+
+static void test_firmware_loader(void)
+{
+    const char *filenames[] = {"test_firmware.hex", "test_firmware_missing.hex"};
+    ty_firmware_loader *loader;
+    ty_firmware * const *fws, * const *fws2;
+    unsigned int fws_count, fws2_count;
+    FILE *fp;
+
+    fp = fopen(filenames[0], "w");
+    if (!fp)
+        abort();
+    fputs(ihex_image, fp);
+    fclose(fp);
+
+    ty_error_mask(TY_ERROR_NOT_FOUND);
+
+    // Missing files are skipped, and the files are only read once
+    ASSERT(ty_firmware_loader_new(filenames, 2, &loader) == 0);
+    ASSERT(ty_firmware_loader_load(loader, &fws, &fws_count) == 0);
+    remove(filenames[0]);
+    ASSERT(fws_count == 1 && check_image(fws[0]));
+    ASSERT(ty_firmware_loader_load(loader, &fws2, &fws2_count) == 0);
+    ASSERT(fws2 == fws && fws2_count == 1);
+    ty_firmware_loader_unref(loader);
+
+    // Every user gets the error when nothing can be loaded
+    ASSERT(ty_firmware_loader_new(filenames + 1, 1, &loader) == 0);
+    ASSERT(ty_firmware_loader_load(loader, &fws, &fws_count) == TY_ERROR_NOT_FOUND);
+    ASSERT(ty_firmware_loader_load(loader, &fws, &fws_count) == TY_ERROR_NOT_FOUND);
+    ty_firmware_loader_unref(loader);
+
+    ty_error_unmask();
+}
+
+void test_firmware(void)
+{
+    test_firmware_mem_formats();
+    test_firmware_mem_errors();
+    test_firmware_mem_borrow();
+    test_firmware_files();
+    test_firmware_bundle();
+    test_firmware_bundle_errors();
+    test_firmware_loader();
+}
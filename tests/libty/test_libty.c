@@ -11,7 +11,12 @@
 #include <stdarg.h>
 #include "test_libty.h"
 
+void test_board(void);
+void test_firmware(void);
 void test_optline(void);
+void test_recorder(void);
+void test_selector(void);
+void test_trace(void);
 
 static char current_file[1024];
 static char current_fn[256];
@@ -68,7 +73,12 @@ void report_test(bool pred, const char *file, unsigned int line, const char *fn,
 
 int main(void)
 {
+    test_board();
+    test_firmware();
     test_optline();
+    test_recorder();
+    test_selector();
+    test_trace();
 
     conclude_current_test();
     if (cases_failures) {
@@ -0,0 +1,98 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/recorder.h"
+#include "../../src/libty/thread.h"
+
+// Find the ring label (T<n>) of the last dumped event that contains text
+static int find_event_ring(FILE *fp, const char *text, char *rline, size_t line_size)
+{
+    char line[512];
+    int ring = -1;
+
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp)) {
+        const char *ptr = strstr(line, "  T");
+        unsigned int id;
+
+        if (!strstr(line, text) || !ptr || sscanf(ptr + 3, "%u", &id) != 1)
+            continue;
+
+        ring = (int)id;
+        if (rline) {
+            strncpy(rline, line, line_size);
+            rline[line_size - 1] = 0;
+        }
+    }
+
+    return ring;
+}
+
+static int record_thread_event(void *udata)
+{
+    ty_recorder_record(TY_RECORDER_EVENT_TASK_STATUS, udata, TY_TASK_STATUS_RUNNING, 0);
+    return 0;
+}
+
+static void test_recorder_threads(void)
+{
+    ty_thread thread;
+    FILE *fp;
+    int ring0, ring1, ring2;
+
+    fp = tmpfile();
+    if (!fp)
+        abort();
+
+    ty_recorder_record(TY_RECORDER_EVENT_TASK_STATUS, "recorder-main", TY_TASK_STATUS_RUNNING, 0);
+
+    // Threads that exit give their ring back to the next one
+    ASSERT(ty_thread_create(&thread, record_thread_event, "recorder-thread-1") == 0);
+    ty_thread_join(&thread);
+    ASSERT(ty_thread_create(&thread, record_thread_event, "recorder-thread-2") == 0);
+    ty_thread_join(&thread);
+
+    ASSERT(ty_recorder_dump_file(fp) == 0);
+    ring0 = find_event_ring(fp, "recorder-main", NULL, 0);
+    ring1 = find_event_ring(fp, "recorder-thread-1", NULL, 0);
+    ring2 = find_event_ring(fp, "recorder-thread-2", NULL, 0);
+    ASSERT(ring0 >= 0 && ring1 >= 0 && ring2 >= 0);
+    ASSERT(ring1 != ring0);
+    ASSERT(ring2 == ring1);
+
+    fclose(fp);
+}
+
+static void test_recorder_masked_errors(void)
+{
+    char line[512] = {0};
+    FILE *fp;
+
+    fp = tmpfile();
+    if (!fp)
+        abort();
+
+    ty_error_mask(TY_ERROR_IO);
+    ty_error(TY_ERROR_IO, "recorder-masked-error");
+    ty_error_unmask();
+
+    ASSERT(ty_recorder_dump_file(fp) == 0);
+    ASSERT(find_event_ring(fp, "recorder-masked-error", line, sizeof(line)) >= 0);
+    ASSERT(strstr(line, "masked"));
+
+    fclose(fp);
+}
+
+void test_recorder(void)
+{
+    test_recorder_threads();
+    test_recorder_masked_errors();
+}
@@ -0,0 +1,157 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/board_priv.h"
+#include "../../src/libty/thread.h"
+
+static ty_board *create_fake_board(const char *serial, ty_model model, const char *location)
+{
+    ty_board *board = calloc(1, sizeof(*board));
+    if (!board)
+        abort();
+
+    board->refcount = 1;
+    board->model = model;
+    board->serial_number = strdup(serial);
+    board->id = malloc(strlen(serial) + 8);
+    board->location = strdup(location);
+    if (!board->serial_number || !board->id || !board->location)
+        abort();
+    sprintf(board->id, "%s-Teensy", serial);
+    board->tag = board->id;
+    if (ty_mutex_init(&board->ifaces_lock) < 0 || ty_mutex_init(&board->snapshot_lock) < 0)
+        abort();
+
+    _ty_board_update_selector_fields(board);
+    _ty_board_publish_snapshot(board);
+
+    return board;
+}
+
+static bool matches(const char *expr, ty_board *board)
+{
+    ty_board_selector *sel;
+    bool match;
+
+    if (ty_board_selector_new(expr, &sel) < 0)
+        return false;
+    match = ty_board_selector_matches(sel, board);
+    ty_board_selector_free(sel);
+
+    // Fail the caller's assertion if the uncompiled path disagrees
+    if (ty_board_matches_tag(board, expr) != match)
+        return !match;
+
+    return match;
+}
+
+static void test_selector_tags(void)
+{
+    ty_board *board = create_fake_board("714230", TY_MODEL_TEENSY_36, "usb-1-2-2");
+
+    ASSERT(matches("714230", board));
+    ASSERT(matches("-Teensy", board));
+    ASSERT(matches("@usb-1-2-2", board));
+    ASSERT(matches("714230-Teensy@usb-1-2-2", board));
+    ASSERT(!matches("714231", board));
+    ASSERT(!matches("@usb-1-2", board));
+    ASSERT(!matches("714230@usb-1-2-3", board));
+
+    ASSERT(ty_board_set_tag(board, "bench-1") == 0);
+    ASSERT(matches("bench-1", board));
+    ASSERT(matches("999,bench-1", board));
+    ASSERT(matches("714230", board));
+    ASSERT(!matches("bench-2", board));
+    ASSERT(ty_board_set_tag(board, "foo,bar") == 0);
+    ASSERT(matches("foo,bar", board));
+    ASSERT(!matches("foo", board));
+    // Tags that are not valid selector syntax still work, alone or in lists
+    ASSERT(ty_board_set_tag(board, "rig..1") == 0);
+    ASSERT(matches("rig..1", board));
+    ASSERT(matches("999,rig..1", board));
+    ASSERT(!matches("rig..2", board));
+    ASSERT(!matches("!rig..1", board));
+    ASSERT(matches("!rig..2", board));
+
+    ty_board_unref(board);
+}
+
+static void test_selector_patterns(void)
+{
+    ty_board *board = create_fake_board("714230", TY_MODEL_TEENSY_36, "usb-4-2");
+
+    ASSERT(matches("71*", board));
+    ASSERT(matches("7?4230", board));
+    ASSERT(matches("*", board));
+    ASSERT(!matches("72*", board));
+    ASSERT(matches("@usb-4-*", board));
+    ASSERT(!matches("@usb-5-*", board));
+
+    ASSERT(matches("700000..799999", board));
+    ASSERT(matches("714230..", board));
+    ASSERT(matches("..714230", board));
+    ASSERT(!matches("714231..", board));
+
+    ASSERT(matches("-Teensy 3", board));
+    ASSERT(matches("-Teensy 3.6", board));
+    ASSERT(matches("-Teensy 3.*", board));
+    ASSERT(!matches("-Teensy 3.5", board));
+    ASSERT(!matches("-Teensy LC", board));
+
+    ty_board_unref(board);
+}
+
+static void test_selector_lists(void)
+{
+    ty_board *board1 = create_fake_board("714230", TY_MODEL_TEENSY_36, "usb-4-2");
+    ty_board *board2 = create_fake_board("29460", TY_MODEL_TEENSY_LC, "usb-4-3");
+
+    ASSERT(matches("714230,29460", board1));
+    ASSERT(matches("714230,29460", board2));
+    ASSERT(matches("@usb-4-*,!@usb-4-2", board2));
+    ASSERT(!matches("@usb-4-*,!@usb-4-2", board1));
+    ASSERT(matches("!-Teensy LC", board1));
+    ASSERT(!matches("!-Teensy LC", board2));
+    ASSERT(!matches("!714230,!29460", board1));
+
+    ty_board_unref(board2);
+    ty_board_unref(board1);
+}
+
+static void test_selector_errors(void)
+{
+    ty_board_selector *sel = NULL;
+    ty_board *board;
+
+    ty_error_mask(TY_ERROR_PARSE);
+    ASSERT(ty_board_selector_new("", &sel) == TY_ERROR_PARSE);
+    ASSERT(ty_board_selector_new("714230,", &sel) == TY_ERROR_PARSE);
+    ASSERT(ty_board_selector_new("!", &sel) == TY_ERROR_PARSE);
+    ty_error_unmask();
+    ASSERT(!sel);
+
+    // Invalid ranges could be custom tags, they only match boards tagged like that
+    board = create_fake_board("15", TY_MODEL_TEENSY_36, "usb-1");
+    ASSERT(ty_board_selector_new("12..ab,20..10", &sel) == 0);
+    ASSERT(!ty_board_selector_matches(sel, board));
+    ASSERT(ty_board_set_tag(board, "20..10") == 0);
+    ASSERT(ty_board_selector_matches(sel, board));
+    ty_board_selector_free(sel);
+    ty_board_unref(board);
+}
+
+void test_selector(void)
+{
+    test_selector_tags();
+    test_selector_patterns();
+    test_selector_lists();
+    test_selector_errors();
+}
@@ -0,0 +1,84 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/trace.h"
+
+static void count_phases(const char *filename, unsigned int *rbegin, unsigned int *rend)
+{
+    char line[512];
+    FILE *fp;
+
+    *rbegin = 0;
+    *rend = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+        return;
+    while (fgets(line, sizeof(line), fp)) {
+        *rbegin += !!strstr(line, "\"ph\": \"B\"");
+        *rend += !!strstr(line, "\"ph\": \"E\"");
+    }
+    fclose(fp);
+}
+
+static void test_trace_sessions(void)
+{
+    const char *filename1 = "test_trace_1.json";
+    const char *filename2 = "test_trace_2.json";
+    unsigned int begin, end;
+    int session1, session2, session3;
+
+    session1 = ty_trace_start(filename1);
+    ASSERT(session1 > 0);
+    ty_trace_begin("test", "outer", NULL);
+
+    // Sessions started inside a span must not get its E event
+    session2 = ty_trace_start(filename2);
+    ASSERT(session2 > 0 && session2 != session1);
+    ty_trace_begin("test", "inner", NULL);
+    ty_trace_end("test", "inner");
+    ty_trace_end("test", "outer");
+
+    // Same file, same session
+    session3 = ty_trace_start(filename2);
+    ASSERT(session3 == session2);
+    ty_trace_stop(session3);
+    ASSERT(ty_trace_active);
+
+    ty_trace_stop(session2);
+    ASSERT(ty_trace_active);
+    ty_trace_stop(session1);
+    ASSERT(!ty_trace_active);
+
+    count_phases(filename1, &begin, &end);
+    ASSERT(begin == 2 && end == 2);
+    count_phases(filename2, &begin, &end);
+    ASSERT(begin == 1 && end == 1);
+
+    // Spans left open by the last session are forgotten
+    session1 = ty_trace_start(filename1);
+    ty_trace_begin("test", "stale", NULL);
+    ty_trace_stop(session1);
+    session1 = ty_trace_start(filename1);
+    ty_trace_end("test", "stale");
+    ty_trace_stop(session1);
+
+    count_phases(filename1, &begin, &end);
+    ASSERT(begin == 0 && end == 0);
+
+    remove(filename1);
+    remove(filename2);
+}
+
+void test_trace(void)
+{
+    test_trace_sessions();
+}